@@ -6,6 +6,48 @@ fi
 
 pushd build > /dev/null
 
+# NOTE(robin): `sh build.sh bench` builds the benchmark suite once per -march variant, runs
+# each one and compares it against bench/baseline_<variant>.json. Baselines are per machine so
+# none are committed: without one we warn and only print the numbers. To make the current
+# numbers the baseline, copy build/bench_<variant>.json to bench/baseline_<variant>.json.
+if [ "$1" == "bench" ]; then
+  if [ `uname -m` == "x86_64" ]; then
+    Variants="default x86-64-v2 x86-64-v3 native"
+  else
+    Variants="default native"
+  fi
+
+  for Variant in $Variants; do
+    case $Variant in
+      default) MarchFlags="" ;;
+      native)  MarchFlags="-march=native" ;;
+      *)       MarchFlags="-march=$Variant" ;;
+    esac
+
+    clang -O2 -fno-trapping-math $MarchFlags ../src/bench_suite.c -o bench_$Variant -lm
+    let ErrorCode+=$?
+
+    Baseline=""
+    if [ -f ../bench/baseline_$Variant.json ]; then
+      Baseline="-baseline ../bench/baseline_$Variant.json"
+    else
+      echo "WARNING: no bench/baseline_$Variant.json, bench_$Variant isn't compared against anything" >&2
+      echo "WARNING: copy build/bench_$Variant.json to bench/baseline_$Variant.json to make it the baseline" >&2
+    fi
+
+    ./bench_$Variant -variant $Variant -json bench_$Variant.json $Baseline
+    Result=$?
+    if [ $Result -gt 1 ]; then
+      echo "bench_$Variant crashed, probably this CPU doesn't support -march=$Variant"
+    else
+      let ErrorCode+=$Result
+    fi
+  done
+
+  popd > /dev/null
+  exit $ErrorCode
+fi
+
 CommonFlags="
 -g
 -lm
@@ -25,6 +67,106 @@ if [ `uname` == "Linux" ]; then
   AlsaFlags="-lasound"
   clang $CommonFlags $AlsaFlags ../src/alsa_example.c -o alsa_example
   let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_scheduler_example.c -o alsa_scheduler_example
+  let ErrorCode+=$?
+
+  clang $CommonFlags $JackFlags ../src/jack_latency.c -o jack_latency
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_latency.c -o alsa_latency
+  let ErrorCode+=$?
+
+  clang $CommonFlags $JackFlags -lpthread ../src/jack_synth.c -o jack_synth
+  let ErrorCode+=$?
+
+  clang $CommonFlags $JackFlags ../src/jack_midi_test.c -o jack_midi_test
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_shm_example.c -o alsa_shm_example
+  let ErrorCode+=$?
+
+  clang $CommonFlags $JackFlags -lpthread ../src/jack_netaudio.c -o jack_netaudio
+  let ErrorCode+=$?
+
+  # NOTE(robin): Two builds of the same plugin for alsa_hotreload_example to swap between
+  clang -g -O2 -shared -fPIC ../src/plugin_example.c -o plugin_a.so -lm
+  let ErrorCode+=$?
+
+  clang -g -O2 -shared -fPIC -DPLUGIN_VARIANT=1 ../src/plugin_example.c -o plugin_b.so -lm
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread -ldl ../src/alsa_hotreload_example.c -o alsa_hotreload_example
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_tsched.c -o alsa_tsched
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags ../src/alsa_hw_example.c -o alsa_hw_example
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_renderahead_example.c -o alsa_renderahead_example
+  let ErrorCode+=$?
+
+  clang $CommonFlags $AlsaFlags -lpthread ../src/alsa_governor_example.c -o alsa_governor_example
+  let ErrorCode+=$?
+fi
+
+# NOTE(robin): Benchmarks are platform neutral and need optimisations turned on
+BenchFlags="
+-O2
+-fno-trapping-math
+"
+
+clang $BenchFlags ../src/dsp_kernels_bench.c -o dsp_kernels_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/interleave_bench.c -o interleave_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/quantize_bench.c -o quantize_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/denormal_bench.c -o denormal_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/bench_suite.c -o bench_suite -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/dsd_bench.c -o dsd_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/meter_bench.c -o meter_bench -lm -lpthread
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/filterbank_bench.c -o filterbank_bench -lm
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/rtlog_bench.c -o rtlog_bench -lm -lpthread
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/trace_bench.c -o trace_bench -lm -lpthread
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/journal_bench.c -o journal_bench -lm -lpthread
+let ErrorCode+=$?
+
+clang $BenchFlags ../src/delaycomp_bench.c -o delaycomp_bench -lm
+let ErrorCode+=$?
+
+# NOTE(robin): Except these, memfd, futexes, recvmmsg and unnamed semaphores are Linux only
+if [ `uname` == "Linux" ]; then
+  clang $BenchFlags ../src/convolver_bench.c -o convolver_bench -lm -lpthread
+  let ErrorCode+=$?
+
+  clang $BenchFlags ../src/shm_bench.c -o shm_bench -lm
+  let ErrorCode+=$?
+
+  clang $BenchFlags ../src/net_bench.c -o net_bench -lm -lpthread
+  let ErrorCode+=$?
+
+  clang $BenchFlags ../src/renderahead_bench.c -o renderahead_bench -lm -lpthread
+  let ErrorCode+=$?
 fi
 
 popd > /dev/null
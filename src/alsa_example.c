@@ -1,10 +1,21 @@
 #include <alsa/asoundlib.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "dsp_kernels.c"
+#include "denormal.c"
+#include "autotune.c"
+
+#define MAX_PERIOD 1024 // NOTE(robin): The size of the buffers in AudioCallback
 
 typedef struct
 {
   snd_pcm_t* PlaybackHandle;
   unsigned int SampleRate;
+  long BufferSize;
+  dsp_kernels Kernels;
 } alsa_data;
 
 int AudioCallback(long FrameCount, void* UserData)
@@ -17,44 +28,39 @@ int AudioCallback(long FrameCount, void* UserData)
     330.0f/(float)ALSAData->SampleRate,
   };
 
-  // NOTE(robin): You'd want to create this in a smarter way
+  // NOTE(robin): You'd want to create these in a smarter way
+  float Left[1024];
+  float Right[1024];
   float AudioBuffer[2048];
-  // NOTE(robin): Interleaved so we have Channels * FrameCount samples to write
-  for (int i = 0; i < 2 * FrameCount; i++)
-  {
-    for (int i = 0; i < 2; i++)
-    {
-      Phase[i] += PhaseDelta[i];
-      if (Phase[i] >= 1.0f)
-        Phase[i] -= 1.0f;
-    }
 
-    float Volume = 0.2;
-    AudioBuffer[i] = Volume * sin(Phase[0] * 2 * M_PI);
-    AudioBuffer[++i] = Volume * sin(Phase[1] * 2 * M_PI);
-  }
+  // NOTE(robin): The kernels were picked for our period size in main, so these loops have
+  // compile time bounds (see dsp_kernels.c)
+  float Volume = 0.2;
+  ALSAData->Kernels.Oscillator(Left, FrameCount, &Phase[0], PhaseDelta[0], Volume);
+  ALSAData->Kernels.Oscillator(Right, FrameCount, &Phase[1], PhaseDelta[1], Volume);
+
+  // NOTE(robin): Interleaved so we have Channels * FrameCount samples to write
+  ALSAData->Kernels.Interleave2(AudioBuffer, Left, Right, FrameCount);
 
   int FramesWritten = snd_pcm_writei(ALSAData->PlaybackHandle, AudioBuffer, FrameCount);
   return FramesWritten;
 }
 
-int main(int argc, char* argv[])
+static u64 Now(void)
 {
-  int Error = 0;
-
-  // NOTE(robin): "plughw:0,0" vs "hw:0,0" allows us to set a virtual sample format
-  // which will be converted to the hardware sample format by the kernel/device
-  // driver. If you want to write directly to the hardware buffer (which
-  // requires obtaining the hardware sample format and converting to it), then
-  // you can use hw:0,0. "default" is also an option.
-  snd_pcm_t* PlaybackHandle;
-  Error = snd_pcm_open(&PlaybackHandle, "plughw:0,0", SND_PCM_STREAM_PLAYBACK, 0);
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
 
-  if (Error)
-  {
-    printf("%s\n", snd_strerror(Error));
-    assert(!"Failed to open your device, perhaps it is already busy?");
-  }
+// NOTE(robin): Sets up the device for periods of PeriodSize frames, two of them in the
+// buffer. This can be done again later to change the period size: snd_pcm_drop stops the
+// device and puts it back in the setup state, where the hardware parameters can be changed.
+// Returns the period size the device actually went with.
+long ConfigureDevice(alsa_data* ALSAData, long PeriodSize)
+{
+  snd_pcm_t* PlaybackHandle = ALSAData->PlaybackHandle;
+  snd_pcm_drop(PlaybackHandle);
 
   snd_pcm_hw_params_t* HardwareParams;
   snd_pcm_hw_params_malloc(&HardwareParams);
@@ -67,36 +73,151 @@ int main(int argc, char* argv[])
   unsigned int SampleRate = 44100;
   snd_pcm_hw_params_set_rate_near(PlaybackHandle, HardwareParams, &SampleRate, 0);
   snd_pcm_hw_params_set_channels(PlaybackHandle, HardwareParams, 2);
-  snd_pcm_hw_params (PlaybackHandle, HardwareParams);
+
+  snd_pcm_uframes_t Frames = PeriodSize;
+  snd_pcm_hw_params_set_period_size_near(PlaybackHandle, HardwareParams, &Frames, 0);
+  Frames *= 2;
+  snd_pcm_hw_params_set_buffer_size_near(PlaybackHandle, HardwareParams, &Frames);
+
+  int Error = snd_pcm_hw_params(PlaybackHandle, HardwareParams);
+  if (Error < 0)
+    printf("Could not set the period size to %ld: %s\n", PeriodSize, snd_strerror(Error));
+
+  snd_pcm_hw_params_get_period_size(HardwareParams, &Frames, 0);
+  PeriodSize = Frames < MAX_PERIOD ? (long)Frames : MAX_PERIOD;
+  snd_pcm_hw_params_get_rate(HardwareParams, &SampleRate, 0);
+  snd_pcm_hw_params_free(HardwareParams);
 
   snd_pcm_sw_params_t* SoftwareParams;
   snd_pcm_sw_params_malloc(&SoftwareParams);
   snd_pcm_sw_params_current(PlaybackHandle, SoftwareParams);
 
-  long BufferSize = 512;
-  snd_pcm_sw_params_set_avail_min(PlaybackHandle, SoftwareParams, BufferSize);
+  snd_pcm_sw_params_set_avail_min(PlaybackHandle, SoftwareParams, PeriodSize);
 
   snd_pcm_sw_params_set_start_threshold(PlaybackHandle, SoftwareParams, 0);
   snd_pcm_sw_params(PlaybackHandle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
 
   snd_pcm_prepare(PlaybackHandle);
 
-  snd_pcm_hw_params_get_rate(HardwareParams, &SampleRate, 0);
+  ALSAData->SampleRate = SampleRate;
+  ALSAData->BufferSize = PeriodSize;
+
+  // NOTE(robin): The kernels are specialised for the period size, so pick them again
+  ALSAData->Kernels = DSPSelectKernels(PeriodSize);
+  return PeriodSize;
+}
+
+// NOTE(robin): The smallest period the device can do with our format
+long SmallestPeriod(snd_pcm_t* PlaybackHandle)
+{
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(PlaybackHandle, HardwareParams);
+  snd_pcm_hw_params_set_access(PlaybackHandle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(PlaybackHandle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_channels(PlaybackHandle, HardwareParams, 2);
+
+  snd_pcm_uframes_t Frames = 0;
+  snd_pcm_hw_params_get_period_size_min(HardwareParams, &Frames, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+  return Frames ? (long)Frames : 16;
+}
+
+// NOTE(robin): Usage: alsa_example [device=plughw:0,0] [autotune [seconds=30]]
+//
+// With autotune we start at the smallest period the device supports and let autotune.c find
+// the smallest one that runs without xruns, printing what it sees once a second, then what
+// it settled on after the given number of seconds.
+int main(int argc, char* argv[])
+{
+  int Error = 0;
+
+  // NOTE(robin): "plughw:0,0" vs "hw:0,0" allows us to set a virtual sample format
+  // which will be converted to the hardware sample format by the kernel/device
+  // driver. If you want to write directly to the hardware buffer (which
+  // requires obtaining the hardware sample format and converting to it), then
+  // you can use hw:0,0. "default" is also an option.
+  const char* Device = argc > 1 ? argv[1] : "plughw:0,0";
+  int AutoTuning = argc > 2 && !strcmp(argv[2], "autotune");
+  u32 Seconds = argc > 3 ? (u32)atoi(argv[3]) : 30;
+
+  snd_pcm_t* PlaybackHandle;
+  Error = snd_pcm_open(&PlaybackHandle, Device, SND_PCM_STREAM_PLAYBACK, 0);
+
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
 
   alsa_data ALSAData = {0};
   ALSAData.PlaybackHandle = PlaybackHandle;
-  ALSAData.SampleRate = SampleRate;
 
-  printf("Sample rate: %u\n", SampleRate);
+  auto_tune AutoTune;
+  long BufferSize = 512;
+  if (AutoTuning)
+  {
+    long Smallest = SmallestPeriod(PlaybackHandle);
+    BufferSize = ConfigureDevice(&ALSAData, Smallest);
+    AutoTuneInit(&AutoTune, ALSAData.SampleRate, Smallest, MAX_PERIOD);
+    if (AutoTune.Period != (u32)BufferSize)
+      BufferSize = ConfigureDevice(&ALSAData, AutoTune.Period);
+    AutoTuneApplied(&AutoTune, BufferSize);
+  }
+  else
+  {
+    BufferSize = ConfigureDevice(&ALSAData, BufferSize);
+  }
+
+  printf("Sample rate: %u\n", ALSAData.SampleRate);
   printf("Buffer size: %ld\n", BufferSize);
 
+  // NOTE(robin): Flush subnormals to zero while we run the audio loop, see denormal.c. If you
+  // move the loop into its own thread this goes at the top of that thread.
+  fp_state FPState = FPEnterAudioThread();
+
+  u64 Start = Now();
+  u64 NextWindow = Start + 1000000000ull;
+
   // NOTE(robin): You would probably have this in a separate thread
-  while (1)
+  while (!AutoTuning || Now() - Start < Seconds * 1000000000ull)
   {
     snd_pcm_wait(PlaybackHandle, -1); // NOTE(robin): Block until buffer is ready
-    AudioCallback(BufferSize, &ALSAData);
+
+    u64 CallbackStart = Now();
+    int Written = AudioCallback(ALSAData.BufferSize, &ALSAData);
+    if (Written < 0)
+    {
+      // NOTE(robin): -EPIPE is an underrun, prepare the device again and carry on
+      if (AutoTuning)
+        AutoTuneXRun(&AutoTune);
+      snd_pcm_recover(PlaybackHandle, Written, 1);
+    }
+
+    if (!AutoTuning)
+      continue;
+
+    u64 End = Now();
+    AutoTuneCallback(&AutoTune, End - CallbackStart, ALSAData.BufferSize);
+
+    // NOTE(robin): Reconfiguring stops the sound for a moment, which is what a change costs,
+    // so it only happens when autotune.c has seen enough to be sure
+    if (End >= NextWindow)
+    {
+      NextWindow += 1000000000ull;
+      u32 Period = AutoTuneUpdate(&AutoTune);
+      AutoTunePrintWindow(&AutoTune);
+      if (Period)
+        AutoTuneApplied(&AutoTune, ConfigureDevice(&ALSAData, Period));
+    }
   }
 
+  FPLeaveAudioThread(FPState);
+
+  if (AutoTuning)
+    AutoTunePrint(&AutoTune);
+
   snd_pcm_close (PlaybackHandle);
   return 0;
 }
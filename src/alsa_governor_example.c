@@ -0,0 +1,503 @@
+/*
+ * This file is an example of governor.c: a synth, an oscillator bank and an ensemble effect,
+ * plus a load generator that takes more and more of the period and then backs off again. It
+ * runs that twice, first ignoring the governor and then following it, and prints what
+ * happened every second: the level, the load and the missed periods.
+ *
+ * Usage: alsa_governor_example [device=null] [seconds=20] [runs=both|on|off]
+ *
+ * The device defaults to "null", which lets you try this out without any audio hardware (we
+ * pace ourselves with clock_nanosleep, since the null PCM is always ready). "offline" doesn't
+ * open a device at all and renders the blocks back to back, measuring each one against the
+ * same budget, which takes out the wakeup jitter.
+ *
+ * The levels, from full quality down, shed the ensemble (the non-essential part), then half
+ * the partials of the oscillator bank, then half again and all but 8 synth voices. The sizes
+ * of the bank and the ensemble are picked at startup so that full quality takes about 60% of
+ * the period on the machine it runs on, and the load generator adds up to 55% on top, which
+ * is more than the period. Missed periods are blocks that took longer than the period.
+ *
+ * NOTE(robin): Missed periods also happen for reasons that have nothing to do with the load
+ * when we don't get real-time priority, see the rtprio note in AudioThread.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "types.h"
+#include "dsp_kernels.c"
+#include "denormal.c"
+#include "synth.c"
+#include "governor.c"
+
+#define EXAMPLE_CHANNELS 2
+#define EXAMPLE_FRAMES 256
+#define EXAMPLE_MAX_PARTIALS 4096
+#define EXAMPLE_MAX_TAPS 1024
+#define EXAMPLE_DELAY_SIZE 4096 // NOTE(robin): A power of two, ~85ms at 48kHz
+#define EXAMPLE_MAX_SECONDS 600
+#define EXAMPLE_LOAD 0.55f
+
+typedef struct
+{
+  u32 Ensemble;
+  f32 Partials; // NOTE(robin): Share of the bank's partials
+  u32 Voices;
+} example_level;
+
+// NOTE(robin): What goes first is what's missed least, see governor.c
+static const example_level Levels[] =
+{
+  {1, 1.0f, SYNTH_MAX_VOICES},
+  {0, 1.0f, SYNTH_MAX_VOICES},
+  {0, 0.5f, SYNTH_MAX_VOICES},
+  {0, 0.25f, 8},
+};
+
+// NOTE(robin): A thick pad of slightly detuned harmonics. The partials that are switched off
+// fade out over a block rather than stopping dead, and fade back in.
+typedef struct
+{
+  u32 Count;
+  f32 Phase[EXAMPLE_CHANNELS][EXAMPLE_MAX_PARTIALS];
+  f32 PhaseDelta[EXAMPLE_CHANNELS][EXAMPLE_MAX_PARTIALS];
+  f32 Amplitude[EXAMPLE_MAX_PARTIALS];
+  f32 Gain[EXAMPLE_MAX_PARTIALS];
+} oscillator_bank;
+
+// NOTE(robin): Many slowly modulated delay taps per channel. When it's bypassed we keep
+// writing the delay line, so that it has the right history when it comes back.
+typedef struct
+{
+  u32 Taps;
+  f32 Delay[EXAMPLE_CHANNELS][EXAMPLE_DELAY_SIZE];
+  u32 Write;
+  f32 LFOPhase[EXAMPLE_MAX_TAPS];
+  f32 LFODelta[EXAMPLE_MAX_TAPS];
+  f32 BaseDelay[EXAMPLE_MAX_TAPS];
+  f32 Wet;
+} ensemble;
+
+// NOTE(robin): What the audio thread saw in one second of audio
+typedef struct
+{
+  u32 Level;
+  u32 MaxLevel;
+  f32 Load;
+  f32 Peak;
+  f32 Generated; // NOTE(robin): The share of the period the load generator took
+  u32 Missed;
+  u32 Voices;
+} example_second;
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  u32 SampleRate;
+  u32 Offline;
+  u32 Null;
+  u32 UseGovernor;
+  u32 Seconds;
+
+  dsp_kernels Kernels;
+  governor Governor;
+  synth Synth;
+  oscillator_bank Bank;
+  ensemble Ensemble;
+
+  example_second History[EXAMPLE_MAX_SECONDS];
+} example_data;
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+static void BankInit(oscillator_bank* Bank, u32 Count, f32 SampleRate)
+{
+  Bank->Count = Count;
+  for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+  {
+    f32 Fundamental = Channel ? 165.0f : 110.0f;
+    for (u32 k = 0; k < Count; k++)
+    {
+      u32 Harmonic = 1 + k % 8;
+      f32 Detune = 1.0f + 0.002f * (f32)(k / 8) / (f32)(Count / 8 + 1);
+      Bank->PhaseDelta[Channel][k] = Fundamental * (f32)Harmonic * Detune / SampleRate;
+      Bank->Phase[Channel][k] = (f32)((k * 2654435761u) >> 8) / (f32)(1 << 24);
+      Bank->Amplitude[k] = 0.2f / ((f32)Harmonic * (f32)(Count / 8 + 1));
+    }
+  }
+  for (u32 k = 0; k < Count; k++)
+    Bank->Gain[k] = 1.0f;
+}
+
+static void BankRender(oscillator_bank* Bank, f32* const* Outputs, u32 FrameCount, u32 Active)
+{
+  for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    memset(Outputs[Channel], 0, FrameCount * sizeof(f32));
+
+  for (u32 k = 0; k < Bank->Count; k++)
+  {
+    f32 Target = k < Active ? 1.0f : 0.0f;
+    f32 Gain = Bank->Gain[k];
+    if (Gain == 0.0f && Target == 0.0f)
+      continue;
+
+    f32 GainDelta = (Target - Gain) / (f32)FrameCount;
+    for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    {
+      f32* Output = Outputs[Channel];
+      f32 Phase = Bank->Phase[Channel][k];
+      f32 PhaseDelta = Bank->PhaseDelta[Channel][k];
+      f32 Amplitude = Bank->Amplitude[k];
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Phase += PhaseDelta;
+        Phase -= (f32)(s32)Phase;
+        Output[i] += Amplitude * (Gain + GainDelta * (f32)i) * DSPSinTurns(Phase);
+      }
+      Bank->Phase[Channel][k] = Phase;
+    }
+    Bank->Gain[k] = Target;
+  }
+}
+
+static void EnsembleInit(ensemble* Ensemble, u32 Taps, f32 SampleRate)
+{
+  memset(Ensemble, 0, sizeof(*Ensemble));
+  Ensemble->Taps = Taps;
+  Ensemble->Wet = 1.0f;
+  for (u32 Tap = 0; Tap < Taps; Tap++)
+  {
+    f32 Spread = (f32)Tap / (f32)Taps;
+    Ensemble->LFODelta[Tap] = (0.1f + 0.5f * Spread) / SampleRate;
+    Ensemble->LFOPhase[Tap] = Spread;
+    Ensemble->BaseDelay[Tap] = (0.008f + 0.020f * Spread) * SampleRate;
+  }
+}
+
+static void EnsembleRender(ensemble* Ensemble, f32* const* Outputs, u32 FrameCount, u32 On)
+{
+  f32 Target = On ? 1.0f : 0.0f;
+  f32 Wet = Ensemble->Wet;
+  f32 WetDelta = (Target - Wet) / (f32)FrameCount;
+  u32 Mask = EXAMPLE_DELAY_SIZE - 1;
+
+  for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+  {
+    f32* Output = Outputs[Channel];
+    f32* Delay = Ensemble->Delay[Channel];
+    for (u32 i = 0; i < FrameCount; i++)
+      Delay[(Ensemble->Write + i) & Mask] = Output[i];
+
+    if (Wet == 0.0f && Target == 0.0f)
+      continue;
+
+    static f32 Sum[EXAMPLE_FRAMES];
+    memset(Sum, 0, FrameCount * sizeof(f32));
+    for (u32 Tap = Channel; Tap < Ensemble->Taps; Tap += EXAMPLE_CHANNELS)
+    {
+      f32 LFOPhase = Ensemble->LFOPhase[Tap];
+      f32 LFODelta = Ensemble->LFODelta[Tap];
+      f32 BaseDelay = Ensemble->BaseDelay[Tap];
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        LFOPhase += LFODelta;
+        LFOPhase -= (f32)(s32)LFOPhase;
+        f32 Position = (f32)((Ensemble->Write & Mask) + i + EXAMPLE_DELAY_SIZE) -
+          BaseDelay * (1.0f + 0.1f * DSPSinTurns(LFOPhase));
+        u32 Index = (u32)Position;
+        f32 Fraction = Position - (f32)Index;
+        f32 A = Delay[Index & Mask];
+        f32 B = Delay[(Index + 1) & Mask];
+        Sum[i] += A + (B - A) * Fraction;
+      }
+      Ensemble->LFOPhase[Tap] = LFOPhase;
+    }
+
+    f32 Scale = 2.0f / (f32)(Ensemble->Taps + 1);
+    for (u32 i = 0; i < FrameCount; i++)
+      Output[i] += (Wet + WetDelta * (f32)i) * Scale * Sum[i];
+  }
+
+  Ensemble->Write += FrameCount;
+  Ensemble->Wet = Target;
+}
+
+// NOTE(robin): The part of the work that can't be shed, as a share of the period. Nothing
+// for the first 10% of the run, up to EXAMPLE_LOAD by 40%, and back down from 60% to 90%.
+static f32 GeneratedLoad(f32 Progress)
+{
+  f32 Load = 0.0f;
+  if (Progress > 0.1f && Progress < 0.4f)
+    Load = (Progress - 0.1f) / 0.3f;
+  else if (Progress >= 0.4f && Progress < 0.6f)
+    Load = 1.0f;
+  else if (Progress >= 0.6f && Progress < 0.9f)
+    Load = (0.9f - Progress) / 0.3f;
+  return EXAMPLE_LOAD * Load;
+}
+
+// NOTE(robin): One period: a new chord every half second, the load generator, then the synth,
+// the bank and the ensemble at the quality the level asks for
+static void RenderBlock(example_data* Data, f32* const* Outputs, u32 Block, u32 Level, f32 Generated)
+{
+  u64 Start = Now();
+  u64 Period = (u64)EXAMPLE_FRAMES * 1000000000ull / Data->SampleRate;
+  while (Now() < Start + (u64)(Generated * (f32)Period))
+  {
+  }
+
+  const example_level* Quality = &Levels[Level];
+  SynthLimitVoices(&Data->Synth, Quality->Voices);
+
+  u32 BlocksPerChord = Data->SampleRate / (2 * EXAMPLE_FRAMES);
+  if (Block % BlocksPerChord == 0)
+  {
+    // NOTE(robin): 16 notes, with the 16 of the last chord still releasing
+    SynthAllNotesOff(&Data->Synth);
+    u32 Root = 36 + (Block / BlocksPerChord) % 5 * 2;
+    for (u32 i = 0; i < 16; i++)
+      SynthNoteOn(&Data->Synth, (u8)(Root + i * 5), 90);
+  }
+
+  static f32 SynthOutput[EXAMPLE_FRAMES];
+  SynthRender(&Data->Synth, SynthOutput, EXAMPLE_FRAMES);
+
+  BankRender(&Data->Bank, Outputs, EXAMPLE_FRAMES, (u32)(Quality->Partials * (f32)Data->Bank.Count));
+  EnsembleRender(&Data->Ensemble, Outputs, EXAMPLE_FRAMES, Quality->Ensemble);
+
+  for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    for (u32 i = 0; i < EXAMPLE_FRAMES; i++)
+      Outputs[Channel][i] += SynthOutput[i];
+}
+
+void* AudioThread(void* Context)
+{
+  example_data* Data = Context;
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the
+  // appropriate rtprio limits set up, in which case we just run at normal priority.
+  if (!Data->Offline)
+  {
+    struct sched_param Param = {0};
+    Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+      printf("Could not get real-time priority, running at normal priority\n");
+  }
+
+  fp_state FPState = FPEnterAudioThread();
+
+  static f32 Outputs[EXAMPLE_CHANNELS][EXAMPLE_FRAMES];
+  static f32 AudioBuffer[EXAMPLE_CHANNELS * EXAMPLE_FRAMES];
+  f32* OutputPointers[EXAMPLE_CHANNELS] = {Outputs[0], Outputs[1]};
+
+  u32 BlocksPerSecond = Data->SampleRate / EXAMPLE_FRAMES;
+  u32 BlockCount = Data->Seconds * BlocksPerSecond;
+  u64 Period = (u64)EXAMPLE_FRAMES * 1000000000ull / Data->SampleRate;
+  u64 Next = Now();
+
+  governor_stats Previous = GovernorRead(&Data->Governor);
+  example_second Second = {0};
+
+  for (u32 Block = 0; Block < BlockCount; Block++)
+  {
+    if (Data->Null)
+    {
+      Next += Period;
+      struct timespec Until = {Next / 1000000000ull, Next % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+    }
+    else if (!Data->Offline)
+    {
+      snd_pcm_wait(Data->Handle, 1000);
+    }
+
+    // NOTE(robin): Without the governor we still measure, we just don't listen
+    u32 Level = GovernorBegin(&Data->Governor);
+    Level = Data->UseGovernor ? Level : 0;
+    f32 Generated = GeneratedLoad((f32)Block / (f32)BlockCount);
+    RenderBlock(Data, OutputPointers, Block, Level, Generated);
+
+    if (!Data->Offline)
+    {
+      Data->Kernels.Interleave2(AudioBuffer, Outputs[0], Outputs[1], EXAMPLE_FRAMES);
+      snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Data->Handle, AudioBuffer, EXAMPLE_FRAMES);
+      if (FramesWritten < 0)
+      {
+        Second.Missed++;
+        snd_pcm_recover(Data->Handle, (int)FramesWritten, 1);
+      }
+      else if (Data->Null && Now() > Next + Period)
+      {
+        // NOTE(robin): The next period was due before we were done with this one
+        Second.Missed++;
+      }
+    }
+    GovernorEnd(&Data->Governor);
+
+    u32 NewLevel = Data->Governor.Level;
+    Second.MaxLevel = NewLevel > Second.MaxLevel ? NewLevel : Second.MaxLevel;
+    Second.Generated += Generated / (f32)BlocksPerSecond;
+
+    if ((Block + 1) % BlocksPerSecond == 0)
+    {
+      governor_stats Stats = GovernorRead(&Data->Governor);
+      Second.Level = Data->UseGovernor ? Stats.Level : 0;
+      Second.MaxLevel = Data->UseGovernor ? Second.MaxLevel : 0;
+      Second.Load = Stats.Load;
+      Second.Peak = Stats.Peak;
+      if (Data->Offline)
+        Second.Missed = Stats.Overruns - Previous.Overruns;
+      u32 Playing;
+      SynthOldestPlaying(&Data->Synth, &Playing);
+      Second.Voices = Playing;
+
+      Data->History[(Block + 1) / BlocksPerSecond - 1] = Second;
+      Second = (example_second){0};
+      Previous = Stats;
+    }
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+static snd_pcm_t* OpenDevice(const char* Device, u32* SampleRate)
+{
+  snd_pcm_t* Handle;
+  int Error = snd_pcm_open(&Handle, Device, SND_PCM_STREAM_PLAYBACK, 0);
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Handle, HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Handle, HardwareParams, EXAMPLE_CHANNELS);
+
+  snd_pcm_uframes_t PeriodSize = EXAMPLE_FRAMES;
+  snd_pcm_hw_params_set_period_size_near(Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params(Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Handle, SoftwareParams, EXAMPLE_FRAMES);
+  snd_pcm_sw_params(Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+  snd_pcm_prepare(Handle);
+  return Handle;
+}
+
+// NOTE(robin): The fastest of a few runs of Count blocks, in nanoseconds per block
+static f64 TimeBlocks(example_data* Data, u32 Partials, u32 Taps, u32 Count)
+{
+  static f32 Outputs[EXAMPLE_CHANNELS][EXAMPLE_FRAMES];
+  f32* OutputPointers[EXAMPLE_CHANNELS] = {Outputs[0], Outputs[1]};
+  BankInit(&Data->Bank, Partials, (f32)Data->SampleRate);
+  EnsembleInit(&Data->Ensemble, Taps, (f32)Data->SampleRate);
+
+  f64 Best = 1e30;
+  for (u32 Run = 0; Run < 5; Run++)
+  {
+    u64 Start = Now();
+    for (u32 i = 0; i < Count; i++)
+    {
+      if (Partials)
+        BankRender(&Data->Bank, OutputPointers, EXAMPLE_FRAMES, Partials);
+      if (Taps)
+        EnsembleRender(&Data->Ensemble, OutputPointers, EXAMPLE_FRAMES, 1);
+    }
+    f64 Time = (f64)(Now() - Start) / Count;
+    Best = Time < Best ? Time : Best;
+  }
+  return Best;
+}
+
+static void Run(example_data* Data, const char* Name, u32 Partials, u32 Taps)
+{
+  SynthInit(&Data->Synth, (f32)Data->SampleRate);
+  BankInit(&Data->Bank, Partials, (f32)Data->SampleRate);
+  EnsembleInit(&Data->Ensemble, Taps, (f32)Data->SampleRate);
+  GovernorInit(&Data->Governor, Data->SampleRate, EXAMPLE_FRAMES, sizeof(Levels) / sizeof(Levels[0]));
+
+  printf("\n%s:\n", Name);
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, Data);
+  pthread_join(Thread, 0);
+
+  printf("%6s %10s %6s %8s %8s %8s %7s\n", "second", "generated", "level", "load", "peak", "voices", "missed");
+  u32 Missed = 0;
+  for (u32 i = 0; i < Data->Seconds; i++)
+  {
+    example_second* Second = &Data->History[i];
+    printf("%6u %9.0f%% %3u/%-2u %7.0f%% %7.0f%% %8u %7u\n", i + 1, 100.0 * Second->Generated,
+        Second->Level, Second->MaxLevel, 100.0 * Second->Load, 100.0 * Second->Peak, Second->Voices, Second->Missed);
+    Missed += Second->Missed;
+  }
+
+  governor_stats Stats = GovernorRead(&Data->Governor);
+  printf("%s: %u missed periods, %u drops and %u raises of the level\n", Name, Missed,
+      Data->UseGovernor ? Stats.Drops : 0, Data->UseGovernor ? Stats.Raises : 0);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Device = argc > 1 ? argv[1] : "null";
+  int Seconds = argc > 2 ? atoi(argv[2]) : 20;
+  const char* Runs = argc > 3 ? argv[3] : "both";
+  Seconds = Seconds < 1 ? 1 : Seconds > EXAMPLE_MAX_SECONDS ? EXAMPLE_MAX_SECONDS : Seconds;
+
+  static example_data Data;
+  Data.SampleRate = 48000;
+  Data.Seconds = (u32)Seconds;
+  Data.Offline = !strcmp(Device, "offline");
+  Data.Null = !strcmp(Device, "null");
+
+  Data.Kernels = DSPSelectKernels(EXAMPLE_FRAMES);
+  if (!Data.Offline)
+    Data.Handle = OpenDevice(Device, &Data.SampleRate);
+
+  // NOTE(robin): Size the bank for 40% of the period and the ensemble for 20%
+  f64 Period = (f64)EXAMPLE_FRAMES * 1e9 / Data.SampleRate;
+  f64 PerPartial = TimeBlocks(&Data, 64, 0, 200) / 64;
+  f64 PerTap = TimeBlocks(&Data, 0, 64, 200) / 64;
+  u32 Partials = (u32)(0.4 * Period / PerPartial);
+  u32 Taps = (u32)(0.2 * Period / PerTap);
+  Partials = Partials < 8 ? 8 : Partials > EXAMPLE_MAX_PARTIALS ? EXAMPLE_MAX_PARTIALS : Partials;
+  Taps = Taps < 2 ? 2 : Taps > EXAMPLE_MAX_TAPS ? EXAMPLE_MAX_TAPS : Taps;
+
+  printf("Device: %s\n", Device);
+  printf("Sample rate: %u\n", Data.SampleRate);
+  printf("Buffer size: %u (%.2fms)\n", EXAMPLE_FRAMES, Period / 1e6);
+  printf("Oscillator bank: %u partials per channel, ensemble: %u taps\n", Partials, Taps);
+  printf("Full quality: %.0f%% of the period, the load generator adds up to %.0f%%\n",
+      100.0 * TimeBlocks(&Data, Partials, Taps, 50) / Period, 100.0 * EXAMPLE_LOAD);
+
+  if (strcmp(Runs, "on"))
+  {
+    Data.UseGovernor = 0;
+    Run(&Data, "Without the governor", Partials, Taps);
+  }
+  if (strcmp(Runs, "off"))
+  {
+    Data.UseGovernor = 1;
+    Run(&Data, "With the governor", Partials, Taps);
+  }
+
+  if (Data.Handle)
+    snd_pcm_close(Data.Handle);
+  return 0;
+}
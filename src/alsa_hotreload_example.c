@@ -0,0 +1,261 @@
+/*
+ * This file is an example of hotreload.c: the ALSA loop runs a sine through a plugin loaded
+ * from a shared object, while the main thread keeps loading new builds of it (alternating
+ * plugin_a.so and plugin_b.so, see plugin_example.c) and swapping them in.
+ *
+ * Usage: alsa_hotreload_example [device] [seconds] [reloads per second]
+ *
+ * The device defaults to "null", which lets you try this out without any audio hardware
+ * (we pace ourselves with clock_nanosleep, since the null PCM is always ready). The plugins
+ * are looked for next to the executable, build.sh puts them there.
+ *
+ * It doubles as the test for the reloading: at the end we print how many periods were
+ * missed (the callback finished after its deadline, or an underrun on a real device) and
+ * how many clicks there were (a jump between two samples that the sine through the filters
+ * can't make, which is what a swap without the crossfade, or a broken state migration,
+ * sounds like), and exit with 1 if there were any.
+ *
+ * NOTE(robin): Missed periods also happen for reasons that have nothing to do with
+ * reloading when we don't get real-time priority, see the rtprio note in AudioThread.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <math.h>
+#include <libgen.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "hotreload.c"
+
+#define EXAMPLE_CHANNELS 2
+#define EXAMPLE_FADE_MS 10.0f
+#define EXAMPLE_CLICK 0.05f // NOTE(robin): Our sine can't move more than 0.015 per sample
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  u32 SampleRate;
+  u32 BufferSize;
+  u32 Null;
+  u32 Running;
+  hot_host Host;
+
+  u32 Periods;
+  u32 Missed;
+  u32 Clicks;
+  u64 WorstSwap; // NOTE(robin): Nanoseconds of processing, in periods with a swap or a fade
+  u64 WorstOther;
+} example_data;
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+void* AudioThread(void* Context)
+{
+  example_data* Data = Context;
+
+  // NOTE(robin): Flush subnormals to zero on this thread, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the
+  // appropriate rtprio limits set up, in which case we just run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  u32 FrameCount = Data->BufferSize;
+  u64 Period = (u64)FrameCount * 1000000000ull / Data->SampleRate;
+  u64 Next = Now();
+
+  f32 Phase[EXAMPLE_CHANNELS] = {0, 0};
+  f32 PhaseDelta[EXAMPLE_CHANNELS] =
+  {
+    220.0f / (f32)Data->SampleRate,
+    330.0f / (f32)Data->SampleRate,
+  };
+  f32 Previous[EXAMPLE_CHANNELS] = {0, 0};
+
+  static f32 Inputs[EXAMPLE_CHANNELS][HOT_MAX_FRAMES];
+  static f32 Outputs[EXAMPLE_CHANNELS][HOT_MAX_FRAMES];
+  static f32 AudioBuffer[EXAMPLE_CHANNELS * HOT_MAX_FRAMES];
+
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    if (Data->Null)
+    {
+      Next += Period;
+      struct timespec Until = {Next / 1000000000ull, Next % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+    }
+    else
+    {
+      snd_pcm_wait(Data->Handle, 1000);
+    }
+    u64 Start = Now();
+
+    const f32* InputPointers[EXAMPLE_CHANNELS];
+    f32* OutputPointers[EXAMPLE_CHANNELS];
+    for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    {
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Phase[Channel] += PhaseDelta[Channel];
+        Phase[Channel] -= Phase[Channel] >= 1.0f ? 1.0f : 0.0f;
+        Inputs[Channel][i] = 0.5f * sinf(2.0f * (f32)M_PI * Phase[Channel]);
+      }
+      InputPointers[Channel] = Inputs[Channel];
+      OutputPointers[Channel] = Outputs[Channel];
+    }
+
+    u32 Swapping = Data->Host.Fading || __atomic_load_n(&Data->Host.Pending, __ATOMIC_RELAXED);
+    HotProcess(&Data->Host, InputPointers, OutputPointers, FrameCount);
+
+    for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    {
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Data->Clicks += fabsf(Outputs[Channel][i] - Previous[Channel]) > EXAMPLE_CLICK;
+        Previous[Channel] = Outputs[Channel][i];
+      }
+    }
+
+    for (u32 i = 0; i < FrameCount; i++)
+    {
+      AudioBuffer[2 * i + 0] = Outputs[0][i];
+      AudioBuffer[2 * i + 1] = Outputs[1][i];
+    }
+
+    u64 Elapsed = Now() - Start;
+    if (Swapping)
+      Data->WorstSwap = Elapsed > Data->WorstSwap ? Elapsed : Data->WorstSwap;
+    else
+      Data->WorstOther = Elapsed > Data->WorstOther ? Elapsed : Data->WorstOther;
+
+    snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Data->Handle, AudioBuffer, FrameCount);
+    if (FramesWritten < 0)
+    {
+      Data->Missed++;
+      snd_pcm_recover(Data->Handle, FramesWritten, 1);
+    }
+    else if (Data->Null && Now() > Next + Period)
+    {
+      // NOTE(robin): The next period was due before we were done with this one
+      Data->Missed++;
+    }
+    Data->Periods++;
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Device = argc > 1 ? argv[1] : "null";
+  int Seconds = argc > 2 ? atoi(argv[2]) : 10;
+  int ReloadsPerSecond = argc > 3 ? atoi(argv[3]) : 10;
+  ReloadsPerSecond = ReloadsPerSecond < 1 ? 1 : ReloadsPerSecond > 100 ? 100 : ReloadsPerSecond;
+
+  // NOTE(robin): The plugins live next to us
+  char Executable[4096] = {0};
+  readlink("/proc/self/exe", Executable, sizeof(Executable) - 1);
+  const char* Directory = dirname(Executable);
+  char Plugins[2][4200];
+  snprintf(Plugins[0], sizeof(Plugins[0]), "%s/plugin_a.so", Directory);
+  snprintf(Plugins[1], sizeof(Plugins[1]), "%s/plugin_b.so", Directory);
+
+  static example_data Data;
+  Data.SampleRate = 48000;
+  Data.BufferSize = 256;
+  Data.Null = !strcmp(Device, "null");
+
+  int Error = snd_pcm_open(&Data.Handle, Device, SND_PCM_STREAM_PLAYBACK, 0);
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Data.Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Data.Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Data.Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Data.Handle, HardwareParams, &Data.SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Data.Handle, HardwareParams, EXAMPLE_CHANNELS);
+
+  snd_pcm_uframes_t PeriodSize = Data.BufferSize;
+  snd_pcm_hw_params_set_period_size_near(Data.Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params(Data.Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, &Data.SampleRate, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+  Data.BufferSize = PeriodSize < HOT_MAX_FRAMES ? PeriodSize : HOT_MAX_FRAMES;
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Data.Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Data.Handle, SoftwareParams, Data.BufferSize);
+  snd_pcm_sw_params(Data.Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+  snd_pcm_prepare(Data.Handle);
+
+  HotInit(&Data.Host, (f32)Data.SampleRate, EXAMPLE_CHANNELS, Data.BufferSize, EXAMPLE_FADE_MS);
+  if (!HotLoad(&Data.Host, Plugins[0]))
+  {
+    printf("%s\n", Data.Host.Error);
+    return 1;
+  }
+
+  printf("Device: %s\n", Device);
+  printf("Sample rate: %u\n", Data.SampleRate);
+  printf("Buffer size: %u\n", Data.BufferSize);
+  printf("Reloading %d times a second\n", ReloadsPerSecond);
+
+  Data.Running = 1;
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, &Data);
+
+  u32 Reloads = 0, Failures = 0, Migrated = 0;
+  u64 WorstLoad = 0;
+  for (int Tick = 0; Tick < ReloadsPerSecond * Seconds; Tick++)
+  {
+    usleep(1000000 / ReloadsPerSecond);
+
+    u64 Start = Now();
+    if (HotLoad(&Data.Host, Plugins[(Tick + 1) % 2]))
+    {
+      Reloads++;
+      Migrated += Data.Host.Migrated;
+    }
+    else
+    {
+      printf("%s\n", Data.Host.Error);
+      Failures++;
+    }
+    u64 Elapsed = Now() - Start;
+    WorstLoad = Elapsed > WorstLoad ? Elapsed : WorstLoad;
+  }
+
+  // NOTE(robin): Let the last swap finish
+  usleep(100000);
+  __atomic_store_n(&Data.Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+  snd_pcm_close(Data.Handle);
+
+  printf("Reloads: %u (%u failed, %u with the state migrated), swaps: %u, slowest load %.1fms\n",
+      Reloads, Failures, Migrated, Data.Host.Swaps, (f64)WorstLoad / 1e6);
+  printf("Periods: %u, missed: %u, clicks: %u\n", Data.Periods, Data.Missed, Data.Clicks);
+  printf("Slowest callback: %.0fus with a swap or fade, %.0fus otherwise (period %.0fus)\n",
+      (f64)Data.WorstSwap / 1000.0, (f64)Data.WorstOther / 1000.0, 1e6 * Data.BufferSize / Data.SampleRate);
+  HotFree(&Data.Host);
+
+  u32 Passed = !Failures && !Data.Missed && !Data.Clicks;
+  printf("%s\n", Passed ? "No missed periods or clicks" : "FAILED");
+  return Passed ? 0 : 1;
+}
@@ -0,0 +1,319 @@
+/*
+ * This file is alsa_example.c without the plug layer: we open a hw: device, find out which
+ * sample formats the hardware takes natively and convert to one of them ourselves with the
+ * kernels from dsp_kernels.c, instead of handing float to plughw: and letting alsa-lib's
+ * generic conversion code do it.
+ *
+ * Usage: alsa_hw_example [device=hw:0,0] [mode=bench] [seconds=5] [format=auto]
+ *
+ * Modes:
+ *
+ * - hw: play a sine through the hw: device, converting to its native format ourselves
+ * - plug: play the same sine through the matching plughw: device as float, like alsa_example
+ * - bench: run plug and then hw, one after the other
+ *
+ * Each runs for the given number of seconds (0 plays forever) and then prints the CPU time
+ * per period.
+ *
+ * The format is picked automatically (see HWFormats), pass one of S32_LE, S24_3LE, S16_LE or
+ * FLOAT_LE to force it. The device has to be a hw: device; hw: devices only take what the
+ * hardware does, so we also take whatever rate, channel count and period size it gives us
+ * closest to what we asked for, and leave the channels past the first two silent.
+ *
+ * NOTE(robin): The CPU time is the thread's CPU time (CLOCK_THREAD_CPUTIME_ID) from the end of
+ * the wait to the end of snd_pcm_writei, so the time writei spends blocked doesn't count but
+ * everything alsa-lib does inside it (including its conversion on the plughw: path) does.
+ * Generating the sine is the same for both paths and is measured separately.
+ */
+
+#include <alsa/asoundlib.h>
+#include <sched.h>
+#include <math.h>
+
+#include "types.h"
+#include "dsp_kernels.c"
+#include "interleave.c"
+#include "denormal.c"
+
+#define EXAMPLE_MAX_CHANNELS 32
+#define EXAMPLE_MAX_FRAMES 1024
+
+typedef struct
+{
+  snd_pcm_format_t Format;
+  const char* Name;
+} hw_format;
+
+// NOTE(robin): In order of preference. The integer formats are what the converter in the
+// hardware runs at, S32 is a multiply and a convert per sample, S24_3 needs packing on top and
+// S16 throws away resolution. Hardware that takes float is rare, and if it does then the
+// driver or the firmware converts, which is the work we wanted to do ourselves.
+static const hw_format HWFormats[] =
+{
+  {SND_PCM_FORMAT_S32_LE, "S32_LE"},
+  {SND_PCM_FORMAT_S24_3LE, "S24_3LE"},
+  {SND_PCM_FORMAT_S16_LE, "S16_LE"},
+  {SND_PCM_FORMAT_FLOAT_LE, "FLOAT_LE"},
+};
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  const hw_format* Format;
+  u32 SampleRate;
+  u32 ChannelCount;
+  u32 FrameCount;
+  dsp_kernels Kernels;       // NOTE(robin): For one channel of FrameCount samples
+  dsp_kernels SampleKernels; // NOTE(robin): For ChannelCount * FrameCount samples
+
+  u32 Periods;
+  u32 Xruns;
+  u64 GenerateTime; // NOTE(robin): Nanoseconds of thread CPU time, summed over all periods
+  u64 OutputTime;
+  u64 WorstOutputTime;
+} stream;
+
+static u64 ThreadTime(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+// NOTE(robin): Returns the first format in HWFormats that the device supports, or Forced if it
+// isn't null and the device supports it
+static const hw_format* PickFormat(snd_pcm_t* Handle, snd_pcm_hw_params_t* HardwareParams, const char* Forced)
+{
+  for (u32 i = 0; i < sizeof(HWFormats) / sizeof(HWFormats[0]); i++)
+  {
+    if (Forced && strcmp(Forced, HWFormats[i].Name))
+      continue;
+
+    if (!snd_pcm_hw_params_test_format(Handle, HardwareParams, HWFormats[i].Format))
+      return &HWFormats[i];
+  }
+
+  return 0;
+}
+
+static u32 OpenStream(stream* Stream, const char* Device, u32 Plug, const char* ForcedFormat)
+{
+  *Stream = (stream){0};
+
+  int Error = snd_pcm_open(&Stream->Handle, Device, SND_PCM_STREAM_PLAYBACK, 0);
+  if (Error)
+  {
+    printf("%s: %s\n", Device, snd_strerror(Error));
+    return 0;
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Stream->Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Stream->Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+
+  // NOTE(robin): On plughw: every format is "supported", so there we ask for float and
+  // alsa-lib converts to whatever the hardware takes
+  static const hw_format PlugFormat = {SND_PCM_FORMAT_FLOAT_LE, "FLOAT_LE"};
+  Stream->Format = Plug ? &PlugFormat : PickFormat(Stream->Handle, HardwareParams, ForcedFormat);
+  if (!Stream->Format)
+  {
+    printf("%s doesn't support %s\n", Device, ForcedFormat ? ForcedFormat : "any of our formats");
+    snd_pcm_hw_params_free(HardwareParams);
+    snd_pcm_close(Stream->Handle);
+    return 0;
+  }
+  snd_pcm_hw_params_set_format(Stream->Handle, HardwareParams, Stream->Format->Format);
+
+  u32 SampleRate = 48000;
+  u32 ChannelCount = 2;
+  snd_pcm_uframes_t PeriodSize = 256;
+  snd_pcm_uframes_t BufferSize = 2 * PeriodSize;
+  snd_pcm_hw_params_set_rate_near(Stream->Handle, HardwareParams, &SampleRate, 0);
+  snd_pcm_hw_params_set_channels_near(Stream->Handle, HardwareParams, &ChannelCount);
+  snd_pcm_hw_params_set_period_size_near(Stream->Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params_set_buffer_size_near(Stream->Handle, HardwareParams, &BufferSize);
+
+  Error = snd_pcm_hw_params(Stream->Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, &SampleRate, 0);
+  snd_pcm_hw_params_get_channels(HardwareParams, &ChannelCount);
+  snd_pcm_hw_params_get_period_size(HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+
+  if (Error || ChannelCount > EXAMPLE_MAX_CHANNELS || PeriodSize > EXAMPLE_MAX_FRAMES)
+  {
+    printf("%s: %s\n", Device, Error ? snd_strerror(Error) : "too many channels or frames");
+    snd_pcm_close(Stream->Handle);
+    return 0;
+  }
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Stream->Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Stream->Handle, SoftwareParams, PeriodSize);
+  snd_pcm_sw_params_set_start_threshold(Stream->Handle, SoftwareParams, 0);
+  snd_pcm_sw_params(Stream->Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+  snd_pcm_prepare(Stream->Handle);
+
+  Stream->SampleRate = SampleRate;
+  Stream->ChannelCount = ChannelCount;
+  Stream->FrameCount = (u32)PeriodSize;
+  Stream->Kernels = DSPSelectKernels(Stream->FrameCount);
+  Stream->SampleKernels = DSPSelectKernels(Stream->ChannelCount * Stream->FrameCount);
+
+  printf("%s: %s, %u Hz, %u channels, %u frames per period\n", Device,
+      Stream->Format->Name, SampleRate, ChannelCount, Stream->FrameCount);
+  return 1;
+}
+
+static void RunStream(stream* Stream, int Seconds)
+{
+  static f32 Planar[EXAMPLE_MAX_CHANNELS][EXAMPLE_MAX_FRAMES];
+  static f32 Interleaved[EXAMPLE_MAX_CHANNELS * EXAMPLE_MAX_FRAMES];
+  static u8 Hardware[4 * EXAMPLE_MAX_CHANNELS * EXAMPLE_MAX_FRAMES];
+
+  const f32* Channels[EXAMPLE_MAX_CHANNELS];
+  for (u32 Channel = 0; Channel < Stream->ChannelCount; Channel++)
+    Channels[Channel] = Planar[Channel];
+
+  f32 Phase[2] = {0, 0};
+  f32 PhaseDelta[2] =
+  {
+    220.0f / (f32)Stream->SampleRate,
+    330.0f / (f32)Stream->SampleRate,
+  };
+
+  u32 FrameCount = Stream->FrameCount;
+  u32 SampleCount = Stream->ChannelCount * FrameCount;
+  u32 PeriodCount = Seconds > 0 ? (u32)((u64)Seconds * Stream->SampleRate / FrameCount) : 0xFFFFFFFF;
+
+  fp_state FPState = FPEnterAudioThread();
+
+  for (u32 Period = 0; Period < PeriodCount; Period++)
+  {
+    snd_pcm_wait(Stream->Handle, 1000);
+    u64 Start = ThreadTime();
+
+    Stream->Kernels.Oscillator(Planar[0], FrameCount, &Phase[0], PhaseDelta[0], 0.2f);
+    if (Stream->ChannelCount > 1)
+      Stream->Kernels.Oscillator(Planar[1], FrameCount, &Phase[1], PhaseDelta[1], 0.2f);
+
+    if (Stream->ChannelCount == 2)
+      Stream->Kernels.Interleave2(Interleaved, Planar[0], Planar[1], FrameCount);
+    else
+      InterleaveF32(Interleaved, Channels, Stream->ChannelCount, FrameCount);
+
+    u64 Generated = ThreadTime();
+
+    // NOTE(robin): The conversion kernels see the interleaved buffer as one long channel
+    void* Output = Hardware;
+    switch (Stream->Format->Format)
+    {
+      case SND_PCM_FORMAT_S32_LE:
+      {
+        Stream->SampleKernels.ConvertF32ToS32((s32*)Hardware, Interleaved, SampleCount);
+      } break;
+
+      case SND_PCM_FORMAT_S24_3LE:
+      {
+        Stream->SampleKernels.ConvertF32ToS24(Hardware, Interleaved, SampleCount);
+      } break;
+
+      case SND_PCM_FORMAT_S16_LE:
+      {
+        Stream->SampleKernels.ConvertF32ToS16((s16*)Hardware, Interleaved, SampleCount);
+      } break;
+
+      default:
+      {
+        Output = Interleaved;
+      } break;
+    }
+
+    snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Stream->Handle, Output, FrameCount);
+    if (FramesWritten < 0)
+    {
+      Stream->Xruns++;
+      snd_pcm_recover(Stream->Handle, (int)FramesWritten, 1);
+    }
+
+    u64 End = ThreadTime();
+    Stream->GenerateTime += Generated - Start;
+    Stream->OutputTime += End - Generated;
+    Stream->WorstOutputTime = End - Generated > Stream->WorstOutputTime ? End - Generated : Stream->WorstOutputTime;
+    Stream->Periods++;
+  }
+
+  FPLeaveAudioThread(FPState);
+}
+
+static void PrintStream(const char* Name, stream* Stream)
+{
+  if (!Stream->Periods)
+    return;
+
+  f64 Periods = (f64)Stream->Periods;
+  printf("%-6s %-10s %8u %10.2f %10.2f %10.2f %8u\n", Name, Stream->Format->Name, Stream->FrameCount,
+      (f64)Stream->GenerateTime / Periods / 1000.0,
+      (f64)Stream->OutputTime / Periods / 1000.0,
+      (f64)Stream->WorstOutputTime / 1000.0,
+      Stream->Xruns);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Device = argc > 1 ? argv[1] : "hw:0,0";
+  const char* Mode = argc > 2 ? argv[2] : "bench";
+  int Seconds = argc > 3 ? atoi(argv[3]) : 5;
+  const char* ForcedFormat = argc > 4 && strcmp(argv[4], "auto") ? argv[4] : 0;
+
+  if (strncmp(Device, "hw:", 3))
+  {
+    printf("%s is not a hw: device\n", Device);
+    return 1;
+  }
+
+  char PlugDevice[256];
+  snprintf(PlugDevice, sizeof(PlugDevice), "plug%s", Device);
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the appropriate
+  // rtprio limits set up, in which case we just run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (sched_setscheduler(0, SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  u32 Bench = !strcmp(Mode, "bench");
+  if (!Bench && strcmp(Mode, "hw") && strcmp(Mode, "plug"))
+  {
+    printf("Unknown mode %s, use hw, plug or bench\n", Mode);
+    return 1;
+  }
+
+  // NOTE(robin): The plug and hw devices are the same hardware, so only one can be open
+  stream PlugStream = {0}, HWStream = {0};
+  if (Bench || !strcmp(Mode, "plug"))
+  {
+    if (!OpenStream(&PlugStream, PlugDevice, 1, 0))
+      return 1;
+    RunStream(&PlugStream, Seconds);
+    snd_pcm_close(PlugStream.Handle);
+  }
+
+  if (Bench || !strcmp(Mode, "hw"))
+  {
+    if (!OpenStream(&HWStream, Device, 0, ForcedFormat))
+      return 1;
+    RunStream(&HWStream, Seconds);
+    snd_pcm_close(HWStream.Handle);
+  }
+
+  // NOTE(robin): Output is conversion plus writei, on the plug path alsa-lib converts from
+  // float to the hardware format inside writei
+  printf("\nCPU time per period in us\n");
+  printf("%-6s %-10s %8s %10s %10s %10s %8s\n", "path", "format", "frames", "generate", "output", "worst", "xruns");
+  PrintStream("plug", &PlugStream);
+  PrintStream("hw", &HWStream);
+  return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * This file measures the round trip latency of an ALSA playback/capture pair with latency.c
+ * and compares it with what snd_pcm_delay reports.
+ *
+ * Usage: alsa_latency [playback device] [capture device] [runs] [period]
+ *
+ * The devices default to "plughw:0,0", with a cable from the first output to the first
+ * input. Without hardware you can use the loopback driver (modprobe snd-aloop), whose
+ * playback device 0 comes back out of capture device 1:
+ *
+ *   alsa_latency plughw:Loopback,0,0 plughw:Loopback,1,0
+ *
+ * NOTE(robin): The audio thread reads a period of input, runs the probe and writes a period
+ * of output, like any full duplex ALSA program. "Reported" is snd_pcm_delay of the playback
+ * stream (frames until what we write now is heard) plus snd_pcm_delay of the capture stream
+ * (how old the oldest frame we're about to read is), both sampled at the top of the period
+ * in which a run starts. Anything the driver doesn't know about, like converter delay or
+ * USB transfers, shows up as the difference.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "fft.c"
+#include "latency.c"
+
+#define LATENCY_ORDER 14 // NOTE(robin): 16383 samples, a third of a second at 48kHz
+#define LATENCY_MAX_DELAY 16384
+#define LATENCY_MAX_PERIOD 4096
+
+typedef struct
+{
+  snd_pcm_t* Playback;
+  snd_pcm_t* Capture;
+  u32 PeriodSize;
+  latency_probe Probe;
+  u32 Running;
+  u32 XRuns;
+} alsa_latency_data;
+
+snd_pcm_t* ALSAOpen(const char* Device, snd_pcm_stream_t Direction, u32* SampleRate, u32* PeriodSize)
+{
+  snd_pcm_t* Handle;
+  int Error = snd_pcm_open(&Handle, Device, Direction, 0);
+  if (Error)
+  {
+    printf("%s: %s\n", Device, snd_strerror(Error));
+    return 0;
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Handle, HardwareParams);
+
+  snd_pcm_hw_params_set_access(Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Handle, HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Handle, HardwareParams, 2);
+
+  // NOTE(robin): Two periods, the usual low latency setup
+  snd_pcm_uframes_t Period = *PeriodSize;
+  snd_pcm_uframes_t Buffer = 2 * Period;
+  snd_pcm_hw_params_set_period_size_near(Handle, HardwareParams, &Period, 0);
+  snd_pcm_hw_params_set_buffer_size_near(Handle, HardwareParams, &Buffer);
+  Error = snd_pcm_hw_params(Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_get_period_size(HardwareParams, &Period, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+
+  if (Error)
+  {
+    printf("%s: %s\n", Device, snd_strerror(Error));
+    snd_pcm_close(Handle);
+    return 0;
+  }
+
+  // NOTE(robin): We start the streams ourselves once the playback buffer is primed
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Handle, SoftwareParams, Period);
+  snd_pcm_sw_params_set_start_threshold(Handle, SoftwareParams, 0x7FFFFFFF);
+  snd_pcm_sw_params(Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+
+  snd_pcm_prepare(Handle);
+  *PeriodSize = (u32)Period;
+  return Handle;
+}
+
+// NOTE(robin): Fills the playback buffer with silence and starts both streams, at the same
+// time if the driver lets us link them
+void ALSAStart(alsa_latency_data* Data)
+{
+  static float Silence[2 * LATENCY_MAX_PERIOD];
+  snd_pcm_drop(Data->Playback);
+  snd_pcm_drop(Data->Capture);
+  snd_pcm_prepare(Data->Playback);
+  snd_pcm_prepare(Data->Capture);
+
+  snd_pcm_writei(Data->Playback, Silence, Data->PeriodSize);
+  snd_pcm_writei(Data->Playback, Silence, Data->PeriodSize);
+
+  snd_pcm_start(Data->Playback);
+  if (snd_pcm_state(Data->Capture) != SND_PCM_STATE_RUNNING)
+    snd_pcm_start(Data->Capture);
+}
+
+void* AudioThread(void* Context)
+{
+  alsa_latency_data* Data = Context;
+
+  // NOTE(robin): Flush subnormals to zero on this thread, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): See alsa_scheduler_example.c
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  static float InputFrames[2 * LATENCY_MAX_PERIOD];
+  static float OutputFrames[2 * LATENCY_MAX_PERIOD];
+  static float Input[LATENCY_MAX_PERIOD];
+  static float Output[LATENCY_MAX_PERIOD];
+
+  ALSAStart(Data);
+
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    snd_pcm_sframes_t PlaybackDelay = 0;
+    snd_pcm_sframes_t CaptureDelay = 0;
+    snd_pcm_delay(Data->Playback, &PlaybackDelay);
+    snd_pcm_delay(Data->Capture, &CaptureDelay);
+
+    snd_pcm_sframes_t Read = snd_pcm_readi(Data->Capture, InputFrames, Data->PeriodSize);
+    if (Read != (snd_pcm_sframes_t)Data->PeriodSize)
+    {
+      // NOTE(robin): An xrun breaks the relationship between the two streams, restart them.
+      // The main thread throws away any run that saw one.
+      __atomic_add_fetch(&Data->XRuns, 1, __ATOMIC_RELEASE);
+      ALSAStart(Data);
+      continue;
+    }
+
+    // NOTE(robin): The probe uses the first channel, the second one is silent
+    for (u32 i = 0; i < Data->PeriodSize; i++)
+      Input[i] = InputFrames[2 * i];
+
+    if (LatencyProbeProcess(&Data->Probe, Output, Input, Data->PeriodSize))
+      Data->Probe.Reported = (f64)(PlaybackDelay + CaptureDelay);
+
+    for (u32 i = 0; i < Data->PeriodSize; i++)
+    {
+      OutputFrames[2 * i + 0] = Output[i];
+      OutputFrames[2 * i + 1] = 0;
+    }
+
+    snd_pcm_sframes_t Written = snd_pcm_writei(Data->Playback, OutputFrames, Data->PeriodSize);
+    if (Written != (snd_pcm_sframes_t)Data->PeriodSize)
+    {
+      __atomic_add_fetch(&Data->XRuns, 1, __ATOMIC_RELEASE);
+      ALSAStart(Data);
+    }
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* PlaybackDevice = argc > 1 ? argv[1] : "plughw:0,0";
+  const char* CaptureDevice = argc > 2 ? argv[2] : PlaybackDevice;
+  u32 Runs = argc > 3 ? atoi(argv[3]) : 10;
+  u32 PeriodSize = argc > 4 ? atoi(argv[4]) : 256;
+  if (PeriodSize > LATENCY_MAX_PERIOD)
+    PeriodSize = LATENCY_MAX_PERIOD;
+
+  static alsa_latency_data Data;
+  static latency_analyser Analyser;
+  latency_stats Stats = {0};
+
+  if (!LatencyProbeInit(&Data.Probe, LATENCY_ORDER, 0.25f, LATENCY_MAX_DELAY) ||
+      !LatencyAnalyserInit(&Analyser, &Data.Probe))
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+
+  u32 SampleRate = 48000;
+  u32 CaptureRate = 48000;
+  u32 CapturePeriod = PeriodSize;
+  Data.Playback = ALSAOpen(PlaybackDevice, SND_PCM_STREAM_PLAYBACK, &SampleRate, &PeriodSize);
+  Data.Capture = ALSAOpen(CaptureDevice, SND_PCM_STREAM_CAPTURE, &CaptureRate, &CapturePeriod);
+  if (!Data.Playback || !Data.Capture)
+    return 1;
+
+  if (SampleRate != CaptureRate || PeriodSize != CapturePeriod)
+  {
+    printf("Playback and capture disagree (%u/%u Hz, %u/%u frames), use plughw devices\n",
+        SampleRate, CaptureRate, PeriodSize, CapturePeriod);
+    return 1;
+  }
+
+  Data.PeriodSize = PeriodSize;
+  if (snd_pcm_link(Data.Capture, Data.Playback))
+    printf("Could not link the streams, starting them one after the other\n");
+
+  printf("Playing on %s, recording %s\n", PlaybackDevice, CaptureDevice);
+  printf("Sample rate: %u\n", SampleRate);
+  printf("Period size: %u\n\n", PeriodSize);
+
+  Data.Running = 1;
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, &Data);
+
+  u32 TimeoutMS = (u32)(1000.0 * Data.Probe.CaptureLength / SampleRate) + 2000;
+  for (u32 Run = 0; Run < Runs; Run++)
+  {
+    u32 XRuns = __atomic_load_n(&Data.XRuns, __ATOMIC_ACQUIRE);
+    LatencyProbeArm(&Data.Probe);
+
+    u32 WaitedMS = 0;
+    while (!LatencyProbeDone(&Data.Probe) && WaitedMS < TimeoutMS)
+    {
+      usleep(10000);
+      WaitedMS += 10;
+    }
+
+    if (!LatencyProbeDone(&Data.Probe))
+    {
+      printf("Timed out waiting for the audio thread\n");
+      break;
+    }
+
+    if (__atomic_load_n(&Data.XRuns, __ATOMIC_ACQUIRE) != XRuns)
+    {
+      printf("run %3u: xrun during the measurement, skipped\n", Run);
+      Stats.Invalid++;
+      continue;
+    }
+
+    latency_result Result = LatencyAnalyse(&Analyser, Data.Probe.Capture, Data.Probe.CaptureLength);
+    Result.Reported = Data.Probe.Reported;
+    LatencyPrintResult(Run, Result, SampleRate);
+    LatencyStatsAdd(&Stats, Result);
+  }
+
+  __atomic_store_n(&Data.Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+
+  LatencyPrintStats(&Stats, SampleRate);
+  printf("xruns: %u\n", Data.XRuns);
+
+  snd_pcm_close(Data.Playback);
+  snd_pcm_close(Data.Capture);
+  return Stats.Count ? 0 : 1;
+}
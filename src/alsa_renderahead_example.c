@@ -0,0 +1,380 @@
+/*
+ * This file is an example of renderahead.c: a synth with occasional CPU spikes (a block that
+ * takes longer than a whole period) played first the usual way, rendered in the callback, and
+ * then rendered ahead on a worker thread, while the live input is passed through in the
+ * callback in both cases.
+ *
+ * Usage: alsa_renderahead_example [device=null] [seconds per mode=10] [depth=4] [spike=1.5] [trace file]
+ *
+ * Depth is the number of periods rendered ahead, spike is how long the slow blocks take in
+ * periods. About one block in 200 is a slow one. To show that the depth can be changed while
+ * the audio runs, the render ahead run drops to a depth of 1 for its middle third, which is
+ * too little for the spikes, and then goes back.
+ *
+ * The device defaults to "null", which lets you try this out without any audio hardware (we
+ * pace ourselves with clock_nanosleep, since the null PCM is always ready). Every second we
+ * print the queue depth, how often the safety margin was used and how many periods were
+ * missed, i.e. the callback finished after its deadline, or an underrun on a real device.
+ *
+ * With a trace file, the callback and the worker record what they do with trace.c, and the
+ * trace is written out shortly after the first missed period or empty queue (or at the end if
+ * there wasn't one), so you can see what led up to it in https://ui.perfetto.dev.
+ *
+ * NOTE(robin): Missed periods also happen for reasons that have nothing to do with the
+ * spikes when we don't get real-time priority, see the rtprio note in AudioThread.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "types.h"
+#include "dsp_kernels.c"
+#include "denormal.c"
+#include "trace.c" // NOTE(robin): Before renderahead.c so that its markers are recorded
+#include "renderahead.c"
+
+#define EXAMPLE_CHANNELS 2
+#define EXAMPLE_MAX_FRAMES 1024
+#define EXAMPLE_PARTIALS 24
+#define EXAMPLE_SPIKE_CHANCE 200
+
+typedef struct
+{
+  f32 SampleRate;
+  f32 Phase[EXAMPLE_CHANNELS][EXAMPLE_PARTIALS];
+  u32 Random;
+  f32 SpikePeriods;
+  u32 Spikes;
+} synth;
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  snd_pcm_t* CaptureHandle;
+  u32 SampleRate;
+  u32 BufferSize;
+  u32 Null;
+  u32 Running;
+  u32 Ahead; // NOTE(robin): Render through RenderAhead rather than in the callback
+
+  synth DirectSynth; // NOTE(robin): Rendered in the callback
+  synth Synth;       // NOTE(robin): Rendered ahead by the worker
+  render_ahead RenderAhead;
+
+  u32 Missed;
+
+  const char* TracePath;
+  u32 TraceWritten;
+} example_data;
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+// NOTE(robin): A chord of additive tones, a few dozen sines per sample. Every now and then a
+// block takes Synth->SpikePeriods periods, which stands in for whatever makes a real synth
+// slow now and then (a lot of new voices at once, a preset change, a page fault).
+static void RenderSynth(void* Context, f32* const* Outputs, u32 FrameCount)
+{
+  synth* Synth = Context;
+  u64 Start = Now();
+
+  for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+  {
+    f32 Fundamental = Channel ? 330.0f : 220.0f;
+    f32* Output = Outputs[Channel];
+    memset(Output, 0, FrameCount * sizeof(f32));
+
+    for (u32 Partial = 0; Partial < EXAMPLE_PARTIALS; Partial++)
+    {
+      f32 PhaseDelta = Fundamental * (f32)(Partial + 1) / Synth->SampleRate;
+      f32 Amplitude = 0.1f / (f32)(Partial + 1);
+      f32 Phase = Synth->Phase[Channel][Partial];
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Phase += PhaseDelta;
+        Phase -= (f32)(s32)Phase;
+        Output[i] += Amplitude * DSPSinTurns(Phase);
+      }
+      Synth->Phase[Channel][Partial] = Phase;
+    }
+  }
+
+  Synth->Random ^= Synth->Random << 13;
+  Synth->Random ^= Synth->Random >> 17;
+  Synth->Random ^= Synth->Random << 5;
+  if (Synth->Random % EXAMPLE_SPIKE_CHANCE == 0)
+  {
+    __atomic_store_n(&Synth->Spikes, Synth->Spikes + 1, __ATOMIC_RELAXED);
+    u64 Period = (u64)FrameCount * 1000000000ull / (u64)Synth->SampleRate;
+    u64 Until = Start + (u64)(Synth->SpikePeriods * (f32)Period);
+    while (Now() < Until)
+    {
+    }
+  }
+}
+
+void* AudioThread(void* Context)
+{
+  example_data* Data = Context;
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the
+  // appropriate rtprio limits set up, in which case we just run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  fp_state FPState = FPEnterAudioThread();
+  TraceThreadName("audio");
+
+  u32 FrameCount = Data->BufferSize;
+  u64 Period = (u64)FrameCount * 1000000000ull / Data->SampleRate;
+  u64 Next = Now();
+
+  static f32 Outputs[EXAMPLE_CHANNELS][EXAMPLE_MAX_FRAMES];
+  static f32 Input[EXAMPLE_CHANNELS * EXAMPLE_MAX_FRAMES];
+  static f32 AudioBuffer[EXAMPLE_CHANNELS * EXAMPLE_MAX_FRAMES];
+  f32* OutputPointers[EXAMPLE_CHANNELS] = {Outputs[0], Outputs[1]};
+
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    if (Data->Null)
+    {
+      Next += Period;
+      struct timespec Until = {Next / 1000000000ull, Next % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+      TraceCounter("wakeup lateness (us)", (s64)(Now() - Next) / 1000);
+    }
+    else
+    {
+      TraceBegin("wait for device");
+      snd_pcm_wait(Data->Handle, 1000);
+      TraceEnd("wait for device");
+    }
+
+    TraceBegin("callback");
+    if (__atomic_load_n(&Data->Ahead, __ATOMIC_ACQUIRE))
+    {
+      TraceBegin("pull");
+      if (!RenderAheadPull(&Data->RenderAhead, OutputPointers))
+        TraceTrigger("queue empty");
+      TraceEnd("pull");
+    }
+    else
+    {
+      TraceBegin("render block");
+      RenderSynth(&Data->DirectSynth, OutputPointers, FrameCount);
+      TraceEnd("render block");
+    }
+
+    // NOTE(robin): The live input stays on the direct path, it's only as late as the device
+    // makes it. The capture stream is non blocking, so we take what's there.
+    TraceBegin("capture and mix");
+    snd_pcm_sframes_t FramesRead = snd_pcm_readi(Data->CaptureHandle, Input, FrameCount);
+    if (FramesRead < 0)
+    {
+      snd_pcm_recover(Data->CaptureHandle, (int)FramesRead, 1);
+      FramesRead = 0;
+    }
+    for (u32 i = 0; i < FrameCount; i++)
+    {
+      for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+      {
+        f32 Live = i < (u32)FramesRead ? Input[EXAMPLE_CHANNELS * i + Channel] : 0.0f;
+        AudioBuffer[EXAMPLE_CHANNELS * i + Channel] = Outputs[Channel][i] + Live;
+      }
+    }
+    TraceEnd("capture and mix");
+
+    TraceBegin("write");
+    snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Data->Handle, AudioBuffer, FrameCount);
+    TraceEnd("write");
+    if (FramesWritten < 0)
+    {
+      __atomic_store_n(&Data->Missed, Data->Missed + 1, __ATOMIC_RELAXED);
+      TraceTrigger("underrun");
+      snd_pcm_recover(Data->Handle, (int)FramesWritten, 1);
+    }
+    else if (Data->Null && Now() > Next + Period)
+    {
+      // NOTE(robin): The next period was due before we were done with this one
+      __atomic_store_n(&Data->Missed, Data->Missed + 1, __ATOMIC_RELAXED);
+      TraceTrigger("missed period");
+    }
+    TraceEnd("callback");
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+static snd_pcm_t* OpenDevice(const char* Device, snd_pcm_stream_t Stream, int Mode, u32* SampleRate, u32* BufferSize)
+{
+  snd_pcm_t* Handle;
+  int Error = snd_pcm_open(&Handle, Device, Stream, Mode);
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Handle, HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Handle, HardwareParams, EXAMPLE_CHANNELS);
+
+  snd_pcm_uframes_t PeriodSize = *BufferSize;
+  snd_pcm_hw_params_set_period_size_near(Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params(Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, SampleRate, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+  *BufferSize = PeriodSize < EXAMPLE_MAX_FRAMES ? (u32)PeriodSize : EXAMPLE_MAX_FRAMES;
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Handle, SoftwareParams, *BufferSize);
+  snd_pcm_sw_params(Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+  snd_pcm_prepare(Handle);
+  return Handle;
+}
+
+static void WriteTrace(example_data* Data)
+{
+  s32 Events = TraceWrite(Data->TracePath);
+  if (Events < 0)
+    printf("Could not write the trace to %s\n", Data->TracePath);
+  else
+    printf("Wrote %d trace events to %s\n", Events, Data->TracePath);
+  Data->TraceWritten = 1;
+}
+
+// NOTE(robin): Prints one line per second for Seconds seconds. Depth is what to set the
+// render ahead depth to for the second, 0 when we're rendering in the callback.
+static void Watch(example_data* Data, const char* Name, int Seconds, u32 Depth)
+{
+  synth* Synth = Depth ? &Data->Synth : &Data->DirectSynth;
+  u32 Missed = __atomic_load_n(&Data->Missed, __ATOMIC_RELAXED);
+  u32 Spikes = __atomic_load_n(&Synth->Spikes, __ATOMIC_RELAXED);
+  render_ahead_stats Previous = RenderAheadRead(&Data->RenderAhead);
+
+  for (int Second = 0; Second < Seconds; Second++)
+  {
+    // NOTE(robin): Too shallow for the spikes in the middle third
+    u32 Target = Second >= Seconds / 3 && Second < 2 * Seconds / 3 ? 1 : Depth;
+    if (Depth)
+      RenderAheadSetDepth(&Data->RenderAhead, Target);
+
+    sleep(1);
+
+    u32 NewMissed = __atomic_load_n(&Data->Missed, __ATOMIC_RELAXED);
+    u32 NewSpikes = __atomic_load_n(&Synth->Spikes, __ATOMIC_RELAXED);
+    render_ahead_stats Stats = RenderAheadRead(&Data->RenderAhead);
+
+    if (Depth)
+    {
+      printf("%-7s depth %2u (min %2u, %4.1fms of latency) spikes %2u margin used %3llu starved %3llu missed %3u\n",
+          Name, Stats.TargetDepth, Stats.MinDepth, 1000.0 * Stats.TargetDepth * Data->BufferSize / Data->SampleRate,
+          NewSpikes - Spikes, (unsigned long long)(Stats.MarginUsed - Previous.MarginUsed),
+          (unsigned long long)(Stats.Starved - Previous.Starved), NewMissed - Missed);
+    }
+    else
+    {
+      printf("%-7s spikes %2u missed %3u\n", Name, NewSpikes - Spikes, NewMissed - Missed);
+    }
+
+    Missed = NewMissed;
+    Spikes = NewSpikes;
+    Previous = Stats;
+
+    // NOTE(robin): A second after the first xrun, so the trace shows the recovery too
+    if (Data->TracePath && !Data->TraceWritten && TraceTriggered())
+      WriteTrace(Data);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Device = argc > 1 ? argv[1] : "null";
+  int Seconds = argc > 2 ? atoi(argv[2]) : 10;
+  int Depth = argc > 3 ? atoi(argv[3]) : 4;
+  f32 SpikePeriods = argc > 4 ? (f32)atof(argv[4]) : 1.5f;
+  const char* TracePath = argc > 5 ? argv[5] : 0;
+  Depth = Depth < 1 ? 1 : Depth > RENDER_AHEAD_MAX_DEPTH ? RENDER_AHEAD_MAX_DEPTH : Depth;
+
+  static example_data Data;
+  Data.SampleRate = 48000;
+  Data.BufferSize = 256;
+  Data.Null = !strcmp(Device, "null");
+  Data.TracePath = TracePath;
+  TraceInit();
+  Data.Handle = OpenDevice(Device, SND_PCM_STREAM_PLAYBACK, 0, &Data.SampleRate, &Data.BufferSize);
+  u32 CaptureRate = Data.SampleRate, CaptureSize = Data.BufferSize;
+  Data.CaptureHandle = OpenDevice(Device, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK, &CaptureRate, &CaptureSize);
+  snd_pcm_start(Data.CaptureHandle);
+
+  Data.DirectSynth.SampleRate = (f32)Data.SampleRate;
+  Data.DirectSynth.Random = 0x12345678;
+  Data.DirectSynth.SpikePeriods = SpikePeriods;
+  Data.Synth = Data.DirectSynth;
+
+  printf("Device: %s\n", Device);
+  printf("Sample rate: %u\n", Data.SampleRate);
+  printf("Buffer size: %u\n", Data.BufferSize);
+  printf("Spikes of %.1f periods, about one block in %d\n\n", (f64)SpikePeriods, EXAMPLE_SPIKE_CHANCE);
+
+  // NOTE(robin): The worker isn't running until RenderAheadStart, the callback renders itself
+  if (!RenderAheadInit(&Data.RenderAhead, EXAMPLE_CHANNELS, Data.BufferSize, RENDER_AHEAD_MAX_DEPTH, RenderSynth, &Data.Synth))
+  {
+    printf("Could not set up render ahead for %u frames\n", Data.BufferSize);
+    return 1;
+  }
+
+  Data.Running = 1;
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, &Data);
+
+  Watch(&Data, "direct", Seconds, 0);
+  u32 DirectMissed = __atomic_load_n(&Data.Missed, __ATOMIC_RELAXED);
+
+  // NOTE(robin): The callback and the worker each have their own synth, so the worker can fill
+  // the queue while the callback is still rendering. A real program would pick one mode
+  // before it starts, or switch while it's silent.
+  u32 Started = RenderAheadStart(&Data.RenderAhead, (u32)Depth);
+  if (Started)
+  {
+    __atomic_store_n(&Data.Ahead, 1, __ATOMIC_RELEASE);
+    Watch(&Data, "ahead", Seconds, (u32)Depth);
+  }
+  else
+  {
+    printf("Could not start the render ahead worker\n");
+  }
+  u32 AheadMissed = __atomic_load_n(&Data.Missed, __ATOMIC_RELAXED) - DirectMissed;
+  render_ahead_stats Stats = RenderAheadRead(&Data.RenderAhead);
+
+  __atomic_store_n(&Data.Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+  RenderAheadFree(&Data.RenderAhead);
+  if (Data.TracePath && !Data.TraceWritten)
+    WriteTrace(&Data);
+  snd_pcm_close(Data.Handle);
+  snd_pcm_close(Data.CaptureHandle);
+  if (!Started)
+    return 1;
+
+  // NOTE(robin): A starved pull is a dropout too, even though the callback made its deadline
+  printf("\nRendering in the callback: %u missed periods\n", DirectMissed);
+  printf("Rendering %d periods ahead: %u missed periods, %llu periods of silence from an empty queue (%d seconds at a depth of 1)\n",
+      Depth, AheadMissed, (unsigned long long)Stats.Starved, 2 * Seconds / 3 - Seconds / 3);
+  return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * This file is an example of using scheduler.c to service an ALSA playback and capture
+ * stream from a single audio thread, instead of blocking on each stream in turn.
+ *
+ * Usage: alsa_scheduler_example [device] [seconds] [trace file]
+ *
+ * The device defaults to "null", which lets you try this out without any audio hardware.
+ * The null PCM is always ready so it has no notion of time; in that case we drive each
+ * stream from its own timerfd instead of the PCM descriptors to simulate a device that
+ * wakes us up once per period.
+ *
+ * With a trace file, the scheduler and the callbacks record what they do with trace.c, and
+ * the trace is written out a second after the first missed period or xrun, or at the end if
+ * there wasn't one.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <math.h>
+
+#include "types.h"
+#include "trace.c" // NOTE(robin): Before scheduler.c so that its markers are recorded
+#include "scheduler.c"
+#include "denormal.c"
+#include "rtlog.c"
+
+#define MAX_PERIOD 1024 // NOTE(robin): Frames, what fits in the callbacks' buffers
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  u32 SampleRate;
+  u32 BufferSize; // NOTE(robin): The period the device gave us, we read and write one at a time
+  int TimerFD; // NOTE(robin): Only used for the null device
+} alsa_stream;
+
+float MicData[2048];
+
+// NOTE(robin): Look at one output buffer in 16 for subnormals, see denormal.c
+denormal_counter OutputDenormals;
+
+void AudioOutputCallback(void* UserData, s64 Lateness)
+{
+  alsa_stream* Stream = UserData;
+
+  if (Stream->TimerFD >= 0)
+  {
+    u64 Expirations;
+    read(Stream->TimerFD, &Expirations, sizeof(Expirations));
+  }
+
+  static float Phase[2] = {0, 0};
+  float PhaseDelta[] =
+  {
+    220.0f/(float)Stream->SampleRate,
+    330.0f/(float)Stream->SampleRate,
+  };
+
+  TraceBegin("render");
+  float AudioBuffer[2048];
+  for (u32 i = 0; i < 2 * Stream->BufferSize; i++)
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      Phase[i] += PhaseDelta[i];
+      if (Phase[i] >= 1.0f)
+        Phase[i] -= 1.0f;
+    }
+
+    float Volume = 0.2;
+    AudioBuffer[i] = Volume * sin(Phase[0] * 2 * M_PI);
+    AudioBuffer[++i] = Volume * sin(Phase[1] * 2 * M_PI);
+  }
+
+  DenormalSample(&OutputDenormals, AudioBuffer, 2 * Stream->BufferSize);
+  TraceEnd("render");
+
+  TraceBegin("write");
+  snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Stream->Handle, AudioBuffer, Stream->BufferSize);
+  TraceEnd("write");
+  if (FramesWritten < 0)
+  {
+    TraceTrigger("output xrun");
+    // NOTE(robin): snd_strerror returns static strings, so it's fine to pass to RTLog
+    RTLog("Output: %s, woke up %.3f ms late\n", snd_strerror((int)FramesWritten), (f64)Lateness / 1e6);
+    snd_pcm_recover(Stream->Handle, FramesWritten, 1);
+  }
+}
+
+void AudioInputCallback(void* UserData, s64 Lateness)
+{
+  alsa_stream* Stream = UserData;
+
+  if (Stream->TimerFD >= 0)
+  {
+    u64 Expirations;
+    read(Stream->TimerFD, &Expirations, sizeof(Expirations));
+  }
+
+  TraceBegin("read");
+  float AudioBuffer[2048];
+  snd_pcm_sframes_t FramesRead = snd_pcm_readi(Stream->Handle, AudioBuffer, Stream->BufferSize);
+  TraceEnd("read");
+  if (FramesRead < 0)
+  {
+    TraceTrigger("input xrun");
+    RTLog("Input: %s, woke up %.3f ms late\n", snd_strerror((int)FramesRead), (f64)Lateness / 1e6);
+    snd_pcm_recover(Stream->Handle, FramesRead, 1);
+    return;
+  }
+
+  // NOTE(robin): Keep the first channel around like the other examples do
+  for (snd_pcm_sframes_t i = 0; i < FramesRead; i++)
+    MicData[i] = AudioBuffer[2 * i];
+}
+
+void ALSAOpenStream(alsa_stream* Stream, const char* Device, snd_pcm_stream_t Direction,
+    u32 SampleRate, u32 BufferSize)
+{
+  int Error = snd_pcm_open(&Stream->Handle, Device, Direction, 0);
+
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Stream->Handle, HardwareParams);
+
+  snd_pcm_hw_params_set_access(Stream->Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Stream->Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Stream->Handle, HardwareParams, &SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Stream->Handle, HardwareParams, 2);
+
+  snd_pcm_uframes_t PeriodSize = BufferSize;
+  snd_pcm_hw_params_set_period_size_near(Stream->Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params(Stream->Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, &SampleRate, 0);
+
+  // NOTE(robin): The device picks the nearest period it can do, which is what it wakes us up
+  // for, so that's what we wait for and what the scheduler's deadlines are based on
+  snd_pcm_hw_params_get_period_size(HardwareParams, &PeriodSize, 0);
+  PeriodSize = PeriodSize < MAX_PERIOD ? PeriodSize : MAX_PERIOD;
+  snd_pcm_hw_params_free(HardwareParams);
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Stream->Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Stream->Handle, SoftwareParams, PeriodSize);
+  snd_pcm_sw_params_set_start_threshold(Stream->Handle, SoftwareParams, 0);
+  snd_pcm_sw_params(Stream->Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+
+  snd_pcm_prepare(Stream->Handle);
+
+  Stream->SampleRate = SampleRate;
+  Stream->BufferSize = (u32)PeriodSize;
+  Stream->TimerFD = -1;
+}
+
+void* AudioThread(void* Context)
+{
+  scheduler* Scheduler = Context;
+  TraceThreadName("audio");
+
+  // NOTE(robin): Flush subnormals to zero on this thread, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the
+  // appropriate rtprio limits set up, in which case we just run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  SchedulerRun(Scheduler);
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* Device = argc > 1 ? argv[1] : "null";
+  int Seconds = argc > 2 ? atoi(argv[2]) : 3;
+  const char* TracePath = argc > 3 ? argv[3] : 0;
+  TraceInit();
+
+  u32 SampleRate = 44100;
+  u32 BufferSize = 512;
+
+  alsa_stream Output = {0};
+  alsa_stream Input = {0};
+  ALSAOpenStream(&Output, Device, SND_PCM_STREAM_PLAYBACK, SampleRate, BufferSize);
+  ALSAOpenStream(&Input, Device, SND_PCM_STREAM_CAPTURE, SampleRate, BufferSize);
+
+  u64 OutputPeriod = (u64)Output.BufferSize * 1000000000ull / Output.SampleRate;
+  u64 InputPeriod = (u64)Input.BufferSize * 1000000000ull / Input.SampleRate;
+
+  printf("Device: %s\n", Device);
+  printf("Sample rate: %u\n", Output.SampleRate);
+  printf("Buffer size: %u output, %u input (asked for %u)\n", Output.BufferSize, Input.BufferSize, BufferSize);
+
+  scheduler Scheduler;
+  SchedulerInit(&Scheduler);
+  DenormalCounterInit(&OutputDenormals, 16);
+
+  if (!strcmp(Device, "null"))
+  {
+    // NOTE(robin): Give the two streams different phases so that they don't always wake up
+    // together, which is what you'd usually see with real hardware.
+    alsa_stream* Streams[] = {&Output, &Input};
+    u64 Periods[] = {OutputPeriod, InputPeriod};
+    for (int i = 0; i < 2; i++)
+    {
+      u64 Period = Periods[i];
+      u64 Offset = Period + i * Period / 3;
+      struct itimerspec Timer = {0};
+      Timer.it_interval.tv_sec = Period / 1000000000ull;
+      Timer.it_interval.tv_nsec = Period % 1000000000ull;
+      Timer.it_value.tv_sec = Offset / 1000000000ull;
+      Timer.it_value.tv_nsec = Offset % 1000000000ull;
+
+      Streams[i]->TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      timerfd_settime(Streams[i]->TimerFD, 0, &Timer, 0);
+    }
+
+    struct pollfd OutputFD = {Output.TimerFD, POLLIN, 0};
+    struct pollfd InputFD = {Input.TimerFD, POLLIN, 0};
+    SchedulerAddFDStream(&Scheduler, "output", &OutputFD, 1, 0, 0, OutputPeriod, AudioOutputCallback, &Output);
+    SchedulerAddFDStream(&Scheduler, "input", &InputFD, 1, 0, 0, InputPeriod, AudioInputCallback, &Input);
+  }
+  else
+  {
+    SchedulerAddALSAStream(&Scheduler, "output", Output.Handle, OutputPeriod, AudioOutputCallback, &Output);
+    SchedulerAddALSAStream(&Scheduler, "input", Input.Handle, InputPeriod, AudioInputCallback, &Input);
+    snd_pcm_start(Input.Handle);
+  }
+
+  // NOTE(robin): Xruns are logged from the audio thread through rtlog.c
+  RTLogStart(stdout);
+
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, &Scheduler);
+
+  int TraceWritten = 0;
+  for (int i = 0; i < Seconds; i++)
+  {
+    sleep(1);
+
+    // NOTE(robin): A second after the first trigger, so the trace shows the recovery too
+    if (TracePath && !TraceWritten && TraceTriggered())
+    {
+      printf("Wrote %d trace events to %s\n", TraceWrite(TracePath), TracePath);
+      TraceWritten = 1;
+    }
+  }
+
+  SchedulerStop(&Scheduler);
+  pthread_join(Thread, 0);
+  RTLogStop();
+
+  if (TracePath && !TraceWritten)
+    printf("Wrote %d trace events to %s\n", TraceWrite(TracePath), TracePath);
+
+  SchedulerPrintStats(&Scheduler);
+  DenormalPrintStats(&OutputDenormals, "output");
+  SchedulerDestroy(&Scheduler);
+
+  snd_pcm_close(Output.Handle);
+  snd_pcm_close(Input.Handle);
+  return 0;
+}
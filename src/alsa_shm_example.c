@@ -0,0 +1,307 @@
+/*
+ * This file is an example of using shm_transport.c to run the DSP in separate worker
+ * processes, while this process owns the ALSA device. Each worker distorts the sine the
+ * device process generates (with its own drive) and we play the mix.
+ *
+ * Usage: alsa_shm_example [device] [seconds] [workers] [crash]
+ *
+ * The device defaults to "null", which lets you try this out without any audio hardware
+ * (we pace ourselves with clock_nanosleep, since the null PCM is always ready). With "crash"
+ * the first worker segfaults after two seconds: the output carries on without it (its share
+ * is silence, missed cycles cost no more than the deadline), and we start a replacement.
+ *
+ * NOTE(robin): The workers are this same executable started with --worker, they find the
+ * shared memory through the file descriptor number on the command line. Any other program
+ * that inherits the descriptor (or receives it over a unix socket) can attach the same way.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <math.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "shm_transport.c"
+
+#define EXAMPLE_CHANNELS 2
+#define EXAMPLE_SET_DRIVE 1 // NOTE(robin): Message type, followed by an f32
+
+typedef struct
+{
+  snd_pcm_t* Handle;
+  u32 SampleRate;
+  u32 BufferSize;
+  u32 Null;
+  u32 Running;
+  shm_host Host;
+  pid_t Workers[SHM_MAX_WORKERS];
+} example_data;
+
+void WorkerMain(int FD, u32 Index, u32 Crash)
+{
+  shm_worker Worker;
+  if (!ShmWorkerAttach(&Worker, FD, Index))
+  {
+    printf("Worker %u could not attach to the shared memory\n", Index);
+    exit(1);
+  }
+
+  // NOTE(robin): The DSP runs here, so this is an audio thread as much as AudioThread is,
+  // see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): Just below the device process, see AudioThread
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2 - 1;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+
+  f32 Drive = 1.0f + 2.0f * (f32)Index;
+  u32 CrashAt = Crash ? 2 * Worker.Region->SampleRate : 0;
+  u32 Frames = 0;
+
+  shm_cycle Cycle;
+  while (ShmWorkerWait(&Worker, &Cycle))
+  {
+    shm_message Message;
+    while (ShmRingRead(&Worker.Slot->ToWorker, &Message))
+    {
+      if (Message.Type == EXAMPLE_SET_DRIVE && Message.Size == sizeof(f32))
+        memcpy(&Drive, Message.Data, sizeof(f32));
+    }
+
+    for (u32 Channel = 0; Channel < Cycle.ChannelCount; Channel++)
+      for (u32 i = 0; i < Cycle.FrameCount; i++)
+        Cycle.Outputs[Channel][i] = tanhf(Drive * Cycle.Inputs[Channel][i]) / Drive;
+
+    Frames += Cycle.FrameCount;
+    if (CrashAt && Frames >= CrashAt)
+      *(volatile u32*)0 = 0;
+
+    ShmWorkerDone(&Worker);
+  }
+
+  FPLeaveAudioThread(FPState);
+  ShmWorkerDetach(&Worker);
+  exit(0);
+}
+
+void StartWorker(example_data* Data, u32 Index, u32 Crash)
+{
+  char FD[16], IndexString[16];
+  snprintf(FD, sizeof(FD), "%d", Data->Host.FD);
+  snprintf(IndexString, sizeof(IndexString), "%u", Index);
+
+  fflush(stdout);
+  pid_t PID = fork();
+  if (PID == 0)
+  {
+    execl("/proc/self/exe", "alsa_shm_example", "--worker", FD, IndexString, Crash ? "crash" : "", (char*)0);
+    _exit(1);
+  }
+  Data->Workers[Index] = PID;
+}
+
+void* AudioThread(void* Context)
+{
+  example_data* Data = Context;
+
+  // NOTE(robin): Flush subnormals to zero on this thread, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): Ask for real-time priority. This will fail unless you have the
+  // appropriate rtprio limits set up, in which case we just run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  u32 WorkerCount = Data->Host.WorkerCount;
+  u32 FrameCount = Data->BufferSize;
+  u64 Period = (u64)FrameCount * 1000000000ull / Data->SampleRate;
+  u64 Next = ShmNow();
+
+  f32 Phase[EXAMPLE_CHANNELS] = {0, 0};
+  f32 PhaseDelta[EXAMPLE_CHANNELS] =
+  {
+    220.0f / (f32)Data->SampleRate,
+    330.0f / (f32)Data->SampleRate,
+  };
+
+  static f32 Inputs[EXAMPLE_CHANNELS][SHM_MAX_FRAMES];
+  static f32 Outputs[EXAMPLE_CHANNELS][SHM_MAX_FRAMES];
+  static f32 Mix[EXAMPLE_CHANNELS][SHM_MAX_FRAMES];
+  static f32 AudioBuffer[EXAMPLE_CHANNELS * SHM_MAX_FRAMES];
+
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    if (Data->Null)
+    {
+      Next += Period;
+      struct timespec Until = {Next / 1000000000ull, Next % 1000000000ull};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+    }
+    else
+    {
+      snd_pcm_wait(Data->Handle, 1000);
+    }
+
+    // NOTE(robin): Leave the workers half of the period, the other half is ours and the
+    // slack for our own wakeup being late
+    u64 Deadline = ShmNow() + Period / 2;
+
+    const f32* InputPointers[EXAMPLE_CHANNELS];
+    f32* OutputPointers[EXAMPLE_CHANNELS];
+    for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+    {
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Phase[Channel] += PhaseDelta[Channel];
+        Phase[Channel] -= Phase[Channel] >= 1.0f ? 1.0f : 0.0f;
+        Inputs[Channel][i] = 0.5f * sinf(2.0f * (f32)M_PI * Phase[Channel]);
+        Mix[Channel][i] = 0;
+      }
+      InputPointers[Channel] = Inputs[Channel];
+      OutputPointers[Channel] = Outputs[Channel];
+    }
+
+    for (u32 i = 0; i < WorkerCount; i++)
+      ShmSubmit(&Data->Host, i, InputPointers, FrameCount, Deadline);
+
+    for (u32 i = 0; i < WorkerCount; i++)
+    {
+      ShmCollect(&Data->Host, i, OutputPointers, FrameCount);
+      for (u32 Channel = 0; Channel < EXAMPLE_CHANNELS; Channel++)
+        for (u32 n = 0; n < FrameCount; n++)
+          Mix[Channel][n] += 0.4f * Outputs[Channel][n] / (f32)WorkerCount;
+    }
+
+    for (u32 i = 0; i < FrameCount; i++)
+    {
+      AudioBuffer[2 * i + 0] = Mix[0][i];
+      AudioBuffer[2 * i + 1] = Mix[1][i];
+    }
+
+    snd_pcm_sframes_t FramesWritten = snd_pcm_writei(Data->Handle, AudioBuffer, FrameCount);
+    if (FramesWritten < 0)
+      snd_pcm_recover(Data->Handle, FramesWritten, 1);
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc > 3 && !strcmp(argv[1], "--worker"))
+  {
+    WorkerMain(atoi(argv[2]), atoi(argv[3]), argc > 4 && !strcmp(argv[4], "crash"));
+    return 0;
+  }
+
+  const char* Device = argc > 1 ? argv[1] : "null";
+  int Seconds = argc > 2 ? atoi(argv[2]) : 5;
+  u32 WorkerCount = argc > 3 ? atoi(argv[3]) : 2;
+  u32 Crash = argc > 4 && !strcmp(argv[4], "crash");
+  if (WorkerCount < 1 || WorkerCount > SHM_MAX_WORKERS)
+  {
+    printf("Between 1 and %d workers\n", SHM_MAX_WORKERS);
+    return 1;
+  }
+
+  static example_data Data;
+  Data.SampleRate = 48000;
+  Data.BufferSize = 256;
+  Data.Null = !strcmp(Device, "null");
+
+  int Error = snd_pcm_open(&Data.Handle, Device, SND_PCM_STREAM_PLAYBACK, 0);
+  if (Error)
+  {
+    printf("%s\n", snd_strerror(Error));
+    assert(!"Failed to open your device, perhaps it is already busy?");
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Data.Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Data.Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Data.Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Data.Handle, HardwareParams, &Data.SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Data.Handle, HardwareParams, EXAMPLE_CHANNELS);
+
+  snd_pcm_uframes_t PeriodSize = Data.BufferSize;
+  snd_pcm_hw_params_set_period_size_near(Data.Handle, HardwareParams, &PeriodSize, 0);
+  snd_pcm_hw_params(Data.Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, &Data.SampleRate, 0);
+  snd_pcm_hw_params_free(HardwareParams);
+  Data.BufferSize = PeriodSize < SHM_MAX_FRAMES ? PeriodSize : SHM_MAX_FRAMES;
+
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Data.Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Data.Handle, SoftwareParams, Data.BufferSize);
+  snd_pcm_sw_params(Data.Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+  snd_pcm_prepare(Data.Handle);
+
+  if (!ShmHostCreate(&Data.Host, EXAMPLE_CHANNELS, WorkerCount, Data.SampleRate))
+  {
+    printf("Could not create the shared memory\n");
+    return 1;
+  }
+
+  for (u32 i = 0; i < WorkerCount; i++)
+    StartWorker(&Data, i, Crash && i == 0);
+
+  printf("Device: %s\n", Device);
+  printf("Sample rate: %u\n", Data.SampleRate);
+  printf("Buffer size: %u\n", Data.BufferSize);
+  printf("Workers: %u\n", WorkerCount);
+
+  Data.Running = 1;
+  pthread_t Thread;
+  pthread_create(&Thread, 0, AudioThread, &Data);
+
+  // NOTE(robin): Restart workers that die and change the drive of every worker once a second
+  for (int Tick = 0; Tick < 10 * Seconds; Tick++)
+  {
+    usleep(100000);
+
+    int Status;
+    pid_t PID;
+    while ((PID = waitpid(-1, &Status, WNOHANG)) > 0)
+    {
+      for (u32 i = 0; i < WorkerCount; i++)
+      {
+        if (Data.Workers[i] != PID)
+          continue;
+
+        if (WIFSIGNALED(Status))
+          printf("Worker %u died (signal %d), starting a new one\n", i, WTERMSIG(Status));
+        else
+          printf("Worker %u exited (%d), starting a new one\n", i, WEXITSTATUS(Status));
+        StartWorker(&Data, i, 0);
+      }
+    }
+
+    if (Tick % 10 == 9)
+    {
+      for (u32 i = 0; i < WorkerCount; i++)
+      {
+        f32 Drive = 1.0f + (f32)((Tick / 10 + i) % 4);
+        ShmRingWrite(&Data.Host.Region->Slots[i].ToWorker, EXAMPLE_SET_DRIVE, &Drive, sizeof(Drive));
+      }
+    }
+  }
+
+  __atomic_store_n(&Data.Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+
+  ShmHostPrintStats(&Data.Host);
+  ShmHostDestroy(&Data.Host);
+  for (u32 i = 0; i < WorkerCount; i++)
+    waitpid(Data.Workers[i], 0, 0);
+
+  snd_pcm_close(Data.Handle);
+  return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ * This file compares the usual period based ALSA playback loop with timer based scheduling
+ * (tsched, what PulseAudio and PipeWire do), for long running playback that should wake
+ * the CPU as rarely as possible.
+ *
+ * Usage: alsa_tsched [device] [seconds per mode] [period]
+ *
+ * The device defaults to "plughw:0,0", and it has to be a device with a clock: the null PCM
+ * is always ready, so it would just spin. Without hardware, the loopback driver works
+ * (modprobe snd-aloop, then alsa_tsched plughw:Loopback,0,0).
+ *
+ * We play a tone that another thread (standing in for a user interface) changes once a
+ * second, first in period mode and then in timer mode, and print for each: how often we
+ * woke up, how much CPU the audio thread used, the xruns, and how long it took for a
+ * change to be heard.
+ *
+ * Period mode is alsa_example.c: a buffer of two periods, snd_pcm_wait until a period is
+ * free (avail_min), write it, repeat. That's a wakeup per period, about 190 a second with
+ * 256 frames at 48kHz.
+ *
+ * Timer mode:
+ * - A buffer of TSCHED_BUFFER_MS, and no period interrupts if the driver can do without
+ *   them (snd_pcm_hw_params_set_period_wakeup, which needs a non-blocking PCM). avail_min
+ *   is the whole buffer, so the PCM's poll descriptors never wake us anyway.
+ * - Every wakeup tops the buffer up completely, however much that is, and then works out
+ *   when the buffer will have drained down to the watermark: snd_pcm_htimestamp gives the
+ *   fill level together with the (monotonic) time the hardware pointer was read, so the
+ *   time it took us to get here doesn't count. We sleep on a timerfd until then, plus on
+ *   an eventfd for changes.
+ * - The watermark is what covers our wakeup being late and the difference between the
+ *   sound card's clock and the system clock, which the sleep doesn't know about. It starts
+ *   at TSCHED_WATERMARK_MS and doubles after an underrun.
+ * - A change would take a whole buffer (seconds) to be heard, so when one comes in we take
+ *   back everything already written except the next TSCHED_SAFETY_MS (snd_pcm_rewindable,
+ *   snd_pcm_rewind) and write it again with the change applied. The tone generator rewinds
+ *   its phase by the same amount, so the audio carries on seamlessly.
+ *
+ * NOTE(robin): Rewinding works on most hw: devices and through plug, but not through every
+ * plugin (dmix can't, for one), in which case snd_pcm_rewindable says 0 and the change is
+ * heard a buffer later. The amount we keep has to cover the time between the rewind and
+ * our write getting into the buffer, and on some hardware the DMA reads ahead of where
+ * the hardware pointer says it is, which is why we don't go below a few ms.
+ */
+
+#define _GNU_SOURCE // NOTE(robin): For RUSAGE_THREAD
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <math.h>
+
+#include "types.h"
+#include "denormal.c"
+
+#define TSCHED_BUFFER_MS 2000
+#define TSCHED_WATERMARK_MS 20
+#define TSCHED_MAX_WATERMARK_MS 500
+#define TSCHED_SAFETY_MS 5
+#define TSCHED_CHUNK 4096 // NOTE(robin): Frames we render at a time
+
+typedef struct
+{
+  f64 Phase; // NOTE(robin): Of the next frame we write
+  f64 Frequency;
+  f64 SampleRate;
+} tone;
+
+typedef struct
+{
+  const char* Device;
+  u32 SampleRate;
+  u32 PeriodSize;
+  u32 Seconds;
+
+  // NOTE(robin): From the control thread
+  u32 Running;
+  u32 Changes;
+  u32 Frequency; // NOTE(robin): Hz
+  int EventFD;
+} tsched_data;
+
+typedef struct
+{
+  u32 BufferSize;
+  u32 PeriodWakeups; // NOTE(robin): Whether the driver still interrupts every period
+  u32 Wakeups;
+  u32 XRuns;
+  u32 Changes;
+  f64 ChangeLatency; // NOTE(robin): Sum, in frames
+  f64 MaxChangeLatency;
+  f64 CPUSeconds;
+} mode_result;
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+static f64 ThreadCPUSeconds(void)
+{
+  struct rusage Usage;
+  getrusage(RUSAGE_THREAD, &Usage);
+  return (f64)(Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec) + 1e-6 * (f64)(Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec);
+}
+
+// NOTE(robin): Interleaved stereo
+void ToneRender(tone* Tone, f32* Frames, u32 FrameCount)
+{
+  f64 Delta = Tone->Frequency / Tone->SampleRate;
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f32 Sample = (f32)(0.2 * sin(2.0 * M_PI * Tone->Phase));
+    Frames[2 * i + 0] = Sample;
+    Frames[2 * i + 1] = Sample;
+    Tone->Phase += Delta;
+    Tone->Phase -= Tone->Phase >= 1.0 ? 1.0 : 0.0;
+  }
+}
+
+// NOTE(robin): Back to where we were FrameCount frames ago, at the same frequency
+void ToneRewind(tone* Tone, u32 FrameCount)
+{
+  Tone->Phase -= (f64)FrameCount * Tone->Frequency / Tone->SampleRate;
+  Tone->Phase -= floor(Tone->Phase);
+}
+
+// NOTE(robin): Writes as much as there is room for. Returns the frames written, or a
+// negative error.
+snd_pcm_sframes_t Fill(snd_pcm_t* Handle, tone* Tone)
+{
+  static f32 Frames[2 * TSCHED_CHUNK];
+  snd_pcm_sframes_t Avail = snd_pcm_avail(Handle);
+  if (Avail < 0)
+    return Avail;
+
+  snd_pcm_sframes_t Total = 0;
+  while (Total < Avail)
+  {
+    u32 Count = Avail - Total < TSCHED_CHUNK ? (u32)(Avail - Total) : TSCHED_CHUNK;
+    ToneRender(Tone, Frames, Count);
+    snd_pcm_sframes_t Written = snd_pcm_writei(Handle, Frames, Count);
+    Written = Written == -EAGAIN ? 0 : Written;
+    if (Written < 0)
+      return Written;
+
+    // NOTE(robin): Only on a non-blocking PCM, give back what didn't fit
+    if ((u32)Written < Count)
+      ToneRewind(Tone, Count - (u32)Written);
+    Total += Written;
+    if ((u32)Written < Count)
+      break;
+  }
+  return Total;
+}
+
+snd_pcm_t* Open(tsched_data* Data, u32 Timer, mode_result* Result)
+{
+  snd_pcm_t* Handle;
+  int Error = snd_pcm_open(&Handle, Data->Device, SND_PCM_STREAM_PLAYBACK, Timer ? SND_PCM_NONBLOCK : 0);
+  if (Error)
+  {
+    printf("%s: %s\n", Data->Device, snd_strerror(Error));
+    return 0;
+  }
+
+  snd_pcm_hw_params_t* HardwareParams;
+  snd_pcm_hw_params_malloc(&HardwareParams);
+  snd_pcm_hw_params_any(Handle, HardwareParams);
+  snd_pcm_hw_params_set_access(Handle, HardwareParams, SND_PCM_ACCESS_RW_INTERLEAVED);
+  snd_pcm_hw_params_set_format(Handle, HardwareParams, SND_PCM_FORMAT_FLOAT_LE);
+  snd_pcm_hw_params_set_rate_near(Handle, HardwareParams, &Data->SampleRate, 0);
+  snd_pcm_hw_params_set_channels(Handle, HardwareParams, 2);
+
+  snd_pcm_uframes_t Period = Data->PeriodSize;
+  snd_pcm_uframes_t Buffer = 2 * Period;
+  Result->PeriodWakeups = 1;
+  if (Timer)
+  {
+    // NOTE(robin): The periods don't matter to us any more, but where the driver has to
+    // keep interrupting, fewer of them is better
+    Buffer = (snd_pcm_uframes_t)Data->SampleRate * TSCHED_BUFFER_MS / 1000;
+    Period = Buffer / 4;
+    if (snd_pcm_hw_params_can_disable_period_wakeup(HardwareParams))
+      Result->PeriodWakeups = snd_pcm_hw_params_set_period_wakeup(Handle, HardwareParams, 0) != 0;
+  }
+  snd_pcm_hw_params_set_buffer_size_near(Handle, HardwareParams, &Buffer);
+  snd_pcm_hw_params_set_period_size_near(Handle, HardwareParams, &Period, 0);
+  Error = snd_pcm_hw_params(Handle, HardwareParams);
+  snd_pcm_hw_params_get_rate(HardwareParams, &Data->SampleRate, 0);
+  snd_pcm_hw_params_get_period_size(HardwareParams, &Period, 0);
+  snd_pcm_hw_params_get_buffer_size(HardwareParams, &Buffer);
+  snd_pcm_hw_params_free(HardwareParams);
+  if (Error)
+  {
+    printf("%s: %s\n", Data->Device, snd_strerror(Error));
+    snd_pcm_close(Handle);
+    return 0;
+  }
+
+  // NOTE(robin): In timer mode we never want the PCM to wake us, and we want timestamps on
+  // the monotonic clock to compare with our timer. Both modes start once the buffer is full.
+  snd_pcm_sw_params_t* SoftwareParams;
+  snd_pcm_sw_params_malloc(&SoftwareParams);
+  snd_pcm_sw_params_current(Handle, SoftwareParams);
+  snd_pcm_sw_params_set_avail_min(Handle, SoftwareParams, Timer ? Buffer : Period);
+  snd_pcm_sw_params_set_start_threshold(Handle, SoftwareParams, Buffer);
+  snd_pcm_sw_params_set_tstamp_mode(Handle, SoftwareParams, SND_PCM_TSTAMP_ENABLE);
+  snd_pcm_sw_params_set_tstamp_type(Handle, SoftwareParams, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+  snd_pcm_sw_params(Handle, SoftwareParams);
+  snd_pcm_sw_params_free(SoftwareParams);
+
+  snd_pcm_prepare(Handle);
+  Result->BufferSize = (u32)Buffer;
+  return Handle;
+}
+
+// NOTE(robin): Returns whether the control thread has changed the frequency since we last
+// looked
+u32 TakeChange(tsched_data* Data, u32* Seen, f64* Frequency)
+{
+  u32 Changes = __atomic_load_n(&Data->Changes, __ATOMIC_ACQUIRE);
+  if (Changes == *Seen)
+    return 0;
+  *Seen = Changes;
+  *Frequency = (f64)__atomic_load_n(&Data->Frequency, __ATOMIC_RELAXED);
+  return 1;
+}
+
+void RecordChange(snd_pcm_t* Handle, mode_result* Result)
+{
+  // NOTE(robin): The change starts with the next frame we write, which is heard after
+  // everything that is still in the buffer
+  snd_pcm_sframes_t Delay = 0;
+  snd_pcm_delay(Handle, &Delay);
+  Result->Changes++;
+  Result->ChangeLatency += (f64)Delay;
+  Result->MaxChangeLatency = (f64)Delay > Result->MaxChangeLatency ? (f64)Delay : Result->MaxChangeLatency;
+}
+
+void RunPeriodMode(tsched_data* Data, mode_result* Result)
+{
+  snd_pcm_t* Handle = Open(Data, 0, Result);
+  if (!Handle)
+    return;
+
+  tone Tone = {0, (f64)__atomic_load_n(&Data->Frequency, __ATOMIC_RELAXED), Data->SampleRate};
+  u32 Seen = __atomic_load_n(&Data->Changes, __ATOMIC_ACQUIRE);
+  f64 CPU = ThreadCPUSeconds();
+  u64 End = Now() + (u64)Data->Seconds * 1000000000ull;
+
+  Fill(Handle, &Tone);
+  while (Now() < End)
+  {
+    snd_pcm_wait(Handle, 1000);
+    Result->Wakeups++;
+
+    if (TakeChange(Data, &Seen, &Tone.Frequency))
+      RecordChange(Handle, Result);
+
+    snd_pcm_sframes_t Written = Fill(Handle, &Tone);
+    if (Written < 0)
+    {
+      Result->XRuns++;
+      snd_pcm_recover(Handle, (int)Written, 1);
+      Fill(Handle, &Tone);
+    }
+  }
+
+  Result->CPUSeconds = ThreadCPUSeconds() - CPU;
+  snd_pcm_close(Handle);
+}
+
+void RunTimerMode(tsched_data* Data, mode_result* Result)
+{
+  snd_pcm_t* Handle = Open(Data, 1, Result);
+  if (!Handle)
+    return;
+
+  int TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  struct pollfd Descriptors[2] =
+  {
+    {TimerFD, POLLIN, 0},
+    {Data->EventFD, POLLIN, 0},
+  };
+
+  f64 Rate = (f64)Data->SampleRate;
+  u32 Watermark = Data->SampleRate * TSCHED_WATERMARK_MS / 1000;
+  u32 MaxWatermark = Data->SampleRate * TSCHED_MAX_WATERMARK_MS / 1000;
+  u32 Safety = Data->SampleRate * TSCHED_SAFETY_MS / 1000;
+  Watermark = Watermark < Result->BufferSize / 2 ? Watermark : Result->BufferSize / 2;
+  MaxWatermark = MaxWatermark < Result->BufferSize / 2 ? MaxWatermark : Result->BufferSize / 2;
+
+  tone Tone = {0, (f64)__atomic_load_n(&Data->Frequency, __ATOMIC_RELAXED), Rate};
+  u32 Seen = __atomic_load_n(&Data->Changes, __ATOMIC_ACQUIRE);
+  f64 CPU = ThreadCPUSeconds();
+  u64 End = Now() + (u64)Data->Seconds * 1000000000ull;
+
+  for (;;)
+  {
+    f64 Frequency;
+    if (TakeChange(Data, &Seen, &Frequency))
+    {
+      // NOTE(robin): Take back what we've written beyond the safety margin (at the old
+      // frequency), and write it again with the change
+      snd_pcm_sframes_t Rewindable = snd_pcm_rewindable(Handle);
+      if (Rewindable > (snd_pcm_sframes_t)Safety)
+      {
+        snd_pcm_sframes_t Rewound = snd_pcm_rewind(Handle, (snd_pcm_uframes_t)(Rewindable - Safety));
+        if (Rewound > 0)
+          ToneRewind(&Tone, (u32)Rewound);
+      }
+      Tone.Frequency = Frequency;
+      RecordChange(Handle, Result);
+    }
+
+    snd_pcm_sframes_t Written = Fill(Handle, &Tone);
+    if (Written < 0)
+    {
+      Result->XRuns++;
+      Watermark = 2 * Watermark < MaxWatermark ? 2 * Watermark : MaxWatermark;
+      snd_pcm_recover(Handle, (int)Written, 1);
+      continue;
+    }
+
+    if (Now() >= End)
+      break;
+
+    // NOTE(robin): When will the buffer be down to the watermark? The fill level and the
+    // time the hardware pointer was read go together, so we don't count our own delays.
+    snd_pcm_uframes_t Avail = 0;
+    snd_htimestamp_t Stamp = {0, 0};
+    snd_pcm_avail(Handle);
+    snd_pcm_htimestamp(Handle, &Avail, &Stamp);
+    u64 Then = (u64)Stamp.tv_sec * 1000000000ull + (u64)Stamp.tv_nsec;
+    Then = Then ? Then : Now();
+
+    u32 Queued = Avail < Result->BufferSize ? Result->BufferSize - (u32)Avail : 0;
+    u64 Sleep = Queued > Watermark ? (u64)(1e9 * (f64)(Queued - Watermark) / Rate) : 0;
+    u64 Wake = Then + Sleep;
+    Wake = Wake < End ? Wake : End;
+
+    struct itimerspec Timer = {{0, 0}, {Wake / 1000000000ull, Wake % 1000000000ull}};
+    timerfd_settime(TimerFD, TFD_TIMER_ABSTIME, &Timer, 0);
+
+    poll(Descriptors, 2, -1);
+    Result->Wakeups++;
+
+    u64 Value;
+    if (Descriptors[0].revents)
+      read(TimerFD, &Value, sizeof(Value));
+    if (Descriptors[1].revents)
+      read(Data->EventFD, &Value, sizeof(Value));
+  }
+
+  Result->CPUSeconds = ThreadCPUSeconds() - CPU;
+  close(TimerFD);
+  snd_pcm_close(Handle);
+}
+
+// NOTE(robin): Our stand-in for a user turning a knob once a second
+void* ControlThread(void* Context)
+{
+  tsched_data* Data = Context;
+  for (u32 Change = 1; __atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE); Change++)
+  {
+    usleep(1000000);
+    __atomic_store_n(&Data->Frequency, Change % 2 ? 330 : 220, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&Data->Changes, 1, __ATOMIC_RELEASE);
+
+    u64 One = 1;
+    write(Data->EventFD, &One, sizeof(One));
+  }
+  return 0;
+}
+
+void PrintResult(const char* Name, tsched_data* Data, mode_result* Result)
+{
+  f64 Milliseconds = 1000.0 / Data->SampleRate;
+  printf("%s: buffer %.0fms%s\n", Name, Result->BufferSize * Milliseconds,
+      Result->PeriodWakeups ? "" : ", no period interrupts");
+  printf("  wakeups %.1f/s, CPU %.3f%%, xruns %u\n", (f64)Result->Wakeups / Data->Seconds,
+      100.0 * Result->CPUSeconds / Data->Seconds, Result->XRuns);
+  if (Result->Changes)
+  {
+    printf("  changes heard after %.1fms on average, %.1fms at most\n",
+        Result->ChangeLatency / Result->Changes * Milliseconds, Result->MaxChangeLatency * Milliseconds);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  static tsched_data Data;
+  Data.Device = argc > 1 ? argv[1] : "plughw:0,0";
+  Data.Seconds = argc > 2 ? atoi(argv[2]) : 10;
+  Data.PeriodSize = argc > 3 ? atoi(argv[3]) : 256;
+  Data.SampleRate = 48000;
+  Data.Frequency = 220;
+  Data.Running = 1;
+  Data.EventFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  pthread_t Thread;
+  pthread_create(&Thread, 0, ControlThread, &Data);
+
+  // NOTE(robin): Flush subnormals to zero while the audio loops run on this thread, see
+  // denormal.c
+  fp_state FPState = FPEnterAudioThread();
+  mode_result Period = {0}, Timer = {0};
+  RunPeriodMode(&Data, &Period);
+  RunTimerMode(&Data, &Timer);
+  FPLeaveAudioThread(FPState);
+
+  __atomic_store_n(&Data.Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+  close(Data.EventFD);
+
+  printf("Device: %s, sample rate %u, period %u\n", Data.Device, Data.SampleRate, Data.PeriodSize);
+  PrintResult("Period mode", &Data, &Period);
+  PrintResult("Timer mode", &Data, &Timer);
+  return 0;
+}
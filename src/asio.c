@@ -7,6 +7,9 @@
  * has the necessary WINAPI functions declared, by including Windows.h for example.
  * Alternatively you can just copy and paste the contents of this file into your own codebase.
  *
+ * The driver loading code is Windows only, but the sample format code at the bottom of the
+ * file is platform neutral so it will also compile (and can be benchmarked) elsewhere.
+ *
  * We use the following WINAPI functions:
  *
  *              winreg.h:
@@ -66,6 +69,10 @@
 #pragma comment(lib, "advapi32")
 #pragma comment(lib, "ole32")
 
+#ifndef _WIN32
+#define __stdcall
+#endif
+
 // NOTE(robin): ASIO SDK has 4 byte align
 #pragma pack(push, 4)
 
@@ -242,6 +249,8 @@ struct asio_driver
   } *VMT;
 };
 
+#ifdef _WIN32
+
 // NOTE(robin): Here we provide some convenience functions for interacting with the registry
 
 void ASIOGetDriverCount(u32* DriverCount)
@@ -352,6 +361,8 @@ void ASIOLoadDriver(asio_driver** Driver, wchar* ClassIDString, wchar* DllPath)
   Factory->VMT->CreateInstance(Factory, 0, ClassID, (void**)Driver);
 }
 
+#endif
+
 // NOTE(robin): Now we provide a conversion function from asio_sample_type to
 // asio_sample_format which makes it easier to access the data describing the format
 // in a programmatic way.
@@ -484,15 +495,18 @@ asio_sample_format ASIOGetSampleFormat(asio_sample_type SampleType)
 
 // NOTE(robin): You may not wish to use this, it would be much better to
 // convert a block of samples in your format to a block of samples in the
-// hardware's format and then memcpy into the hardware buffer.  This function
-// is provided mostly for reference.
+// hardware's format and then memcpy into the hardware buffer (see
+// ASIOWriteBlockToHardwareBuffer and quantize.c). This function is provided
+// mostly for reference.
 //
 // ASIO drivers can expect data in a variety of formats, this function converts
 // from 64-bit float format to the hardware's native format and then writes the
 // converted sample to the hardware buffer.
 asio_error ASIOWriteSampleToHardwareBuffer(void* HardwareBuffer, s32 FrameIndex, f64 Sample, asio_sample_format Format)
 {
-  // NOTE(robin): DSD formats and packed sample formats are not supported yet
+  // NOTE(robin): Packed sample formats are not supported here. DSD can't be written a sample
+  // at a time since each bit depends on the modulator's state, use DSDModulate from dsd.c on
+  // whole buffers with DSDGetPacking(Format.BitAlign, Format.IsBigEndian) instead.
   if (Format.DSD || Format.BitAlign || Format.BytesPerSample > 8)
     return ASIOErrorInvalidParameter;
 
@@ -522,8 +536,16 @@ asio_error ASIOWriteSampleToHardwareBuffer(void* HardwareBuffer, s32 FrameIndex,
   }
   else // NOTE(robin): Integer sample format
   {
-    s32 SampleMaxValue = (1 << (Format.BytesPerSample * 8 - 1)) - 1;
-    s32 IntegerSampleValue = (s32)(SampleMaxValue * Sample);
+    // NOTE(robin): Clip first, otherwise out of range samples overflow and wrap around to
+    // the other end of the range which is a lot louder than clipping.
+    if (Sample > 1.0)
+      Sample = 1.0;
+    if (Sample < -1.0)
+      Sample = -1.0;
+
+    s32 SampleMaxValue = (s32)((1u << (Format.BytesPerSample * 8 - 1)) - 1);
+    f64 ScaledSample = SampleMaxValue * Sample;
+    s32 IntegerSampleValue = (s32)(ScaledSample + (ScaledSample < 0 ? -0.5 : 0.5)); // NOTE(robin): Round to nearest
 
     u8* IntegerSampleBytes = (u8*)&IntegerSampleValue;
     for (u32 i = 0; i < Format.BytesPerSample; i++)
@@ -546,7 +568,40 @@ asio_error ASIOWriteSampleToHardwareBuffer(void* HardwareBuffer, s32 FrameIndex,
   u32 Start = Format.IsBigEndian ? SampleByteCount - Format.BytesPerSample : 0;
   u32 End = Format.IsBigEndian ? SampleByteCount : Format.BytesPerSample;
   for (u32 i = Start; i < End; i++)
-    HardwareByteBuffer[i] = SampleBytes[i];
+    HardwareByteBuffer[i - Start] = SampleBytes[i];
+
+  return ASIOErrorOK;
+}
+
+// NOTE(robin): Number of significant bits in an integer sample format, e.g. 24 for
+// ASIOSampleTypeInt32LSB24 (24 bit samples in a 32 bit container).
+u32 ASIOGetSampleBits(asio_sample_format Format)
+{
+  return Format.BitAlign ? Format.BitAlign : Format.BytesPerSample * 8;
+}
+
+// NOTE(robin): Writes a block of integer samples to the hardware buffer. The samples must
+// already be in the range of the format (see ASIOGetSampleBits), which is what quantize.c
+// produces. ASIO's 32 bit containers hold smaller samples in their low bits, so unlike
+// ASIOWriteSampleToHardwareBuffer this handles the Int32xxx16/18/20/24 formats too.
+asio_error ASIOWriteBlockToHardwareBuffer(void* HardwareBuffer, const s32* Samples, s32 FrameCount,
+    asio_sample_format Format)
+{
+  // NOTE(robin): For DSD see dsd.c
+  if (Format.DSD || Format.IsFloat)
+    return ASIOErrorInvalidParameter;
+
+  for (s32 FrameIndex = 0; FrameIndex < FrameCount; FrameIndex++)
+  {
+    u32 Value = (u32)Samples[FrameIndex];
+    u8* Bytes = (u8*)HardwareBuffer + FrameIndex * Format.BytesPerSample;
+
+    for (u32 i = 0; i < Format.BytesPerSample; i++)
+    {
+      u32 Shift = 8 * (Format.IsBigEndian ? Format.BytesPerSample - 1 - i : i);
+      Bytes[i] = (u8)(Value >> Shift);
+    }
+  }
 
   return ASIOErrorOK;
 }
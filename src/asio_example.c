@@ -26,6 +26,10 @@ typedef double f64;
 typedef u16 wchar;
 
 #include "asio.c"
+#include "quantize.c"
+#include "meter.c"
+#include "rtlog.c"
+#include "filterbank.c"
 
 // NOTE(robin): Since ASIO doesn't support passing user data to the callback, we store the information we need
 // in a global struct
@@ -44,6 +48,14 @@ typedef struct
 } asio_device;
 asio_device ASIODevice;
 
+// NOTE(robin): Scratch buffers for the audio callback, big enough for any buffer size we'll be given
+#define OUTPUT_MAX_FRAMES 4096
+f32 OutputPlanar[2][OUTPUT_MAX_FRAMES];
+s32 OutputQuantized[2][OUTPUT_MAX_FRAMES];
+quantizer OutputQuantizer;
+meter OutputMeter;
+filter OutputEQ[2][2]; // NOTE(robin): [Channel][Stage]
+
 // NOTE(robin): This is the actual audio callback. The ASIO hardware will call this periodically
 // and you should fill the hardware buffers before the next callback (otherwise you will have buffer underflow).
 asio_time* ASIOAudioCallback(asio_time* Time, s32 BufferIndex, s32 DoDirectProcess)
@@ -56,7 +68,10 @@ asio_time* ASIOAudioCallback(asio_time* Time, s32 BufferIndex, s32 DoDirectProce
     330.0/ASIODevice.SampleRate,
   };
 
-  for (s32 FrameIndex = 0; FrameIndex < ASIODevice.BufferSize; FrameIndex++)
+  s32 FrameCount = ASIODevice.BufferSize < OUTPUT_MAX_FRAMES ? ASIODevice.BufferSize : OUTPUT_MAX_FRAMES;
+
+  // NOTE(robin): Render a block of float samples for each channel first...
+  for (s32 FrameIndex = 0; FrameIndex < FrameCount; FrameIndex++)
   {
     // NOTE(robin): Advance our sin oscillators
     for (u32 i = 0; i < 2; i++)
@@ -64,33 +79,52 @@ asio_time* ASIOAudioCallback(asio_time* Time, s32 BufferIndex, s32 DoDirectProce
       Phase[i] += PhaseDelta[i];
       if (Phase[i] >= 1)
         Phase[i] -= 1;
+
+      f64 Volume = 0.1f; // NOTE(robin): Turn it down a bit
+      OutputPlanar[i][FrameIndex] = (f32)(Volume * sin(2 * 3.1415926538 * Phase[i]));
     }
+  }
 
-    f64 Samples[] =
-    {
-      sin(2 * 3.1415926538 * Phase[0]),
-      sin(2 * 3.1415926538 * Phase[1]),
-    };
+  // NOTE(robin): Run the output EQ on the whole block in place, see filterbank.c
+  for (u32 Channel = 0; Channel < 2; Channel++)
+  {
+    for (u32 Stage = 0; Stage < 2; Stage++)
+      FilterProcess(&OutputEQ[Channel][Stage], OutputPlanar[Channel], FrameCount);
+  }
 
-    // NOTE(robin): Just output to the first 2 outputs since this is probably what
-    // the speakers/headphones are plugged into
-    for (u32 ChannelIndex = 0; ChannelIndex < 2; ChannelIndex++)
-    {
-      void* OutputBuffer = ASIODevice.Outputs[ChannelIndex].Buffers[BufferIndex];
-      void* InputBuffer = ASIODevice.Inputs[0].Buffers[BufferIndex]; // NOTE(robin): Get data from input 0 here
+  // NOTE(robin): Levels for the main thread to print, see meter.c
+  const f32* Inputs[] = {OutputPlanar[0], OutputPlanar[1]};
+  MeterProcess(&OutputMeter, Inputs, FrameCount);
 
-      f64 Volume = 0.1f; // NOTE(robin): Turn it down a bit
-      f64 Sample = Volume * Samples[ChannelIndex]; // NOTE(robin): The floating point sample we want to write
+  // NOTE(robin): ...then convert each block to the hardware format in one go. The quantiser
+  // clips, dithers and rounds instead of truncating, see quantize.c.
+  s32* Outputs[] = {OutputQuantized[0], OutputQuantized[1]};
+  QuantizeChannels(&OutputQuantizer, Outputs, Inputs, 2, FrameCount);
 
-      // NOTE(robin): InputChannels + ChannelIndex is because the output channels come directly after the inputs
-      asio_sample_format HardwareFormat =
-        ASIOGetSampleFormat(ASIODevice.Channels[ASIODevice.InputChannels + ChannelIndex].SampleType);
+  // NOTE(robin): Just output to the first 2 outputs since this is probably what
+  // the speakers/headphones are plugged into
+  for (u32 ChannelIndex = 0; ChannelIndex < 2; ChannelIndex++)
+  {
+    void* OutputBuffer = ASIODevice.Outputs[ChannelIndex].Buffers[BufferIndex];
 
-      asio_error Error = ASIOWriteSampleToHardwareBuffer(OutputBuffer, FrameIndex, Sample, HardwareFormat);
+    // NOTE(robin): InputChannels + ChannelIndex is because the output channels come directly after the inputs
+    asio_sample_format HardwareFormat =
+      ASIOGetSampleFormat(ASIODevice.Channels[ASIODevice.InputChannels + ChannelIndex].SampleType);
 
-      if (Error != ASIOErrorOK)
-        printf("Failed to convert to the hardware sample format\n");
+    asio_error Error = ASIOErrorOK;
+    if (HardwareFormat.IsFloat)
+    {
+      // NOTE(robin): Float devices don't need quantising, just write the samples as they are
+      for (s32 FrameIndex = 0; FrameIndex < FrameCount && Error == ASIOErrorOK; FrameIndex++)
+        Error = ASIOWriteSampleToHardwareBuffer(OutputBuffer, FrameIndex, OutputPlanar[ChannelIndex][FrameIndex], HardwareFormat);
+    }
+    else
+    {
+      Error = ASIOWriteBlockToHardwareBuffer(OutputBuffer, OutputQuantized[ChannelIndex], FrameCount, HardwareFormat);
     }
+
+    if (Error != ASIOErrorOK)
+      RTLog("Failed to convert channel %u to the hardware sample format\n", ChannelIndex);
   }
 
   if (ASIODevice.SupportsOutputReady)
@@ -247,15 +281,39 @@ int main(void)
   ASIODevice.Outputs = &BufferInfos[InputChannels]; // NOTE(robin): Outputs come after input buffers
   ASIODevice.Channels = ChannelInfos;
 
+  // NOTE(robin): We assume all of the outputs use the same sample format, which is the case for
+  // every driver we've seen. 16 bit devices get noise shaping, for 24 bit and up plain TPDF
+  // dither is already far below the noise floor of the analog side.
+  asio_sample_format OutputFormat = ASIOGetSampleFormat(ChannelInfos[InputChannels].SampleType);
+  u32 OutputBits = ASIOGetSampleBits(OutputFormat);
+  QuantizerInit(&OutputQuantizer, OutputBits, 1,
+      OutputBits <= 16 ? QuantizeShapeLipshitz : QuantizeShapeNone);
+  MeterInit(&OutputMeter, 2, SampleRate);
+
+  // NOTE(robin): A rumble filter and a little warmth on the output. Two channels don't fill
+  // the lanes of a filter_bank, so these are scalar filters that keep their settings.
+  for (u32 Channel = 0; Channel < 2; Channel++)
+  {
+    FilterInit(&OutputEQ[Channel][0], FilterKindBiquad, FilterHighpass, (f32)(30.0 / SampleRate), 0.707f, 0);
+    FilterInit(&OutputEQ[Channel][1], FilterKindSVF, FilterLowShelf, (f32)(250.0 / SampleRate), 0.707f, 3.0f);
+  }
+
   printf("Sample rate: %f\n", SampleRate);
   printf("Input channels: %d\n", InputChannels);
   printf("Output channels: %d\n", OutputChannels);
   printf("Buffer size: %d\n", BufferSize);
 
+  // NOTE(robin): The callbacks can't printf, they log through rtlog.c instead
+  RTLogStart(stdout);
+
   // NOTE(robin): Tell the hardware to start calling our callbacks
   ASIODriver->VMT->Start(ASIODriver);
 
-  Sleep(3000);
+  for (u32 i = 0; i < 3; i++)
+  {
+    Sleep(1000);
+    MeterPrint(MeterRead(&OutputMeter));
+  }
 
   // IMPORTANT(robin): You must call these 3 when your application terminates otherwise
   // the user will have no audio!
@@ -263,5 +321,6 @@ int main(void)
   ASIODriver->VMT->DisposeBuffers(ASIODriver);
   ASIODriver->VMT->Release(ASIODriver);
 
+  RTLogStop();
   return 0;
 }
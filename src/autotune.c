@@ -0,0 +1,250 @@
+/*
+ * This file finds the smallest period size (and so the lowest latency) that runs without
+ * xruns on this machine, as loaded as it is right now, instead of a guess hardcoded in the
+ * source.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   auto_tune AutoTune;
+ *   AutoTuneInit(&AutoTune, SampleRate, SmallestPeriod, LargestPeriod);
+ *   ... open the device with AutoTune.Period ...
+ *
+ *   // In the callback
+ *   AutoTuneCallback(&AutoTune, Nanoseconds, FrameCount); // NOTE(robin): Time spent in it
+ *   // On an xrun (in the callback, or JACK's xrun callback)
+ *   AutoTuneXRun(&AutoTune);
+ *
+ *   // Once a second on another thread
+ *   u32 Period = AutoTuneUpdate(&AutoTune);
+ *   if (Period)
+ *     ... reconfigure the device to Period frames, then ...
+ *     AutoTuneApplied(&AutoTune, ActualPeriod);
+ *   ...
+ *   AutoTunePrint(&AutoTune);
+ *
+ * NOTE(robin): The period sizes tried are the powers of two from the smallest the device
+ * supports up to the largest we allow, and we start at the smallest. Every window (one call
+ * to AutoTuneUpdate) looks at the xruns and the callback load, i.e. the time the callback
+ * took over the length of the period:
+ *
+ * - Any xrun, or a peak load above AUTO_TUNE_UP_LOAD, goes up one size right away. A size that
+ *   had xruns isn't tried again for a while, twice as long each time it fails, so we don't
+ *   keep dropping back into a period that glitches.
+ * - AUTO_TUNE_STABLE_WINDOWS clean windows in a row with the peak load below
+ *   AUTO_TUNE_DOWN_LOAD go down one size. Half the period means about twice the load, so
+ *   that threshold is a bit under half of the one for going up, to leave some hysteresis.
+ *
+ * When the load of the machine changes (another program starts, or stops), this carries on
+ * finding the new best size. The callback side is wait free and cheap; the decisions, which
+ * need to reconfigure the device, are up to another thread.
+ */
+
+#include <stdio.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AutoTuneExchange(Pointer, Value) (u32)_InterlockedExchange((volatile long*)(Pointer), (long)(Value))
+#define AutoTuneLoad(Pointer) (*(volatile u32*)(Pointer))
+#define AutoTuneStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#define AutoTuneAdd(Pointer, Value) _InterlockedExchangeAdd((volatile long*)(Pointer), (long)(Value))
+#else
+#define AutoTuneExchange(Pointer, Value) __atomic_exchange_n((Pointer), (Value), __ATOMIC_RELAXED)
+#define AutoTuneLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_RELAXED)
+#define AutoTuneStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELAXED)
+#define AutoTuneAdd(Pointer, Value) __atomic_fetch_add((Pointer), (Value), __ATOMIC_RELAXED)
+#endif
+
+#define AUTO_TUNE_MAX_SIZES 16
+#define AUTO_TUNE_UP_LOAD 0.7f
+#define AUTO_TUNE_DOWN_LOAD 0.3f
+#define AUTO_TUNE_STABLE_WINDOWS 3
+#define AUTO_TUNE_RETRY_WINDOWS 4 // NOTE(robin): Before a size that failed is tried again
+#define AUTO_TUNE_MAX_RETRY_WINDOWS 64
+
+typedef struct
+{
+  u32 Period;
+  u32 Windows;   // NOTE(robin): Windows spent at this size
+  u32 XRuns;
+  u32 Failures;  // NOTE(robin): Times we had to leave this size because of xruns
+  u32 RetryAt;   // NOTE(robin): Window from which we can try this size again
+  f32 PeakLoad;
+} auto_tune_size;
+
+typedef struct
+{
+  u32 SampleRate;
+  u32 SizeCount;
+  auto_tune_size Sizes[AUTO_TUNE_MAX_SIZES];
+
+  u32 Current;     // NOTE(robin): Index into Sizes
+  u32 Period;      // NOTE(robin): Frames, what the device is running at
+  u32 Window;
+  u32 CleanWindows;
+  u32 LastChange;  // NOTE(robin): Window of the last change
+
+  // NOTE(robin): Written by the callback, taken by AutoTuneUpdate. The peak is in millionths
+  // of the period so that it can be read and written atomically.
+  u32 Callbacks;
+  u32 XRuns;
+  u32 PeakLoad;
+
+  // NOTE(robin): The last window, for printing
+  u32 LastPeriod;
+  u32 LastCallbacks;
+  u32 LastXRuns;
+  f32 LastPeakLoad;
+} auto_tune;
+
+// NOTE(robin): Smallest is the smallest period the device supports, rounded up to a power of
+// two. Largest is rounded down.
+void AutoTuneInit(auto_tune* AutoTune, u32 SampleRate, u32 Smallest, u32 Largest)
+{
+  *AutoTune = (auto_tune){0};
+  AutoTune->SampleRate = SampleRate;
+
+  u32 Period = 1;
+  while (Period < Smallest)
+    Period *= 2;
+
+  for (; Period <= Largest && AutoTune->SizeCount < AUTO_TUNE_MAX_SIZES; Period *= 2)
+    AutoTune->Sizes[AutoTune->SizeCount++].Period = Period;
+
+  if (!AutoTune->SizeCount)
+    AutoTune->Sizes[AutoTune->SizeCount++].Period = Largest;
+
+  AutoTune->Period = AutoTune->Sizes[0].Period;
+}
+
+// NOTE(robin): Call from the callback with how long it took
+void AutoTuneCallback(auto_tune* AutoTune, u64 Nanoseconds, u32 FrameCount)
+{
+  u32 Load = (u32)(Nanoseconds * AutoTune->SampleRate / (FrameCount * 1000ull));
+
+  // NOTE(robin): Only the callback makes the peak bigger, so at worst a peak that comes in
+  // while AutoTuneUpdate takes it counts towards the next window
+  if (Load > AutoTuneLoad(&AutoTune->PeakLoad))
+    AutoTuneStore(&AutoTune->PeakLoad, Load);
+  AutoTuneAdd(&AutoTune->Callbacks, 1);
+}
+
+// NOTE(robin): Can be called from any thread, including more than one
+void AutoTuneXRun(auto_tune* AutoTune)
+{
+  AutoTuneAdd(&AutoTune->XRuns, 1);
+}
+
+static void AutoTuneSetSize(auto_tune* AutoTune, u32 Index)
+{
+  AutoTune->Current = Index;
+  AutoTune->Period = AutoTune->Sizes[Index].Period;
+  AutoTune->CleanWindows = 0;
+  AutoTune->LastChange = AutoTune->Window;
+}
+
+// NOTE(robin): Call once per window (a second or so works) from a thread that can
+// reconfigure the device. Returns the period size to switch to, or 0 to stay.
+u32 AutoTuneUpdate(auto_tune* AutoTune)
+{
+  u32 Callbacks = AutoTuneExchange(&AutoTune->Callbacks, 0);
+  u32 XRuns = AutoTuneExchange(&AutoTune->XRuns, 0);
+  f32 PeakLoad = (f32)AutoTuneExchange(&AutoTune->PeakLoad, 0) / 1e6f;
+
+  AutoTune->LastPeriod = AutoTune->Period;
+  AutoTune->LastCallbacks = Callbacks;
+  AutoTune->LastXRuns = XRuns;
+  AutoTune->LastPeakLoad = PeakLoad;
+  AutoTune->Window++;
+
+  auto_tune_size* Size = &AutoTune->Sizes[AutoTune->Current];
+  Size->Windows++;
+  Size->XRuns += XRuns;
+  Size->PeakLoad = PeakLoad > Size->PeakLoad ? PeakLoad : Size->PeakLoad;
+
+  // NOTE(robin): A window without callbacks is the device restarting after a change
+  if (!Callbacks && !XRuns)
+    return 0;
+
+  if (XRuns || PeakLoad > AUTO_TUNE_UP_LOAD)
+  {
+    if (XRuns)
+    {
+      u32 Wait = AUTO_TUNE_RETRY_WINDOWS << (Size->Failures < 4 ? Size->Failures : 4);
+      Wait = Wait < AUTO_TUNE_MAX_RETRY_WINDOWS ? Wait : AUTO_TUNE_MAX_RETRY_WINDOWS;
+      Size->Failures++;
+      Size->RetryAt = AutoTune->Window + Wait;
+    }
+
+    if (AutoTune->Current + 1 < AutoTune->SizeCount)
+    {
+      AutoTuneSetSize(AutoTune, AutoTune->Current + 1);
+      return AutoTune->Period;
+    }
+
+    AutoTune->CleanWindows = 0;
+    return 0;
+  }
+
+  AutoTune->CleanWindows = PeakLoad < AUTO_TUNE_DOWN_LOAD ? AutoTune->CleanWindows + 1 : 0;
+  if (AutoTune->CleanWindows >= AUTO_TUNE_STABLE_WINDOWS && AutoTune->Current > 0 &&
+      AutoTune->Window >= AutoTune->Sizes[AutoTune->Current - 1].RetryAt)
+  {
+    AutoTuneSetSize(AutoTune, AutoTune->Current - 1);
+    return AutoTune->Period;
+  }
+
+  return 0;
+}
+
+// NOTE(robin): Tell us what the device actually ended up with after a change, if it isn't
+// what AutoTuneUpdate asked for (JACK refuses some sizes, ALSA picks the nearest it can do)
+void AutoTuneApplied(auto_tune* AutoTune, u32 Period)
+{
+  u32 Nearest = 0;
+  for (u32 i = 1; i < AutoTune->SizeCount; i++)
+  {
+    u32 Distance = Period > AutoTune->Sizes[i].Period ? Period - AutoTune->Sizes[i].Period : AutoTune->Sizes[i].Period - Period;
+    u32 Best = Period > AutoTune->Sizes[Nearest].Period ? Period - AutoTune->Sizes[Nearest].Period : AutoTune->Sizes[Nearest].Period - Period;
+    if (Distance < Best)
+      Nearest = i;
+  }
+
+  AutoTune->Current = Nearest;
+  AutoTune->Period = Period;
+
+  // NOTE(robin): Don't count what happened while the device was switching
+  AutoTuneExchange(&AutoTune->Callbacks, 0);
+  AutoTuneExchange(&AutoTune->XRuns, 0);
+  AutoTuneExchange(&AutoTune->PeakLoad, 0);
+}
+
+// NOTE(robin): One line about the last window
+void AutoTunePrintWindow(auto_tune* AutoTune)
+{
+  printf("period %5u (%6.2fms) callbacks %5u xruns %3u peak load %5.1f%%",
+      AutoTune->LastPeriod, 1000.0 * AutoTune->LastPeriod / AutoTune->SampleRate,
+      AutoTune->LastCallbacks, AutoTune->LastXRuns, 100.0 * AutoTune->LastPeakLoad);
+  if (AutoTune->Period != AutoTune->LastPeriod)
+    printf(" -> %u", AutoTune->Period);
+  printf("\n");
+}
+
+// NOTE(robin): What was tried and what we ended up with
+void AutoTunePrint(auto_tune* AutoTune)
+{
+  printf("\n%8s %10s %8s %8s %10s\n", "period", "latency", "windows", "xruns", "peak load");
+  for (u32 i = 0; i < AutoTune->SizeCount; i++)
+  {
+    auto_tune_size* Size = &AutoTune->Sizes[i];
+    if (!Size->Windows)
+      continue;
+    printf("%8u %8.2fms %8u %8u %9.1f%%%s\n", Size->Period, 1000.0 * Size->Period / AutoTune->SampleRate,
+        Size->Windows, Size->XRuns, 100.0 * Size->PeakLoad, i == AutoTune->Current ? "  <-" : "");
+  }
+
+  printf("Chosen period: %u frames (%.2fms at %uHz), unchanged for the last %u windows\n",
+      AutoTune->Period, 1000.0 * AutoTune->Period / AutoTune->SampleRate, AutoTune->SampleRate,
+      AutoTune->Window - AutoTune->LastChange);
+}
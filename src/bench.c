@@ -0,0 +1,315 @@
+/*
+ * This file provides a tiny timing harness for the benchmark programs in this directory.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): We time a function by calling it repeatedly in batches and keep the fastest
+ * batch. The minimum is much more stable than the mean since everything that can go wrong
+ * on a busy machine (interrupts, migrations, frequency changes) only ever makes things slower.
+ *
+ * For comparing against a baseline the fastest batch isn't good enough though: it's a single
+ * lucky batch, and one run gets lucky on a different kernel than the next. There we use the
+ * median batch, which a few interrupted batches don't move, and the batches are long enough
+ * (BENCH_BATCH_NS) that a batch is many calls of even the slowest kernel.
+ *
+ * Results can also be written as JSON (one result per line so that it's easy to diff and to
+ * read back without a JSON parser) and compared against a baseline file from an earlier run,
+ * see BenchReportBegin and BenchLoadBaseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define BENCH_HAS_CYCLES 1
+#endif
+
+typedef void bench_function(void* Data);
+
+u64 BenchGetTime(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER Counter, Frequency;
+  QueryPerformanceCounter(&Counter);
+  QueryPerformanceFrequency(&Frequency);
+  return (u64)((f64)Counter.QuadPart * 1e9 / (f64)Frequency.QuadPart);
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+// NOTE(robin): On x86 this is the time stamp counter, which counts at a fixed rate (usually
+// the base clock) rather than actual core cycles, so with turbo the real cycle counts are a
+// bit higher. Elsewhere there's no cycle counter we can read from user space, so it's 0.
+u64 BenchGetCycles(void)
+{
+#if BENCH_HAS_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+#define BENCH_BATCHES 51        // NOTE(robin): Odd, so there's a middle one
+#define BENCH_BATCH_NS 200000ull // NOTE(robin): Least time per batch
+
+typedef struct
+{
+  f64 Nanoseconds; // NOTE(robin): Per call, the fastest batch
+  f64 Cycles;      // NOTE(robin): Per call, 0 if there is no cycle counter
+  f64 Median;      // NOTE(robin): Per call, the median batch, this is what baselines compare
+} bench_result;
+
+static int BenchCompareF64(const void* A, const void* B)
+{
+  f64 X = *(const f64*)A, Y = *(const f64*)B;
+  return (X > Y) - (X < Y);
+}
+
+// NOTE(robin): Returns the fastest and the median time for a single call to Function
+bench_result BenchRun(bench_function* Function, void* Data)
+{
+  // NOTE(robin): Warm up the caches and the branch predictors, and work out how many calls we
+  // need per batch so that a batch takes at least BENCH_BATCH_NS
+  u32 CallsPerBatch = 1;
+  for (;;)
+  {
+    u64 Start = BenchGetTime();
+    for (u32 i = 0; i < CallsPerBatch; i++)
+      Function(Data);
+    u64 Elapsed = BenchGetTime() - Start;
+
+    if (Elapsed > BENCH_BATCH_NS || CallsPerBatch >= (1u << 24))
+      break;
+    CallsPerBatch *= 2;
+  }
+
+  bench_result Best = {1e30, 0, 0};
+  f64 PerCall[BENCH_BATCHES];
+  for (u32 Batch = 0; Batch < BENCH_BATCHES; Batch++)
+  {
+    u64 Start = BenchGetTime();
+    u64 StartCycles = BenchGetCycles();
+    for (u32 i = 0; i < CallsPerBatch; i++)
+      Function(Data);
+    u64 ElapsedCycles = BenchGetCycles() - StartCycles;
+    u64 Elapsed = BenchGetTime() - Start;
+
+    PerCall[Batch] = (f64)Elapsed / CallsPerBatch;
+    if (PerCall[Batch] < Best.Nanoseconds)
+    {
+      Best.Nanoseconds = PerCall[Batch];
+      Best.Cycles = (f64)ElapsedCycles / CallsPerBatch;
+    }
+  }
+
+  qsort(PerCall, BENCH_BATCHES, sizeof(f64), BenchCompareF64);
+  Best.Median = PerCall[BENCH_BATCHES / 2];
+  return Best;
+}
+
+// NOTE(robin): Combines the results of measuring the same thing Count times, e.g. in rounds
+// spread out over a run so that a slow spell of the machine only lands on some of them: the
+// fastest of the fastest, and the median of the medians.
+bench_result BenchCombine(const bench_result* Results, u32 Count)
+{
+  bench_result Result = Results[0];
+  f64 Medians[64];
+  Count = Count < 64 ? Count : 64;
+  for (u32 i = 0; i < Count; i++)
+  {
+    if (Results[i].Nanoseconds < Result.Nanoseconds)
+    {
+      Result.Nanoseconds = Results[i].Nanoseconds;
+      Result.Cycles = Results[i].Cycles;
+    }
+    Medians[i] = Results[i].Median;
+  }
+
+  qsort(Medians, Count, sizeof(f64), BenchCompareF64);
+  Result.Median = Count & 1 ? Medians[Count / 2] : 0.5 * (Medians[Count / 2 - 1] + Medians[Count / 2]);
+  return Result;
+}
+
+// NOTE(robin): Returns the fastest time for a single call to Function in nanoseconds
+f64 BenchMeasure(bench_function* Function, void* Data)
+{
+  return BenchRun(Function, Data).Nanoseconds;
+}
+
+#define BENCH_MAX_BASELINE 1024
+
+// NOTE(robin): The fastest kernels take a fraction of a nanosecond per sample, where timer
+// resolution and the machine's mood alone move the result by more than 20%. A result only
+// counts as a regression when it got slower by the threshold and by this much.
+#define BENCH_NOISE_FLOOR 0.1 // NOTE(robin): Nanoseconds per sample
+
+typedef struct
+{
+  char Name[64];
+  u32 ChannelCount;
+  u32 FrameCount;
+  f64 NanosecondsPerSample;
+  f64 MedianPerSample;
+} bench_baseline_entry;
+
+typedef struct
+{
+  FILE* JSON;
+  u32 ResultCount;
+
+  bench_baseline_entry Baseline[BENCH_MAX_BASELINE];
+  u32 BaselineCount;
+  f64 Threshold;  // NOTE(robin): Allowed slowdown before we call it a regression, 0.1 is 10%
+  f64 NoiseFloor; // NOTE(robin): And the least one in ns per sample, see BENCH_NOISE_FLOOR
+  u32 Regressions;
+} bench_report;
+
+// NOTE(robin): Path may be null, in which case we only print to stdout
+void BenchReportBegin(bench_report* Report, const char* Path, const char* Name, const char* Variant)
+{
+  Report->JSON = 0;
+  Report->ResultCount = 0;
+  Report->BaselineCount = 0;
+  Report->Threshold = 0;
+  Report->NoiseFloor = BENCH_NOISE_FLOOR;
+  Report->Regressions = 0;
+
+  if (Path)
+  {
+    Report->JSON = fopen(Path, "w");
+    if (!Report->JSON)
+    {
+      printf("Could not open %s for writing\n", Path);
+      return;
+    }
+
+    fprintf(Report->JSON, "{\n\"benchmark\": \"%s\",\n\"variant\": \"%s\",\n\"results\": [\n",
+        Name, Variant);
+  }
+}
+
+// NOTE(robin): Reads the results of an earlier run back in, this relies on the one result per
+// line layout that BenchReportAdd writes. Returns the number of entries read.
+u32 BenchLoadBaseline(bench_report* Report, const char* Path, f64 Threshold)
+{
+  Report->BaselineCount = 0;
+  Report->Threshold = Threshold;
+
+  FILE* File = fopen(Path, "r");
+  if (!File)
+    return 0;
+
+  char Line[512];
+  while (fgets(Line, sizeof(Line), File) && Report->BaselineCount < BENCH_MAX_BASELINE)
+  {
+    bench_baseline_entry* Entry = &Report->Baseline[Report->BaselineCount];
+    if (sscanf(Line, " {\"name\": \"%63[^\"]\", \"channels\": %u, \"frames\": %u, \"ns_per_sample\": %lf, "
+          "\"median_ns_per_sample\": %lf", Entry->Name, &Entry->ChannelCount, &Entry->FrameCount,
+          &Entry->NanosecondsPerSample, &Entry->MedianPerSample) == 5)
+    {
+      Report->BaselineCount++;
+    }
+  }
+
+  fclose(File);
+  return Report->BaselineCount;
+}
+
+bench_baseline_entry* BenchFindBaseline(bench_report* Report, const char* Name, u32 ChannelCount, u32 FrameCount)
+{
+  for (u32 i = 0; i < Report->BaselineCount; i++)
+  {
+    bench_baseline_entry* Entry = &Report->Baseline[i];
+    if (!strcmp(Entry->Name, Name) && Entry->ChannelCount == ChannelCount && Entry->FrameCount == FrameCount)
+      return Entry;
+  }
+  return 0;
+}
+
+// NOTE(robin): Whether Result is slower than its baseline by the threshold and the noise floor
+u32 BenchIsRegression(bench_report* Report, const char* Name, u32 ChannelCount, u32 FrameCount,
+    bench_result Result)
+{
+  bench_baseline_entry* Baseline = BenchFindBaseline(Report, Name, ChannelCount, FrameCount);
+  if (!Baseline)
+    return 0;
+
+  f64 MedianPerSample = Result.Median / ((f64)ChannelCount * FrameCount);
+  return MedianPerSample / Baseline->MedianPerSample - 1.0 > Report->Threshold &&
+      MedianPerSample - Baseline->MedianPerSample > Report->NoiseFloor;
+}
+
+void BenchReportHeader(void)
+{
+  printf("%-24s %5s %6s %10s %10s %14s %10s %10s\n",
+      "kernel", "ch", "frames", "ns/frame", "ns/sample", "frames/s", "cyc/sample", "baseline");
+}
+
+// NOTE(robin): Records one result. The kernel processed ChannelCount * FrameCount samples per
+// call. The baseline comparison is between medians, see the top of the file.
+void BenchReportAdd(bench_report* Report, const char* Name, u32 ChannelCount, u32 FrameCount,
+    bench_result Result)
+{
+  f64 Samples = (f64)ChannelCount * FrameCount;
+  f64 NanosecondsPerFrame = Result.Nanoseconds / FrameCount;
+  f64 NanosecondsPerSample = Result.Nanoseconds / Samples;
+  f64 FramesPerSecond = 1e9 * FrameCount / Result.Nanoseconds;
+  f64 CyclesPerSample = Result.Cycles / Samples;
+  f64 MedianPerSample = Result.Median / Samples;
+
+  char Comparison[32] = "";
+  bench_baseline_entry* Baseline = BenchFindBaseline(Report, Name, ChannelCount, FrameCount);
+  if (Baseline)
+  {
+    f64 Change = MedianPerSample / Baseline->MedianPerSample - 1.0;
+    u32 Regressed = BenchIsRegression(Report, Name, ChannelCount, FrameCount, Result);
+    Report->Regressions += Regressed;
+    snprintf(Comparison, sizeof(Comparison), "%+6.1f%%%s", 100.0 * Change, Regressed ? " SLOWER" : "");
+  }
+
+  printf("%-24s %5u %6u %10.3f %10.3f %14.0f %10.2f %s\n", Name, ChannelCount, FrameCount,
+      NanosecondsPerFrame, NanosecondsPerSample, FramesPerSecond, CyclesPerSample, Comparison);
+
+  if (Report->JSON)
+  {
+    fprintf(Report->JSON, "%s  {\"name\": \"%s\", \"channels\": %u, \"frames\": %u, \"ns_per_sample\": %.4f, "
+        "\"median_ns_per_sample\": %.4f, \"ns_per_frame\": %.4f, \"frames_per_second\": %.0f, "
+        "\"cycles_per_sample\": %.3f}", Report->ResultCount ? ",\n" : "", Name, ChannelCount, FrameCount,
+        NanosecondsPerSample, MedianPerSample, NanosecondsPerFrame, FramesPerSecond, CyclesPerSample);
+  }
+
+  Report->ResultCount++;
+}
+
+// NOTE(robin): Returns the number of regressions against the baseline
+u32 BenchReportEnd(bench_report* Report)
+{
+  if (Report->JSON)
+  {
+    fprintf(Report->JSON, "\n]\n}\n");
+    fclose(Report->JSON);
+    Report->JSON = 0;
+  }
+
+  if (Report->BaselineCount)
+  {
+    printf("\n%u result(s) more than %.0f%% slower than the baseline\n",
+        Report->Regressions, 100.0 * Report->Threshold);
+  }
+
+  return Report->Regressions;
+}
@@ -0,0 +1,388 @@
+/*
+ * This file is the benchmark suite for the per sample hot paths: sample format conversion
+ * (including ASIOWriteSampleToHardwareBuffer and the WASAPI conversion switch), oscillators,
+ * interleaving and mixing, each across a few channel counts and block sizes.
+ *
+ * Usage: bench_suite [-json results.json] [-baseline baseline.json] [-threshold 20] [-floor 0.1]
+ *                    [-variant name]
+ *
+ * Results are printed as ns/frame, ns/sample, frames/s and cycles/sample (see BenchGetCycles).
+ * With -baseline every result is compared against the same kernel, channel count and block
+ * size in an earlier -json file, and we exit with an error if any of them got more than
+ * -threshold percent slower, and slower by at least -floor ns per sample, which keeps timing
+ * noise on the fastest kernels from counting. The comparison is between medians, measured in
+ * SUITE_ROUNDS rounds over the whole run, and a result that looks slower is measured again
+ * before it counts. With that an unchanged build compared against its own results passes
+ * cleanly at the defaults. `./build.sh bench` builds and runs this for every
+ * -march variant.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "asio.c"
+#include "dsp_kernels.c"
+#include "interleave.c"
+#include "quantize.c"
+
+#define SUITE_MAX_CHANNELS 32
+#define SUITE_MAX_FRAMES 1024
+#define SUITE_MAX_SAMPLES (SUITE_MAX_CHANNELS * SUITE_MAX_FRAMES)
+#define SUITE_ROUNDS 5
+#define SUITE_RETRIES 2
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 FrameCount;
+  dsp_kernels Kernels;       // NOTE(robin): For FrameCount samples, i.e. one channel
+  dsp_kernels SampleKernels; // NOTE(robin): For ChannelCount * FrameCount samples
+  quantizer Quantizer;
+
+  f32* Planar[SUITE_MAX_CHANNELS];
+  f32* Scratch[SUITE_MAX_CHANNELS];
+  s32* Quantized[SUITE_MAX_CHANNELS];
+  f32* Interleaved;
+  u8* Hardware; // NOTE(robin): Device buffer, big enough for 4 bytes per sample
+  f32 Phase[SUITE_MAX_CHANNELS];
+
+  asio_sample_type ASIOType;
+  u32 BytesPerSample;
+} suite_data;
+
+// NOTE(robin): The per sample oscillator loop from the examples
+void BenchNaiveOscillator(void* Context)
+{
+  suite_data* Data = Context;
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+  {
+    f32 PhaseDelta = (220.0f + 110.0f * Channel) / 48000.0f;
+    f32 Phase = Data->Phase[Channel];
+    f32* Output = Data->Planar[Channel];
+
+    for (u32 Frame = 0; Frame < Data->FrameCount; Frame++)
+    {
+      Phase += PhaseDelta;
+      if (Phase >= 1.0f)
+        Phase -= 1.0f;
+      Output[Frame] = 0.1f * sinf(Phase * 2 * (f32)M_PI);
+    }
+
+    Data->Phase[Channel] = Phase;
+  }
+}
+
+void BenchOscillator(void* Context)
+{
+  suite_data* Data = Context;
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+  {
+    f32 PhaseDelta = (220.0f + 110.0f * Channel) / 48000.0f;
+    Data->Kernels.Oscillator(Data->Planar[Channel], Data->FrameCount, &Data->Phase[Channel], PhaseDelta, 0.1f);
+  }
+}
+
+void BenchMix(void* Context)
+{
+  suite_data* Data = Context;
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    Data->Kernels.Mix(Data->Scratch[Channel], Data->Planar[Channel], Data->FrameCount, 0.5f);
+}
+
+void BenchNaiveInterleave(void* Context)
+{
+  suite_data* Data = Context;
+  u32 ChannelCount = Data->ChannelCount;
+  for (u32 Frame = 0; Frame < Data->FrameCount; Frame++)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      Data->Interleaved[Frame * ChannelCount + Channel] = Data->Planar[Channel][Frame];
+  }
+}
+
+void BenchInterleave(void* Context)
+{
+  suite_data* Data = Context;
+  InterleaveF32(Data->Interleaved, (const f32* const*)Data->Planar, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchDeinterleave(void* Context)
+{
+  suite_data* Data = Context;
+  DeinterleaveF32(Data->Scratch, Data->Interleaved, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchConvertF32ToS16(void* Context)
+{
+  suite_data* Data = Context;
+  Data->SampleKernels.ConvertF32ToS16((s16*)Data->Hardware, Data->Interleaved, Data->ChannelCount * Data->FrameCount);
+}
+
+void BenchConvertF32ToS32(void* Context)
+{
+  suite_data* Data = Context;
+  Data->SampleKernels.ConvertF32ToS32((s32*)Data->Hardware, Data->Interleaved, Data->ChannelCount * Data->FrameCount);
+}
+
+void BenchConvertF32ToS24(void* Context)
+{
+  suite_data* Data = Context;
+  Data->SampleKernels.ConvertF32ToS24(Data->Hardware, Data->Interleaved, Data->ChannelCount * Data->FrameCount);
+}
+
+void BenchConvertS16ToF32(void* Context)
+{
+  suite_data* Data = Context;
+  Data->SampleKernels.ConvertS16ToF32(Data->Interleaved, (s16*)Data->Hardware, Data->ChannelCount * Data->FrameCount);
+}
+
+// NOTE(robin): The conversion switch from AudioInputCallback in wasapi_example.c, hardware
+// format to float with the switch on the sample size inside the loop
+void BenchWASAPISwitch(void* Context)
+{
+  suite_data* Data = Context;
+  u32 BytesPerSample = Data->BytesPerSample;
+  u32 ChannelCount = Data->ChannelCount;
+  u8* AudioBuffer = Data->Hardware;
+
+  for (u32 FrameIndex = 0; FrameIndex < Data->FrameCount; FrameIndex++)
+  {
+    for (u32 i = 0; i < ChannelCount; i++)
+    {
+      u32 SampleIndex = FrameIndex * ChannelCount + i;
+      f32 Sample = 0;
+
+      switch (BytesPerSample)
+      {
+        case 2:
+        {
+          s16* InputBuffer = (s16*)AudioBuffer;
+          Sample = InputBuffer[SampleIndex] / (f32)0x7FFF;
+        } break;
+
+        case 3:
+        {
+          u8* InputBuffer = AudioBuffer + 3 * SampleIndex;
+          s32 IntSample = 0;
+          u8* SampleBytes = (u8*)&IntSample;
+
+          SampleBytes[0] = InputBuffer[0];
+          SampleBytes[1] = InputBuffer[1];
+          SampleBytes[2] = InputBuffer[2];
+
+          Sample = IntSample / (f32)0x7FFFFF;
+        } break;
+
+        case 4:
+        {
+          s32* InputBuffer = (s32*)AudioBuffer;
+          Sample = InputBuffer[SampleIndex] / (f32)0x7FFFFFFF;
+        } break;
+      }
+
+      Data->Interleaved[SampleIndex] = Sample;
+    }
+  }
+}
+
+// NOTE(robin): What asio_example.c used to do, look up the format and write one sample at a time
+void BenchASIOWriteSample(void* Context)
+{
+  suite_data* Data = Context;
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+  {
+    void* Buffer = Data->Hardware + Channel * SUITE_MAX_FRAMES * 4;
+    for (u32 Frame = 0; Frame < Data->FrameCount; Frame++)
+    {
+      asio_sample_format Format = ASIOGetSampleFormat(Data->ASIOType);
+      ASIOWriteSampleToHardwareBuffer(Buffer, Frame, Data->Planar[Channel][Frame], Format);
+    }
+  }
+}
+
+// NOTE(robin): What asio_example.c does now, quantise each block and then write it
+void BenchASIOWriteBlock(void* Context)
+{
+  suite_data* Data = Context;
+  asio_sample_format Format = ASIOGetSampleFormat(Data->ASIOType);
+
+  QuantizeChannels(&Data->Quantizer, Data->Quantized, (const f32* const*)Data->Planar,
+      Data->ChannelCount, Data->FrameCount);
+
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+  {
+    void* Buffer = Data->Hardware + Channel * SUITE_MAX_FRAMES * 4;
+    ASIOWriteBlockToHardwareBuffer(Buffer, Data->Quantized[Channel], Data->FrameCount, Format);
+  }
+}
+
+void BenchASIOGetSampleFormat(void* Context)
+{
+  suite_data* Data = Context;
+  u32 Sum = 0;
+  for (u32 i = 0; i < Data->ChannelCount * Data->FrameCount; i++)
+    Sum += ASIOGetSampleFormat((asio_sample_type)(i % ASIOSampleTypeCount)).BytesPerSample;
+  Data->Hardware[0] = (u8)Sum;
+}
+
+typedef struct
+{
+  const char* Name;
+  bench_function* Function;
+  asio_sample_type ASIOType;
+  u32 BytesPerSample;
+} suite_case;
+
+static bench_result SuiteRun(suite_data* Data, suite_case* Case, u32 ChannelCount, u32 FrameCount)
+{
+  Data->ChannelCount = ChannelCount;
+  Data->FrameCount = FrameCount;
+  Data->Kernels = DSPSelectKernels(FrameCount);
+  Data->SampleKernels = DSPSelectKernels(ChannelCount * FrameCount);
+  Data->ASIOType = Case->ASIOType;
+  Data->BytesPerSample = Case->BytesPerSample;
+
+  u32 Bits = Case->ASIOType == ASIOSampleTypeInt16LSB ? 16 :
+             Case->ASIOType == ASIOSampleTypeInt24LSB ? 24 : 32;
+  QuantizerInit(&Data->Quantizer, Bits, 1, QuantizeShapeNone);
+
+  return BenchRun(Case->Function, Data);
+}
+
+int main(int argc, char** argv)
+{
+  const char* JSONPath = 0;
+  const char* BaselinePath = 0;
+  const char* Variant = "default";
+  f64 Threshold = 20.0;
+  f64 NoiseFloor = BENCH_NOISE_FLOOR;
+
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (!strcmp(argv[i], "-json"))
+      JSONPath = argv[i + 1];
+    else if (!strcmp(argv[i], "-baseline"))
+      BaselinePath = argv[i + 1];
+    else if (!strcmp(argv[i], "-threshold"))
+      Threshold = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-floor"))
+      NoiseFloor = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "-variant"))
+      Variant = argv[i + 1];
+    else
+    {
+      printf("Unknown argument %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  static suite_data Data;
+  for (u32 Channel = 0; Channel < SUITE_MAX_CHANNELS; Channel++)
+  {
+    Data.Planar[Channel] = malloc(SUITE_MAX_FRAMES * sizeof(f32));
+    Data.Scratch[Channel] = malloc(SUITE_MAX_FRAMES * sizeof(f32));
+    Data.Quantized[Channel] = malloc(SUITE_MAX_FRAMES * sizeof(s32));
+    for (u32 Frame = 0; Frame < SUITE_MAX_FRAMES; Frame++)
+    {
+      Data.Planar[Channel][Frame] = 0.5f * sinf(0.01f * (f32)(Frame * (Channel + 1)));
+      Data.Scratch[Channel][Frame] = 0;
+    }
+  }
+  Data.Interleaved = malloc(SUITE_MAX_SAMPLES * sizeof(f32));
+  Data.Hardware = calloc(SUITE_MAX_SAMPLES, 4);
+  InterleaveF32(Data.Interleaved, (const f32* const*)Data.Planar, SUITE_MAX_CHANNELS, SUITE_MAX_FRAMES);
+
+  suite_case Cases[] =
+  {
+    {"naive_oscillator", BenchNaiveOscillator},
+    {"oscillator", BenchOscillator},
+    {"mix", BenchMix},
+    {"naive_interleave", BenchNaiveInterleave},
+    {"interleave", BenchInterleave},
+    {"deinterleave", BenchDeinterleave},
+    {"f32_to_s16", BenchConvertF32ToS16},
+    {"f32_to_s32", BenchConvertF32ToS32},
+    {"f32_to_s24", BenchConvertF32ToS24},
+    {"s16_to_f32", BenchConvertS16ToF32},
+    {"wasapi_switch_s16", BenchWASAPISwitch, 0, 2},
+    {"wasapi_switch_s24", BenchWASAPISwitch, 0, 3},
+    {"wasapi_switch_s32", BenchWASAPISwitch, 0, 4},
+    {"asio_get_sample_format", BenchASIOGetSampleFormat},
+    {"asio_write_sample_s16", BenchASIOWriteSample, ASIOSampleTypeInt16LSB},
+    {"asio_write_sample_s24", BenchASIOWriteSample, ASIOSampleTypeInt24LSB},
+    {"asio_write_sample_s32", BenchASIOWriteSample, ASIOSampleTypeInt32LSB},
+    {"asio_write_sample_f32", BenchASIOWriteSample, ASIOSampleTypeFloat32LSB},
+    {"asio_write_block_s16", BenchASIOWriteBlock, ASIOSampleTypeInt16LSB},
+    {"asio_write_block_s24", BenchASIOWriteBlock, ASIOSampleTypeInt24LSB},
+    {"asio_write_block_s32", BenchASIOWriteBlock, ASIOSampleTypeInt32LSB},
+  };
+
+  u32 ChannelCounts[] = {2, 8, 32};
+  u32 FrameCounts[] = {64, 256, 1024};
+
+  bench_report Report = {0};
+  BenchReportBegin(&Report, JSONPath, "bench_suite", Variant);
+  Report.NoiseFloor = NoiseFloor;
+  if (BaselinePath)
+  {
+    if (!BenchLoadBaseline(&Report, BaselinePath, Threshold / 100.0))
+      printf("No baseline results in %s, nothing to compare against\n", BaselinePath);
+  }
+
+  printf("variant: %s\n", Variant);
+  BenchReportHeader();
+
+  // NOTE(robin): The whole suite runs SUITE_ROUNDS times and each result is combined from its
+  // rounds, so a slow spell of the machine (another process, the host of a VM) that lasts
+  // for a few kernels only counts in one round of them, see BenchCombine
+  u32 CaseCount = sizeof(Cases) / sizeof(Cases[0]);
+  u32 ChannelCountCount = sizeof(ChannelCounts) / sizeof(ChannelCounts[0]);
+  u32 FrameCountCount = sizeof(FrameCounts) / sizeof(FrameCounts[0]);
+  static bench_result Results[sizeof(Cases) / sizeof(Cases[0])][3][3][SUITE_ROUNDS];
+  for (u32 Round = 0; Round < SUITE_ROUNDS; Round++)
+  {
+    for (u32 CaseIndex = 0; CaseIndex < CaseCount; CaseIndex++)
+    {
+      for (u32 i = 0; i < ChannelCountCount; i++)
+      {
+        for (u32 j = 0; j < FrameCountCount; j++)
+          Results[CaseIndex][i][j][Round] = SuiteRun(&Data, &Cases[CaseIndex], ChannelCounts[i], FrameCounts[j]);
+      }
+    }
+  }
+
+  for (u32 CaseIndex = 0; CaseIndex < CaseCount; CaseIndex++)
+  {
+    suite_case* Case = &Cases[CaseIndex];
+    for (u32 i = 0; i < ChannelCountCount; i++)
+    {
+      for (u32 j = 0; j < FrameCountCount; j++)
+      {
+        bench_result Result = BenchCombine(Results[CaseIndex][i][j], SUITE_ROUNDS);
+
+        // NOTE(robin): Even so a kernel can run slower for a whole run (it's more than the
+        // threshold on a busy machine or a VM), so before we call it a regression we measure
+        // it again and keep the faster. A real regression is slower every time.
+        for (u32 Retry = 0; Retry < SUITE_RETRIES &&
+            BenchIsRegression(&Report, Case->Name, ChannelCounts[i], FrameCounts[j], Result); Retry++)
+        {
+          bench_result Rounds[SUITE_ROUNDS];
+          for (u32 Round = 0; Round < SUITE_ROUNDS; Round++)
+            Rounds[Round] = SuiteRun(&Data, Case, ChannelCounts[i], FrameCounts[j]);
+
+          bench_result Again = BenchCombine(Rounds, SUITE_ROUNDS);
+          if (Again.Median < Result.Median)
+            Result = Again;
+        }
+
+        BenchReportAdd(&Report, Case->Name, ChannelCounts[i], FrameCounts[j], Result);
+      }
+    }
+  }
+
+  return BenchReportEnd(&Report) ? 1 : 0;
+}
@@ -0,0 +1,596 @@
+/*
+ * This file is a zero latency convolution engine for long impulse responses (reverbs,
+ * speaker cabinets) on many channels, built on fft.c.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined, fft.c and denormal.c.
+ *
+ * NOTE(robin): Convolving with a 4 second impulse response directly is ~200k multiply adds
+ * per sample per channel, which no CPU can do for many channels. FFT convolution is cheap
+ * but has a latency of its block size. So we split the impulse response (IR) in time:
+ *
+ *   IR:  | head |  level 0: B  |   level 1: 4B   |      level 2: 16B     |  ...
+ *         0     B              8B               32B                     128B
+ *
+ * - The head (the first B taps, B being the callback's block size) is a plain FIR so the
+ *   output has no latency at all.
+ * - Each level is a uniformly partitioned FFT convolution (overlap-save with a frequency
+ *   domain delay line) with partitions of N samples, 4 times longer than the level before,
+ *   up to CONVOLVER_MAX_PARTITION. The last level takes whatever is left of the IR.
+ * - Level l starts at 2N in the IR. Its input is complete every N samples and the first
+ *   output it produces isn't needed until N samples after that, so it gets a whole N
+ *   samples of time to compute. Level 0 (N = B) runs in the callback, the longer levels
+ *   run on background threads.
+ *
+ * Every N samples the callback waits for the level's previous job (the deadline), adds its
+ * result into an output ring buffer and starts the next job. If no worker has picked the
+ * job up yet, the callback runs it itself instead of waiting. The result is added in the
+ * same place in the same order whoever computed it, so the output is bit identical with any
+ * number of threads, including none: with ThreadCount 0 every job runs inline, which is the
+ * offline path (e.g. for rendering or benchmarking).
+ *
+ * Waiting for a worker sleeps on a futex rather than spinning: the workers run below the
+ * audio thread, so on the same core (or with only one) they don't get to run while it
+ * spins. The wait gives up after MaxWait nanoseconds, and then the level adds nothing for
+ * those N samples and we count a miss. With worker threads ConvolverInit sets it to
+ * CONVOLVER_DEFAULT_MAX_WAIT; set it from your period after ConvolverInit (the head, level 0
+ * and the rest of the callback need some of it too), or to 0 to wait as long as it takes.
+ * The worker finishes the late job in its own time and we don't start the level's next one
+ * until it has, so the level stays silent until then. The blocks it skipped are missing
+ * from its delay line, so the next job clears it first rather than let the input that's
+ * left meet the wrong partitions of the IR: the level comes back with the start of its part
+ * of the IR and has all of it again PartitionCount jobs later. Misses aren't bit identical
+ * to the offline path, so set MaxWait to 0 to render with worker threads.
+ *
+ * All memory is allocated in ConvolverInit. ConvolverProcess doesn't allocate or take locks.
+ * Starting a job posts a semaphore, which doesn't block. The worker threads use pthreads,
+ * POSIX semaphores and futexes, so this is Linux only.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define CONVOLVER_MAX_LEVELS 8
+#define CONVOLVER_MAX_THREADS 8
+#define CONVOLVER_MAX_PARTITION 8192
+
+// NOTE(robin): Nanoseconds, under a 128 frame period at 48kHz
+#define CONVOLVER_DEFAULT_MAX_WAIT 1000000
+
+typedef enum
+{
+  ConvolverJobIdle,
+  ConvolverJobPending,
+  ConvolverJobRunning,
+  ConvolverJobWaited, // NOTE(robin): Running, and the callback sleeps on State until it's done
+  ConvolverJobDone,
+} convolver_job_state;
+
+typedef struct
+{
+  u32 Size;           // NOTE(robin): Partition size N, the FFT is 2N
+  u32 Start;          // NOTE(robin): Offset of the first partition in the IR
+  u32 PartitionCount;
+  u32 Stride;         // NOTE(robin): N + 1 bins, rounded up so every spectrum is aligned
+  u32 Background;
+  fft_real FFT;
+} convolver_level;
+
+// NOTE(robin): One per channel per level. Only whoever runs the job touches anything but
+// State, and State hands the job over (see ConvolverLaunch and ConvolverFinish).
+typedef struct
+{
+  convolver_level* Level;
+  f32* IRRe;  // NOTE(robin): PartitionCount spectra, Stride apart
+  f32* IRIm;
+  f32* FDLRe; // NOTE(robin): The last PartitionCount input spectra, Current is the newest
+  f32* FDLIm;
+  u32 Current;
+  f32* Input; // NOTE(robin): The last 2N input samples
+  f32* AccRe;
+  f32* AccIm;
+  f32* Time;  // NOTE(robin): 2N, the result is the second half
+  u32 State;
+  u32 Launched;
+  u32 Missed;  // NOTE(robin): We gave up on the job, whoever runs it still owns it
+  u32 Restart; // NOTE(robin): The FDL has a gap from a miss, clear it before the next job
+} convolver_job;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 BlockSize;
+  u32 LevelCount;
+  u32 ThreadCount;
+  convolver_level Levels[CONVOLVER_MAX_LEVELS];
+  convolver_job* Jobs; // NOTE(robin): [Level][Channel], so workers pick short levels first
+
+  f32* HeadIR;     // NOTE(robin): [Channel][BlockSize]
+  f32* HeadWork;   // NOTE(robin): [Channel][2 * BlockSize], previous block then current
+  f32* InputRing;  // NOTE(robin): [Channel][RingSize]
+  f32* OutputRing; // NOTE(robin): [Channel][RingSize], future output from the levels
+  u32 RingSize;
+  u64 Time;
+
+  pthread_t Threads[CONVOLVER_MAX_THREADS];
+  sem_t Wake;
+  u32 Quit;
+
+  u64 MaxWait; // NOTE(robin): Nanoseconds a deadline waits for a worker, 0 for no limit
+
+  u32 Waits;  // NOTE(robin): Deadlines where a worker was still running the job
+  u32 Steals; // NOTE(robin): Deadlines where no worker had started the job
+  u32 Misses; // NOTE(robin): Deadlines where we gave up waiting
+} convolver;
+
+static void* ConvolverAlloc(u64 Count, u32* Failed)
+{
+  // NOTE(robin): 64 byte aligned for SIMD, and zeroed
+  void* Result = 0;
+  if (posix_memalign(&Result, 64, Count * sizeof(f32)))
+  {
+    *Failed = 1;
+    return 0;
+  }
+  memset(Result, 0, Count * sizeof(f32));
+  return Result;
+}
+
+static u64 ConvolverNow(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+// NOTE(robin): Sleeps while *Address == Expected, until Deadline (CLOCK_MONOTONIC
+// nanoseconds, 0 for no deadline), see ShmFutexWait in shm_transport.c
+static void ConvolverFutexWait(u32* Address, u32 Expected, u64 Deadline)
+{
+  struct timespec Time;
+  Time.tv_sec = Deadline / 1000000000ull;
+  Time.tv_nsec = Deadline % 1000000000ull;
+  syscall(SYS_futex, Address, FUTEX_WAIT_BITSET_PRIVATE, Expected, Deadline ? &Time : 0, 0, FUTEX_BITSET_MATCH_ANY);
+}
+
+// NOTE(robin): Done with a job that was handed over. Only wakes the callback (a syscall) if
+// it's waiting for this job.
+static void ConvolverHandBack(convolver_job* Job)
+{
+  if (__atomic_exchange_n(&Job->State, ConvolverJobDone, __ATOMIC_RELEASE) == ConvolverJobWaited)
+    syscall(SYS_futex, &Job->State, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
+
+// NOTE(robin): Acc += X * H over Count complex bins, this is most of the work in a long IR
+static void ConvolverMultiplyAdd(f32* restrict AccRe, f32* restrict AccIm,
+    const f32* restrict XRe, const f32* restrict XIm,
+    const f32* restrict HRe, const f32* restrict HIm, u32 Count)
+{
+  for (u32 i = 0; i < Count; i++)
+  {
+    AccRe[i] += XRe[i] * HRe[i] - XIm[i] * HIm[i];
+    AccIm[i] += XRe[i] * HIm[i] + XIm[i] * HRe[i];
+  }
+}
+
+static void ConvolverRunJob(convolver_job* Job)
+{
+  convolver_level* Level = Job->Level;
+  u32 Stride = Level->Stride;
+  u32 Count = Level->PartitionCount;
+
+  // NOTE(robin): Done here rather than when the callback notices, so the worker pays for it
+  if (Job->Restart)
+  {
+    memset(Job->FDLRe, 0, Count * Stride * sizeof(f32));
+    memset(Job->FDLIm, 0, Count * Stride * sizeof(f32));
+    Job->Restart = 0;
+  }
+
+  f32* XRe = Job->FDLRe + Job->Current * Stride;
+  f32* XIm = Job->FDLIm + Job->Current * Stride;
+  FFTRealForward(&Level->FFT, Job->Input, XRe, XIm);
+
+  memset(Job->AccRe, 0, Stride * sizeof(f32));
+  memset(Job->AccIm, 0, Stride * sizeof(f32));
+
+  // NOTE(robin): Partition p of the IR meets the input from p blocks ago
+  for (u32 p = 0; p < Count; p++)
+  {
+    u32 Slot = (Job->Current + Count - p) % Count;
+    ConvolverMultiplyAdd(Job->AccRe, Job->AccIm,
+        Job->FDLRe + Slot * Stride, Job->FDLIm + Slot * Stride,
+        Job->IRRe + p * Stride, Job->IRIm + p * Stride, Stride);
+  }
+
+  FFTRealInverse(&Level->FFT, Job->AccRe, Job->AccIm, Job->Time);
+  Job->Current = (Job->Current + 1) % Count;
+}
+
+static void* ConvolverWorker(void* Context)
+{
+  convolver* Convolver = Context;
+
+  // NOTE(robin): Just below the audio thread, see alsa_scheduler_example.c. This fails
+  // without rtprio limits, in which case we run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2 - 1;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+
+  // NOTE(robin): The jobs are the same DSP as the callback's, so they need the same
+  // floating point settings, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  u32 JobCount = Convolver->LevelCount * Convolver->ChannelCount;
+  while (1)
+  {
+    sem_wait(&Convolver->Wake);
+    if (__atomic_load_n(&Convolver->Quit, __ATOMIC_ACQUIRE))
+      break;
+
+    for (u32 i = 0; i < JobCount; i++)
+    {
+      convolver_job* Job = &Convolver->Jobs[i];
+      u32 Expected = ConvolverJobPending;
+      if (__atomic_compare_exchange_n(&Job->State, &Expected, ConvolverJobRunning, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      {
+        ConvolverRunJob(Job);
+        ConvolverHandBack(Job);
+      }
+    }
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+// NOTE(robin): Splits the IR into levels as described at the top of the file
+static u32 ConvolverPlan(convolver* Convolver, u32 IRLength)
+{
+  u32 BlockSize = Convolver->BlockSize;
+  u32 Start = BlockSize;
+  u32 Size = BlockSize;
+  u32 LevelCount = 0;
+
+  while (Start < IRLength)
+  {
+    if (LevelCount == CONVOLVER_MAX_LEVELS)
+      return 0;
+
+    u32 Next = 4 * Size;
+    if (Next > CONVOLVER_MAX_PARTITION)
+      Next = Size > CONVOLVER_MAX_PARTITION ? Size : CONVOLVER_MAX_PARTITION;
+
+    u32 Count = (IRLength - Start + Size - 1) / Size;
+    if (Next > Size && 2 * Next < IRLength)
+      Count = (2 * Next - Start) / Size;
+
+    convolver_level* Level = &Convolver->Levels[LevelCount++];
+    Level->Size = Size;
+    Level->Start = Start;
+    Level->PartitionCount = Count;
+    Level->Stride = (Size + 1 + 15) & ~15u;
+    Level->Background = Size > BlockSize;
+
+    Start += Count * Size;
+    Size = Next;
+  }
+
+  Convolver->LevelCount = LevelCount;
+  return 1;
+}
+
+// NOTE(robin): IRs[Channel] is the impulse response for that channel (they can all point at
+// the same one). BlockSize must be a power of 2 and every ConvolverProcess call processes
+// exactly that many frames. ThreadCount 0 computes everything in ConvolverProcess, with
+// worker threads MaxWait starts at CONVOLVER_DEFAULT_MAX_WAIT (see the top of the file).
+// Returns 0 on bad parameters or if we're out of memory.
+u32 ConvolverInit(convolver* Convolver, u32 ChannelCount, u32 BlockSize,
+    const f32* const* IRs, u32 IRLength, u32 ThreadCount)
+{
+  *Convolver = (convolver){0};
+  if (!BlockSize || (BlockSize & (BlockSize - 1)) || BlockSize < 4 || ThreadCount > CONVOLVER_MAX_THREADS)
+    return 0;
+
+  Convolver->ChannelCount = ChannelCount;
+  Convolver->BlockSize = BlockSize;
+  if (!ConvolverPlan(Convolver, IRLength))
+    return 0;
+
+  u32 Failed = 0;
+  u32 MaxSize = BlockSize;
+  for (u32 l = 0; l < Convolver->LevelCount; l++)
+  {
+    convolver_level* Level = &Convolver->Levels[l];
+    if (!FFTRealInit(&Level->FFT, 2 * Level->Size))
+      Failed = 1;
+    if (Level->Size > MaxSize)
+      MaxSize = Level->Size;
+  }
+
+  // NOTE(robin): The input ring holds the 2N samples of the longest level, the output ring
+  // holds N samples ahead of the current block
+  Convolver->RingSize = 4 * MaxSize;
+  Convolver->HeadIR = ConvolverAlloc((u64)ChannelCount * BlockSize, &Failed);
+  Convolver->HeadWork = ConvolverAlloc((u64)ChannelCount * 2 * BlockSize, &Failed);
+  Convolver->InputRing = ConvolverAlloc((u64)ChannelCount * Convolver->RingSize, &Failed);
+  Convolver->OutputRing = ConvolverAlloc((u64)ChannelCount * Convolver->RingSize, &Failed);
+  Convolver->Jobs = calloc((u64)Convolver->LevelCount * ChannelCount, sizeof(convolver_job));
+  if (Failed || !Convolver->Jobs)
+    return 0;
+
+  f32* Segment = ConvolverAlloc(2 * MaxSize, &Failed);
+  if (Failed)
+    return 0;
+
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+  {
+    u32 HeadLength = IRLength < BlockSize ? IRLength : BlockSize;
+    memcpy(Convolver->HeadIR + Channel * BlockSize, IRs[Channel], HeadLength * sizeof(f32));
+
+    for (u32 l = 0; l < Convolver->LevelCount; l++)
+    {
+      convolver_level* Level = &Convolver->Levels[l];
+      convolver_job* Job = &Convolver->Jobs[l * ChannelCount + Channel];
+      u32 Spectra = Level->PartitionCount * Level->Stride;
+
+      Job->Level = Level;
+      Job->IRRe = ConvolverAlloc(Spectra, &Failed);
+      Job->IRIm = ConvolverAlloc(Spectra, &Failed);
+      Job->FDLRe = ConvolverAlloc(Spectra, &Failed);
+      Job->FDLIm = ConvolverAlloc(Spectra, &Failed);
+      Job->Input = ConvolverAlloc(2 * Level->Size, &Failed);
+      Job->AccRe = ConvolverAlloc(Level->Stride, &Failed);
+      Job->AccIm = ConvolverAlloc(Level->Stride, &Failed);
+      Job->Time = ConvolverAlloc(2 * Level->Size, &Failed);
+      if (Failed)
+        return 0;
+
+      // NOTE(robin): Each partition is N taps padded with N zeros
+      for (u32 p = 0; p < Level->PartitionCount; p++)
+      {
+        memset(Segment, 0, 2 * Level->Size * sizeof(f32));
+        u32 Offset = Level->Start + p * Level->Size;
+        for (u32 i = 0; i < Level->Size && Offset + i < IRLength; i++)
+          Segment[i] = IRs[Channel][Offset + i];
+
+        FFTRealForward(&Level->FFT, Segment, Job->IRRe + p * Level->Stride, Job->IRIm + p * Level->Stride);
+      }
+    }
+  }
+  free(Segment);
+
+  Convolver->ThreadCount = ThreadCount;
+  Convolver->MaxWait = ThreadCount ? CONVOLVER_DEFAULT_MAX_WAIT : 0;
+  sem_init(&Convolver->Wake, 0, 0);
+  for (u32 i = 0; i < ThreadCount; i++)
+    pthread_create(&Convolver->Threads[i], 0, ConvolverWorker, Convolver);
+
+  return 1;
+}
+
+void ConvolverFree(convolver* Convolver)
+{
+  __atomic_store_n(&Convolver->Quit, 1, __ATOMIC_RELEASE);
+  for (u32 i = 0; i < Convolver->ThreadCount; i++)
+    sem_post(&Convolver->Wake);
+  for (u32 i = 0; i < Convolver->ThreadCount; i++)
+    pthread_join(Convolver->Threads[i], 0);
+  sem_destroy(&Convolver->Wake);
+
+  for (u32 i = 0; i < Convolver->LevelCount * Convolver->ChannelCount; i++)
+  {
+    convolver_job* Job = &Convolver->Jobs[i];
+    free(Job->IRRe);
+    free(Job->IRIm);
+    free(Job->FDLRe);
+    free(Job->FDLIm);
+    free(Job->Input);
+    free(Job->AccRe);
+    free(Job->AccIm);
+    free(Job->Time);
+  }
+  for (u32 l = 0; l < Convolver->LevelCount; l++)
+    FFTRealFree(&Convolver->Levels[l].FFT);
+
+  free(Convolver->Jobs);
+  free(Convolver->HeadIR);
+  free(Convolver->HeadWork);
+  free(Convolver->InputRing);
+  free(Convolver->OutputRing);
+  *Convolver = (convolver){0};
+}
+
+// NOTE(robin): Copies the job's input window out of the input ring and hands it to the workers
+// (or runs it now if there aren't any)
+static void ConvolverLaunch(convolver* Convolver, convolver_job* Job, const f32* Ring, u64 End)
+{
+  u32 Length = 2 * Job->Level->Size;
+  u32 Mask = Convolver->RingSize - 1;
+  u32 First = (u32)((End - Length) & Mask);
+  u32 Contiguous = Convolver->RingSize - First;
+  if (Contiguous >= Length)
+  {
+    memcpy(Job->Input, Ring + First, Length * sizeof(f32));
+  }
+  else
+  {
+    memcpy(Job->Input, Ring + First, Contiguous * sizeof(f32));
+    memcpy(Job->Input + Contiguous, Ring, (Length - Contiguous) * sizeof(f32));
+  }
+
+  Job->Launched = 1;
+  if (!Convolver->ThreadCount || !Job->Level->Background)
+  {
+    ConvolverRunJob(Job);
+    Job->State = ConvolverJobDone;
+    return;
+  }
+
+  __atomic_store_n(&Job->State, ConvolverJobPending, __ATOMIC_RELEASE);
+  sem_post(&Convolver->Wake);
+}
+
+// NOTE(robin): The deadline: make sure the job is done, running it here if nobody started it.
+// Returns 0 if a worker is still running it after MaxWait.
+static u32 ConvolverFinish(convolver* Convolver, convolver_job* Job)
+{
+  u32 Expected = ConvolverJobPending;
+  if (__atomic_compare_exchange_n(&Job->State, &Expected, ConvolverJobRunning, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    Convolver->Steals++;
+    ConvolverRunJob(Job);
+    __atomic_store_n(&Job->State, ConvolverJobDone, __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  if (Expected == ConvolverJobDone)
+    return 1;
+
+  // NOTE(robin): Tell the worker we're waiting, unless it finished in the meantime
+  Convolver->Waits++;
+  if (!__atomic_compare_exchange_n(&Job->State, &Expected, ConvolverJobWaited, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && Expected == ConvolverJobDone)
+    return 1;
+
+  u64 Deadline = Convolver->MaxWait ? ConvolverNow() + Convolver->MaxWait : 0;
+  while (__atomic_load_n(&Job->State, __ATOMIC_ACQUIRE) != ConvolverJobDone)
+  {
+    if (Deadline && ConvolverNow() >= Deadline)
+    {
+      Convolver->Misses++;
+      return 0;
+    }
+    ConvolverFutexWait(&Job->State, ConvolverJobWaited, Deadline);
+  }
+  return 1;
+}
+
+static void ConvolverMerge(convolver* Convolver, convolver_job* Job, f32* OutputRing, u64 Time)
+{
+  u32 Size = Job->Level->Size;
+  f32* Out = OutputRing + (Time & (Convolver->RingSize - 1));
+  const f32* Result = Job->Time + Size;
+  for (u32 i = 0; i < Size; i++)
+    Out[i] += Result[i];
+}
+
+// NOTE(robin): Processes exactly BlockSize frames per channel. Outputs may be the same
+// buffers as Inputs.
+void ConvolverProcess(convolver* Convolver, f32* const* Outputs, const f32* const* Inputs)
+{
+  u32 BlockSize = Convolver->BlockSize;
+  u32 Mask = Convolver->RingSize - 1;
+  u32 Position = (u32)(Convolver->Time & Mask);
+
+  for (u32 Channel = 0; Channel < Convolver->ChannelCount; Channel++)
+  {
+    f32* Work = Convolver->HeadWork + Channel * 2 * BlockSize;
+    f32* InputRing = Convolver->InputRing + Channel * Convolver->RingSize;
+    f32* OutputRing = Convolver->OutputRing + Channel * Convolver->RingSize;
+    const f32* HeadIR = Convolver->HeadIR + Channel * BlockSize;
+    f32* Output = Outputs[Channel];
+
+    // NOTE(robin): The ring size is a multiple of the block size so a block never wraps
+    memcpy(Work + BlockSize, Inputs[Channel], BlockSize * sizeof(f32));
+    memcpy(InputRing + Position, Inputs[Channel], BlockSize * sizeof(f32));
+
+    // NOTE(robin): What the levels computed for this block, then the head on top
+    f32* Future = OutputRing + Position;
+    for (u32 n = 0; n < BlockSize; n++)
+    {
+      Output[n] = Future[n];
+      Future[n] = 0;
+    }
+
+    for (u32 k = 0; k < BlockSize; k++)
+    {
+      f32 Tap = HeadIR[k];
+      const f32* In = Work + BlockSize - k;
+      for (u32 n = 0; n < BlockSize; n++)
+        Output[n] += Tap * In[n];
+    }
+
+    memcpy(Work, Work + BlockSize, BlockSize * sizeof(f32));
+  }
+
+  // NOTE(robin): Levels whose input just became complete. Background results go in first
+  // (they're due now), then we start the next background jobs so the workers can get going
+  // while we run level 0 ourselves.
+  u64 End = Convolver->Time + BlockSize;
+  for (u32 Pass = 0; Pass < 2; Pass++)
+  {
+    for (u32 l = 0; l < Convolver->LevelCount; l++)
+    {
+      convolver_level* Level = &Convolver->Levels[l];
+      if (End % Level->Size || Level->Background != (Pass == 0))
+        continue;
+
+      for (u32 Channel = 0; Channel < Convolver->ChannelCount; Channel++)
+      {
+        convolver_job* Job = &Convolver->Jobs[l * Convolver->ChannelCount + Channel];
+        f32* InputRing = Convolver->InputRing + Channel * Convolver->RingSize;
+        f32* OutputRing = Convolver->OutputRing + Channel * Convolver->RingSize;
+
+        if (Level->Background)
+        {
+          // NOTE(robin): The job started N samples ago produced output for [End, End + N).
+          // After a miss its result is too late to use, and we wait for the worker to be done
+          // with it before we give it the next one.
+          if (Job->Missed)
+          {
+            if (__atomic_load_n(&Job->State, __ATOMIC_ACQUIRE) != ConvolverJobDone)
+              continue;
+            Job->Missed = 0;
+            Job->Restart = 1;
+          }
+          else if (Job->Launched)
+          {
+            if (!ConvolverFinish(Convolver, Job))
+            {
+              Job->Missed = 1;
+              continue;
+            }
+            ConvolverMerge(Convolver, Job, OutputRing, End);
+          }
+          ConvolverLaunch(Convolver, Job, InputRing, End);
+        }
+        else
+        {
+          // NOTE(robin): Level 0 starts at B in the IR, so it's output for the next block
+          ConvolverLaunch(Convolver, Job, InputRing, End);
+          ConvolverMerge(Convolver, Job, OutputRing, End);
+        }
+      }
+    }
+  }
+
+  Convolver->Time = End;
+}
+
+void ConvolverPrintStats(convolver* Convolver)
+{
+  printf("Convolver: %u channels, block %u, %u levels, %u threads\n",
+      Convolver->ChannelCount, Convolver->BlockSize, Convolver->LevelCount, Convolver->ThreadCount);
+  for (u32 l = 0; l < Convolver->LevelCount; l++)
+  {
+    convolver_level* Level = &Convolver->Levels[l];
+    printf("  level %u: %u x %u samples from %u (%s)\n", l, Level->PartitionCount, Level->Size,
+        Level->Start, Level->Background ? "background" : "callback");
+  }
+  printf("  deadlines that waited for a worker: %u, ran in the callback: %u, missed: %u\n",
+      Convolver->Waits, Convolver->Steals, Convolver->Misses);
+}
@@ -0,0 +1,312 @@
+/*
+ * This file tests and benchmarks convolver.c with synthetic reverb impulse responses, so it
+ * runs anywhere without an audio device.
+ *
+ * - Accuracy: the output is compared with a direct (f64) convolution.
+ * - Determinism: the same input through the threaded engine and the offline path (ThreadCount
+ *   0) must give bit identical output.
+ * - Misses: a background job held past its deadline must leave that level silent, and once
+ *   the level has refilled its delay line the output must be bit identical to the offline
+ *   path again.
+ * - CPU: the offline path for a range of IR lengths and channel counts at 48kHz with 128
+ *   frame blocks. The long levels only run every few blocks, so we report the average block
+ *   (over a whole cycle of the longest level) and the worst single block, as the share of
+ *   the block's duration one CPU core needs. With worker threads on spare cores the long
+ *   levels move off the audio thread, so the worst block drops to roughly the head and level 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "fft.c"
+#include "denormal.c"
+#include "convolver.c"
+
+#define BENCH_RATE 48000
+#define BENCH_BLOCK 128
+#define BENCH_MAX_CHANNELS 32
+#define TEST_IR_LENGTH 20000
+#define TEST_BLOCKS 400
+
+typedef struct
+{
+  convolver Convolver;
+  f32* Inputs[BENCH_MAX_CHANNELS];
+  f32* Outputs[BENCH_MAX_CHANNELS];
+  u32 BlocksPerCycle;
+} bench_data;
+
+// NOTE(robin): Exponentially decaying noise, like a room
+f32* MakeIR(u32 Length, u32 Seed)
+{
+  f32* IR = malloc(Length * sizeof(f32));
+  srand(Seed);
+  for (u32 i = 0; i < Length; i++)
+  {
+    f32 Noise = (f32)rand() / (f32)RAND_MAX - 0.5f;
+    IR[i] = Noise * expf(-6.9f * (f32)i / (f32)Length);
+  }
+  IR[0] = 1.0f;
+  return IR;
+}
+
+// NOTE(robin): Runs TEST_BLOCKS blocks of noise through two channels with different IRs
+void RunTest(f32* Output, const f32* Input, f32** IRs, u32 ThreadCount)
+{
+  static convolver Convolver;
+  u32 Initialised = ConvolverInit(&Convolver, 2, BENCH_BLOCK, (const f32* const*)IRs, TEST_IR_LENGTH, ThreadCount);
+  assert(Initialised);
+
+  // NOTE(robin): We're rendering, so we wait for the workers however long they take
+  Convolver.MaxWait = 0;
+
+  f32 InBlock[2][BENCH_BLOCK];
+  f32 OutBlock[2][BENCH_BLOCK];
+  const f32* Inputs[2] = {InBlock[0], InBlock[1]};
+  f32* Outputs[2] = {OutBlock[0], OutBlock[1]};
+
+  for (u32 Block = 0; Block < TEST_BLOCKS; Block++)
+  {
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+    {
+      InBlock[0][i] = Input[Block * BENCH_BLOCK + i];
+      InBlock[1][i] = -Input[Block * BENCH_BLOCK + i];
+    }
+
+    ConvolverProcess(&Convolver, Outputs, Inputs);
+
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+    {
+      Output[2 * (Block * BENCH_BLOCK + i) + 0] = OutBlock[0][i];
+      Output[2 * (Block * BENCH_BLOCK + i) + 1] = OutBlock[1][i];
+    }
+  }
+
+  if (ThreadCount)
+    ConvolverPrintStats(&Convolver);
+  assert(!Convolver.Misses);
+  ConvolverFree(&Convolver);
+}
+
+void VerifyConvolver(void)
+{
+  u32 Length = TEST_BLOCKS * BENCH_BLOCK;
+  f32* Input = malloc(Length * sizeof(f32));
+  f32* Offline = malloc(2 * Length * sizeof(f32));
+  f32* Threaded = malloc(2 * Length * sizeof(f32));
+  f32* IRs[2] = {MakeIR(TEST_IR_LENGTH, 1), MakeIR(TEST_IR_LENGTH, 2)};
+
+  srand(3);
+  for (u32 i = 0; i < Length; i++)
+    Input[i] = (f32)rand() / (f32)RAND_MAX - 0.5f;
+
+  RunTest(Offline, Input, IRs, 0);
+  RunTest(Threaded, Input, IRs, 2);
+
+  // NOTE(robin): Checking every 7th sample is enough to hit every level and partition
+  f64 MaxError = 0;
+  f64 Power = 0;
+  u32 Checked = 0;
+  for (u32 n = 0; n < Length; n += 7)
+  {
+    for (u32 Channel = 0; Channel < 2; Channel++)
+    {
+      f64 Sum = 0;
+      f64 Sign = Channel ? -1.0 : 1.0;
+      for (u32 k = 0; k < TEST_IR_LENGTH && k <= n; k++)
+        Sum += (f64)IRs[Channel][k] * Sign * (f64)Input[n - k];
+
+      f64 Error = fabs(Sum - (f64)Offline[2 * n + Channel]);
+      if (Error > MaxError)
+        MaxError = Error;
+      Power += Sum * Sum;
+      Checked++;
+    }
+  }
+
+  f64 RMS = sqrt(Power / Checked);
+  printf("Max error against direct convolution: %.1fdB below the output RMS\n", 20.0 * log10(MaxError / RMS));
+  assert(MaxError < 1e-4 * RMS);
+
+  assert(!memcmp(Offline, Threaded, 2 * Length * sizeof(f32)));
+  printf("Threaded output is bit identical to the offline path\n\n");
+
+  free(Input);
+  free(Offline);
+  free(Threaded);
+  free(IRs[0]);
+  free(IRs[1]);
+}
+
+#define MISS_BLOCK 64
+#define MISS_IR_LENGTH 2048
+#define MISS_BLOCKS 96
+
+// NOTE(robin): Runs MISS_BLOCKS blocks of Input through Convolver, one channel. If Stall is set
+// we play the worker of level 1 ourselves: the convolver thinks it has a thread (so it hands
+// the jobs over) but doesn't have one, and we hold the job launched at block Stall until its
+// deadline has been missed. Returns the sample its deadline was at.
+static u32 RunMiss(convolver* Convolver, f32* Output, const f32* Input, u32 Stall)
+{
+  convolver_job* Job = &Convolver->Jobs[1];
+  u32 Size = Job->Level->Size;
+  u32 MissedAt = 0;
+  if (Stall)
+  {
+    Convolver->ThreadCount = 1;
+    Convolver->MaxWait = 100000;
+  }
+
+  for (u32 Block = 0; Block < MISS_BLOCKS; Block++)
+  {
+    const f32* Inputs[1] = {Input + Block * MISS_BLOCK};
+    f32* Outputs[1] = {Output + Block * MISS_BLOCK};
+    ConvolverProcess(Convolver, Outputs, Inputs);
+
+    // NOTE(robin): Picked up like a worker would, and then not run
+    if (Stall && Block == Stall)
+    {
+      u32 Expected = ConvolverJobPending;
+      u32 Taken = __atomic_compare_exchange_n(&Job->State, &Expected, ConvolverJobRunning, 0,
+          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+      assert(Taken);
+      MissedAt = (Block + 1) * MISS_BLOCK + Size;
+    }
+
+    // NOTE(robin): The deadline has passed, the late worker finishes
+    if (Stall && Job->Missed && __atomic_load_n(&Job->State, __ATOMIC_ACQUIRE) != ConvolverJobDone)
+    {
+      ConvolverRunJob(Job);
+      ConvolverHandBack(Job);
+    }
+  }
+
+  // NOTE(robin): There's no thread to join
+  Convolver->ThreadCount = 0;
+  return MissedAt;
+}
+
+// NOTE(robin): The IR is zero outside level 1, so the output is exactly that level's
+void VerifyMiss(void)
+{
+  f32* IR = calloc(MISS_IR_LENGTH, sizeof(f32));
+  f32* Input = malloc(MISS_BLOCKS * MISS_BLOCK * sizeof(f32));
+  f32* Offline = malloc(MISS_BLOCKS * MISS_BLOCK * sizeof(f32));
+  f32* Missed = malloc(MISS_BLOCKS * MISS_BLOCK * sizeof(f32));
+  const f32* IRs[1] = {IR};
+
+  static convolver Convolver;
+  u32 Initialised = ConvolverInit(&Convolver, 1, MISS_BLOCK, IRs, MISS_IR_LENGTH, 0);
+  assert(Initialised && Convolver.LevelCount == 2 && Convolver.Levels[1].Background);
+  u32 Start = Convolver.Levels[1].Start;
+  u32 Size = Convolver.Levels[1].Size;
+  u32 Count = Convolver.Levels[1].PartitionCount;
+  ConvolverFree(&Convolver);
+
+  srand(5);
+  for (u32 i = Start; i < MISS_IR_LENGTH; i++)
+    IR[i] = (f32)rand() / (f32)RAND_MAX - 0.5f;
+  for (u32 i = 0; i < MISS_BLOCKS * MISS_BLOCK; i++)
+    Input[i] = (f32)rand() / (f32)RAND_MAX - 0.5f;
+
+  Initialised = ConvolverInit(&Convolver, 1, MISS_BLOCK, IRs, MISS_IR_LENGTH, 0);
+  assert(Initialised);
+  RunMiss(&Convolver, Offline, Input, 0);
+  ConvolverFree(&Convolver);
+
+  // NOTE(robin): Level 1 launches when a block ends on a multiple of its size, we stall the
+  // one launched at the end of block 4 * Size / MISS_BLOCK - 1
+  Initialised = ConvolverInit(&Convolver, 1, MISS_BLOCK, IRs, MISS_IR_LENGTH, 0);
+  assert(Initialised);
+  u32 MissedAt = RunMiss(&Convolver, Missed, Input, 4 * Size / MISS_BLOCK - 1);
+  u32 Misses = Convolver.Misses;
+  ConvolverFree(&Convolver);
+  assert(Misses == 1);
+
+  // NOTE(robin): Up to the miss the output is the offline one. The missed job's N samples
+  // and the next N, while the late job was still owned by the worker, are silent. Then the
+  // level restarts with a cleared delay line and is exact again once the job launched
+  // PartitionCount - 1 jobs after the restart has merged.
+  u32 Silent = MissedAt + 2 * Size;
+  u32 Exact = MissedAt + (Count + 1) * Size;
+  assert(Exact < MISS_BLOCKS * MISS_BLOCK);
+  assert(!memcmp(Offline, Missed, MissedAt * sizeof(f32)));
+  for (u32 i = MissedAt; i < Silent; i++)
+    assert(Missed[i] == 0.0f);
+  assert(!memcmp(Offline + Exact, Missed + Exact, (MISS_BLOCKS * MISS_BLOCK - Exact) * sizeof(f32)));
+  printf("A missed deadline leaves the level silent for %u samples and it's bit identical again after %u\n\n",
+      Silent - MissedAt, Exact - MissedAt);
+
+  free(IR);
+  free(Input);
+  free(Offline);
+  free(Missed);
+}
+
+void BenchCycle(void* Context)
+{
+  bench_data* Data = Context;
+  for (u32 Block = 0; Block < Data->BlocksPerCycle; Block++)
+    ConvolverProcess(&Data->Convolver, Data->Outputs, (const f32* const*)Data->Inputs);
+}
+
+int main(int argc, char** argv)
+{
+  VerifyConvolver();
+  VerifyMiss();
+
+  static bench_data Data;
+  for (u32 Channel = 0; Channel < BENCH_MAX_CHANNELS; Channel++)
+  {
+    Data.Inputs[Channel] = malloc(BENCH_BLOCK * sizeof(f32));
+    Data.Outputs[Channel] = malloc(BENCH_BLOCK * sizeof(f32));
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+      Data.Inputs[Channel][i] = 0.5f * sinf((f32)(i * (Channel + 1)) * 0.01f);
+  }
+
+  u32 Lengths[] = {BENCH_RATE / 2, BENCH_RATE, 2 * BENCH_RATE, 4 * BENCH_RATE};
+  u32 Channels[] = {1, 8, 32};
+  f64 BlockNS = BENCH_BLOCK * 1e9 / BENCH_RATE;
+
+  printf("Offline path, %d frame blocks at %dHz, share of real time on one core\n", BENCH_BLOCK, BENCH_RATE);
+  printf("%-10s %9s %12s %12s %12s\n", "IR", "channels", "ns/sample", "average", "worst block");
+  for (u32 i = 0; i < sizeof(Lengths) / sizeof(Lengths[0]); i++)
+  {
+    f32* IR = MakeIR(Lengths[i], 4);
+    const f32* IRs[BENCH_MAX_CHANNELS];
+    for (u32 Channel = 0; Channel < BENCH_MAX_CHANNELS; Channel++)
+      IRs[Channel] = IR;
+
+    for (u32 j = 0; j < sizeof(Channels) / sizeof(Channels[0]); j++)
+    {
+      u32 Initialised = ConvolverInit(&Data.Convolver, Channels[j], BENCH_BLOCK, IRs, Lengths[i], 0);
+      assert(Initialised);
+
+      u32 MaxSize = Data.Convolver.Levels[Data.Convolver.LevelCount - 1].Size;
+      Data.BlocksPerCycle = MaxSize / BENCH_BLOCK;
+      f64 Average = BenchMeasure(BenchCycle, &Data) / Data.BlocksPerCycle;
+
+      // NOTE(robin): The worst block is the one where every level is due
+      f64 Worst = 0;
+      for (u32 Block = 0; Block < 4 * Data.BlocksPerCycle; Block++)
+      {
+        u64 Start = BenchGetTime();
+        ConvolverProcess(&Data.Convolver, Data.Outputs, (const f32* const*)Data.Inputs);
+        f64 Elapsed = (f64)(BenchGetTime() - Start);
+        if (Elapsed > Worst)
+          Worst = Elapsed;
+      }
+
+      printf("%8.1fs %9u %12.2f %11.1f%% %11.1f%%\n", (f64)Lengths[i] / BENCH_RATE, Channels[j],
+          Average / (BENCH_BLOCK * Channels[j]), 100.0 * Average / BlockNS, 100.0 * Worst / BlockNS);
+      ConvolverFree(&Data.Convolver);
+    }
+    free(IR);
+  }
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * This file keeps parallel processing paths sample aligned when some of them have latency
+ * (a lookahead limiter, a linear phase filter, a plugin that works in blocks...): every path
+ * reports its latency, and the others get delayed to match the slowest one.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   delay_comp DelayComp;
+ *   DelayCompInit(&DelayComp, PathCount, ChannelCount, MaxLatency);
+ *   DelayCompSetLatency(&DelayComp, Path, Latency); // NOTE(robin): For each path with latency
+ *   DelayCompUpdate(&DelayComp);
+ *   ...
+ *   // In the callback
+ *   DelayCompBegin(&DelayComp);
+ *   u32 Lookahead = DelayCompLatency(&DelayComp, Path); // NOTE(robin): What the path has to run with
+ *   ... run each path ...
+ *   DelayCompProcess(&DelayComp, Path, Channel, Samples, FrameCount); // NOTE(robin): After each path
+ *   ... mix the paths ...
+ *   DelayCompEnd(&DelayComp, FrameCount);
+ *
+ *   // On another thread, when a path's latency changes
+ *   DelayCompSetLatency(&DelayComp, Path, Latency);
+ *   if (DelayCompUpdate(&DelayComp))
+ *     ... tell the host the total latency changed, e.g. jack_recompute_total_latencies ...
+ *
+ * NOTE(robin): The total latency is the largest latency of all the paths, and every path gets
+ * a delay of the total minus its own latency after it, so they all come out the total late.
+ * The delays are rings allocated for MaxLatency up front, which are written every callback
+ * whatever the delay, so changing a delay only moves where we read from.
+ *
+ * Working out the delays happens in DelayCompUpdate, off the audio thread. The result is
+ * handed to the audio thread, which picks it up in DelayCompBegin, so the latency a path runs
+ * with (DelayCompLatency) and the delays after the other paths change in the same callback
+ * and they stay aligned through the change. There are two slots for it: DelayCompUpdate
+ * writes the one the audio thread isn't using, and only once the audio thread has picked up
+ * the last one, otherwise it leaves it for the next call.
+ *
+ * Changing a delay jumps to a different point in the signal, which clicks; crossfade or mute
+ * around it if that matters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DelayCompLoad(Pointer) (*(volatile u32*)(Pointer))
+#define DelayCompStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#else
+#define DelayCompLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_ACQUIRE)
+#define DelayCompStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELEASE)
+#endif
+
+#define DELAY_COMP_MAX_PATHS 8
+#define DELAY_COMP_MAX_CHANNELS 8
+
+typedef struct
+{
+  u32 Total;
+  u32 Latencies[DELAY_COMP_MAX_PATHS];
+  u32 Delays[DELAY_COMP_MAX_PATHS];
+} delay_comp_config;
+
+typedef struct
+{
+  u32 PathCount;
+  u32 ChannelCount;
+  u32 MaxLatency;
+
+  // NOTE(robin): A ring per path and channel
+  f32* Lines;
+  u32 Size;
+  u32 Position;
+
+  // NOTE(robin): Only touched by the audio thread
+  delay_comp_config Active;
+  u32 ActiveGeneration;
+
+  // NOTE(robin): Only touched by the thread that calls DelayCompUpdate
+  u32 Requested[DELAY_COMP_MAX_PATHS];
+
+  delay_comp_config Configs[2];
+  u32 Published;    // NOTE(robin): Generation, the config is in Configs[Published & 1]
+  u32 Acknowledged; // NOTE(robin): The generation the audio thread runs with
+  u32 Total;        // NOTE(robin): Of the last published config, for the host's latency queries
+} delay_comp;
+
+void DelayCompInit(delay_comp* DelayComp, u32 PathCount, u32 ChannelCount, u32 MaxLatency)
+{
+  *DelayComp = (delay_comp){0};
+  DelayComp->PathCount = PathCount < DELAY_COMP_MAX_PATHS ? PathCount : DELAY_COMP_MAX_PATHS;
+  DelayComp->ChannelCount = ChannelCount < DELAY_COMP_MAX_CHANNELS ? ChannelCount : DELAY_COMP_MAX_CHANNELS;
+  DelayComp->MaxLatency = MaxLatency;
+
+  DelayComp->Size = 1;
+  while (DelayComp->Size <= MaxLatency)
+    DelayComp->Size *= 2;
+  DelayComp->Lines = calloc((size_t)DelayComp->PathCount * DelayComp->ChannelCount * DelayComp->Size, sizeof(f32));
+}
+
+void DelayCompFree(delay_comp* DelayComp)
+{
+  free(DelayComp->Lines);
+  DelayComp->Lines = 0;
+}
+
+// NOTE(robin): Returns 0 if the latency is more than we can compensate for, the path keeps
+// its old one then
+u32 DelayCompSetLatency(delay_comp* DelayComp, u32 Path, u32 Latency)
+{
+  if (Path >= DelayComp->PathCount || Latency > DelayComp->MaxLatency)
+    return 0;
+
+  DelayComp->Requested[Path] = Latency;
+  return 1;
+}
+
+// NOTE(robin): Works out the delays for the latencies set so far and hands them to the audio
+// thread. Returns 1 if the total latency changed, 0 if it didn't or if the audio thread
+// hasn't picked up the previous change yet, in which case call again later.
+u32 DelayCompUpdate(delay_comp* DelayComp)
+{
+  u32 Published = DelayComp->Published;
+  if (DelayCompLoad(&DelayComp->Acknowledged) != Published)
+    return 0;
+
+  delay_comp_config* Current = &DelayComp->Configs[Published & 1];
+  if (Published && !memcmp(Current->Latencies, DelayComp->Requested, sizeof(DelayComp->Requested)))
+    return 0;
+
+  delay_comp_config* Next = &DelayComp->Configs[(Published + 1) & 1];
+  *Next = (delay_comp_config){0};
+  for (u32 i = 0; i < DelayComp->PathCount; i++)
+  {
+    Next->Latencies[i] = DelayComp->Requested[i];
+    Next->Total = Next->Latencies[i] > Next->Total ? Next->Latencies[i] : Next->Total;
+  }
+  for (u32 i = 0; i < DelayComp->PathCount; i++)
+    Next->Delays[i] = Next->Total - Next->Latencies[i];
+
+  u32 Changed = !Published || Next->Total != Current->Total;
+  DelayCompStore(&DelayComp->Total, Next->Total);
+  DelayCompStore(&DelayComp->Published, Published + 1);
+  return Changed;
+}
+
+// NOTE(robin): The total latency, from any thread. Right after a change it can be a callback
+// ahead of what the audio thread is running with.
+u32 DelayCompTotal(delay_comp* DelayComp)
+{
+  return DelayCompLoad(&DelayComp->Total);
+}
+
+// NOTE(robin): Call at the start of the callback, before any of the paths run
+void DelayCompBegin(delay_comp* DelayComp)
+{
+  u32 Published = DelayCompLoad(&DelayComp->Published);
+  if (Published != DelayComp->ActiveGeneration)
+  {
+    DelayComp->Active = DelayComp->Configs[Published & 1];
+    DelayComp->ActiveGeneration = Published;
+    DelayCompStore(&DelayComp->Acknowledged, Published);
+  }
+}
+
+// NOTE(robin): The latency the path has to run with in this callback
+u32 DelayCompLatency(delay_comp* DelayComp, u32 Path)
+{
+  return DelayComp->Active.Latencies[Path];
+}
+
+// NOTE(robin): Delays the output of a path in place. Call for every path and channel, every
+// callback, also for the ones that currently have no delay, so their history is there when
+// they get one.
+void DelayCompProcess(delay_comp* DelayComp, u32 Path, u32 Channel, f32* Samples, u32 FrameCount)
+{
+  f32* Line = DelayComp->Lines + ((size_t)Path * DelayComp->ChannelCount + Channel) * DelayComp->Size;
+  u32 Mask = DelayComp->Size - 1;
+  u32 Delay = DelayComp->Active.Delays[Path];
+  u32 Position = DelayComp->Position;
+
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Line[(Position + i) & Mask] = Samples[i];
+    Samples[i] = Line[(Position + i - Delay) & Mask];
+  }
+}
+
+// NOTE(robin): Call at the end of the callback
+void DelayCompEnd(delay_comp* DelayComp, u32 FrameCount)
+{
+  DelayComp->Position += FrameCount;
+}
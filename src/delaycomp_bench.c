@@ -0,0 +1,262 @@
+/*
+ * This file tests delaycomp.c and limiter.c with synthetic signals, so it runs anywhere
+ * without an audio device.
+ *
+ * - Alignment: three paths with different latencies (each just a delay standing in for its
+ *   processing) get an impulse train. After compensation every path must give the input
+ *   exactly the total latency late, on every frame, with odd block sizes.
+ * - Latency change: a third of the way in, one path's latency goes up past the others and
+ *   later back down, like jack_example's limiter. The change has to reach the path and the
+ *   delays in the same callback, so the paths that didn't change stay aligned through it,
+ *   and DelayCompUpdate mustn't publish a second change before the audio thread picked up
+ *   the first.
+ * - Limiter: the monotonic queue's peak against a plain scan of the window, on noise with
+ *   the lookahead changing between blocks, compared through the limiter's output. Then its
+ *   cost per frame for a short and a long lookahead, which should be about the same.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "delaycomp.c"
+#include "limiter.c"
+
+#define BENCH_RATE 48000
+#define BENCH_PATHS 3
+#define BENCH_LENGTH (1 << 16)
+#define BENCH_MAX_LATENCY 512
+#define BENCH_BLOCK 128
+
+typedef struct
+{
+  f32* Input;
+  f32* Paths[BENCH_PATHS];
+  // NOTE(robin): What each frame ran with
+  u32 Totals[BENCH_LENGTH];
+  u32 Latencies[BENCH_PATHS][BENCH_LENGTH];
+
+  limiter Limiter;
+  f32* Left;
+  f32* Right;
+  u32 Lookahead;
+} bench_data;
+
+u32 Random(u32* State)
+{
+  *State = *State * 1664525u + 1013904223u;
+  return *State >> 8;
+}
+
+// NOTE(robin): A path that has Latency, it gives what went in Latency frames earlier
+void RunPath(f32* Input, f32* Output, u32 Start, u32 FrameCount, u32 Latency)
+{
+  for (u32 i = 0; i < FrameCount; i++)
+    Output[i] = Start + i >= Latency ? Input[Start + i - Latency] : 0.0f;
+}
+
+void VerifyAlignment(bench_data* Data)
+{
+  for (u32 i = 0; i < BENCH_LENGTH; i++)
+    Data->Input[i] = i % 997 == 0 ? 1.0f : 0.0f;
+
+  delay_comp DelayComp;
+  DelayCompInit(&DelayComp, BENCH_PATHS, 1, BENCH_MAX_LATENCY);
+  assert(DelayComp.Lines);
+  u32 Latencies[BENCH_PATHS] = {0, 64, 200};
+  for (u32 Path = 0; Path < BENCH_PATHS; Path++)
+  {
+    u32 Set = DelayCompSetLatency(&DelayComp, Path, Latencies[Path]);
+    assert(Set);
+  }
+  u32 Changed = DelayCompUpdate(&DelayComp);
+  assert(Changed && DelayCompTotal(&DelayComp) == 200);
+
+  u32 TooLong = DelayCompSetLatency(&DelayComp, 1, BENCH_MAX_LATENCY + 1);
+  assert(!TooLong);
+
+  // NOTE(robin): Path 1 goes to 300 (now the slowest) a third of the way in and back to 64
+  // two thirds of the way in. Each time path 0 asks for a change too, before the audio
+  // thread ran, which has to wait for the next callback.
+  u32 Switches[] = {BENCH_LENGTH / 3, 2 * BENCH_LENGTH / 3};
+  u32 SwitchLatencies[] = {300, 64};
+  u32 WaitingLatencies[] = {32, 0};
+  u32 SwitchCount = 0;
+  u32 Waiting = 0;
+
+  u32 Seed = 1;
+  for (u32 Start = 0; Start < BENCH_LENGTH;)
+  {
+    u32 FrameCount = 1 + Random(&Seed) % 256;
+    FrameCount = Start + FrameCount < BENCH_LENGTH ? FrameCount : BENCH_LENGTH - Start;
+
+    u32 Published = DelayComp.Published;
+    if (Waiting)
+    {
+      Changed = DelayCompUpdate(&DelayComp);
+      assert(!Changed && DelayComp.Published == Published + 1);
+      Waiting = 0;
+    }
+    else if (SwitchCount < 2 && Start >= Switches[SwitchCount])
+    {
+      DelayCompSetLatency(&DelayComp, 1, SwitchLatencies[SwitchCount]);
+      Changed = DelayCompUpdate(&DelayComp);
+      assert(Changed && DelayComp.Published == Published + 1);
+
+      DelayCompSetLatency(&DelayComp, 0, WaitingLatencies[SwitchCount]);
+      Changed = DelayCompUpdate(&DelayComp);
+      assert(!Changed && DelayComp.Published == Published + 1);
+      Waiting = 1;
+      SwitchCount++;
+    }
+
+    DelayCompBegin(&DelayComp);
+    for (u32 Path = 0; Path < BENCH_PATHS; Path++)
+    {
+      f32* Output = Data->Paths[Path] + Start;
+      RunPath(Data->Input, Output, Start, FrameCount, DelayCompLatency(&DelayComp, Path));
+      DelayCompProcess(&DelayComp, Path, 0, Output, FrameCount);
+    }
+    for (u32 i = 0; i < FrameCount; i++)
+    {
+      Data->Totals[Start + i] = DelayComp.Active.Total;
+      for (u32 Path = 0; Path < BENCH_PATHS; Path++)
+        Data->Latencies[Path][Start + i] = DelayComp.Active.Latencies[Path];
+    }
+    DelayCompEnd(&DelayComp, FrameCount);
+    Start += FrameCount;
+  }
+  assert(SwitchCount == 2 && !Waiting);
+
+  // NOTE(robin): A path whose own latency changed has output from before the change in its
+  // delay line, made with the old latency, and comes out aligned again once it has played
+  // through that. Everything else has to be aligned on every frame.
+  u32 Impulses = 0;
+  u32 Settling = 0;
+  for (u32 i = 0; i < BENCH_LENGTH; i++)
+  {
+    u32 Total = Data->Totals[i];
+    f32 Expected = i >= Total ? Data->Input[i - Total] : 0.0f;
+    for (u32 Path = 0; Path < BENCH_PATHS; Path++)
+    {
+      u32 Delay = Total - Data->Latencies[Path][i];
+      u32 Written = i - Delay;
+      if (i < Delay || Data->Latencies[Path][Written] == Data->Latencies[Path][i])
+      {
+        assert(Data->Paths[Path][i] == Expected);
+      }
+      else
+      {
+        u32 Latency = Data->Latencies[Path][Written];
+        assert(Data->Paths[Path][i] == (Written >= Latency ? Data->Input[Written - Latency] : 0.0f));
+        Settling++;
+      }
+    }
+    Impulses += Expected != 0.0f;
+  }
+  printf("alignment: %u impulses through %u paths, total latency 200 -> 300 -> 200, %u frames settling\n",
+      Impulses, BENCH_PATHS, Settling);
+  assert(Impulses > 60 && Settling < 4 * BENCH_MAX_LATENCY);
+
+  DelayCompFree(&DelayComp);
+}
+
+// NOTE(robin): LimiterProcess with the loudest peak in the window found by looking at every
+// frame in it. Same arithmetic otherwise, so the outputs have to match exactly.
+void BruteForceLimiter(bench_data* Data, f32* Left, f32* Right, u32 Start, u32 FrameCount, u32 Lookahead,
+    f32* Gain, f32* OutLeft, f32* OutRight)
+{
+  f32 Attack = 1.0f - expf(-5.0f / (f32)(Lookahead + 1));
+  f32 Release = Data->Limiter.Release;
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    u32 Frame = Start + i;
+    f32 Peak = 0.0f;
+    for (u32 k = 0; k <= Lookahead && k <= Frame; k++)
+      Peak = fmaxf(Peak, fmaxf(fabsf(Left[Frame - k]), fabsf(Right[Frame - k])));
+
+    f32 Target = Peak > Data->Limiter.Ceiling ? Data->Limiter.Ceiling / Peak : 1.0f;
+    *Gain += (Target - *Gain) * (Target < *Gain ? Attack : Release);
+
+    OutLeft[i] = Frame >= Lookahead ? Left[Frame - Lookahead] * *Gain : 0.0f;
+    OutRight[i] = Frame >= Lookahead ? Right[Frame - Lookahead] * *Gain : 0.0f;
+  }
+}
+
+void VerifyLimiter(bench_data* Data)
+{
+  // NOTE(robin): Noise with bursts, so the peak in the window goes up and down a lot
+  u32 State = 7;
+  f32* Left = Data->Input;
+  f32* Right = Data->Paths[0];
+  for (u32 i = 0; i < BENCH_LENGTH; i++)
+  {
+    f32 Level = (i / 1500) % 3 == 0 ? 0.9f : 0.1f;
+    Left[i] = Level * ((f32)(Random(&State) % 2001) / 1000.0f - 1.0f);
+    Right[i] = Level * ((f32)(Random(&State) % 2001) / 1000.0f - 1.0f);
+  }
+
+  LimiterInit(&Data->Limiter, 0.2f, BENCH_RATE);
+  f32 Gain = 1.0f;
+  f32 Output[2][BENCH_BLOCK];
+  f32 Expected[2][BENCH_BLOCK];
+  u32 Lookaheads[] = {64, 1, 300, 0, LIMITER_MAX_LOOKAHEAD, 17};
+  u32 Mismatches = 0;
+  for (u32 Block = 0; Block < BENCH_LENGTH / BENCH_BLOCK; Block++)
+  {
+    u32 Start = Block * BENCH_BLOCK;
+    u32 Lookahead = Lookaheads[(Block / 40) % (sizeof(Lookaheads) / sizeof(Lookaheads[0]))];
+
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+    {
+      Output[0][i] = Left[Start + i];
+      Output[1][i] = Right[Start + i];
+    }
+    LimiterProcess(&Data->Limiter, Output[0], Output[1], BENCH_BLOCK, Lookahead);
+    BruteForceLimiter(Data, Left, Right, Start, BENCH_BLOCK, Lookahead, &Gain, Expected[0], Expected[1]);
+
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+    {
+      Mismatches += fabsf(Output[0][i] - Expected[0][i]) > 1e-6f;
+      Mismatches += fabsf(Output[1][i] - Expected[1][i]) > 1e-6f;
+    }
+  }
+  printf("limiter: %u frames, lookahead switching between 0 and %u, %u mismatches against a plain scan\n",
+      BENCH_LENGTH, LIMITER_MAX_LOOKAHEAD, Mismatches);
+  assert(Mismatches == 0);
+}
+
+void BenchLimiter(void* Context)
+{
+  bench_data* Data = Context;
+  LimiterProcess(&Data->Limiter, Data->Left, Data->Right, BENCH_BLOCK, Data->Lookahead);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  Data.Input = malloc(BENCH_LENGTH * sizeof(f32));
+  for (u32 Path = 0; Path < BENCH_PATHS; Path++)
+    Data.Paths[Path] = malloc(BENCH_LENGTH * sizeof(f32));
+
+  VerifyAlignment(&Data);
+  VerifyLimiter(&Data);
+
+  printf("%10s %14s\n", "lookahead", "ns/frame");
+  u32 Lookaheads[] = {16, 64, 256, LIMITER_MAX_LOOKAHEAD};
+  for (u32 i = 0; i < sizeof(Lookaheads) / sizeof(Lookaheads[0]); i++)
+  {
+    // NOTE(robin): The noise from the limiter check, one block at a time, loud enough that
+    // the limiter works all the time
+    Data.Left = Data.Input;
+    Data.Right = Data.Paths[0];
+    Data.Lookahead = Lookaheads[i];
+    LimiterInit(&Data.Limiter, 0.01f, BENCH_RATE);
+    printf("%10u %14.2f\n", Lookaheads[i], BenchMeasure(BenchLimiter, &Data) / BENCH_BLOCK);
+  }
+
+  return 0;
+}
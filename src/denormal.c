@@ -0,0 +1,164 @@
+/*
+ * This file sets up the floating point environment for audio threads and provides a debug
+ * counter for subnormal ("denormal") samples.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): Subnormals are the tiny floats below 2^-126 (about 1e-38). Any recursive
+ * filter that is fed silence decays towards zero and ends up spending a long time in that
+ * range, e.g. a reverb or filter tail after the music stops. Most x86 CPUs handle
+ * subnormals in microcode, so every operation on one can be 10-100x slower than normal and
+ * a callback that usually takes 10% of the period suddenly misses its deadline.
+ *
+ * Nothing we do in audio needs that range (it's ~700dB below full scale) so we tell the CPU
+ * to treat subnormals as zero:
+ *
+ * - x86: MXCSR FTZ (flush results to zero) and DAZ (treat subnormal inputs as zero)
+ * - AArch64: FPCR.FZ, which does both
+ *
+ * The floating point environment is per thread, so this has to be done at the top of every
+ * thread that runs DSP code, and should be put back the way it was when that code is done:
+ *
+ *   fp_state State = FPEnterAudioThread();
+ *   ...
+ *   FPLeaveAudioThread(State);
+ *
+ * If you don't own the thread (e.g. JACK's process thread) do the same around the body of
+ * your callback, so that we don't change the behaviour of anyone else's code on that thread.
+ * Reading and writing MXCSR/FPCR costs a handful of cycles, nothing next to a period.
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#define FP_X86 1
+#elif defined(__aarch64__)
+#define FP_ARM64 1
+#endif
+
+typedef struct
+{
+  u64 Control; // NOTE(robin): MXCSR or FPCR on entry
+} fp_state;
+
+#define FP_X86_FTZ 0x8000
+#define FP_X86_DAZ 0x0040
+#define FP_ARM64_FZ (1ull << 24)
+
+// NOTE(robin): Returns the current state so that it can be restored with FPLeaveAudioThread.
+// On architectures we don't know about this does nothing.
+fp_state FPEnterAudioThread(void)
+{
+  fp_state Result = {0};
+
+#if FP_X86
+  u32 Control = _mm_getcsr();
+  Result.Control = Control;
+  _mm_setcsr(Control | FP_X86_FTZ | FP_X86_DAZ);
+#elif FP_ARM64
+  u64 Control;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(Control));
+  Result.Control = Control;
+  Control |= FP_ARM64_FZ;
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(Control));
+#endif
+
+  return Result;
+}
+
+void FPLeaveAudioThread(fp_state State)
+{
+#if FP_X86
+  _mm_setcsr((u32)State.Control);
+#elif FP_ARM64
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(State.Control));
+#endif
+}
+
+// NOTE(robin): Returns non-zero if subnormals are currently flushed on this thread
+u32 FPFlushesSubnormals(void)
+{
+#if FP_X86
+  return (_mm_getcsr() & (FP_X86_FTZ | FP_X86_DAZ)) == (FP_X86_FTZ | FP_X86_DAZ);
+#elif FP_ARM64
+  u64 Control;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(Control));
+  return (Control & FP_ARM64_FZ) != 0;
+#else
+  return 0;
+#endif
+}
+
+// NOTE(robin): Debug counter for subnormals in output buffers. This is an extra pass over the
+// output, so we only look at one buffer in every Interval (1 checks them all). Only the audio
+// thread writes to this, read it once the thread is done (or accept slightly stale numbers).
+typedef struct
+{
+  u32 Interval; // NOTE(robin): Zero disables the counter
+  u32 Countdown;
+  u64 BuffersSeen;
+  u64 BuffersChecked;
+  u64 SamplesChecked;
+  u64 Subnormals;
+  u64 BuffersWithSubnormals;
+} denormal_counter;
+
+void DenormalCounterInit(denormal_counter* Counter, u32 Interval)
+{
+  *Counter = (denormal_counter){0};
+  Counter->Interval = Interval;
+}
+
+// NOTE(robin): Works on the bits so that it gives the right answer even when the CPU is
+// flushing subnormals (in which case comparisons would treat them as zero). The memcpy is
+// how to read a float's bits without breaking strict aliasing, it compiles to a plain load.
+u32 DenormalCount(const f32* Buffer, u32 SampleCount)
+{
+  u32 Result = 0;
+  for (u32 i = 0; i < SampleCount; i++)
+  {
+    u32 Bits;
+    memcpy(&Bits, &Buffer[i], sizeof(Bits));
+    u32 Exponent = Bits & 0x7F800000;
+    u32 Mantissa = Bits & 0x007FFFFF;
+    Result += (Exponent == 0) & (Mantissa != 0);
+  }
+  return Result;
+}
+
+void DenormalSample(denormal_counter* Counter, const f32* Buffer, u32 SampleCount)
+{
+  if (!Counter->Interval)
+    return;
+
+  Counter->BuffersSeen++;
+  if (Counter->Countdown)
+  {
+    Counter->Countdown--;
+    return;
+  }
+  Counter->Countdown = Counter->Interval - 1;
+
+  u32 Subnormals = DenormalCount(Buffer, SampleCount);
+  Counter->BuffersChecked++;
+  Counter->SamplesChecked += SampleCount;
+  Counter->Subnormals += Subnormals;
+  Counter->BuffersWithSubnormals += Subnormals != 0;
+}
+
+void DenormalPrintStats(denormal_counter* Counter, const char* Name)
+{
+  if (!Counter->BuffersChecked)
+    return;
+
+  printf("%s: checked %llu of %llu buffers, %llu subnormal samples (%.4f%%) in %llu buffers\n",
+      Name,
+      (unsigned long long)Counter->BuffersChecked,
+      (unsigned long long)Counter->BuffersSeen,
+      (unsigned long long)Counter->Subnormals,
+      100.0 * (f64)Counter->Subnormals / (f64)Counter->SamplesChecked,
+      (unsigned long long)Counter->BuffersWithSubnormals);
+}
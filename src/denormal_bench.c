@@ -0,0 +1,154 @@
+/*
+ * This file shows what subnormals do to a decaying filter, and that denormal.c fixes it.
+ *
+ * We run a bank of resonant lowpass filters (64 channels, 256 frame blocks at 48kHz), hit them
+ * with an impulse and then feed them silence, like a synth voice or a filter tail after the
+ * music stops. The time per block is printed as the tail decays, once with the default
+ * floating point environment and once after FPEnterAudioThread.
+ *
+ * The filter is a 2 pole resonator (r = 0.9995) so that each channel spends a while in the
+ * normal range, then decays into the subnormal range and gets stuck there: the smallest
+ * subnormal times a coefficient close to 1 rounds back to itself, so the tail never reaches 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "denormal.c"
+
+#define BENCH_CHANNELS 64
+#define BENCH_FRAMES 256
+#define BENCH_BLOCKS 2000
+
+typedef struct
+{
+  f32 A1, A2;
+  f32 Y1[BENCH_CHANNELS];
+  f32 Y2[BENCH_CHANNELS];
+} resonator_bank;
+
+void ResonatorInit(resonator_bank* Bank, f32 Frequency, f32 SampleRate)
+{
+  f32 R = 0.9995f;
+  f32 Omega = 2.0f * 3.14159265f * Frequency / SampleRate;
+  Bank->A1 = 2.0f * R * cosf(Omega);
+  Bank->A2 = -R * R;
+
+  // NOTE(robin): Impulse, with a different amplitude per channel so that they don't all
+  // decay into the subnormal range at the same time
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    Bank->Y1[Channel] = 1.0f / (f32)(Channel + 1);
+    Bank->Y2[Channel] = 0;
+  }
+}
+
+// NOTE(robin): The input is silence so the filter is just its feedback part. We keep the
+// sample loop per channel (like a real per voice filter) and keep the outputs so the work
+// can't be optimised away.
+void ResonatorProcess(resonator_bank* Bank, f32* Output)
+{
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    f32 Y1 = Bank->Y1[Channel];
+    f32 Y2 = Bank->Y2[Channel];
+    f32* Out = Output + Channel * BENCH_FRAMES;
+
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+    {
+      f32 Y = Bank->A1 * Y1 + Bank->A2 * Y2;
+      Y2 = Y1;
+      Y1 = Y;
+      Out[Frame] = Y;
+    }
+
+    Bank->Y1[Channel] = Y1;
+    Bank->Y2[Channel] = Y2;
+  }
+}
+
+typedef struct
+{
+  f64 Median; // NOTE(robin): ns per block
+  f64 Max;
+  u32 MaxBlock;
+  u64 Subnormals;
+  f64 Times[BENCH_BLOCKS];
+} run_result;
+
+int CompareF64(const void* A, const void* B)
+{
+  f64 X = *(const f64*)A;
+  f64 Y = *(const f64*)B;
+  return X < Y ? -1 : X > Y;
+}
+
+void Run(run_result* Result, f32* Output)
+{
+  static resonator_bank Bank;
+  ResonatorInit(&Bank, 440.0f, 48000.0f);
+
+  Result->Max = 0;
+  Result->Subnormals = 0;
+  for (u32 Block = 0; Block < BENCH_BLOCKS; Block++)
+  {
+    u64 Start = BenchGetTime();
+    ResonatorProcess(&Bank, Output);
+    f64 Time = (f64)(BenchGetTime() - Start);
+
+    Result->Times[Block] = Time;
+    if (Time > Result->Max)
+    {
+      Result->Max = Time;
+      Result->MaxBlock = Block;
+    }
+    Result->Subnormals += DenormalCount(Output, BENCH_CHANNELS * BENCH_FRAMES);
+  }
+
+  static f64 Sorted[BENCH_BLOCKS];
+  for (u32 i = 0; i < BENCH_BLOCKS; i++)
+    Sorted[i] = Result->Times[i];
+  qsort(Sorted, BENCH_BLOCKS, sizeof(f64), CompareF64);
+  Result->Median = Sorted[BENCH_BLOCKS / 2];
+}
+
+int main(int argc, char** argv)
+{
+  f32* Output = malloc(BENCH_CHANNELS * BENCH_FRAMES * sizeof(f32));
+  static run_result Default;
+  static run_result Flushed;
+
+  // NOTE(robin): Warm up so that the first blocks aren't dominated by page faults
+  Run(&Default, Output);
+
+  Run(&Default, Output);
+
+  fp_state State = FPEnterAudioThread();
+  u32 WasFlushing = FPFlushesSubnormals();
+  Run(&Flushed, Output);
+  FPLeaveAudioThread(State);
+
+  if (!WasFlushing)
+    printf("NOTE: this architecture isn't supported by denormal.c, both runs are the same\n");
+
+  f64 PeriodNS = BENCH_FRAMES * 1e9 / 48000.0;
+  printf("%d channel resonator bank, %d frames per block, period is %.0fus\n\n",
+      BENCH_CHANNELS, BENCH_FRAMES, PeriodNS / 1000.0);
+
+  printf("%8s %14s %14s\n", "block", "default (us)", "ftz/daz (us)");
+  for (u32 Block = 0; Block < BENCH_BLOCKS; Block += BENCH_BLOCKS / 20)
+    printf("%8u %14.1f %14.1f\n", Block, Default.Times[Block] / 1000.0, Flushed.Times[Block] / 1000.0);
+
+  printf("\n%-10s %12s %12s %10s %14s\n", "", "median (us)", "max (us)", "max/period", "subnormals");
+  printf("%-10s %12.1f %12.1f %9.1f%% %14llu\n", "default",
+      Default.Median / 1000.0, Default.Max / 1000.0, 100.0 * Default.Max / PeriodNS,
+      (unsigned long long)Default.Subnormals);
+  printf("%-10s %12.1f %12.1f %9.1f%% %14llu\n", "ftz/daz",
+      Flushed.Median / 1000.0, Flushed.Max / 1000.0, 100.0 * Flushed.Max / PeriodNS,
+      (unsigned long long)Flushed.Subnormals);
+
+  return 0;
+}
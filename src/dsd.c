@@ -0,0 +1,642 @@
+/*
+ * This file converts between DSD (the 1 bit format used by SACD and some ASIO devices) and
+ * PCM: a multistage decimator for capture and a sigma-delta modulator for playback, plus bit
+ * packing for the ASIO DSD sample types. It is platform neutral so you can test it anywhere.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): A DSD stream is one bit per sample at 64, 128 or 256 times 44.1kHz (DSD64 is
+ * 2.8224MHz). A 1 means +1 and a 0 means -1, and the audio is the average of the bits. The
+ * quantisation noise is pushed up above the audio band by noise shaping, so getting PCM back
+ * is just a very good lowpass filter and decimation:
+ *
+ *   bits -> FIR, decimate by 8 -> (FIR, decimate by 2) x Stages -> PCM
+ *
+ * The first stage works on whole bytes: an 8 * DSD_LUT_TABLES tap FIR applied to 1 bit data
+ * is DSD_LUT_TABLES table lookups per byte, each table holding the sum of 8 taps for every
+ * possible byte. The decimate by 2 stages are polyphase FIRs on floats, written so that the
+ * inner loops run over output samples and vectorise.
+ *
+ * Going the other way we interpolate by 2 until we're at 1/8 of the DSD rate, linearly
+ * interpolate the last factor of 8 and then quantise to 1 bit with a 5th order error
+ * feedback sigma-delta modulator. The modulator is recursive so it can't be vectorised along
+ * time; like the noise shaped path in quantize.c it runs DSD_LANES channels at once instead.
+ *
+ * Levels: PCM full scale (1.0) is 50% modulation, which is the SACD 0dB reference level. A
+ * 1 bit modulator of this order becomes unstable somewhere above ~60% modulation, so PCM
+ * input is clipped to [-1, 1]. If the modulator does go unstable we reset it, see
+ * DSDModulatorResets.
+ *
+ * Packing (ASIO's DSD sample types), ASIO buffers are planar so this is per channel:
+ *
+ * - DSDInt8LSB1: 8 samples per byte, the first sample in the least significant bit
+ * - DSDInt8MSB1: 8 samples per byte, the first sample in the most significant bit
+ * - DSDInt8NER8: 1 sample per byte. We write 0 or 1 and treat any non-zero byte as a 1.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#endif
+
+#define DSD_MAX_CHANNELS 32
+#define DSD_MAX_STAGES 5      // NOTE(robin): DSD256 to 44.1kHz is 8 * 2^5
+#define DSD_MAX_BYTES 8192    // NOTE(robin): Per channel per call, i.e. 65536 DSD samples
+#define DSD_LUT_TABLES 16
+#define DSD_SHARP_TAPS 160    // NOTE(robin): For the stage next to the PCM rate
+#define DSD_SOFT_TAPS 48      // NOTE(robin): For the other decimate/interpolate by 2 stages
+#define DSD_MAX_TAPS 160
+#define DSD_ORDER 5
+#define DSD_LANES 4
+
+typedef enum
+{
+  DSDPackingLSB1,
+  DSDPackingMSB1,
+  DSDPackingNER8,
+} dsd_packing;
+
+typedef struct
+{
+  u32 TapCount;
+  f32 Taps[DSD_MAX_TAPS];
+} dsd_fir;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 Stages; // NOTE(robin): Number of decimate by 2 stages after the first decimate by 8
+  dsd_packing Packing;
+
+  f32 LUT[DSD_LUT_TABLES][256];
+  dsd_fir Filters[DSD_MAX_STAGES];
+
+  u8 ByteHistory[DSD_MAX_CHANNELS][DSD_LUT_TABLES];
+  f32 History[DSD_MAX_CHANNELS][DSD_MAX_STAGES][DSD_MAX_TAPS];
+
+  // NOTE(robin): Scratch space shared by all channels
+  u8 Bytes[DSD_LUT_TABLES + DSD_MAX_BYTES];
+  f32 Work[DSD_MAX_TAPS + DSD_MAX_BYTES];
+  f32 Stage[DSD_MAX_BYTES];
+} dsd_decimator;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 Stages; // NOTE(robin): Number of interpolate by 2 stages before the final 8x
+  dsd_packing Packing;
+
+  dsd_fir Filters[DSD_MAX_STAGES]; // NOTE(robin): Filters[0] runs at the PCM rate
+  f32 History[DSD_MAX_CHANNELS][DSD_MAX_STAGES][DSD_MAX_TAPS];
+  f64 Previous[DSD_MAX_CHANNELS]; // NOTE(robin): Last sample at 1/8 of the DSD rate, halved
+
+  // NOTE(robin): Noise transfer function N(z) / D(z), and the error feedback filter
+  // NTF - 1 = sum(C[k] z^-k) / D(z)
+  f64 C[DSD_ORDER + 1];
+  f64 D[DSD_ORDER + 1];
+  f64 State[DSD_MAX_CHANNELS][DSD_ORDER];
+  u32 Resets;
+
+  f32 Work[DSD_MAX_TAPS + DSD_MAX_BYTES];
+  f32 Stage[2][DSD_MAX_BYTES];
+  f32 Upsampled[DSD_LANES][DSD_MAX_BYTES]; // NOTE(robin): At 1/8 of the DSD rate
+  u8 Bytes[DSD_LANES][DSD_MAX_BYTES];      // NOTE(robin): LSB first
+} dsd_modulator;
+
+// NOTE(robin): Maps the BitAlign/IsBigEndian fields of ASIO's asio_sample_format to a packing,
+// LSB1 and MSB1 have BitAlign 1.
+dsd_packing DSDGetPacking(u32 BitAlign, u32 IsBigEndian)
+{
+  if (BitAlign == 1)
+    return IsBigEndian ? DSDPackingMSB1 : DSDPackingLSB1;
+  return DSDPackingNER8;
+}
+
+// NOTE(robin): Bytes needed to hold SampleCount DSD samples
+u32 DSDPackedBytes(dsd_packing Packing, u32 SampleCount)
+{
+  return Packing == DSDPackingNER8 ? SampleCount : SampleCount / 8;
+}
+
+static u8 DSDReverseBits(u8 Byte)
+{
+  Byte = (u8)(((Byte & 0xF0) >> 4) | ((Byte & 0x0F) << 4));
+  Byte = (u8)(((Byte & 0xCC) >> 2) | ((Byte & 0x33) << 2));
+  Byte = (u8)(((Byte & 0xAA) >> 1) | ((Byte & 0x55) << 1));
+  return Byte;
+}
+
+// NOTE(robin): Converts ByteCount LSB first bytes (ByteCount * 8 samples) to Packing
+void DSDPack(void* Output, dsd_packing Packing, const u8* restrict Bytes, u32 ByteCount)
+{
+  u8* Out = Output;
+  switch (Packing)
+  {
+    case DSDPackingLSB1:
+    {
+      memcpy(Out, Bytes, ByteCount);
+    } break;
+
+    case DSDPackingMSB1:
+    {
+      for (u32 i = 0; i < ByteCount; i++)
+        Out[i] = DSDReverseBits(Bytes[i]);
+    } break;
+
+    case DSDPackingNER8:
+    {
+      for (u32 i = 0; i < ByteCount; i++)
+      {
+        for (u32 Bit = 0; Bit < 8; Bit++)
+          Out[8 * i + Bit] = (Bytes[i] >> Bit) & 1;
+      }
+    } break;
+  }
+}
+
+// NOTE(robin): The opposite of DSDPack, Bytes receives ByteCount LSB first bytes
+void DSDUnpack(u8* restrict Bytes, const void* Input, dsd_packing Packing, u32 ByteCount)
+{
+  const u8* In = Input;
+  switch (Packing)
+  {
+    case DSDPackingLSB1:
+    {
+      memcpy(Bytes, In, ByteCount);
+    } break;
+
+    case DSDPackingMSB1:
+    {
+      for (u32 i = 0; i < ByteCount; i++)
+        Bytes[i] = DSDReverseBits(In[i]);
+    } break;
+
+    case DSDPackingNER8:
+    {
+      for (u32 i = 0; i < ByteCount; i++)
+      {
+        u8 Byte = 0;
+        for (u32 Bit = 0; Bit < 8; Bit++)
+          Byte |= (u8)((In[8 * i + Bit] != 0) << Bit);
+        Bytes[i] = Byte;
+      }
+    } break;
+  }
+}
+
+static f64 DSDBesselI0(f64 X)
+{
+  f64 Sum = 1;
+  f64 Term = 1;
+  for (u32 k = 1; k < 32; k++)
+  {
+    Term *= (X / (2.0 * k)) * (X / (2.0 * k));
+    Sum += Term;
+  }
+  return Sum;
+}
+
+// NOTE(robin): Kaiser windowed sinc lowpass with unity gain at DC. Cutoff is in cycles per
+// sample, 0.25 is half of Nyquist.
+void DSDDesignLowpass(f32* Taps, u32 TapCount, f64 Cutoff)
+{
+  f64 Beta = 10.0; // NOTE(robin): About 100dB of stopband attenuation
+  f64 Center = 0.5 * (TapCount - 1);
+  f64 Sum = 0;
+  f64 Designed[DSD_MAX_TAPS]; // NOTE(robin): Also holds the 8 * DSD_LUT_TABLES first stage
+
+  for (u32 t = 0; t < TapCount; t++)
+  {
+    f64 X = t - Center;
+    f64 Sinc = X == 0 ? 2.0 * Cutoff : sin(2.0 * 3.14159265358979 * Cutoff * X) / (3.14159265358979 * X);
+    f64 Ratio = X / (Center + 1);
+    f64 Window = DSDBesselI0(Beta * sqrt(1.0 - Ratio * Ratio)) / DSDBesselI0(Beta);
+    Designed[t] = Sinc * Window;
+    Sum += Designed[t];
+  }
+
+  for (u32 t = 0; t < TapCount; t++)
+    Taps[t] = (f32)(Designed[t] / Sum);
+}
+
+static void DSDDesignStages(dsd_fir* Filters, u32 Stages, u32 SharpIndex)
+{
+  for (u32 Stage = 0; Stage < Stages; Stage++)
+  {
+    dsd_fir* Filter = &Filters[Stage];
+    Filter->TapCount = Stage == SharpIndex ? DSD_SHARP_TAPS : DSD_SOFT_TAPS;
+    DSDDesignLowpass(Filter->Taps, Filter->TapCount, 0.25);
+  }
+}
+
+// NOTE(robin): Decimation is the ratio between the DSD rate and the PCM rate, which must be 8
+// times a power of 2 (e.g. 64 for DSD64 to 44.1kHz, 128 for DSD256 to 88.2kHz). Returns 0 if
+// that isn't supported.
+u32 DSDDecimatorInit(dsd_decimator* Decimator, u32 ChannelCount, u32 Decimation, dsd_packing Packing)
+{
+  memset(Decimator, 0, sizeof(*Decimator));
+
+  u32 Stages = 0;
+  while ((8u << Stages) < Decimation)
+    Stages++;
+  if ((8u << Stages) != Decimation || Stages > DSD_MAX_STAGES || ChannelCount > DSD_MAX_CHANNELS)
+    return 0;
+
+  Decimator->ChannelCount = ChannelCount;
+  Decimator->Stages = Stages;
+  Decimator->Packing = Packing;
+
+  // NOTE(robin): The first stage only has to stop noise aliasing onto the audio band from
+  // around multiples of DSD rate / 8, it doesn't need to be sharp
+  f32 Taps[8 * DSD_LUT_TABLES];
+  DSDDesignLowpass(Taps, 8 * DSD_LUT_TABLES, 1.0 / 16.0);
+
+  // NOTE(robin): Output m sees samples 8m + 7 back to 8m + 7 - (8 * DSD_LUT_TABLES - 1). Byte
+  // m - j holds samples 8(m - j) + Bit, which meet tap 8j + 7 - Bit. The factor of 2 makes
+  // 50% modulation full scale.
+  for (u32 j = 0; j < DSD_LUT_TABLES; j++)
+  {
+    for (u32 Byte = 0; Byte < 256; Byte++)
+    {
+      f32 Sum = 0;
+      for (u32 Bit = 0; Bit < 8; Bit++)
+        Sum += ((Byte >> Bit) & 1 ? 2.0f : -2.0f) * Taps[8 * j + 7 - Bit];
+      Decimator->LUT[j][Byte] = Sum;
+    }
+  }
+
+  DSDDesignStages(Decimator->Filters, Stages, Stages - 1);
+
+  // NOTE(robin): Silence is alternating bits, start the history off that way so there's no
+  // click at the start
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    memset(Decimator->ByteHistory[Channel], 0x55, DSD_LUT_TABLES);
+
+  return 1;
+}
+
+// NOTE(robin): Input is Work[0 .. TapCount - 2] (history) followed by InputCount new samples,
+// InputCount must be even
+static void DSDDecimate2(f32* restrict Output, const f32* restrict Work, u32 InputCount, const dsd_fir* Filter)
+{
+  u32 OutputCount = InputCount / 2;
+  u32 Offset = Filter->TapCount - 1;
+
+  for (u32 n = 0; n < OutputCount; n++)
+    Output[n] = 0;
+
+  for (u32 t = 0; t < Filter->TapCount; t++)
+  {
+    f32 Tap = Filter->Taps[t];
+    const f32* In = Work + Offset + 1 - t;
+    for (u32 n = 0; n < OutputCount; n++)
+      Output[n] += Tap * In[2 * n];
+  }
+}
+
+// NOTE(robin): Input is Work[0 .. TapCount / 2 - 2] (history) followed by InputCount new samples
+static void DSDInterpolate2(f32* restrict Output, f32* restrict Even, f32* restrict Odd,
+    const f32* restrict Work, u32 InputCount, const dsd_fir* Filter)
+{
+  u32 PhaseTaps = Filter->TapCount / 2;
+  u32 Offset = PhaseTaps - 1;
+
+  for (u32 n = 0; n < InputCount; n++)
+  {
+    Even[n] = 0;
+    Odd[n] = 0;
+  }
+
+  // NOTE(robin): Zero stuffing loses half the energy, so the taps are doubled
+  for (u32 k = 0; k < PhaseTaps; k++)
+  {
+    f32 EvenTap = 2.0f * Filter->Taps[2 * k];
+    f32 OddTap = 2.0f * Filter->Taps[2 * k + 1];
+    const f32* In = Work + Offset - k;
+    for (u32 n = 0; n < InputCount; n++)
+    {
+      Even[n] += EvenTap * In[n];
+      Odd[n] += OddTap * In[n];
+    }
+  }
+
+  for (u32 n = 0; n < InputCount; n++)
+  {
+    Output[2 * n + 0] = Even[n];
+    Output[2 * n + 1] = Odd[n];
+  }
+}
+
+// NOTE(robin): Converts one block of DSD to PCM. Inputs[Channel] holds DSD in the decimator's
+// packing, SampleCount DSD samples per channel, which should be a multiple of the decimation
+// and at most DSD_MAX_BYTES * 8. Returns how many DSD samples it converted, which is less
+// than SampleCount if it isn't; pass the rest in the next call. Each output gets the returned
+// count / Decimation PCM samples.
+u32 DSDDecimate(dsd_decimator* Decimator, f32* const* Outputs, const void* const* Inputs, u32 SampleCount)
+{
+  u32 ByteCount = SampleCount / 8;
+  if (ByteCount > DSD_MAX_BYTES)
+    ByteCount = DSD_MAX_BYTES;
+  ByteCount &= ~((1u << Decimator->Stages) - 1);
+
+  for (u32 Channel = 0; Channel < Decimator->ChannelCount; Channel++)
+  {
+    // NOTE(robin): Stage 1, bytes to floats at 1/8 of the DSD rate
+    u8* Bytes = Decimator->Bytes;
+    memcpy(Bytes, Decimator->ByteHistory[Channel], DSD_LUT_TABLES);
+    DSDUnpack(Bytes + DSD_LUT_TABLES, Inputs[Channel], Decimator->Packing, ByteCount);
+
+    f32* Current = Decimator->Stage;
+    for (u32 m = 0; m < ByteCount; m++)
+    {
+      f32 Sum = 0;
+      for (u32 j = 0; j < DSD_LUT_TABLES; j++)
+        Sum += Decimator->LUT[j][Bytes[DSD_LUT_TABLES + m - j]];
+      Current[m] = Sum;
+    }
+    memcpy(Decimator->ByteHistory[Channel], Bytes + ByteCount, DSD_LUT_TABLES);
+
+    // NOTE(robin): Then halve the rate Stages times, in place
+    u32 Count = ByteCount;
+    for (u32 Stage = 0; Stage < Decimator->Stages; Stage++)
+    {
+      dsd_fir* Filter = &Decimator->Filters[Stage];
+      f32* History = Decimator->History[Channel][Stage];
+      u32 HistoryCount = Filter->TapCount - 1;
+
+      memcpy(Decimator->Work, History, HistoryCount * sizeof(f32));
+      memcpy(Decimator->Work + HistoryCount, Current, Count * sizeof(f32));
+      memcpy(History, Decimator->Work + Count, HistoryCount * sizeof(f32));
+
+      f32* Output = Stage == Decimator->Stages - 1 ? Outputs[Channel] : Current;
+      DSDDecimate2(Output, Decimator->Work, Count, Filter);
+      Count /= 2;
+    }
+
+    if (!Decimator->Stages)
+      memcpy(Outputs[Channel], Current, Count * sizeof(f32));
+  }
+
+  return ByteCount * 8;
+}
+
+// NOTE(robin): Interpolation is the ratio between the DSD rate and the PCM rate, 8 times a
+// power of 2. Returns 0 if that isn't supported.
+u32 DSDModulatorInit(dsd_modulator* Modulator, u32 ChannelCount, u32 Interpolation, dsd_packing Packing)
+{
+  memset(Modulator, 0, sizeof(*Modulator));
+
+  u32 Stages = 0;
+  while ((8u << Stages) < Interpolation)
+    Stages++;
+  if ((8u << Stages) != Interpolation || Stages > DSD_MAX_STAGES || ChannelCount > DSD_MAX_CHANNELS)
+    return 0;
+
+  Modulator->ChannelCount = ChannelCount;
+  Modulator->Stages = Stages;
+  Modulator->Packing = Packing;
+  DSDDesignStages(Modulator->Filters, Stages, 0);
+
+  // NOTE(robin): The NTF zeros sit in the audio band (taken as 0.4535 of the PCM rate, 20kHz
+  // at 44.1kHz): one at DC and two pairs at 0.5385 and 0.9062 of the band edge, the roots of
+  // the 5th Legendre polynomial, which minimise the in band noise. That's ~15dB better than
+  // putting all of them at DC.
+  f64 BandEdge = 2.0 * 3.14159265358979 * 0.4535 / Interpolation;
+  f64 Cos1 = cos(0.5385 * BandEdge);
+  f64 Cos2 = cos(0.9062 * BandEdge);
+
+  // NOTE(robin): N(z) = (1 - z^-1)(1 - 2 Cos1 z^-1 + z^-2)(1 - 2 Cos2 z^-1 + z^-2)
+  f64 N[DSD_ORDER + 1] = {1, -1};
+  f64 Pairs[2] = {Cos1, Cos2};
+  for (u32 Pair = 0; Pair < 2; Pair++)
+  {
+    u32 Degree = 1 + 2 * Pair;
+    for (u32 i = Degree + 2; i > 0; i--)
+    {
+      N[i] -= 2.0 * Pairs[Pair] * N[i - 1];
+      if (i >= 2)
+        N[i] += N[i - 2];
+    }
+  }
+  f64 NAtNyquist = 2.0 * (2.0 + 2.0 * Cos1) * (2.0 + 2.0 * Cos2);
+
+  // NOTE(robin): The poles are those of a 5th order Butterworth highpass, from the bilinear
+  // transform of the analog prototype. The cutoff is chosen so that the gain at Nyquist is
+  // 1.5, the usual rule of thumb for a stable 1 bit modulator (Lee's criterion). We find it
+  // by bisection.
+  f64 Low = 1e-6;
+  f64 High = 1.0;
+  for (u32 Iteration = 0; Iteration < 60; Iteration++)
+  {
+    f64 Cutoff = 0.5 * (Low + High);
+
+    // NOTE(robin): D(z) = prod(1 - Pole z^-1), complex numbers as (Re, Im) pairs
+    f64 Re[DSD_ORDER + 1] = {1};
+    f64 Im[DSD_ORDER + 1] = {0};
+    for (u32 k = 0; k < DSD_ORDER; k++)
+    {
+      f64 Angle = 3.14159265358979 * (2.0 * k + DSD_ORDER + 1) / (2.0 * DSD_ORDER);
+      f64 SRe = Cutoff * cos(Angle);
+      f64 SIm = Cutoff * sin(Angle);
+
+      // NOTE(robin): z = (1 + s) / (1 - s)
+      f64 NumRe = 1 + SRe, NumIm = SIm;
+      f64 DenRe = 1 - SRe, DenIm = -SIm;
+      f64 Den = DenRe * DenRe + DenIm * DenIm;
+      f64 PoleRe = (NumRe * DenRe + NumIm * DenIm) / Den;
+      f64 PoleIm = (NumIm * DenRe - NumRe * DenIm) / Den;
+
+      for (u32 i = k + 1; i > 0; i--)
+      {
+        f64 ProductRe = PoleRe * Re[i - 1] - PoleIm * Im[i - 1];
+        f64 ProductIm = PoleRe * Im[i - 1] + PoleIm * Re[i - 1];
+        Re[i] -= ProductRe;
+        Im[i] -= ProductIm;
+      }
+    }
+
+    f64 DAtNyquist = 0;
+    for (u32 i = 0; i <= DSD_ORDER; i++)
+      DAtNyquist += (i & 1 ? -1.0 : 1.0) * Re[i];
+    f64 Gain = NAtNyquist / fabs(DAtNyquist);
+
+    if (Gain > 1.5)
+      High = Cutoff;
+    else
+      Low = Cutoff;
+
+    for (u32 i = 0; i <= DSD_ORDER; i++)
+      Modulator->D[i] = Re[i];
+  }
+
+  for (u32 i = 0; i <= DSD_ORDER; i++)
+    Modulator->C[i] = N[i] - Modulator->D[i];
+
+  return 1;
+}
+
+// NOTE(robin): Number of times a modulator lane went unstable and had to be reset
+u32 DSDModulatorResets(dsd_modulator* Modulator)
+{
+  return Modulator->Resets;
+}
+
+// NOTE(robin): 1 bit quantisation of DSD_LANES channels at once. Upsampled holds ByteCount
+// samples at 1/8 of the DSD rate per lane which we linearly interpolate up to the DSD rate.
+static void DSDModulateLanes(dsd_modulator* Modulator, u32 FirstChannel, u32 LaneCount, u32 ByteCount)
+{
+  f64 State[DSD_ORDER][DSD_LANES] = {{0}};
+  f64 Previous[DSD_LANES] = {0};
+  for (u32 Lane = 0; Lane < LaneCount; Lane++)
+  {
+    for (u32 k = 0; k < DSD_ORDER; k++)
+      State[k][Lane] = Modulator->State[FirstChannel + Lane][k];
+    Previous[Lane] = Modulator->Previous[FirstChannel + Lane];
+  }
+
+  f64* C = Modulator->C;
+  f64* D = Modulator->D;
+
+  for (u32 m = 0; m < ByteCount; m++)
+  {
+    // NOTE(robin): Everything in the lane loops is f64 so that they map straight onto SIMD
+    // registers, the bits are packed into bytes afterwards
+    f64 Step[DSD_LANES];
+    f64 Value[DSD_LANES];
+    f64 Signs[8][DSD_LANES];
+    for (u32 Lane = 0; Lane < DSD_LANES; Lane++)
+    {
+      f64 Next = 0.5 * (f64)Modulator->Upsampled[Lane][m];
+      Step[Lane] = 0.125 * (Next - Previous[Lane]);
+      Value[Lane] = Previous[Lane];
+      Previous[Lane] = Next;
+    }
+
+    for (u32 Bit = 0; Bit < 8; Bit++)
+    {
+      for (u32 Lane = 0; Lane < DSD_LANES; Lane++)
+      {
+        Value[Lane] += Step[Lane];
+
+        // NOTE(robin): F = (NTF - 1) applied to the error, then u = x + F, y = sign(u),
+        // e = y - u, which makes y = x + NTF * e. NTF - 1 has no z^0 term so F only depends
+        // on past errors, it's the first state of a transposed direct form II filter.
+        f64 F = State[0][Lane];
+        f64 Wanted = Value[Lane] + F;
+        f64 Sign = Wanted >= 0 ? 1.0 : -1.0;
+        f64 Error = Sign - Wanted;
+
+        // NOTE(robin): Written out so that this is straight line code the compiler can
+        // vectorise across lanes, it has to match DSD_ORDER
+        State[0][Lane] = State[1][Lane] + C[1] * Error - D[1] * F;
+        State[1][Lane] = State[2][Lane] + C[2] * Error - D[2] * F;
+        State[2][Lane] = State[3][Lane] + C[3] * Error - D[3] * F;
+        State[3][Lane] = State[4][Lane] + C[4] * Error - D[4] * F;
+        State[4][Lane] = C[5] * Error - D[5] * F;
+
+        Signs[Bit][Lane] = Sign;
+      }
+    }
+
+    for (u32 Lane = 0; Lane < DSD_LANES; Lane++)
+    {
+      u32 Byte = 0;
+      for (u32 Bit = 0; Bit < 8; Bit++)
+        Byte |= (u32)(Signs[Bit][Lane] > 0) << Bit;
+      Modulator->Bytes[Lane][m] = (u8)Byte;
+    }
+
+    // NOTE(robin): A stable modulator keeps the feedback within a few units. If it runs away
+    // the output is garbage until we clear its state.
+    for (u32 Lane = 0; Lane < LaneCount; Lane++)
+    {
+      if (fabs(State[0][Lane]) > 16.0)
+      {
+        for (u32 k = 0; k < DSD_ORDER; k++)
+          State[k][Lane] = 0;
+        Modulator->Resets++;
+      }
+    }
+  }
+
+  for (u32 Lane = 0; Lane < LaneCount; Lane++)
+  {
+    for (u32 k = 0; k < DSD_ORDER; k++)
+      Modulator->State[FirstChannel + Lane][k] = State[k][Lane];
+    Modulator->Previous[FirstChannel + Lane] = Previous[Lane];
+  }
+}
+
+// NOTE(robin): Converts one block of PCM to DSD. Each input has FrameCount samples in [-1, 1],
+// and each output receives FrameCount * Interpolation DSD samples in the modulator's packing
+// (see DSDPackedBytes). FrameCount * Interpolation / 8 should be at most DSD_MAX_BYTES.
+// Returns how many frames it converted, which is less than FrameCount if it isn't; pass the
+// rest in the next call.
+u32 DSDModulate(dsd_modulator* Modulator, void* const* Outputs, const f32* const* Inputs, u32 FrameCount)
+{
+  u32 ByteCount = FrameCount << Modulator->Stages;
+  if (ByteCount > DSD_MAX_BYTES)
+  {
+    FrameCount = DSD_MAX_BYTES >> Modulator->Stages;
+    ByteCount = FrameCount << Modulator->Stages;
+  }
+
+  for (u32 FirstChannel = 0; FirstChannel < Modulator->ChannelCount; FirstChannel += DSD_LANES)
+  {
+    u32 LaneCount = Modulator->ChannelCount - FirstChannel;
+    if (LaneCount > DSD_LANES)
+      LaneCount = DSD_LANES;
+
+    for (u32 Lane = 0; Lane < DSD_LANES; Lane++)
+    {
+      f32* Upsampled = Modulator->Upsampled[Lane];
+      if (Lane >= LaneCount)
+      {
+        // NOTE(robin): Unused lanes just run on silence
+        memset(Upsampled, 0, ByteCount * sizeof(f32));
+        continue;
+      }
+
+      u32 Channel = FirstChannel + Lane;
+      f32* Current = Modulator->Stage[0];
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        f32 Sample = Inputs[Channel][i];
+        Current[i] = Sample > 1.0f ? 1.0f : Sample < -1.0f ? -1.0f : Sample;
+      }
+
+      u32 Count = FrameCount;
+      for (u32 Stage = 0; Stage < Modulator->Stages; Stage++)
+      {
+        dsd_fir* Filter = &Modulator->Filters[Stage];
+        f32* History = Modulator->History[Channel][Stage];
+        u32 HistoryCount = Filter->TapCount / 2 - 1;
+
+        memcpy(Modulator->Work, History, HistoryCount * sizeof(f32));
+        memcpy(Modulator->Work + HistoryCount, Current, Count * sizeof(f32));
+        memcpy(History, Modulator->Work + Count, HistoryCount * sizeof(f32));
+
+        // NOTE(robin): Stage[1] is split in half for the even and odd phases, the output goes to
+        // Upsampled on the last stage and back into Stage[0] otherwise
+        f32* Output = Stage == Modulator->Stages - 1 ? Upsampled : Modulator->Stage[0];
+        DSDInterpolate2(Output, Modulator->Stage[1], Modulator->Stage[1] + DSD_MAX_BYTES / 2,
+            Modulator->Work, Count, Filter);
+        Count *= 2;
+      }
+
+      if (!Modulator->Stages)
+        memcpy(Upsampled, Current, Count * sizeof(f32));
+    }
+
+    DSDModulateLanes(Modulator, FirstChannel, LaneCount, ByteCount);
+
+    for (u32 Lane = 0; Lane < LaneCount; Lane++)
+      DSDPack(Outputs[FirstChannel + Lane], Modulator->Packing, Modulator->Bytes[Lane], ByteCount);
+  }
+
+  return FrameCount;
+}
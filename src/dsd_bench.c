@@ -0,0 +1,174 @@
+/*
+ * This file tests and benchmarks dsd.c with synthetic bitstreams, so it runs anywhere without
+ * a DSD capable device.
+ *
+ * - Packing: random bytes go through every ASIO DSD packing and back unchanged.
+ * - Accuracy: a ~1kHz sine at 44.1kHz is modulated to DSD64/128/256 and decimated back to
+ *   44.1kHz, and we report the SINAD (signal to noise and distortion) of the result. The test
+ *   frequency is a whole number of cycles in the analysis window so that a least squares fit
+ *   of sin/cos is exact and whatever's left over is noise and distortion.
+ * - Throughput: 8 channels in both directions, reported per DSD sample and as the share of
+ *   real time one CPU core needs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "dsd.c"
+
+#define BENCH_CHANNELS 8
+#define BENCH_FRAMES 128 // NOTE(robin): PCM frames at 44.1kHz per block
+#define ANALYSIS_FRAMES 16384
+#define ANALYSIS_CYCLES 372 // NOTE(robin): 372 * 44100 / 16384 = 1001.3Hz
+#define SETTLE_FRAMES 4096  // NOTE(robin): Skipped so the filters are past their start up
+
+typedef struct
+{
+  dsd_modulator Modulator;
+  dsd_decimator Decimator;
+  u32 Ratio;
+  f32* PCM[BENCH_CHANNELS];
+  f32* Decimated[BENCH_CHANNELS];
+  u8* DSD[BENCH_CHANNELS];
+} bench_data;
+
+void VerifyPacking(void)
+{
+  static u8 Bytes[256];
+  static u8 Packed[256 * 8];
+  static u8 Unpacked[256];
+  for (u32 i = 0; i < 256; i++)
+    Bytes[i] = (u8)rand();
+
+  for (u32 Packing = DSDPackingLSB1; Packing <= DSDPackingNER8; Packing++)
+  {
+    DSDPack(Packed, Packing, Bytes, 256);
+    DSDUnpack(Unpacked, Packed, Packing, 256);
+    for (u32 i = 0; i < 256; i++)
+      assert(Unpacked[i] == Bytes[i]);
+  }
+
+  // NOTE(robin): The first sample is bit 0 for LSB1 and bit 7 for MSB1
+  u8 First = 1;
+  DSDPack(Packed, DSDPackingMSB1, &First, 1);
+  assert(Packed[0] == 0x80);
+  DSDPack(Packed, DSDPackingNER8, &First, 1);
+  assert(Packed[0] == 1 && Packed[1] == 0);
+}
+
+// NOTE(robin): Returns SINAD in dB of a round trip through DSD at Ratio times 44.1kHz
+f64 MeasureSINAD(bench_data* Data, u32 Ratio, f64 Amplitude, dsd_packing Packing, u32* Resets)
+{
+  DSDModulatorInit(&Data->Modulator, 1, Ratio, Packing);
+  DSDDecimatorInit(&Data->Decimator, 1, Ratio, Packing);
+
+  static f32 Output[SETTLE_FRAMES + ANALYSIS_FRAMES];
+  f64 Omega = 2 * 3.14159265358979 * ANALYSIS_CYCLES / ANALYSIS_FRAMES;
+
+  for (u32 Block = 0; Block < (SETTLE_FRAMES + ANALYSIS_FRAMES) / BENCH_FRAMES; Block++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+      Data->PCM[0][Frame] = (f32)(Amplitude * sin(Omega * (Block * BENCH_FRAMES + Frame)));
+
+    u32 Modulated = DSDModulate(&Data->Modulator, (void* const*)Data->DSD, (const f32* const*)Data->PCM, BENCH_FRAMES);
+    f32* Out = Output + Block * BENCH_FRAMES;
+    u32 Decimated = DSDDecimate(&Data->Decimator, &Out, (const void* const*)Data->DSD, BENCH_FRAMES * Ratio);
+    assert(Modulated == BENCH_FRAMES && Decimated == BENCH_FRAMES * Ratio);
+  }
+
+  f64 Sin = 0, Cos = 0;
+  f32* Analysed = Output + SETTLE_FRAMES;
+  for (u32 i = 0; i < ANALYSIS_FRAMES; i++)
+  {
+    Sin += Analysed[i] * sin(Omega * i);
+    Cos += Analysed[i] * cos(Omega * i);
+  }
+  Sin *= 2.0 / ANALYSIS_FRAMES;
+  Cos *= 2.0 / ANALYSIS_FRAMES;
+
+  f64 Signal = 0, Residual = 0;
+  for (u32 i = 0; i < ANALYSIS_FRAMES; i++)
+  {
+    f64 Fit = Sin * sin(Omega * i) + Cos * cos(Omega * i);
+    Signal += Fit * Fit;
+    Residual += (Analysed[i] - Fit) * (Analysed[i] - Fit);
+  }
+
+  // NOTE(robin): The round trip must keep the level, only the phase changes (filter delay)
+  assert(fabs(sqrt(Sin * Sin + Cos * Cos) - Amplitude) < 0.01 * Amplitude);
+
+  *Resets = DSDModulatorResets(&Data->Modulator);
+  return 10.0 * log10(Signal / Residual);
+}
+
+void BenchModulate(void* Context)
+{
+  bench_data* Data = Context;
+  DSDModulate(&Data->Modulator, (void* const*)Data->DSD, (const f32* const*)Data->PCM, BENCH_FRAMES);
+}
+
+void BenchDecimate(void* Context)
+{
+  bench_data* Data = Context;
+  DSDDecimate(&Data->Decimator, Data->Decimated, (const void* const*)Data->DSD, BENCH_FRAMES * Data->Ratio);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    Data.PCM[Channel] = malloc(BENCH_FRAMES * sizeof(f32));
+    Data.Decimated[Channel] = malloc(BENCH_FRAMES * sizeof(f32));
+    Data.DSD[Channel] = malloc(BENCH_FRAMES * 256); // NOTE(robin): NER8 at DSD256
+  }
+
+  VerifyPacking();
+  printf("LSB1, MSB1 and NER8 packing round trip\n\n");
+
+  u32 Ratios[] = {64, 128, 256};
+  const char* Names[] = {"DSD64", "DSD128", "DSD256"};
+
+  printf("Round trip 44.1kHz -> DSD -> 44.1kHz, 1001Hz sine\n");
+  printf("%-8s %16s %16s %16s %8s\n", "", "-20dB SINAD", "-6dB SINAD", "0dB SINAD", "resets");
+  for (u32 i = 0; i < 3; i++)
+  {
+    u32 Resets[3];
+    f64 Quiet = MeasureSINAD(&Data, Ratios[i], 0.1, DSDPackingLSB1, &Resets[0]);
+    f64 Half = MeasureSINAD(&Data, Ratios[i], 0.5, DSDPackingMSB1, &Resets[1]);
+    f64 Full = MeasureSINAD(&Data, Ratios[i], 1.0, DSDPackingNER8, &Resets[2]);
+    printf("%-8s %13.1fdB %13.1fdB %13.1fdB %8u\n", Names[i], Quiet, Half, Full,
+        Resets[0] + Resets[1] + Resets[2]);
+  }
+
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+      Data.PCM[Channel][Frame] = 0.5f * sinf((f32)(Frame * (Channel + 1)) * 0.01f);
+  }
+
+  printf("\n%d channels x %d frames at 44.1kHz, LSB1 packing\n", BENCH_CHANNELS, BENCH_FRAMES);
+  printf("%-8s %16s %12s %16s %12s\n", "", "modulate ns/bit", "realtime", "decimate ns/bit", "realtime");
+  for (u32 i = 0; i < 3; i++)
+  {
+    Data.Ratio = Ratios[i];
+    DSDModulatorInit(&Data.Modulator, BENCH_CHANNELS, Ratios[i], DSDPackingLSB1);
+    DSDDecimatorInit(&Data.Decimator, BENCH_CHANNELS, Ratios[i], DSDPackingLSB1);
+
+    // NOTE(robin): Decimate whatever the modulator produced last
+    BenchModulate(&Data);
+
+    f64 Bits = (f64)BENCH_CHANNELS * BENCH_FRAMES * Ratios[i];
+    f64 PeriodNS = BENCH_FRAMES * 1e9 / 44100.0;
+    f64 Modulate = BenchMeasure(BenchModulate, &Data);
+    f64 Decimate = BenchMeasure(BenchDecimate, &Data);
+    printf("%-8s %16.3f %11.1f%% %16.3f %11.1f%%\n", Names[i],
+        Modulate / Bits, 100.0 * Modulate / PeriodNS, Decimate / Bits, 100.0 * Decimate / PeriodNS);
+  }
+
+  return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * This file provides a small registry of block based DSP kernels (gain, mix, a sine
+ * oscillator, sample format conversion and stereo interleaving).
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): Most devices run with a fixed period of 64, 128 or 256 frames, but the
+ * callbacks in the examples loop over FrameCount with a runtime bound. Here we generate a
+ * copy of every kernel for each power of two block size (see dsp_kernels_template.c) where
+ * the frame count is a compile time constant, plus a generic copy for everything else.
+ *
+ * You pick the set of kernels once, when you know the period size, and then call through
+ * the table in your callback:
+ *
+ *   dsp_kernels Kernels = DSPSelectKernels(BufferSize);
+ *   ...
+ *   Kernels.Oscillator(Left, FrameCount, &Phase, PhaseDelta, Volume);
+ *
+ * If the period size changes (e.g. the JACK buffer size callback) just select again.
+ *
+ * NOTE(robin): The kernels are plain C loops that rely on the compiler to vectorise them,
+ * so by default they only use the instruction set the whole program was compiled for (SSE2
+ * on x86-64). With clang or gcc on x86 we also compile every kernel for AVX2 and AVX-512 and
+ * pick the best one the CPU supports the first time kernels are selected, so the same binary
+ * runs on old and new machines. Set the DSP_ISA environment variable to one of the names in
+ * DSPISANames to force a particular instruction set for testing. On AArch64 NEON is part of
+ * the baseline so there is nothing to pick, and with MSVC (which can't compile single
+ * functions for a different instruction set) you only get the baseline kernels.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#define DSP_X86_DISPATCH 1
+#endif
+
+// NOTE(robin): Not all compilers we care about know about the C99 restrict keyword
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#endif
+
+#define DSP_PASTE_(A, B) A##B
+#define DSP_PASTE(A, B) DSP_PASTE_(A, B)
+
+typedef void dsp_gain_kernel(f32* Buffer, u32 FrameCount, f32 Gain);
+typedef void dsp_mix_kernel(f32* restrict Dest, const f32* restrict Source, u32 FrameCount, f32 Gain);
+typedef void dsp_oscillator_kernel(f32* restrict Output, u32 FrameCount,
+    f32* restrict Phase, f32 PhaseDelta, f32 Amplitude);
+typedef void dsp_convert_f32_to_s16_kernel(s16* restrict Output, const f32* restrict Input, u32 FrameCount);
+typedef void dsp_convert_f32_to_s32_kernel(s32* restrict Output, const f32* restrict Input, u32 FrameCount);
+typedef void dsp_convert_f32_to_s24_kernel(u8* restrict Output, const f32* restrict Input, u32 FrameCount);
+typedef void dsp_convert_s16_to_f32_kernel(f32* restrict Output, const s16* restrict Input, u32 FrameCount);
+typedef void dsp_convert_s32_to_f32_kernel(f32* restrict Output, const s32* restrict Input, u32 FrameCount);
+typedef void dsp_interleave2_kernel(f32* restrict Output,
+    const f32* restrict Left, const f32* restrict Right, u32 FrameCount);
+typedef void dsp_deinterleave2_kernel(f32* restrict Left, f32* restrict Right,
+    const f32* restrict Input, u32 FrameCount);
+
+typedef struct
+{
+  u32 BlockSize; // NOTE(robin): Zero for the generic kernels
+  dsp_gain_kernel* Gain;
+  dsp_mix_kernel* Mix;
+  dsp_oscillator_kernel* Oscillator;
+  dsp_convert_f32_to_s16_kernel* ConvertF32ToS16;
+  dsp_convert_f32_to_s32_kernel* ConvertF32ToS32;
+  dsp_convert_f32_to_s24_kernel* ConvertF32ToS24; // NOTE(robin): Packed, 3 bytes per sample
+  dsp_convert_s16_to_f32_kernel* ConvertS16ToF32;
+  dsp_convert_s32_to_f32_kernel* ConvertS32ToF32;
+  dsp_interleave2_kernel* Interleave2;
+  dsp_deinterleave2_kernel* Deinterleave2;
+} dsp_kernels;
+
+// NOTE(robin): Computes sin(2 * pi * Phase) for Phase in [0, 1). This is branch free so that
+// the loops that call it can be vectorised. The maximum error is around 4e-6.
+static inline f32 DSPSinTurns(f32 Phase)
+{
+  // NOTE(robin): Move to [-0.5, 0.5) and then fold into [-0.25, 0.25] using the symmetry
+  // of sin around a quarter turn. This is a triangle wave with the sign of X, written with
+  // fabsf/copysignf instead of comparisons so that there's no control flow.
+  f32 X = Phase - 0.5f;
+  X = copysignf(0.25f - fabsf(fabsf(X) - 0.25f), X);
+
+  f32 Z = 6.28318530718f * X;
+  f32 Z2 = Z * Z;
+  f32 Result = Z * (1.0f + Z2 * (-1.0f / 6.0f + Z2 * (1.0f / 120.0f +
+        Z2 * (-1.0f / 5040.0f + Z2 * (1.0f / 362880.0f)))));
+
+  // NOTE(robin): sin(2 * pi * (X + 0.5)) = -sin(2 * pi * X)
+  return -Result;
+}
+
+typedef enum
+{
+  DSPISABaseline, // NOTE(robin): Whatever the program was compiled for
+  DSPISAAVX2,
+  DSPISAAVX512,
+
+  DSPISACount,
+} dsp_isa;
+
+const char* DSPISANames[DSPISACount] =
+{
+#if defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+  "neon",
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  "sse2",
+#else
+  "c",
+#endif
+  "avx2",
+  "avx512",
+};
+
+#define DSP_REGISTRY_SIZE 7
+
+#define DSP_ISA Baseline
+#include "dsp_kernels_isa.c"
+#undef DSP_ISA
+
+// NOTE(robin): Every function between push and pop is compiled for the given instruction set.
+// DSPSinTurns is inlined into those functions, so it gets compiled for it too.
+#if DSP_X86_DISPATCH
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#define DSP_ISA AVX2
+#include "dsp_kernels_isa.c"
+#undef DSP_ISA
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f,avx512dq,avx512bw,avx512vl,avx2,fma"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq,avx512bw,avx512vl,avx2,fma")
+#endif
+
+#define DSP_ISA AVX512
+#include "dsp_kernels_isa.c"
+#undef DSP_ISA
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+dsp_kernels** DSPKernelRegistries[DSPISACount] =
+{
+  DSPKernelRegistryBaseline,
+#if DSP_X86_DISPATCH
+  DSPKernelRegistryAVX2,
+  DSPKernelRegistryAVX512,
+#endif
+};
+
+// NOTE(robin): Does this CPU (and OS, which has to save the wider registers on a context
+// switch) support ISA?
+u32 DSPISASupported(dsp_isa ISA)
+{
+  if (ISA == DSPISABaseline)
+    return 1;
+
+#if DSP_X86_DISPATCH
+  u32 EAX, EBX, ECX, EDX;
+  if (!__get_cpuid(1, &EAX, &EBX, &ECX, &EDX))
+    return 0;
+
+  u32 HasOSXSAVE = (ECX >> 27) & 1;
+  u32 HasAVX = (ECX >> 28) & 1;
+  u32 HasFMA = (ECX >> 12) & 1;
+  if (!HasOSXSAVE || !HasAVX || !HasFMA)
+    return 0;
+
+  // NOTE(robin): XCR0 says which register state the OS saves: bits 1-2 are SSE/AVX, bits 5-7
+  // are the AVX-512 opmask and upper registers
+  u32 XCR0Low, XCR0High;
+  __asm__ __volatile__("xgetbv" : "=a"(XCR0Low), "=d"(XCR0High) : "c"(0));
+
+  if (!__get_cpuid_count(7, 0, &EAX, &EBX, &ECX, &EDX))
+    return 0;
+
+  switch (ISA)
+  {
+    case DSPISAAVX2:
+    {
+      return (XCR0Low & 0x6) == 0x6 && ((EBX >> 5) & 1);
+    } break;
+
+    case DSPISAAVX512:
+    {
+      u32 HasF = (EBX >> 16) & 1;
+      u32 HasDQ = (EBX >> 17) & 1;
+      u32 HasBW = (EBX >> 30) & 1;
+      u32 HasVL = (EBX >> 31) & 1;
+      return (XCR0Low & 0xE6) == 0xE6 && ((EBX >> 5) & 1) && HasF && HasDQ && HasBW && HasVL;
+    } break;
+
+    default:
+    {
+    } break;
+  }
+#endif
+
+  return 0;
+}
+
+dsp_isa DSPActiveISA;
+u32 DSPActiveISAValid;
+
+// NOTE(robin): Picks the best instruction set this CPU supports, or the one named by the DSP_ISA
+// environment variable if it's supported. Called for you the first time you select kernels.
+dsp_isa DSPDetectISA(void)
+{
+  dsp_isa Result = DSPISABaseline;
+  for (u32 ISA = 0; ISA < DSPISACount; ISA++)
+  {
+    if (DSPISASupported((dsp_isa)ISA))
+      Result = (dsp_isa)ISA;
+  }
+
+  const char* Override = getenv("DSP_ISA");
+  if (Override)
+  {
+    u32 Found = 0;
+    for (u32 ISA = 0; ISA < DSPISACount; ISA++)
+    {
+      if (!strcmp(Override, DSPISANames[ISA]))
+      {
+        Found = 1;
+        if (DSPISASupported((dsp_isa)ISA))
+          Result = (dsp_isa)ISA;
+        else
+          printf("DSP_ISA=%s is not supported on this machine, using %s\n", Override, DSPISANames[Result]);
+      }
+    }
+
+    if (!Found)
+      printf("Unknown DSP_ISA=%s, using %s\n", Override, DSPISANames[Result]);
+  }
+
+  DSPActiveISA = Result;
+  DSPActiveISAValid = 1;
+  return Result;
+}
+
+// NOTE(robin): Select the kernels for a particular instruction set, mostly useful for testing.
+// The specialised kernels only handle exactly BlockSize frames, anything else gets the
+// generic kernels.
+dsp_kernels DSPSelectKernelsISA(u32 FrameCount, dsp_isa ISA)
+{
+  if (ISA >= DSPISACount || !DSPKernelRegistries[ISA] || !DSPISASupported(ISA))
+    ISA = DSPISABaseline;
+
+  dsp_kernels** Registry = DSPKernelRegistries[ISA];
+  for (u32 i = 0; i < DSP_REGISTRY_SIZE - 1; i++)
+  {
+    if (Registry[i]->BlockSize == FrameCount)
+      return *Registry[i];
+  }
+
+  return *Registry[DSP_REGISTRY_SIZE - 1];
+}
+
+// NOTE(robin): Call this when the period size is known (or changes), never per callback.
+dsp_kernels DSPSelectKernels(u32 FrameCount)
+{
+  if (!DSPActiveISAValid)
+    DSPDetectISA();
+
+  return DSPSelectKernelsISA(FrameCount, DSPActiveISA);
+}
@@ -0,0 +1,344 @@
+/*
+ * This file benchmarks the block size specialised kernels from dsp_kernels.c against the
+ * generic kernels, and against the per sample loop the examples use, for every instruction
+ * set this CPU supports.
+ *
+ * Before anything is timed every kernel of every instruction set is checked against a plain
+ * scalar reference. Gain, interleaving and the integer to float conversions must match
+ * exactly. Mix and the oscillator may differ by rounding (the AVX2 and AVX-512 variants can
+ * use fused multiply-add), and float to integer conversions by 1 LSB for the same reason.
+ *
+ * Build it with optimisations turned on (see build.sh), the numbers are meaningless otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include <string.h>
+
+#include "types.h"
+#include "bench.c"
+#include "dsp_kernels.c"
+
+typedef struct
+{
+  dsp_kernels Kernels;
+  u32 FrameCount;
+
+  f32 Left[1024];
+  f32 Right[1024];
+  f32 Interleaved[2048];
+  s16 Int16[2048];
+  s32 Int32[2048];
+  f32 Phase[2];
+} bench_data;
+
+// NOTE(robin): This is what the callbacks in the examples do today
+void BenchNaiveOscillator(void* Context)
+{
+  bench_data* Data = Context;
+  f32 PhaseDelta[] = {220.0f / 48000.0f, 330.0f / 48000.0f};
+
+  for (u32 i = 0; i < 2 * Data->FrameCount; i++)
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      Data->Phase[i] += PhaseDelta[i];
+      if (Data->Phase[i] >= 1.0f)
+        Data->Phase[i] -= 1.0f;
+    }
+
+    f32 Volume = 0.2f;
+    Data->Interleaved[i] = Volume * sinf(Data->Phase[0] * 2 * (f32)M_PI);
+    Data->Interleaved[++i] = Volume * sinf(Data->Phase[1] * 2 * (f32)M_PI);
+  }
+}
+
+void BenchOscillator(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.Oscillator(Data->Left, Data->FrameCount, &Data->Phase[0], 220.0f / 48000.0f, 0.2f);
+  Data->Kernels.Oscillator(Data->Right, Data->FrameCount, &Data->Phase[1], 330.0f / 48000.0f, 0.2f);
+  Data->Kernels.Interleave2(Data->Interleaved, Data->Left, Data->Right, Data->FrameCount);
+}
+
+void BenchGain(void* Context)
+{
+  bench_data* Data = Context;
+  // NOTE(robin): A gain of -1 keeps the data stable however many times we run this. Anything
+  // smaller than 1 would eventually decay into denormals and measure those instead.
+  Data->Kernels.Gain(Data->Left, Data->FrameCount, -1.0f);
+}
+
+void BenchMix(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.Mix(Data->Left, Data->Right, Data->FrameCount, 0.5f);
+}
+
+void BenchConvertF32ToS16(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.ConvertF32ToS16(Data->Int16, Data->Interleaved, 2 * Data->FrameCount);
+}
+
+void BenchConvertF32ToS32(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.ConvertF32ToS32(Data->Int32, Data->Interleaved, 2 * Data->FrameCount);
+}
+
+void BenchConvertF32ToS24(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.ConvertF32ToS24((u8*)Data->Int32, Data->Interleaved, 2 * Data->FrameCount);
+}
+
+void BenchConvertS16ToF32(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.ConvertS16ToF32(Data->Interleaved, Data->Int16, 2 * Data->FrameCount);
+}
+
+void BenchInterleave2(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.Interleave2(Data->Interleaved, Data->Left, Data->Right, Data->FrameCount);
+}
+
+void BenchDeinterleave2(void* Context)
+{
+  bench_data* Data = Context;
+  Data->Kernels.Deinterleave2(Data->Left, Data->Right, Data->Interleaved, Data->FrameCount);
+}
+
+typedef struct
+{
+  const char* Name;
+  bench_function* Function;
+  u32 SamplesPerFrame; // NOTE(robin): How many samples per frame the kernel is called with
+} bench_case;
+
+#define VERIFY_MAX_FRAMES 1024
+
+// NOTE(robin): Returns the number of mismatches, and prints the first one
+u32 VerifyCompare(const char* ISAName, const char* Kernel, u32 FrameCount,
+    const f64* Expected, const f64* Actual, u32 Count, f64 Tolerance)
+{
+  u32 Mismatches = 0;
+  for (u32 i = 0; i < Count; i++)
+  {
+    if (fabs(Expected[i] - Actual[i]) > Tolerance)
+    {
+      if (!Mismatches)
+      {
+        printf("%s %s (%u frames) sample %u: expected %.9g, got %.9g\n",
+            ISAName, Kernel, FrameCount, i, Expected[i], Actual[i]);
+      }
+      Mismatches++;
+    }
+  }
+  return Mismatches;
+}
+
+u32 VerifyKernels(dsp_kernels Kernels, const char* ISAName, u32 FrameCount)
+{
+  static f32 Input[2 * VERIFY_MAX_FRAMES];
+  static f32 Output[2 * VERIFY_MAX_FRAMES];
+  static f32 Left[VERIFY_MAX_FRAMES], Right[VERIFY_MAX_FRAMES];
+  static s16 Int16[2 * VERIFY_MAX_FRAMES];
+  static s32 Int32[2 * VERIFY_MAX_FRAMES];
+  static f64 Expected[2 * VERIFY_MAX_FRAMES];
+  static f64 Actual[2 * VERIFY_MAX_FRAMES];
+
+  // NOTE(robin): Include values outside of [-1, 1] to check the clipping
+  for (u32 i = 0; i < 2 * VERIFY_MAX_FRAMES; i++)
+  {
+    Input[i] = 1.5f * sinf((f32)i * 0.37f);
+    Int16[i] = (s16)(i * 2654435761u >> 16);
+    Int32[i] = (s32)(i * 2654435761u);
+  }
+
+  u32 Mismatches = 0;
+
+  memcpy(Output, Input, FrameCount * sizeof(f32));
+  Kernels.Gain(Output, FrameCount, 0.3f);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[i] = Input[i] * 0.3f;
+    Actual[i] = Output[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "gain", FrameCount, Expected, Actual, FrameCount, 0);
+
+  memcpy(Output, Input, FrameCount * sizeof(f32));
+  Kernels.Mix(Output, Input + FrameCount, FrameCount, 0.3f);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[i] = (f64)Input[i] + 0.3 * (f64)Input[FrameCount + i];
+    Actual[i] = Output[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "mix", FrameCount, Expected, Actual, FrameCount, 1e-6);
+
+  f32 Phase = 0.9f;
+  f32 PhaseDelta = 440.0f / 48000.0f;
+  Kernels.Oscillator(Output, FrameCount, &Phase, PhaseDelta, 0.5f);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[i] = 0.5 * sin(2 * 3.14159265358979 * (0.9f + (f64)(i + 1) * PhaseDelta));
+    Actual[i] = Output[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "oscillator", FrameCount, Expected, Actual, FrameCount, 1e-5);
+
+  s16 Int16Out[2 * VERIFY_MAX_FRAMES];
+  Kernels.ConvertF32ToS16(Int16Out, Input, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f64 Sample = Input[i] > 1.0f ? 1.0 : Input[i] < -1.0f ? -1.0 : Input[i];
+    Expected[i] = round(Sample * 32767.0);
+    Actual[i] = Int16Out[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "f32_to_s16", FrameCount, Expected, Actual, FrameCount, 1);
+
+  s32 Int32Out[2 * VERIFY_MAX_FRAMES];
+  Kernels.ConvertF32ToS32(Int32Out, Input, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f64 Sample = (f64)Input[i] * 2147483648.0;
+    Sample = Sample > 2147483520.0 ? 2147483520.0 : Sample < -2147483648.0 ? -2147483648.0 : Sample;
+    Expected[i] = trunc(Sample);
+    Actual[i] = Int32Out[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "f32_to_s32", FrameCount, Expected, Actual, FrameCount, 1);
+
+  u8 Int24Out[3 * 2 * VERIFY_MAX_FRAMES];
+  Kernels.ConvertF32ToS24(Int24Out, Input, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f64 Sample = Input[i] > 1.0f ? 1.0 : Input[i] < -1.0f ? -1.0 : Input[i];
+    Expected[i] = round(Sample * 8388607.0);
+    u32 Value = Int24Out[3 * i] | (Int24Out[3 * i + 1] << 8) | ((u32)Int24Out[3 * i + 2] << 16);
+    Actual[i] = (s32)(Value << 8) >> 8; // NOTE(robin): Sign extend
+  }
+  Mismatches += VerifyCompare(ISAName, "f32_to_s24", FrameCount, Expected, Actual, FrameCount, 1);
+
+  Kernels.ConvertS16ToF32(Output, Int16, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[i] = Int16[i] / 32768.0;
+    Actual[i] = Output[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "s16_to_f32", FrameCount, Expected, Actual, FrameCount, 0);
+
+  Kernels.ConvertS32ToF32(Output, Int32, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[i] = (f32)Int32[i] * (1.0f / 2147483648.0f);
+    Actual[i] = Output[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "s32_to_f32", FrameCount, Expected, Actual, FrameCount, 0);
+
+  Kernels.Interleave2(Output, Input, Input + FrameCount, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[2 * i + 0] = Input[i];
+    Expected[2 * i + 1] = Input[FrameCount + i];
+    Actual[2 * i + 0] = Output[2 * i + 0];
+    Actual[2 * i + 1] = Output[2 * i + 1];
+  }
+  Mismatches += VerifyCompare(ISAName, "interleave2", FrameCount, Expected, Actual, 2 * FrameCount, 0);
+
+  Kernels.Deinterleave2(Left, Right, Input, FrameCount);
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Expected[2 * i + 0] = Input[2 * i + 0];
+    Expected[2 * i + 1] = Input[2 * i + 1];
+    Actual[2 * i + 0] = Left[i];
+    Actual[2 * i + 1] = Right[i];
+  }
+  Mismatches += VerifyCompare(ISAName, "deinterleave2", FrameCount, Expected, Actual, 2 * FrameCount, 0);
+
+  return Mismatches;
+}
+
+int main(int argc, char** argv)
+{
+  // NOTE(robin): The conversions run over interleaved stereo, so they are called with
+  // 2 * FrameCount samples and need the kernels specialised for twice the block size.
+  bench_case Cases[] =
+  {
+    {"oscillator", BenchOscillator, 1},
+    {"gain", BenchGain, 1},
+    {"mix", BenchMix, 1},
+    {"f32_to_s16", BenchConvertF32ToS16, 2},
+    {"f32_to_s32", BenchConvertF32ToS32, 2},
+    {"f32_to_s24", BenchConvertF32ToS24, 2},
+    {"s16_to_f32", BenchConvertS16ToF32, 2},
+    {"interleave2", BenchInterleave2, 1},
+    {"deinterleave2", BenchDeinterleave2, 1},
+  };
+  u32 CaseCount = sizeof(Cases) / sizeof(Cases[0]);
+
+  u32 BlockSizes[] = {64, 128, 256, 512};
+
+  static bench_data Data;
+  for (u32 i = 0; i < 1024; i++)
+  {
+    Data.Left[i] = 0.5f * sinf(i * 0.01f);
+    Data.Right[i] = 0.5f * cosf(i * 0.01f);
+  }
+
+  // NOTE(robin): Check every variant first, including frame counts that only the generic
+  // kernels handle
+  u32 VerifyFrames[] = {1, 37, 100, 32, 64, 128, 256, 512, 1024};
+  u32 Mismatches = 0;
+  for (u32 ISA = 0; ISA < DSPISACount; ISA++)
+  {
+    if (!DSPISASupported((dsp_isa)ISA))
+      continue;
+
+    for (u32 i = 0; i < sizeof(VerifyFrames) / sizeof(VerifyFrames[0]); i++)
+    {
+      dsp_kernels Kernels = DSPSelectKernelsISA(VerifyFrames[i], (dsp_isa)ISA);
+      Mismatches += VerifyKernels(Kernels, DSPISANames[ISA], VerifyFrames[i]);
+    }
+  }
+  assert(!Mismatches);
+  printf("All supported instruction sets match the scalar reference, %s is selected\n",
+      DSPISANames[DSPDetectISA()]);
+
+  for (u32 ISA = 0; ISA < DSPISACount; ISA++)
+  {
+    if (!DSPISASupported((dsp_isa)ISA))
+      continue;
+
+    printf("\n%s\n", DSPISANames[ISA]);
+    printf("%-14s %6s %12s %12s %8s\n", "kernel", "frames", "generic ns", "fixed ns", "speedup");
+
+    for (u32 SizeIndex = 0; SizeIndex < sizeof(BlockSizes) / sizeof(BlockSizes[0]); SizeIndex++)
+    {
+      u32 FrameCount = BlockSizes[SizeIndex];
+      Data.FrameCount = FrameCount;
+
+      Data.Kernels = DSPSelectKernelsISA(0, (dsp_isa)ISA);
+      f64 Naive = BenchMeasure(BenchNaiveOscillator, &Data);
+      printf("%-14s %6u %12.1f\n", "naive_osc", FrameCount, Naive);
+
+      for (u32 CaseIndex = 0; CaseIndex < CaseCount; CaseIndex++)
+      {
+        u32 KernelFrames = Cases[CaseIndex].SamplesPerFrame * FrameCount;
+
+        Data.Kernels = DSPSelectKernelsISA(0, (dsp_isa)ISA);
+        f64 Generic = BenchMeasure(Cases[CaseIndex].Function, &Data);
+
+        Data.Kernels = DSPSelectKernelsISA(KernelFrames, (dsp_isa)ISA);
+        f64 Fixed = BenchMeasure(Cases[CaseIndex].Function, &Data);
+
+        printf("%-14s %6u %12.1f %12.1f %7.2fx\n", Cases[CaseIndex].Name, FrameCount,
+            Generic, Fixed, Generic / Fixed);
+      }
+    }
+  }
+
+  return 0;
+}
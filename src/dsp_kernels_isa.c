@@ -0,0 +1,45 @@
+/*
+ * IMPORTANT(robin): This file is included once per instruction set by dsp_kernels.c, don't
+ * include it yourself.
+ *
+ * Generates the generic kernels and every block size specialisation for the instruction set
+ * in DSP_ISA, plus the registry that DSPSelectKernels searches.
+ */
+
+#include "dsp_kernels_template.c"
+
+#define DSP_BLOCK_SIZE 32
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+#define DSP_BLOCK_SIZE 64
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+#define DSP_BLOCK_SIZE 128
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+#define DSP_BLOCK_SIZE 256
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+#define DSP_BLOCK_SIZE 512
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+#define DSP_BLOCK_SIZE 1024
+#include "dsp_kernels_template.c"
+#undef DSP_BLOCK_SIZE
+
+// NOTE(robin): The generic kernels go last, they match any frame count
+dsp_kernels* DSP_PASTE(DSPKernelRegistry, DSP_ISA)[DSP_REGISTRY_SIZE] =
+{
+  &DSP_PASTE(DSPKernels32, DSP_ISA),
+  &DSP_PASTE(DSPKernels64, DSP_ISA),
+  &DSP_PASTE(DSPKernels128, DSP_ISA),
+  &DSP_PASTE(DSPKernels256, DSP_ISA),
+  &DSP_PASTE(DSPKernels512, DSP_ISA),
+  &DSP_PASTE(DSPKernels1024, DSP_ISA),
+  &DSP_PASTE(DSPKernelsGeneric, DSP_ISA),
+};
@@ -0,0 +1,171 @@
+/*
+ * IMPORTANT(robin): This file is included several times by dsp_kernels_isa.c, don't include it
+ * yourself.
+ *
+ * Each inclusion generates one set of DSP kernels for the instruction set in DSP_ISA. If
+ * DSP_BLOCK_SIZE is defined then the kernels are specialised for exactly that many frames:
+ * the loop bounds are compile time constants, so the compiler can fully vectorise (and often
+ * unroll) the loops without any remainder handling. If DSP_BLOCK_SIZE is not defined then we
+ * generate the generic kernels which use the FrameCount argument instead.
+ *
+ * Every kernel takes FrameCount either way so that all of the variants have the same
+ * signature and can live in the same function pointer table.
+ */
+
+#ifdef DSP_BLOCK_SIZE
+#define DSP_FRAMES DSP_BLOCK_SIZE
+#define DSP_NAME(Name) DSP_PASTE(DSP_PASTE(Name, DSP_BLOCK_SIZE), DSP_ISA)
+#else
+#define DSP_FRAMES FrameCount
+#define DSP_NAME(Name) DSP_PASTE(DSP_PASTE(Name, Generic), DSP_ISA)
+#endif
+
+void DSP_NAME(DSPGain)(f32* Buffer, u32 FrameCount, f32 Gain)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+    Buffer[i] *= Gain;
+}
+
+// NOTE(robin): Dest += Gain * Source
+void DSP_NAME(DSPMix)(f32* restrict Dest, const f32* restrict Source, u32 FrameCount, f32 Gain)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+    Dest[i] += Gain * Source[i];
+}
+
+// NOTE(robin): Same as the oscillators in the examples, i.e. the phase is advanced before each
+// sample is computed. Phase is in [0, 1) and is updated for the next block.
+void DSP_NAME(DSPOscillator)(f32* restrict Output, u32 FrameCount,
+    f32* restrict Phase, f32 PhaseDelta, f32 Amplitude)
+{
+  f32 StartPhase = *Phase;
+
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+  {
+    // NOTE(robin): Computing the phase from the start of the block instead of accumulating it
+    // removes the dependency between samples so the loop can be vectorised
+    f32 SamplePhase = StartPhase + (f32)(i + 1) * PhaseDelta;
+    SamplePhase -= (f32)(s32)SamplePhase;
+    Output[i] = Amplitude * DSPSinTurns(SamplePhase);
+  }
+
+  f32 EndPhase = StartPhase + (f32)DSP_FRAMES * PhaseDelta;
+  *Phase = EndPhase - (f32)(s32)EndPhase;
+}
+
+void DSP_NAME(DSPConvertF32ToS16)(s16* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+  {
+    f32 Sample = Input[i];
+    Sample = Sample > 1.0f ? 1.0f : Sample;
+    Sample = Sample < -1.0f ? -1.0f : Sample;
+    Sample *= 32767.0f;
+    Sample += copysignf(0.5f, Sample); // NOTE(robin): Round to nearest
+    Output[i] = (s16)(s32)Sample;
+  }
+}
+
+void DSP_NAME(DSPConvertF32ToS32)(s32* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+  {
+    // NOTE(robin): 2147483647 isn't representable as a float, 2147483520 is the largest float
+    // that is still in range.
+    f32 Sample = Input[i] * 2147483648.0f;
+    Sample = Sample > 2147483520.0f ? 2147483520.0f : Sample;
+    Sample = Sample < -2147483648.0f ? -2147483648.0f : Sample;
+    Output[i] = (s32)Sample;
+  }
+}
+
+// NOTE(robin): Packed 24 bit little endian (ALSA's S24_3LE, ASIO's Int24LSB). Storing three
+// bytes per sample doesn't vectorise, so we convert a chunk to 32 bit integers first (which
+// does) and then store each sample as a whole 32 bit word 3 bytes after the previous one. The
+// top byte is garbage but the next sample overwrites it, only the very last sample has to be
+// stored a byte at a time. This assumes a little endian machine.
+void DSP_NAME(DSPConvertF32ToS24)(u8* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  s32 Chunk[64];
+  for (u32 Start = 0; Start < DSP_FRAMES; Start += 64)
+  {
+    u32 Count = DSP_FRAMES - Start < 64 ? DSP_FRAMES - Start : 64;
+    for (u32 i = 0; i < Count; i++)
+    {
+      f32 Sample = Input[Start + i];
+      Sample = Sample > 1.0f ? 1.0f : Sample;
+      Sample = Sample < -1.0f ? -1.0f : Sample;
+      Sample *= 8388607.0f;
+      Sample += copysignf(0.5f, Sample);
+      Chunk[i] = (s32)Sample;
+    }
+
+    u8* Out = Output + 3 * Start;
+    u32 Last = Start + Count == DSP_FRAMES;
+    for (u32 i = 0; i < Count - Last; i++)
+      memcpy(Out + 3 * i, &Chunk[i], 4);
+
+    if (Last)
+    {
+      u32 Value = (u32)Chunk[Count - 1];
+      Out[3 * (Count - 1) + 0] = (u8)Value;
+      Out[3 * (Count - 1) + 1] = (u8)(Value >> 8);
+      Out[3 * (Count - 1) + 2] = (u8)(Value >> 16);
+    }
+  }
+}
+
+void DSP_NAME(DSPConvertS16ToF32)(f32* restrict Output, const s16* restrict Input, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+    Output[i] = (f32)Input[i] * (1.0f / 32768.0f);
+}
+
+void DSP_NAME(DSPConvertS32ToF32)(f32* restrict Output, const s32* restrict Input, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+    Output[i] = (f32)Input[i] * (1.0f / 2147483648.0f);
+}
+
+// NOTE(robin): Stereo only, see interleave.c for any number of channels
+void DSP_NAME(DSPInterleave2)(f32* restrict Output,
+    const f32* restrict Left, const f32* restrict Right, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+  {
+    Output[2 * i + 0] = Left[i];
+    Output[2 * i + 1] = Right[i];
+  }
+}
+
+void DSP_NAME(DSPDeinterleave2)(f32* restrict Left, f32* restrict Right,
+    const f32* restrict Input, u32 FrameCount)
+{
+  for (u32 i = 0; i < DSP_FRAMES; i++)
+  {
+    Left[i] = Input[2 * i + 0];
+    Right[i] = Input[2 * i + 1];
+  }
+}
+
+dsp_kernels DSP_NAME(DSPKernels) =
+{
+#ifdef DSP_BLOCK_SIZE
+  DSP_BLOCK_SIZE,
+#else
+  0,
+#endif
+  DSP_NAME(DSPGain),
+  DSP_NAME(DSPMix),
+  DSP_NAME(DSPOscillator),
+  DSP_NAME(DSPConvertF32ToS16),
+  DSP_NAME(DSPConvertF32ToS32),
+  DSP_NAME(DSPConvertF32ToS24),
+  DSP_NAME(DSPConvertS16ToF32),
+  DSP_NAME(DSPConvertS32ToF32),
+  DSP_NAME(DSPInterleave2),
+  DSP_NAME(DSPDeinterleave2),
+};
+
+#undef DSP_FRAMES
+#undef DSP_NAME
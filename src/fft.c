@@ -0,0 +1,271 @@
+/*
+ * This file is a small power of 2 FFT on split (separate real and imaginary) float arrays.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): It's an iterative radix 2 transform: bit reverse the input, then log2(Size)
+ * passes of butterflies. The twiddles for each pass are stored next to each other (the pass
+ * with half size Half uses Twiddle[Half .. 2 * Half - 1]) so the inner loop reads memory
+ * in order and vectorises. All of the memory is allocated in FFTInit, the transforms
+ * themselves don't allocate and are safe to call from an audio thread.
+ *
+ * fft_real transforms real signals of Size samples with a complex FFT of Size / 2: the even
+ * samples go in the real part and the odd samples in the imaginary part, and one extra pass
+ * untangles the two. The spectrum is the Size / 2 + 1 bins from DC to Nyquist (the rest
+ * are the conjugates of these).
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#endif
+
+typedef struct
+{
+  u32 Size;
+  u32* Reverse;
+  f32* TwiddleRe;
+  f32* TwiddleIm;
+} fft;
+
+// NOTE(robin): Size must be a power of 2, returns 0 if it isn't or if we're out of memory
+u32 FFTInit(fft* FFT, u32 Size)
+{
+  *FFT = (fft){0};
+  if (Size < 2 || (Size & (Size - 1)))
+    return 0;
+
+  FFT->Size = Size;
+  FFT->Reverse = malloc(Size * sizeof(u32));
+  FFT->TwiddleRe = malloc(Size * sizeof(f32));
+  FFT->TwiddleIm = malloc(Size * sizeof(f32));
+  if (!FFT->Reverse || !FFT->TwiddleRe || !FFT->TwiddleIm)
+    return 0;
+
+  u32 Bits = 0;
+  while ((1u << Bits) < Size)
+    Bits++;
+
+  for (u32 i = 0; i < Size; i++)
+  {
+    u32 Reversed = 0;
+    for (u32 Bit = 0; Bit < Bits; Bit++)
+      Reversed |= ((i >> Bit) & 1) << (Bits - 1 - Bit);
+    FFT->Reverse[i] = Reversed;
+  }
+
+  // NOTE(robin): Forward transform twiddles, e^(-2 pi i j / (2 * Half))
+  FFT->TwiddleRe[0] = 1;
+  FFT->TwiddleIm[0] = 0;
+  for (u32 Half = 1; Half < Size; Half *= 2)
+  {
+    for (u32 j = 0; j < Half; j++)
+    {
+      f64 Angle = -3.14159265358979323846 * (f64)j / (f64)Half;
+      FFT->TwiddleRe[Half + j] = (f32)cos(Angle);
+      FFT->TwiddleIm[Half + j] = (f32)sin(Angle);
+    }
+  }
+
+  return 1;
+}
+
+void FFTFree(fft* FFT)
+{
+  free(FFT->Reverse);
+  free(FFT->TwiddleRe);
+  free(FFT->TwiddleIm);
+  *FFT = (fft){0};
+}
+
+static void FFTTransform(fft* FFT, f32* restrict Re, f32* restrict Im, f32 Direction)
+{
+  u32 Size = FFT->Size;
+
+  for (u32 i = 0; i < Size; i++)
+  {
+    u32 j = FFT->Reverse[i];
+    if (j > i)
+    {
+      f32 TempRe = Re[i]; Re[i] = Re[j]; Re[j] = TempRe;
+      f32 TempIm = Im[i]; Im[i] = Im[j]; Im[j] = TempIm;
+    }
+  }
+
+  for (u32 Half = 1; Half < Size; Half *= 2)
+  {
+    const f32* restrict WRe = FFT->TwiddleRe + Half;
+    const f32* restrict WIm = FFT->TwiddleIm + Half;
+
+    for (u32 Start = 0; Start < Size; Start += 2 * Half)
+    {
+      f32* restrict ARe = Re + Start;
+      f32* restrict AIm = Im + Start;
+      f32* restrict BRe = Re + Start + Half;
+      f32* restrict BIm = Im + Start + Half;
+
+      // NOTE(robin): The inverse uses the conjugate twiddles, hence Direction
+      for (u32 j = 0; j < Half; j++)
+      {
+        f32 TRe = BRe[j] * WRe[j] - BIm[j] * WIm[j] * Direction;
+        f32 TIm = BRe[j] * WIm[j] * Direction + BIm[j] * WRe[j];
+        BRe[j] = ARe[j] - TRe;
+        BIm[j] = AIm[j] - TIm;
+        ARe[j] += TRe;
+        AIm[j] += TIm;
+      }
+    }
+  }
+}
+
+// NOTE(robin): In place forward transform
+void FFTForward(fft* FFT, f32* Re, f32* Im)
+{
+  FFTTransform(FFT, Re, Im, 1.0f);
+}
+
+// NOTE(robin): In place inverse transform, scaled by 1 / Size so that it undoes FFTForward
+void FFTInverse(fft* FFT, f32* Re, f32* Im)
+{
+  FFTTransform(FFT, Re, Im, -1.0f);
+
+  f32 Scale = 1.0f / (f32)FFT->Size;
+  for (u32 i = 0; i < FFT->Size; i++)
+  {
+    Re[i] *= Scale;
+    Im[i] *= Scale;
+  }
+}
+
+typedef struct
+{
+  u32 Size;
+  fft Half;
+  f32* TwiddleRe; // NOTE(robin): e^(-2 pi i k / Size) for k < Size / 4 + 1
+  f32* TwiddleIm;
+} fft_real;
+
+// NOTE(robin): Size must be a power of 2 and at least 4
+u32 FFTRealInit(fft_real* FFT, u32 Size)
+{
+  *FFT = (fft_real){0};
+  if (Size < 4 || !FFTInit(&FFT->Half, Size / 2))
+    return 0;
+
+  FFT->Size = Size;
+  u32 Count = Size / 4 + 1;
+  FFT->TwiddleRe = malloc(Count * sizeof(f32));
+  FFT->TwiddleIm = malloc(Count * sizeof(f32));
+  if (!FFT->TwiddleRe || !FFT->TwiddleIm)
+    return 0;
+
+  for (u32 k = 0; k < Count; k++)
+  {
+    f64 Angle = -2.0 * 3.14159265358979323846 * (f64)k / (f64)Size;
+    FFT->TwiddleRe[k] = (f32)cos(Angle);
+    FFT->TwiddleIm[k] = (f32)sin(Angle);
+  }
+
+  return 1;
+}
+
+void FFTRealFree(fft_real* FFT)
+{
+  FFTFree(&FFT->Half);
+  free(FFT->TwiddleRe);
+  free(FFT->TwiddleIm);
+  *FFT = (fft_real){0};
+}
+
+// NOTE(robin): Input has Size samples, Re and Im receive Size / 2 + 1 bins. Input may not
+// overlap Re or Im.
+void FFTRealForward(fft_real* FFT, const f32* restrict Input, f32* restrict Re, f32* restrict Im)
+{
+  u32 M = FFT->Size / 2;
+  for (u32 n = 0; n < M; n++)
+  {
+    Re[n] = Input[2 * n + 0];
+    Im[n] = Input[2 * n + 1];
+  }
+
+  FFTForward(&FFT->Half, Re, Im);
+
+  // NOTE(robin): With Z the half size transform, the transforms of the even and odd samples
+  // are E[k] = (Z[k] + conj(Z[M - k])) / 2 and O[k] = (Z[k] - conj(Z[M - k])) / 2i, and
+  // X[k] = E[k] + W^k O[k]. Bins k and M - k need each other so we do them in pairs.
+  f32 Z0Re = Re[0];
+  f32 Z0Im = Im[0];
+  Re[0] = Z0Re + Z0Im;
+  Im[0] = 0;
+  Re[M] = Z0Re - Z0Im;
+  Im[M] = 0;
+
+  for (u32 k = 1; k <= M / 2; k++)
+  {
+    u32 j = M - k;
+    f32 ARe = Re[k], AIm = Im[k];
+    f32 BRe = Re[j], BIm = Im[j];
+
+    f32 ERe = 0.5f * (ARe + BRe);
+    f32 EIm = 0.5f * (AIm - BIm);
+    f32 ORe = 0.5f * (AIm + BIm);
+    f32 OIm = -0.5f * (ARe - BRe);
+
+    // NOTE(robin): W^(M - k) = -conj(W^k), and for bin j E and O are the conjugates of bin k's
+    f32 WRe = FFT->TwiddleRe[k], WIm = FFT->TwiddleIm[k];
+    f32 TRe = ORe * WRe - OIm * WIm;
+    f32 TIm = ORe * WIm + OIm * WRe;
+
+    Re[k] = ERe + TRe;
+    Im[k] = EIm + TIm;
+    Re[j] = ERe - TRe;
+    Im[j] = -EIm + TIm;
+  }
+}
+
+// NOTE(robin): The inverse of FFTRealForward (including the 1 / Size scale). Re and Im are
+// used as scratch.
+void FFTRealInverse(fft_real* FFT, f32* restrict Re, f32* restrict Im, f32* restrict Output)
+{
+  u32 M = FFT->Size / 2;
+
+  f32 DCRe = Re[0];
+  f32 NyquistRe = Re[M];
+  Re[0] = 0.5f * (DCRe + NyquistRe);
+  Im[0] = 0.5f * (DCRe - NyquistRe);
+
+  for (u32 k = 1; k <= M / 2; k++)
+  {
+    u32 j = M - k;
+    f32 ARe = Re[k], AIm = Im[k];
+    f32 BRe = Re[j], BIm = Im[j];
+
+    f32 ERe = 0.5f * (ARe + BRe);
+    f32 EIm = 0.5f * (AIm - BIm);
+    f32 DRe = 0.5f * (ARe - BRe);
+    f32 DIm = 0.5f * (AIm + BIm);
+
+    // NOTE(robin): The reverse of the forward pass: E[k] = (X[k] + conj(X[j])) / 2 and
+    // O[k] = conj(W^k) (X[k] - conj(X[j])) / 2, then Z[k] = E + iO and Z[j] = conj(E) + i conj(O)
+    f32 WRe = FFT->TwiddleRe[k], WIm = FFT->TwiddleIm[k];
+    f32 ORe = DRe * WRe + DIm * WIm;
+    f32 OIm = DIm * WRe - DRe * WIm;
+
+    Re[k] = ERe - OIm;
+    Im[k] = EIm + ORe;
+    Re[j] = ERe + OIm;
+    Im[j] = -EIm + ORe;
+  }
+
+  FFTInverse(&FFT->Half, Re, Im);
+
+  for (u32 n = 0; n < M; n++)
+  {
+    Output[2 * n + 0] = Re[n];
+    Output[2 * n + 1] = Im[n];
+  }
+}
@@ -0,0 +1,486 @@
+/*
+ * This file is a bank of EQ/crossover filters (biquad and state variable filter cascades)
+ * for many channels at once.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   filter_bank Bank;
+ *   FilterBankInit(&Bank, ChannelCount, 2, Kinds, RampFrames);
+ *   for (every channel)
+ *   {
+ *     FilterBankSet(&Bank, Channel, 0, FilterPeak, 1000.0f / SampleRate, 1.0f, 6.0f);
+ *     FilterBankSet(&Bank, Channel, 1, FilterLowpass, 8000.0f / SampleRate, 0.707f, 0);
+ *   }
+ *
+ *   // In the callback, in place
+ *   FilterBankProcess(&Bank, Channels, FrameCount);
+ *
+ * NOTE(robin): A recursive filter needs the previous output to compute the next one, so the
+ * samples of one channel can't be computed side by side. Different channels can though, so
+ * we run FILTER_LANES channels (a lane group) through the same code together: the state and
+ * coefficients are stored per stage as arrays of FILTER_LANES (structure of arrays) and the
+ * loops over the lanes vectorise into one SIMD operation per filter operation. 4 lanes fill
+ * an SSE/NEON register, 8 an AVX one and 16 an AVX-512 one; the default of 8 is a good fit
+ * for all of them (two SSE operations per step hide some latency). The channels of a group
+ * are transposed into one interleaved block first, run through every stage of the cascade
+ * there, and transposed back. Channel counts that aren't a multiple of FILTER_LANES fill the
+ * last group with silent lanes, so for one or two channels a plain scalar loop is faster:
+ * use a filter per channel and stage for those (FilterInit, FilterProcess).
+ *
+ * Every stage of the cascade has a kind (biquad or SVF) for all channels, but each channel
+ * can have its own shape and settings. Biquads are transposed direct form II with the
+ * Audio EQ Cookbook designs. The SVF is the trapezoidal (TPT/"zero delay feedback") state
+ * variable filter, which keeps working when its coefficients change quickly, so prefer it
+ * for anything that's modulated.
+ *
+ * NOTE(robin): FilterBankSet designs the new coefficients once. If RampFrames isn't zero, the
+ * next FilterBankProcess moves every coefficient of the stage there in a straight line over
+ * RampFrames samples, which is one add per coefficient per sample instead of a redesign
+ * (tan, pow, division) per sample. FilterBankSet isn't thread safe, call it from the audio
+ * thread (e.g. when you drain your parameter queue) or before processing starts.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#endif
+
+#ifndef FILTER_LANES
+#define FILTER_LANES 8
+#endif
+
+#define FILTER_MAX_STAGES 8
+#define FILTER_BLOCK 256 // NOTE(robin): Frames per transposed block
+#define FILTER_COEFFICIENTS 6
+
+typedef enum
+{
+  FilterKindBiquad,
+  FilterKindSVF,
+} filter_kind;
+
+typedef enum
+{
+  FilterLowpass,
+  FilterHighpass,
+  FilterBandpass,
+  FilterNotch,
+  FilterAllpass,
+  FilterPeak,      // NOTE(robin): Bell, GainDB at Frequency
+  FilterLowShelf,
+  FilterHighShelf,
+} filter_shape;
+
+// NOTE(robin): Biquads use b0, b1, b2, a1, a2 and SVFs a1, a2, a3, m0, m1, m2
+typedef struct
+{
+  f32 Coefficients[FILTER_COEFFICIENTS][FILTER_LANES];
+  f32 Targets[FILTER_COEFFICIENTS][FILTER_LANES];
+  f32 Deltas[FILTER_COEFFICIENTS][FILTER_LANES];
+  f32 State[2][FILTER_LANES];
+  u32 RampRemaining;
+  u32 Changed;
+} filter_stage;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 GroupCount;
+  u32 StageCount;
+  u32 RampFrames;
+  filter_kind Kinds[FILTER_MAX_STAGES];
+  filter_stage* Stages; // NOTE(robin): [Group][Stage]
+  f32 Work[FILTER_BLOCK * FILTER_LANES];
+  f32 Silence[FILTER_BLOCK];
+  f32 Discard[FILTER_BLOCK];
+} filter_bank;
+
+// NOTE(robin): Designs one stage. Frequency is relative to the sample rate (0 to 0.5), Q is
+// the usual quality factor (0.707 for Butterworth) and GainDB is only used by the peak and
+// shelf shapes.
+void FilterDesign(f32* Coefficients, filter_kind Kind, filter_shape Shape, f32 Frequency, f32 Q, f32 GainDB)
+{
+  const f64 Pi = 3.14159265358979323846;
+  f64 A = pow(10.0, GainDB / 40.0);
+
+  if (Kind == FilterKindSVF)
+  {
+    f64 G = tan(Pi * Frequency);
+    f64 K = 1.0 / Q;
+    f64 M0 = 0, M1 = 0, M2 = 0;
+    switch (Shape)
+    {
+      case FilterLowpass: { M2 = 1; } break;
+      case FilterHighpass: { M0 = 1; M1 = -K; M2 = -1; } break;
+      case FilterBandpass: { M1 = 1; } break;
+      case FilterNotch: { M0 = 1; M1 = -K; } break;
+      case FilterAllpass: { M0 = 1; M1 = -2 * K; } break;
+      case FilterPeak:
+      {
+        K = 1.0 / (Q * A);
+        M0 = 1; M1 = K * (A * A - 1);
+      } break;
+      case FilterLowShelf:
+      {
+        G /= sqrt(A);
+        M0 = 1; M1 = K * (A - 1); M2 = A * A - 1;
+      } break;
+      case FilterHighShelf:
+      {
+        G *= sqrt(A);
+        M0 = A * A; M1 = K * (1 - A) * A; M2 = 1 - A * A;
+      } break;
+    }
+
+    f64 A1 = 1.0 / (1.0 + G * (G + K));
+    Coefficients[0] = (f32)A1;
+    Coefficients[1] = (f32)(G * A1);
+    Coefficients[2] = (f32)(G * G * A1);
+    Coefficients[3] = (f32)M0;
+    Coefficients[4] = (f32)M1;
+    Coefficients[5] = (f32)M2;
+    return;
+  }
+
+  f64 W = 2.0 * Pi * Frequency;
+  f64 Cos = cos(W);
+  f64 Alpha = sin(W) / (2.0 * Q);
+  f64 B0 = 1, B1 = 0, B2 = 0, A0 = 1, A1 = 0, A2 = 0;
+  switch (Shape)
+  {
+    case FilterLowpass:
+    {
+      B0 = (1 - Cos) / 2; B1 = 1 - Cos; B2 = (1 - Cos) / 2;
+      A0 = 1 + Alpha; A1 = -2 * Cos; A2 = 1 - Alpha;
+    } break;
+    case FilterHighpass:
+    {
+      B0 = (1 + Cos) / 2; B1 = -(1 + Cos); B2 = (1 + Cos) / 2;
+      A0 = 1 + Alpha; A1 = -2 * Cos; A2 = 1 - Alpha;
+    } break;
+    case FilterBandpass:
+    {
+      B0 = Alpha; B1 = 0; B2 = -Alpha;
+      A0 = 1 + Alpha; A1 = -2 * Cos; A2 = 1 - Alpha;
+    } break;
+    case FilterNotch:
+    {
+      B0 = 1; B1 = -2 * Cos; B2 = 1;
+      A0 = 1 + Alpha; A1 = -2 * Cos; A2 = 1 - Alpha;
+    } break;
+    case FilterAllpass:
+    {
+      B0 = 1 - Alpha; B1 = -2 * Cos; B2 = 1 + Alpha;
+      A0 = 1 + Alpha; A1 = -2 * Cos; A2 = 1 - Alpha;
+    } break;
+    case FilterPeak:
+    {
+      B0 = 1 + Alpha * A; B1 = -2 * Cos; B2 = 1 - Alpha * A;
+      A0 = 1 + Alpha / A; A1 = -2 * Cos; A2 = 1 - Alpha / A;
+    } break;
+    case FilterLowShelf:
+    {
+      f64 S = 2 * sqrt(A) * Alpha;
+      B0 = A * ((A + 1) - (A - 1) * Cos + S);
+      B1 = 2 * A * ((A - 1) - (A + 1) * Cos);
+      B2 = A * ((A + 1) - (A - 1) * Cos - S);
+      A0 = (A + 1) + (A - 1) * Cos + S;
+      A1 = -2 * ((A - 1) + (A + 1) * Cos);
+      A2 = (A + 1) + (A - 1) * Cos - S;
+    } break;
+    case FilterHighShelf:
+    {
+      f64 S = 2 * sqrt(A) * Alpha;
+      B0 = A * ((A + 1) + (A - 1) * Cos + S);
+      B1 = -2 * A * ((A - 1) + (A + 1) * Cos);
+      B2 = A * ((A + 1) + (A - 1) * Cos - S);
+      A0 = (A + 1) - (A - 1) * Cos + S;
+      A1 = 2 * ((A - 1) - (A + 1) * Cos);
+      A2 = (A + 1) - (A - 1) * Cos - S;
+    } break;
+  }
+
+  Coefficients[0] = (f32)(B0 / A0);
+  Coefficients[1] = (f32)(B1 / A0);
+  Coefficients[2] = (f32)(B2 / A0);
+  Coefficients[3] = (f32)(A1 / A0);
+  Coefficients[4] = (f32)(A2 / A0);
+  Coefficients[5] = 0;
+}
+
+// NOTE(robin): One stage for one channel, the scalar loop for when there are too few channels
+// to fill the lanes. The same operations as the bank, with fixed coefficients: to change it,
+// FilterDesign into Coefficients (there's no ramp, so that's for between notes, not sweeps).
+typedef struct
+{
+  filter_kind Kind;
+  f32 Coefficients[FILTER_COEFFICIENTS];
+  f32 State[2];
+} filter;
+
+void FilterInit(filter* Filter, filter_kind Kind, filter_shape Shape, f32 Frequency, f32 Q, f32 GainDB)
+{
+  Filter->Kind = Kind;
+  Filter->State[0] = Filter->State[1] = 0;
+  FilterDesign(Filter->Coefficients, Kind, Shape, Frequency, Q, GainDB);
+}
+
+// NOTE(robin): Filters one channel in place
+void FilterProcess(filter* Filter, f32* Samples, u32 FrameCount)
+{
+  f32* C = Filter->Coefficients;
+  f32 S1 = Filter->State[0], S2 = Filter->State[1];
+  if (Filter->Kind == FilterKindBiquad)
+  {
+    for (u32 n = 0; n < FrameCount; n++)
+    {
+      f32 In = Samples[n];
+      f32 Out = C[0] * In + S1;
+      S1 = C[1] * In - C[3] * Out + S2;
+      S2 = C[2] * In - C[4] * Out;
+      Samples[n] = Out;
+    }
+  }
+  else
+  {
+    for (u32 n = 0; n < FrameCount; n++)
+    {
+      f32 In = Samples[n];
+      f32 V3 = In - S2;
+      f32 V1 = C[0] * S1 + C[1] * V3;
+      f32 V2 = S2 + C[1] * S1 + C[2] * V3;
+      S1 = 2 * V1 - S1;
+      S2 = 2 * V2 - S2;
+      Samples[n] = C[3] * In + C[4] * V1 + C[5] * V2;
+    }
+  }
+  Filter->State[0] = S1;
+  Filter->State[1] = S2;
+}
+
+// NOTE(robin): Every stage starts out passing the signal through unchanged. Returns 0 if we're
+// out of memory or there are too many stages.
+u32 FilterBankInit(filter_bank* Bank, u32 ChannelCount, u32 StageCount, const filter_kind* Kinds, u32 RampFrames)
+{
+  memset(Bank, 0, sizeof(*Bank));
+  if (StageCount > FILTER_MAX_STAGES)
+    return 0;
+
+  Bank->ChannelCount = ChannelCount;
+  Bank->GroupCount = (ChannelCount + FILTER_LANES - 1) / FILTER_LANES;
+  Bank->StageCount = StageCount;
+  Bank->RampFrames = RampFrames;
+  memcpy(Bank->Kinds, Kinds, StageCount * sizeof(filter_kind));
+
+  Bank->Stages = calloc((u64)Bank->GroupCount * StageCount, sizeof(filter_stage));
+  if (!Bank->Stages)
+    return 0;
+
+  // NOTE(robin): b0 = 1 for a biquad, m0 = 1 for an SVF
+  for (u32 Group = 0; Group < Bank->GroupCount; Group++)
+  {
+    for (u32 s = 0; s < StageCount; s++)
+    {
+      filter_stage* Stage = &Bank->Stages[Group * StageCount + s];
+      u32 Unity = Kinds[s] == FilterKindSVF ? 3 : 0;
+      for (u32 j = 0; j < FILTER_LANES; j++)
+      {
+        Stage->Coefficients[Unity][j] = 1.0f;
+        Stage->Targets[Unity][j] = 1.0f;
+      }
+    }
+  }
+
+  return 1;
+}
+
+void FilterBankFree(filter_bank* Bank)
+{
+  free(Bank->Stages);
+  Bank->Stages = 0;
+}
+
+// NOTE(robin): Changes one stage of one channel, see FilterDesign for the parameters. Takes
+// effect (or starts ramping) at the next FilterBankProcess.
+void FilterBankSet(filter_bank* Bank, u32 Channel, u32 StageIndex, filter_shape Shape, f32 Frequency, f32 Q, f32 GainDB)
+{
+  if (Channel >= Bank->ChannelCount || StageIndex >= Bank->StageCount)
+    return;
+
+  f32 Coefficients[FILTER_COEFFICIENTS];
+  FilterDesign(Coefficients, Bank->Kinds[StageIndex], Shape, Frequency, Q, GainDB);
+
+  filter_stage* Stage = &Bank->Stages[(Channel / FILTER_LANES) * Bank->StageCount + StageIndex];
+  u32 Lane = Channel % FILTER_LANES;
+  for (u32 c = 0; c < FILTER_COEFFICIENTS; c++)
+  {
+    Stage->Targets[c][Lane] = Coefficients[c];
+    if (!Bank->RampFrames)
+      Stage->Coefficients[c][Lane] = Coefficients[c];
+  }
+  Stage->Changed = 1;
+}
+
+// NOTE(robin): Starts a ramp from where the coefficients are now (which may be halfway
+// through an earlier ramp) to the targets
+static void FilterStartRamp(filter_bank* Bank, filter_stage* Stage)
+{
+  Stage->Changed = 0;
+  if (!Bank->RampFrames)
+    return;
+
+  f32 Scale = 1.0f / (f32)Bank->RampFrames;
+  for (u32 c = 0; c < FILTER_COEFFICIENTS; c++)
+    for (u32 j = 0; j < FILTER_LANES; j++)
+      Stage->Deltas[c][j] = (Stage->Targets[c][j] - Stage->Coefficients[c][j]) * Scale;
+  Stage->RampRemaining = Bank->RampFrames;
+}
+
+// NOTE(robin): The coefficients and state are copied into locals for the loop. Through the
+// stage pointer the compiler has to assume they might alias Work, and then it won't
+// vectorise (or keep anything in registers).
+static void FilterBiquad(filter_stage* Stage, f32* restrict Work, u32 FrameCount, u32 Ramping)
+{
+  f32 C[5][FILTER_LANES], D[5][FILTER_LANES], S1[FILTER_LANES], S2[FILTER_LANES];
+  memcpy(C, Stage->Coefficients, sizeof(C));
+  memcpy(D, Stage->Deltas, sizeof(D));
+  memcpy(S1, Stage->State[0], sizeof(S1));
+  memcpy(S2, Stage->State[1], sizeof(S2));
+
+  for (u32 n = 0; n < FrameCount; n++)
+  {
+    f32* X = Work + n * FILTER_LANES;
+    if (Ramping)
+    {
+      for (u32 c = 0; c < 5; c++)
+        for (u32 j = 0; j < FILTER_LANES; j++)
+          C[c][j] += D[c][j];
+    }
+
+    for (u32 j = 0; j < FILTER_LANES; j++)
+    {
+      f32 In = X[j];
+      f32 Out = C[0][j] * In + S1[j];
+      S1[j] = C[1][j] * In - C[3][j] * Out + S2[j];
+      S2[j] = C[2][j] * In - C[4][j] * Out;
+      X[j] = Out;
+    }
+  }
+
+  memcpy(Stage->Coefficients, C, sizeof(C));
+  memcpy(Stage->State[0], S1, sizeof(S1));
+  memcpy(Stage->State[1], S2, sizeof(S2));
+}
+
+static void FilterSVF(filter_stage* Stage, f32* restrict Work, u32 FrameCount, u32 Ramping)
+{
+  f32 C[FILTER_COEFFICIENTS][FILTER_LANES], D[FILTER_COEFFICIENTS][FILTER_LANES];
+  f32 IC1[FILTER_LANES], IC2[FILTER_LANES];
+  memcpy(C, Stage->Coefficients, sizeof(C));
+  memcpy(D, Stage->Deltas, sizeof(D));
+  memcpy(IC1, Stage->State[0], sizeof(IC1));
+  memcpy(IC2, Stage->State[1], sizeof(IC2));
+
+  for (u32 n = 0; n < FrameCount; n++)
+  {
+    f32* X = Work + n * FILTER_LANES;
+    if (Ramping)
+    {
+      for (u32 c = 0; c < FILTER_COEFFICIENTS; c++)
+        for (u32 j = 0; j < FILTER_LANES; j++)
+          C[c][j] += D[c][j];
+    }
+
+    for (u32 j = 0; j < FILTER_LANES; j++)
+    {
+      f32 In = X[j];
+      f32 V3 = In - IC2[j];
+      f32 V1 = C[0][j] * IC1[j] + C[1][j] * V3;
+      f32 V2 = IC2[j] + C[1][j] * IC1[j] + C[2][j] * V3;
+      IC1[j] = 2 * V1 - IC1[j];
+      IC2[j] = 2 * V2 - IC2[j];
+      X[j] = C[3][j] * In + C[4][j] * V1 + C[5][j] * V2;
+    }
+  }
+
+  memcpy(Stage->Coefficients, C, sizeof(C));
+  memcpy(Stage->State[0], IC1, sizeof(IC1));
+  memcpy(Stage->State[1], IC2, sizeof(IC2));
+}
+
+// NOTE(robin): Filters every channel in place
+void FilterBankProcess(filter_bank* Bank, f32* const* Channels, u32 FrameCount)
+{
+  for (u32 Group = 0; Group < Bank->GroupCount; Group++)
+  {
+    filter_stage* Stages = &Bank->Stages[Group * Bank->StageCount];
+    for (u32 s = 0; s < Bank->StageCount; s++)
+      if (Stages[s].Changed)
+        FilterStartRamp(Bank, &Stages[s]);
+
+    for (u32 Start = 0; Start < FrameCount; Start += FILTER_BLOCK)
+    {
+      u32 Count = FrameCount - Start < FILTER_BLOCK ? FrameCount - Start : FILTER_BLOCK;
+
+      f32* Lanes[FILTER_LANES];
+      for (u32 j = 0; j < FILTER_LANES; j++)
+      {
+        u32 Channel = Group * FILTER_LANES + j;
+        Lanes[j] = Channel < Bank->ChannelCount ? Channels[Channel] + Start : Bank->Silence;
+      }
+
+      for (u32 n = 0; n < Count; n++)
+        for (u32 j = 0; j < FILTER_LANES; j++)
+          Bank->Work[n * FILTER_LANES + j] = Lanes[j][n];
+
+      for (u32 s = 0; s < Bank->StageCount; s++)
+      {
+        filter_stage* Stage = &Stages[s];
+        u32 Ramped = Stage->RampRemaining < Count ? Stage->RampRemaining : Count;
+        f32* Work = Bank->Work;
+
+        // NOTE(robin): The ramped part of the block, then the rest with fixed coefficients
+        for (u32 Pass = 0; Pass < 2; Pass++)
+        {
+          u32 Frames = Pass == 0 ? Ramped : Count - Ramped;
+          if (Bank->Kinds[s] == FilterKindSVF)
+            FilterSVF(Stage, Work, Frames, Pass == 0);
+          else
+            FilterBiquad(Stage, Work, Frames, Pass == 0);
+          Work += Frames * FILTER_LANES;
+
+          // NOTE(robin): Land exactly on the targets where the ramp ends, the sum of the steps
+          // won't quite, so the rest of the block already runs on them
+          if (Pass == 0)
+          {
+            Stage->RampRemaining -= Ramped;
+            if (Ramped && !Stage->RampRemaining)
+              memcpy(Stage->Coefficients, Stage->Targets, sizeof(Stage->Coefficients));
+          }
+        }
+      }
+
+      for (u32 j = 0; j < FILTER_LANES; j++)
+      {
+        u32 Channel = Group * FILTER_LANES + j;
+        Lanes[j] = Channel < Bank->ChannelCount ? Channels[Channel] + Start : Bank->Discard;
+      }
+
+      for (u32 n = 0; n < Count; n++)
+        for (u32 j = 0; j < FILTER_LANES; j++)
+          Lanes[j][n] = Bank->Work[n * FILTER_LANES + j];
+    }
+  }
+}
+
+// NOTE(robin): Clears the filter state, e.g. after a discontinuity in the input
+void FilterBankReset(filter_bank* Bank)
+{
+  for (u32 i = 0; i < Bank->GroupCount * Bank->StageCount; i++)
+    memset(Bank->Stages[i].State, 0, sizeof(Bank->Stages[i].State));
+}
@@ -0,0 +1,225 @@
+/*
+ * This file tests and benchmarks filterbank.c against the obvious way of doing the same thing,
+ * a scalar loop per channel, so it runs anywhere without an audio device.
+ *
+ * The cascade is a 4 band EQ (low shelf, two peaks, high shelf biquads) followed by a 4th
+ * order Linkwitz-Riley crossover lowpass (two Butterworth SVFs), with different settings on
+ * every channel.
+ *
+ * - Accuracy: with fixed coefficients the bank must match the scalar loop (same operations
+ *   in the same order, so bit identical unless the compiler contracts to FMA differently).
+ * - Ramps: after a parameter change the coefficients must land exactly on the new design
+ *   after RampFrames, from the frame the ramp ends even if that is mid-block, and a fast
+ *   filter sweep must stay stable.
+ * - Speed: 2 to 128 channels of 128 frame blocks, in ns per sample per channel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "filterbank.c"
+
+#define BENCH_RATE 48000.0f
+#define BENCH_BLOCK 128
+#define BENCH_MAX_CHANNELS 128
+#define BENCH_STAGES 6
+
+typedef struct
+{
+  filter_bank Bank;
+  filter Scalar[BENCH_MAX_CHANNELS][BENCH_STAGES];
+  f32* Channels[BENCH_MAX_CHANNELS];
+  u32 ChannelCount;
+} bench_data;
+
+filter_kind Kinds[BENCH_STAGES] =
+{
+  FilterKindBiquad, FilterKindBiquad, FilterKindBiquad, FilterKindBiquad, FilterKindSVF, FilterKindSVF,
+};
+
+// NOTE(robin): The straightforward version, one channel and one stage at a time
+void ScalarProcess(filter* Filters, f32* Samples, u32 FrameCount)
+{
+  for (u32 s = 0; s < BENCH_STAGES; s++)
+    FilterProcess(&Filters[s], Samples, FrameCount);
+}
+
+void Setup(bench_data* Data, u32 ChannelCount, u32 RampFrames)
+{
+  Data->ChannelCount = ChannelCount;
+  FilterBankFree(&Data->Bank);
+  u32 Initialised = FilterBankInit(&Data->Bank, ChannelCount, BENCH_STAGES, Kinds, RampFrames);
+  assert(Initialised);
+
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+  {
+    f32 Spread = 1.0f + 0.01f * (f32)Channel;
+    filter_shape Shapes[] = {FilterLowShelf, FilterPeak, FilterPeak, FilterHighShelf, FilterLowpass, FilterLowpass};
+    f32 Frequencies[] = {100, 500, 2500, 8000, 2000, 2000};
+    f32 Qs[] = {0.707f, 1.0f, 2.0f, 0.707f, 0.7071f, 0.7071f};
+    f32 Gains[] = {3, -4, 2, -3, 0, 0};
+    for (u32 s = 0; s < BENCH_STAGES; s++)
+    {
+      f32 Frequency = Frequencies[s] * Spread / BENCH_RATE;
+      FilterBankSet(&Data->Bank, Channel, s, Shapes[s], Frequency, Qs[s], Gains[s]);
+
+      FilterInit(&Data->Scalar[Channel][s], Kinds[s], Shapes[s], Frequency, Qs[s], Gains[s]);
+    }
+  }
+}
+
+void FillNoise(bench_data* Data)
+{
+  for (u32 Channel = 0; Channel < BENCH_MAX_CHANNELS; Channel++)
+    for (u32 i = 0; i < BENCH_BLOCK; i++)
+      Data->Channels[Channel][i] = (f32)rand() / (f32)RAND_MAX - 0.5f;
+}
+
+void VerifyBank(bench_data* Data)
+{
+  static f32 Reference[BENCH_MAX_CHANNELS][BENCH_BLOCK];
+
+  // NOTE(robin): 13 channels so the last lane group is partly empty
+  Setup(Data, 13, 0);
+  f64 MaxError = 0;
+  for (u32 Block = 0; Block < 100; Block++)
+  {
+    FillNoise(Data);
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    {
+      memcpy(Reference[Channel], Data->Channels[Channel], sizeof(Reference[Channel]));
+      ScalarProcess(Data->Scalar[Channel], Reference[Channel], BENCH_BLOCK);
+    }
+
+    FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    {
+      for (u32 i = 0; i < BENCH_BLOCK; i++)
+      {
+        f64 Error = fabs((f64)Data->Channels[Channel][i] - (f64)Reference[Channel][i]);
+        MaxError = Error > MaxError ? Error : MaxError;
+      }
+    }
+  }
+  printf("Max difference from the scalar loop: %g\n", MaxError);
+  assert(MaxError < 1e-5);
+
+  // NOTE(robin): Ramp to a new setting and check that we land on it
+  Setup(Data, 13, 480);
+  FillNoise(Data);
+  FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+  FilterBankSet(&Data->Bank, 9, 4, FilterHighpass, 300.0f / BENCH_RATE, 0.5f, 0);
+  for (u32 Block = 0; Block < 4; Block++)
+  {
+    FillNoise(Data);
+    FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+  }
+
+  f32 Expected[FILTER_COEFFICIENTS];
+  FilterDesign(Expected, FilterKindSVF, FilterHighpass, 300.0f / BENCH_RATE, 0.5f, 0);
+  filter_stage* Stage = &Data->Bank.Stages[1 * BENCH_STAGES + 4];
+  for (u32 c = 0; c < FILTER_COEFFICIENTS; c++)
+    assert(Stage->Coefficients[c][9 % FILTER_LANES] == Expected[c]);
+  printf("Ramped coefficients land on the new design\n");
+
+  // NOTE(robin): The same ramp ends 96 frames into the 4th block. Run it once as a whole block
+  // and once split where the ramp ends: the rest of the block has to be on the new design in
+  // both, so the outputs must be bit identical.
+  static filter_bank Split;
+  static f32 SplitOutput[BENCH_MAX_CHANNELS][BENCH_BLOCK];
+  f32* SplitChannels[BENCH_MAX_CHANNELS];
+  Setup(Data, 13, 480);
+  FilterBankSet(&Data->Bank, 9, 4, FilterHighpass, 300.0f / BENCH_RATE, 0.5f, 0);
+  Split = Data->Bank;
+  Split.Stages = malloc((u64)Split.GroupCount * Split.StageCount * sizeof(filter_stage));
+  memcpy(Split.Stages, Data->Bank.Stages, (u64)Split.GroupCount * Split.StageCount * sizeof(filter_stage));
+  u32 Differences = 0;
+  for (u32 Block = 0; Block < 4; Block++)
+  {
+    FillNoise(Data);
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    {
+      memcpy(SplitOutput[Channel], Data->Channels[Channel], sizeof(SplitOutput[Channel]));
+      SplitChannels[Channel] = SplitOutput[Channel];
+    }
+
+    FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+    u32 RampEnd = Block == 3 ? 480 - 3 * BENCH_BLOCK : BENCH_BLOCK;
+    FilterBankProcess(&Split, SplitChannels, RampEnd);
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+      SplitChannels[Channel] += RampEnd;
+    FilterBankProcess(&Split, SplitChannels, BENCH_BLOCK - RampEnd);
+
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+      for (u32 i = 0; i < BENCH_BLOCK; i++)
+        Differences += Data->Channels[Channel][i] != SplitOutput[Channel][i];
+  }
+  FilterBankFree(&Split);
+  printf("A ramp ending mid-block switches to the new design on the frame it ends: %u differences\n",
+      Differences);
+  assert(Differences == 0);
+
+  // NOTE(robin): Sweep the SVFs between 50Hz and 15kHz every block with a short ramp
+  Setup(Data, 13, 32);
+  f32 Peak = 0;
+  for (u32 Block = 0; Block < 2000; Block++)
+  {
+    f32 Frequency = (Block & 1) ? 15000.0f : 50.0f;
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    {
+      FilterBankSet(&Data->Bank, Channel, 4, FilterLowpass, Frequency / BENCH_RATE, 4.0f, 0);
+      FilterBankSet(&Data->Bank, Channel, 5, FilterPeak, Frequency / BENCH_RATE, 4.0f, 12.0f);
+    }
+
+    FillNoise(Data);
+    FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+    for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+      for (u32 i = 0; i < BENCH_BLOCK; i++)
+        Peak = fabsf(Data->Channels[Channel][i]) > Peak ? fabsf(Data->Channels[Channel][i]) : Peak;
+  }
+  printf("Peak output during a fast sweep: %.2f\n\n", Peak);
+  assert(Peak < 100.0f);
+}
+
+void BenchBank(void* Context)
+{
+  bench_data* Data = Context;
+  FilterBankProcess(&Data->Bank, Data->Channels, BENCH_BLOCK);
+}
+
+void BenchScalar(void* Context)
+{
+  bench_data* Data = Context;
+  for (u32 Channel = 0; Channel < Data->ChannelCount; Channel++)
+    ScalarProcess(Data->Scalar[Channel], Data->Channels[Channel], BENCH_BLOCK);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  for (u32 Channel = 0; Channel < BENCH_MAX_CHANNELS; Channel++)
+    Data.Channels[Channel] = malloc(BENCH_BLOCK * sizeof(f32));
+
+  VerifyBank(&Data);
+
+  printf("%d stages, %d frame blocks, %d lanes\n", BENCH_STAGES, BENCH_BLOCK, FILTER_LANES);
+  printf("%9s %18s %18s %9s\n", "channels", "bank ns/sample", "scalar ns/sample", "speedup");
+  u32 Counts[] = {2, 4, 8, 16, 32, 64, 128};
+  for (u32 i = 0; i < sizeof(Counts) / sizeof(Counts[0]); i++)
+  {
+    Setup(&Data, Counts[i], 0);
+    FillNoise(&Data);
+    f64 Samples = (f64)Counts[i] * BENCH_BLOCK;
+    f64 Bank = BenchMeasure(BenchBank, &Data) / Samples;
+    f64 Scalar = BenchMeasure(BenchScalar, &Data) / Samples;
+    printf("%9u %18.2f %18.2f %8.1fx\n", Counts[i], Bank, Scalar, Scalar / Bank);
+  }
+
+  FilterBankFree(&Data.Bank);
+  return 0;
+}
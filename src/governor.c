@@ -0,0 +1,210 @@
+/*
+ * This file keeps an eye on how much of the period the audio callback uses and tells it to
+ * do less (fewer voices, cheaper oscillators, skip the effects that aren't essential) before
+ * it runs out of time, and to go back to full quality once there's room again.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined. On Windows you need to have
+ * included Windows.h.
+ *
+ *   governor Governor;
+ *   GovernorInit(&Governor, SampleRate, FrameCount, 4); // NOTE(robin): Levels 0 to 3
+ *   ...
+ *   // In the callback
+ *   u32 Level = GovernorBegin(&Governor);
+ *   ... render, doing less the higher Level is ...
+ *   GovernorEnd(&Governor);
+ *
+ * NOTE(robin): The budget is the length of the period, FrameCount / SampleRate, and the load
+ * is how much of it the callback took. Level 0 is full quality, and what each level sheds is
+ * up to you. Order the levels so that what goes first is what's missed least: the
+ * non-essential effects, then the oscillator or resampler quality, then voices.
+ *
+ * Both decisions look at the load differently, since getting them wrong costs differently:
+ *
+ * - Going down a level has to happen before the xrun, so it looks at the peak of the recent
+ *   loads (which decays over about 50ms). When that's above High we drop a level, then wait a
+ *   few periods to see what that bought us before dropping another. A period that went over
+ *   the budget drops a level right away.
+ * - Going back up too early means glitching again straight after, so it waits for the
+ *   average load (a ~200ms moving average) to be below Low for Hold periods in a row. If
+ *   we have to go down again soon after going up, Hold doubles (up to a few seconds), so a
+ *   load that sits right at the edge doesn't make the quality flap up and down; it halves
+ *   again each time a level holds.
+ *
+ * Low has to be far enough below High that the cost of a level fits in between, otherwise
+ * going up puts the load straight back above High. GovernorInit picks 0.5 and 0.8.
+ *
+ * Everything GovernorBegin and GovernorEnd do is a handful of arithmetic and two reads of the
+ * clock, the same every period. GovernorRead gives another thread the level and the loads.
+ */
+
+#include <math.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define GovernorExchange(Pointer, Value) (u32)_InterlockedExchange((volatile long*)(Pointer), (long)(Value))
+#define GovernorLoad(Pointer) (*(volatile u32*)(Pointer))
+#define GovernorStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#else
+#define GovernorExchange(Pointer, Value) __atomic_exchange_n((Pointer), (Value), __ATOMIC_RELAXED)
+#define GovernorLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_RELAXED)
+#define GovernorStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELAXED)
+#endif
+
+#define GOVERNOR_COOLDOWN 4          // NOTE(robin): Periods to wait between two drops
+#define GOVERNOR_HOLD_SECONDS 0.5f   // NOTE(robin): Quiet time before going back up
+#define GOVERNOR_MAX_HOLD_SECONDS 4.0f
+
+typedef struct
+{
+  u32 Level;
+  f32 Load;  // NOTE(robin): Moving average, 1 is the whole period
+  f32 Peak;  // NOTE(robin): Highest load of a single period since the last read
+  u32 Drops;
+  u32 Raises;
+  u32 Overruns; // NOTE(robin): Periods that took longer than the budget
+} governor_stats;
+
+typedef struct
+{
+  u64 Budget; // NOTE(robin): Nanoseconds
+  u32 LevelCount;
+  f32 High;
+  f32 Low;
+  f32 PeakDecay;
+  f32 AverageCoefficient;
+  u32 BaseHold;
+  u32 MaxHold;
+
+  u64 Start;
+  f32 RecentPeak;
+  f32 Average;
+  u32 Cooldown;
+  u32 Calm;    // NOTE(robin): Periods in a row with the average below Low
+  u32 Hold;
+  u32 SinceRaise;
+
+  // NOTE(robin): Written by the callback, read by GovernorRead. The loads are in millionths
+  // so that they can be read and written atomically.
+  u32 Level;
+  u32 Drops;
+  u32 Raises;
+  u32 Overruns;
+  u32 Load;
+  u32 Peak;
+} governor;
+
+static u64 GovernorNow(void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER Frequency;
+  if (!Frequency.QuadPart)
+    QueryPerformanceFrequency(&Frequency);
+  LARGE_INTEGER Counter;
+  QueryPerformanceCounter(&Counter);
+  return (u64)((f64)Counter.QuadPart * 1e9 / (f64)Frequency.QuadPart);
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+// NOTE(robin): LevelCount is the number of quality levels including full quality, so the
+// level goes from 0 to LevelCount - 1
+void GovernorInit(governor* Governor, u32 SampleRate, u32 FrameCount, u32 LevelCount)
+{
+  *Governor = (governor){0};
+  Governor->Budget = (u64)FrameCount * 1000000000ull / SampleRate;
+  Governor->LevelCount = LevelCount ? LevelCount : 1;
+  Governor->High = 0.8f;
+  Governor->Low = 0.5f;
+
+  f32 PeriodsPerSecond = (f32)SampleRate / (f32)FrameCount;
+  Governor->PeakDecay = expf(-1.0f / (0.05f * PeriodsPerSecond));
+  Governor->AverageCoefficient = 1.0f - expf(-1.0f / (0.2f * PeriodsPerSecond));
+  Governor->BaseHold = (u32)(GOVERNOR_HOLD_SECONDS * PeriodsPerSecond) + 1;
+  Governor->MaxHold = (u32)(GOVERNOR_MAX_HOLD_SECONDS * PeriodsPerSecond) + 1;
+  Governor->Hold = Governor->BaseHold;
+  Governor->SinceRaise = 2 * Governor->MaxHold; // NOTE(robin): i.e. not recently
+}
+
+// NOTE(robin): Call at the very start of the callback, returns the level to render at
+u32 GovernorBegin(governor* Governor)
+{
+  Governor->Start = GovernorNow();
+  return Governor->Level;
+}
+
+// NOTE(robin): Call at the very end of the callback, after the output has been written
+void GovernorEnd(governor* Governor)
+{
+  f32 Load = (f32)(GovernorNow() - Governor->Start) / (f32)Governor->Budget;
+
+  Governor->RecentPeak = Load > Governor->RecentPeak ? Load : Governor->RecentPeak * Governor->PeakDecay;
+  Governor->Average += (Load - Governor->Average) * Governor->AverageCoefficient;
+  GovernorStore(&Governor->Load, (u32)(Governor->Average * 1e6f));
+
+  // NOTE(robin): Only we make Peak bigger, GovernorRead only sets it to 0, so the worst that
+  // can happen is that a peak is counted in the next read rather than this one
+  u32 Peak = (u32)(Load * 1e6f);
+  if (Peak > GovernorLoad(&Governor->Peak))
+    GovernorStore(&Governor->Peak, Peak);
+
+  u32 Overrun = Load > 1.0f;
+  if (Overrun)
+    GovernorStore(&Governor->Overruns, Governor->Overruns + 1);
+
+  Governor->Cooldown -= Governor->Cooldown > 0;
+  Governor->SinceRaise += Governor->SinceRaise < 2 * Governor->MaxHold;
+
+  u32 Level = Governor->Level;
+  if ((Overrun || (Governor->RecentPeak > Governor->High && !Governor->Cooldown)) &&
+      Level + 1 < Governor->LevelCount)
+  {
+    // NOTE(robin): Back off for longer before the next raise if the last one didn't last
+    if (Governor->SinceRaise < 2 * Governor->Hold)
+      Governor->Hold = 2 * Governor->Hold < Governor->MaxHold ? 2 * Governor->Hold : Governor->MaxHold;
+
+    GovernorStore(&Governor->Level, Level + 1);
+    GovernorStore(&Governor->Drops, Governor->Drops + 1);
+    Governor->Cooldown = GOVERNOR_COOLDOWN;
+    Governor->Calm = 0;
+
+    // NOTE(robin): The peak was measured at the old level, start over at the new one
+    Governor->RecentPeak = 0;
+    return;
+  }
+
+  Governor->Calm = Governor->Average < Governor->Low ? Governor->Calm + 1 : 0;
+  if (Governor->Calm >= Governor->Hold && Level > 0)
+  {
+    GovernorStore(&Governor->Level, Level - 1);
+    GovernorStore(&Governor->Raises, Governor->Raises + 1);
+    Governor->Calm = 0;
+    Governor->SinceRaise = 0;
+  }
+
+  // NOTE(robin): A level that held for a while earns back some of the backoff
+  if (Governor->SinceRaise == 2 * Governor->Hold && Governor->Hold > Governor->BaseHold)
+    Governor->Hold = Governor->Hold / 2 > Governor->BaseHold ? Governor->Hold / 2 : Governor->BaseHold;
+}
+
+// NOTE(robin): Can be called from any thread. Peak starts over after each read.
+governor_stats GovernorRead(governor* Governor)
+{
+  governor_stats Stats;
+  Stats.Level = GovernorLoad(&Governor->Level);
+  Stats.Load = (f32)GovernorLoad(&Governor->Load) / 1e6f;
+  Stats.Peak = (f32)GovernorExchange(&Governor->Peak, 0) / 1e6f;
+  Stats.Drops = GovernorLoad(&Governor->Drops);
+  Stats.Raises = GovernorLoad(&Governor->Raises);
+  Stats.Overruns = GovernorLoad(&Governor->Overruns);
+  return Stats;
+}
@@ -0,0 +1,337 @@
+/*
+ * This file loads DSP plugins (plugin.h) from shared objects and swaps a new build in while
+ * the audio keeps running, so you can change the processing without restarting the device.
+ * Linux only (dlopen, link with -ldl on older glibc).
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   hot_host Host;
+ *   HotInit(&Host, SampleRate, ChannelCount, MaxFrames, 10.0f);
+ *   HotLoad(&Host, "build/plugin_a.so"); // Before the audio starts, or at any time
+ *
+ *   // Audio thread, every period
+ *   HotProcess(&Host, Inputs, Outputs, FrameCount);
+ *
+ *   // Any one other thread, whenever there is a new build
+ *   if (!HotLoad(&Host, "build/plugin_a.so"))
+ *     printf("%s\n", Host.Error);
+ *
+ * NOTE(robin): HotLoad does all the slow work on the calling thread: it loads the shared
+ * object, calls Init, migrates the state of the running instance, and only then hands the
+ * new module to the audio thread through a single pointer (Pending). HotProcess picks it up
+ * with an atomic exchange at the start of a period, so the swap always happens between two
+ * callbacks, and never waits for anything. For FadeFrames after the swap it runs both the
+ * old and the new instance and crossfades from one to the other, which hides whatever
+ * difference there is between the two (the migrated state is a period or two old by the
+ * time the new instance runs, and the new build might just sound different). After that
+ * the old module goes on the Retired list, and the next HotLoad (or HotFree) tears it down
+ * and unloads it, again off the audio thread.
+ *
+ * The state migration is a request/response with the audio thread: HotLoad sets
+ * SnapshotState to requested, HotProcess calls SaveState of the current instance into
+ * Snapshot at the start of its next period and marks it ready, and HotLoad passes it to the
+ * new instance's LoadState. If the audio isn't running we wait for a bit and then load
+ * without the state.
+ *
+ * dlopen returns the already loaded handle when you open the same file again (it checks the
+ * device and inode, too), which the old module is, so HotLoad loads a private copy of the
+ * file instead. That also protects the running code from a build that writes the shared
+ * object in place. The copy is a memfd, loaded through /proc/self/fd, so it has no name in
+ * the file system that another user could put their own code at before we load it.
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "plugin.h"
+
+#define HOT_MAX_CHANNELS 8
+#define HOT_MAX_FRAMES 4096
+#define HOT_STATE_SIZE 65536
+
+enum
+{
+  HotSnapshotIdle,
+  HotSnapshotRequested,
+  HotSnapshotReady,
+};
+
+typedef struct hot_module
+{
+  void* Library;
+  const plugin_api* API;
+  void* Instance;
+  u32 Generation;
+  struct hot_module* Next; // NOTE(robin): On the Retired list
+} hot_module;
+
+typedef struct
+{
+  f32 SampleRate;
+  u32 ChannelCount;
+  u32 MaxFrames;
+  u32 FadeFrames;
+
+  // NOTE(robin): Owned by the audio thread
+  hot_module* Current;
+  hot_module* Fading;
+  u32 FadePosition;
+  f32 Scratch[HOT_MAX_CHANNELS][HOT_MAX_FRAMES];
+
+  // NOTE(robin): Handed between the threads
+  hot_module* Pending;
+  hot_module* Retired;
+  u32 Swaps;
+  u32 SnapshotState;
+  u32 SnapshotSize;
+  u32 SnapshotVersion;
+  u8 Snapshot[HOT_STATE_SIZE];
+
+  // NOTE(robin): Owned by the thread that calls HotLoad
+  u32 Generation;
+  u32 Migrated;
+  char Error[256];
+} hot_host;
+
+u32 HotInit(hot_host* Host, f32 SampleRate, u32 ChannelCount, u32 MaxFrames, f32 FadeMilliseconds)
+{
+  memset(Host, 0, sizeof(*Host));
+  if (!ChannelCount || ChannelCount > HOT_MAX_CHANNELS || !MaxFrames || MaxFrames > HOT_MAX_FRAMES)
+    return 0;
+
+  Host->SampleRate = SampleRate;
+  Host->ChannelCount = ChannelCount;
+  Host->MaxFrames = MaxFrames;
+  Host->FadeFrames = (u32)(FadeMilliseconds * 0.001f * SampleRate);
+  return 1;
+}
+
+static void HotUnload(hot_module* Module)
+{
+  if (Module->Instance)
+    Module->API->Teardown(Module->Instance);
+  dlclose(Module->Library);
+  free(Module);
+}
+
+// NOTE(robin): Unloads the modules the audio thread is done with
+static void HotCollect(hot_host* Host)
+{
+  hot_module* Module = __atomic_exchange_n(&Host->Retired, 0, __ATOMIC_ACQUIRE);
+  while (Module)
+  {
+    hot_module* Next = Module->Next;
+    HotUnload(Module);
+    Module = Next;
+  }
+}
+
+static void HotSleep(u32 Milliseconds)
+{
+  struct timespec Time = {Milliseconds / 1000, (long)(Milliseconds % 1000) * 1000000};
+  nanosleep(&Time, 0);
+}
+
+static u32 HotCopyFile(const char* From, int Output)
+{
+  int Input = open(From, O_RDONLY);
+  if (Input < 0)
+    return 0;
+
+  u8 Buffer[65536];
+  ssize_t Size;
+  u32 Success = 1;
+  while ((Size = read(Input, Buffer, sizeof(Buffer))) > 0)
+    Success &= write(Output, Buffer, (size_t)Size) == Size;
+  Success &= Size == 0;
+
+  close(Input);
+  return Success;
+}
+
+static u32 HotFail(hot_host* Host, const char* Message, const char* Detail)
+{
+  snprintf(Host->Error, sizeof(Host->Error), "%s: %s", Message, Detail ? Detail : "unknown error");
+  return 0;
+}
+
+// NOTE(robin): Blocks for a while (loading, Init, waiting for the state), call it from one
+// thread only. Returns 0 and leaves the running module alone if anything goes wrong.
+u32 HotLoad(hot_host* Host, const char* Path)
+{
+  HotCollect(Host);
+
+  // NOTE(robin): Until the audio thread has taken the last one
+  for (u32 i = 0; i < 1000 && __atomic_load_n(&Host->Pending, __ATOMIC_ACQUIRE); i++)
+    HotSleep(1);
+  if (__atomic_load_n(&Host->Pending, __ATOMIC_ACQUIRE))
+    return HotFail(Host, "The previous module was never picked up", "is the audio running?");
+
+  u32 Generation = ++Host->Generation;
+  int Copy = (int)syscall(SYS_memfd_create, "hotreload", 0);
+  if (Copy < 0)
+    return HotFail(Host, "Could not create a copy of", Path);
+  if (!HotCopyFile(Path, Copy))
+  {
+    close(Copy);
+    return HotFail(Host, "Could not copy", Path);
+  }
+
+  char CopyPath[64];
+  snprintf(CopyPath, sizeof(CopyPath), "/proc/self/fd/%d", Copy);
+  void* Library = dlopen(CopyPath, RTLD_NOW | RTLD_LOCAL);
+  close(Copy); // NOTE(robin): The mapping keeps it around for as long as we need it
+  if (!Library)
+    return HotFail(Host, "Could not load", dlerror());
+
+  plugin_get_api* GetAPI = (plugin_get_api*)dlsym(Library, PLUGIN_ENTRY_POINT);
+  const plugin_api* API = GetAPI ? GetAPI() : 0;
+  if (!API || API->APIVersion != PLUGIN_API_VERSION || !API->Init || !API->Process || !API->Teardown)
+  {
+    dlclose(Library);
+    return HotFail(Host, "Not a plugin, or built against another plugin.h", Path);
+  }
+
+  hot_module* Module = calloc(1, sizeof(hot_module));
+  if (!Module)
+  {
+    dlclose(Library);
+    return HotFail(Host, "Out of memory loading", Path);
+  }
+  Module->Library = Library;
+  Module->API = API;
+  Module->Generation = Generation;
+  Module->Instance = API->Init(Host->SampleRate, Host->ChannelCount, Host->MaxFrames);
+  if (!Module->Instance)
+  {
+    HotUnload(Module);
+    return HotFail(Host, "Init failed", API->Name);
+  }
+
+  // NOTE(robin): Ask the audio thread for the state of whatever is running now
+  Host->Migrated = 0;
+  if (API->LoadState && __atomic_load_n(&Host->Current, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(&Host->SnapshotState, HotSnapshotRequested, __ATOMIC_RELEASE);
+    for (u32 i = 0; i < 1000 && __atomic_load_n(&Host->SnapshotState, __ATOMIC_ACQUIRE) != HotSnapshotReady; i++)
+      HotSleep(1);
+
+    u32 Expected = HotSnapshotReady;
+    if (__atomic_compare_exchange_n(&Host->SnapshotState, &Expected, HotSnapshotIdle, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      if (Host->SnapshotSize)
+      {
+        API->LoadState(Module->Instance, Host->Snapshot, Host->SnapshotSize, Host->SnapshotVersion);
+        Host->Migrated = 1;
+      }
+    }
+    else
+    {
+      // NOTE(robin): Nobody answered, take the request back. If the audio thread got to it
+      // in between it has written a snapshot nobody reads, which is fine.
+      __atomic_store_n(&Host->SnapshotState, HotSnapshotIdle, __ATOMIC_RELEASE);
+    }
+  }
+
+  __atomic_store_n(&Host->Pending, Module, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static void HotRetire(hot_host* Host, hot_module* Module)
+{
+  hot_module* Head = __atomic_load_n(&Host->Retired, __ATOMIC_RELAXED);
+  do
+  {
+    Module->Next = Head;
+  } while (!__atomic_compare_exchange_n(&Host->Retired, &Head, Module, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// NOTE(robin): The audio thread's part. Without a module the inputs pass through.
+void HotProcess(hot_host* Host, const f32* const* Inputs, f32** Outputs, u32 FrameCount)
+{
+  u32 ChannelCount = Host->ChannelCount;
+  FrameCount = FrameCount < Host->MaxFrames ? FrameCount : Host->MaxFrames;
+
+  // NOTE(robin): The state is that of the instance we'll fade out, as of this period
+  if (__atomic_load_n(&Host->SnapshotState, __ATOMIC_ACQUIRE) == HotSnapshotRequested)
+  {
+    const plugin_api* API = Host->Current ? Host->Current->API : 0;
+    Host->SnapshotSize = API && API->SaveState ? API->SaveState(Host->Current->Instance, Host->Snapshot, HOT_STATE_SIZE) : 0;
+    Host->SnapshotSize = Host->SnapshotSize < HOT_STATE_SIZE ? Host->SnapshotSize : HOT_STATE_SIZE;
+    Host->SnapshotVersion = API ? API->StateVersion : 0;
+    u32 Expected = HotSnapshotRequested;
+    __atomic_compare_exchange_n(&Host->SnapshotState, &Expected, HotSnapshotReady, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  }
+
+  // NOTE(robin): One swap at a time, a module that comes in during a fade waits for it
+  if (!Host->Fading && __atomic_load_n(&Host->Pending, __ATOMIC_RELAXED))
+  {
+    hot_module* Module = __atomic_exchange_n(&Host->Pending, 0, __ATOMIC_ACQUIRE);
+    Host->Fading = Host->Current;
+    __atomic_store_n(&Host->Current, Module, __ATOMIC_RELAXED);
+    Host->FadePosition = 0;
+    Host->Swaps++;
+  }
+
+  f32* Old[HOT_MAX_CHANNELS];
+  if (Host->Fading)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      Old[Channel] = Host->Scratch[Channel];
+    Host->Fading->API->Process(Host->Fading->Instance, Inputs, Old, FrameCount);
+  }
+
+  if (Host->Current)
+  {
+    Host->Current->API->Process(Host->Current->Instance, Inputs, Outputs, FrameCount);
+  }
+  else
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      memcpy(Outputs[Channel], Inputs[Channel], FrameCount * sizeof(f32));
+  }
+
+  if (Host->Fading)
+  {
+    // NOTE(robin): A linear (equal gain) fade, since the two are mostly the same signal
+    f32 Step = Host->FadeFrames ? 1.0f / (f32)Host->FadeFrames : 1.0f;
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    {
+      f32 Gain = (f32)Host->FadePosition * Step;
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        Gain = Gain < 1.0f ? Gain : 1.0f;
+        Outputs[Channel][i] = Old[Channel][i] + Gain * (Outputs[Channel][i] - Old[Channel][i]);
+        Gain += Step;
+      }
+    }
+
+    Host->FadePosition += FrameCount;
+    if (Host->FadePosition >= Host->FadeFrames)
+    {
+      HotRetire(Host, Host->Fading);
+      Host->Fading = 0;
+    }
+  }
+}
+
+// NOTE(robin): Only once the audio thread has stopped calling HotProcess
+void HotFree(hot_host* Host)
+{
+  HotCollect(Host);
+  hot_module* Modules[] = {Host->Current, Host->Fading, Host->Pending};
+  for (u32 i = 0; i < sizeof(Modules) / sizeof(Modules[0]); i++)
+  {
+    if (Modules[i])
+      HotUnload(Modules[i]);
+  }
+  Host->Current = Host->Fading = Host->Pending = 0;
+}
@@ -0,0 +1,484 @@
+/*
+ * This file provides routines for converting between interleaved buffers (ALSA, CoreAudio,
+ * WASAPI) and planar buffers (JACK, ASIO) for any number of channels, with optional
+ * channel maps and channel subsets.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): Converting between the two layouts is a matrix transpose. We work on tiles
+ * of 4 frames by 4 channels: load one 4 wide vector from each of 4 planar channels,
+ * transpose the 4x4 block in registers and store 4 vectors of interleaved frames (or the
+ * other way around for deinterleaving). Leftover pairs of channels use 2x2 tiles, and
+ * anything left over after that is done one sample at a time.
+ *
+ * We use SSE on x86, NEON on ARM and plain C everywhere else. The 2, 4, 6 and 8 channel
+ * cases get their own copies of the loops with the channel count known at compile time,
+ * see InterleaveF32/DeinterleaveF32.
+ *
+ * The NonTemporal variants write with streaming stores which bypass the cache. That's only
+ * a win for buffers that are much larger than your cache (e.g. converting seconds of 64
+ * channel audio at once), for normal period sized buffers you want the data you just
+ * wrote to stay in the cache for whoever reads it next. Streaming stores need 16 byte
+ * aligned destinations and only help when whole cache lines are written, so interleaving
+ * only streams when the destination is aligned and the channel count is a multiple of 4.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INTERLEAVE_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define INTERLEAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#define INTERLEAVE_INLINE static __forceinline
+#else
+#define INTERLEAVE_INLINE static inline __attribute__((always_inline))
+#endif
+
+// NOTE(robin): The most channels the Mapped functions support, we need a pointer per channel
+// on the stack
+#define INTERLEAVE_MAX_CHANNELS 256
+
+// NOTE(robin): Tiny vector abstraction so the tile loops can be written once {{{
+#if INTERLEAVE_SSE
+
+typedef __m128 ilv_f32x4;
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZero(void) { return _mm_setzero_ps(); }
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad(const f32* P) { return _mm_loadu_ps(P); }
+INTERLEAVE_INLINE void ILVStore(f32* P, ilv_f32x4 V) { _mm_storeu_ps(P, V); }
+
+INTERLEAVE_INLINE void ILVStoreNT(f32* P, ilv_f32x4 V)
+{
+  if (((size_t)P & 15) == 0)
+    _mm_stream_ps(P, V);
+  else
+    _mm_storeu_ps(P, V);
+}
+
+INTERLEAVE_INLINE void ILVFence(void) { _mm_sfence(); }
+
+// NOTE(robin): Loads 2 floats from each pointer into a single vector
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad2x2(const f32* P0, const f32* P1)
+{
+  ilv_f32x4 Low = _mm_castpd_ps(_mm_load_sd((const double*)P0));
+  return _mm_loadh_pi(Low, (const __m64*)P1);
+}
+
+INTERLEAVE_INLINE void ILVStoreLow2(f32* P, ilv_f32x4 V) { _mm_storel_pi((__m64*)P, V); }
+INTERLEAVE_INLINE void ILVStoreHigh2(f32* P, ilv_f32x4 V) { _mm_storeh_pi((__m64*)P, V); }
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZipLow(ilv_f32x4 A, ilv_f32x4 B) { return _mm_unpacklo_ps(A, B); }
+INTERLEAVE_INLINE ilv_f32x4 ILVZipHigh(ilv_f32x4 A, ilv_f32x4 B) { return _mm_unpackhi_ps(A, B); }
+INTERLEAVE_INLINE ilv_f32x4 ILVEvens(ilv_f32x4 A, ilv_f32x4 B) { return _mm_shuffle_ps(A, B, _MM_SHUFFLE(2, 0, 2, 0)); }
+INTERLEAVE_INLINE ilv_f32x4 ILVOdds(ilv_f32x4 A, ilv_f32x4 B) { return _mm_shuffle_ps(A, B, _MM_SHUFFLE(3, 1, 3, 1)); }
+
+#define ILVTranspose4(R0, R1, R2, R3) _MM_TRANSPOSE4_PS(R0, R1, R2, R3)
+
+#elif INTERLEAVE_NEON
+
+typedef float32x4_t ilv_f32x4;
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZero(void) { return vdupq_n_f32(0); }
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad(const f32* P) { return vld1q_f32(P); }
+INTERLEAVE_INLINE void ILVStore(f32* P, ilv_f32x4 V) { vst1q_f32(P, V); }
+INTERLEAVE_INLINE void ILVStoreNT(f32* P, ilv_f32x4 V) { vst1q_f32(P, V); } // NOTE(robin): No streaming stores in NEON
+INTERLEAVE_INLINE void ILVFence(void) {}
+
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad2x2(const f32* P0, const f32* P1) { return vcombine_f32(vld1_f32(P0), vld1_f32(P1)); }
+INTERLEAVE_INLINE void ILVStoreLow2(f32* P, ilv_f32x4 V) { vst1_f32(P, vget_low_f32(V)); }
+INTERLEAVE_INLINE void ILVStoreHigh2(f32* P, ilv_f32x4 V) { vst1_f32(P, vget_high_f32(V)); }
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZipLow(ilv_f32x4 A, ilv_f32x4 B) { return vzipq_f32(A, B).val[0]; }
+INTERLEAVE_INLINE ilv_f32x4 ILVZipHigh(ilv_f32x4 A, ilv_f32x4 B) { return vzipq_f32(A, B).val[1]; }
+INTERLEAVE_INLINE ilv_f32x4 ILVEvens(ilv_f32x4 A, ilv_f32x4 B) { return vuzpq_f32(A, B).val[0]; }
+INTERLEAVE_INLINE ilv_f32x4 ILVOdds(ilv_f32x4 A, ilv_f32x4 B) { return vuzpq_f32(A, B).val[1]; }
+
+#define ILVTranspose4(R0, R1, R2, R3) \
+  do \
+  { \
+    float32x4x2_t T01 = vtrnq_f32(R0, R1); \
+    float32x4x2_t T23 = vtrnq_f32(R2, R3); \
+    R0 = vcombine_f32(vget_low_f32(T01.val[0]), vget_low_f32(T23.val[0])); \
+    R1 = vcombine_f32(vget_low_f32(T01.val[1]), vget_low_f32(T23.val[1])); \
+    R2 = vcombine_f32(vget_high_f32(T01.val[0]), vget_high_f32(T23.val[0])); \
+    R3 = vcombine_f32(vget_high_f32(T01.val[1]), vget_high_f32(T23.val[1])); \
+  } while (0)
+
+#else
+
+typedef struct
+{
+  f32 E[4];
+} ilv_f32x4;
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZero(void) { ilv_f32x4 V = {{0}}; return V; }
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad(const f32* P) { ilv_f32x4 V; memcpy(V.E, P, sizeof(V.E)); return V; }
+INTERLEAVE_INLINE void ILVStore(f32* P, ilv_f32x4 V) { memcpy(P, V.E, sizeof(V.E)); }
+INTERLEAVE_INLINE void ILVStoreNT(f32* P, ilv_f32x4 V) { memcpy(P, V.E, sizeof(V.E)); }
+INTERLEAVE_INLINE void ILVFence(void) {}
+
+INTERLEAVE_INLINE ilv_f32x4 ILVLoad2x2(const f32* P0, const f32* P1)
+{
+  ilv_f32x4 V = {{P0[0], P0[1], P1[0], P1[1]}};
+  return V;
+}
+
+INTERLEAVE_INLINE void ILVStoreLow2(f32* P, ilv_f32x4 V) { P[0] = V.E[0]; P[1] = V.E[1]; }
+INTERLEAVE_INLINE void ILVStoreHigh2(f32* P, ilv_f32x4 V) { P[0] = V.E[2]; P[1] = V.E[3]; }
+
+INTERLEAVE_INLINE ilv_f32x4 ILVZipLow(ilv_f32x4 A, ilv_f32x4 B) { ilv_f32x4 V = {{A.E[0], B.E[0], A.E[1], B.E[1]}}; return V; }
+INTERLEAVE_INLINE ilv_f32x4 ILVZipHigh(ilv_f32x4 A, ilv_f32x4 B) { ilv_f32x4 V = {{A.E[2], B.E[2], A.E[3], B.E[3]}}; return V; }
+INTERLEAVE_INLINE ilv_f32x4 ILVEvens(ilv_f32x4 A, ilv_f32x4 B) { ilv_f32x4 V = {{A.E[0], A.E[2], B.E[0], B.E[2]}}; return V; }
+INTERLEAVE_INLINE ilv_f32x4 ILVOdds(ilv_f32x4 A, ilv_f32x4 B) { ilv_f32x4 V = {{A.E[1], A.E[3], B.E[1], B.E[3]}}; return V; }
+
+#define ILVTranspose4(R0, R1, R2, R3) \
+  do \
+  { \
+    ilv_f32x4 T0 = {{R0.E[0], R1.E[0], R2.E[0], R3.E[0]}}; \
+    ilv_f32x4 T1 = {{R0.E[1], R1.E[1], R2.E[1], R3.E[1]}}; \
+    ilv_f32x4 T2 = {{R0.E[2], R1.E[2], R2.E[2], R3.E[2]}}; \
+    ilv_f32x4 T3 = {{R0.E[3], R1.E[3], R2.E[3], R3.E[3]}}; \
+    R0 = T0; R1 = T1; R2 = T2; R3 = T3; \
+  } while (0)
+
+#endif
+// }}}
+
+INTERLEAVE_INLINE ilv_f32x4 ILVLoadOrZero(const f32* P)
+{
+  return P ? ILVLoad(P) : ILVZero();
+}
+
+// NOTE(robin): Planar -> interleaved. Sources has one pointer per interleaved channel, a null
+// pointer means that channel is filled with silence.
+INTERLEAVE_INLINE void InterleaveTiles(f32* restrict Output, const f32* const* Sources,
+    u32 ChannelCount, u32 FrameCount, u32 NonTemporal)
+{
+  u32 Frame = 0;
+  for (; Frame + 4 <= FrameCount; Frame += 4)
+  {
+    f32* Out = Output + (size_t)Frame * ChannelCount;
+
+    u32 Channel = 0;
+    for (; Channel + 4 <= ChannelCount; Channel += 4)
+    {
+      const f32* S0 = Sources[Channel + 0];
+      const f32* S1 = Sources[Channel + 1];
+      const f32* S2 = Sources[Channel + 2];
+      const f32* S3 = Sources[Channel + 3];
+
+      ilv_f32x4 R0 = ILVLoadOrZero(S0 ? S0 + Frame : 0);
+      ilv_f32x4 R1 = ILVLoadOrZero(S1 ? S1 + Frame : 0);
+      ilv_f32x4 R2 = ILVLoadOrZero(S2 ? S2 + Frame : 0);
+      ilv_f32x4 R3 = ILVLoadOrZero(S3 ? S3 + Frame : 0);
+
+      // NOTE(robin): Rows were channels, now they're frames
+      ILVTranspose4(R0, R1, R2, R3);
+
+      if (NonTemporal)
+      {
+        ILVStoreNT(Out + 0 * ChannelCount + Channel, R0);
+        ILVStoreNT(Out + 1 * ChannelCount + Channel, R1);
+        ILVStoreNT(Out + 2 * ChannelCount + Channel, R2);
+        ILVStoreNT(Out + 3 * ChannelCount + Channel, R3);
+      }
+      else
+      {
+        ILVStore(Out + 0 * ChannelCount + Channel, R0);
+        ILVStore(Out + 1 * ChannelCount + Channel, R1);
+        ILVStore(Out + 2 * ChannelCount + Channel, R2);
+        ILVStore(Out + 3 * ChannelCount + Channel, R3);
+      }
+    }
+
+    for (; Channel + 2 <= ChannelCount; Channel += 2)
+    {
+      const f32* S0 = Sources[Channel + 0];
+      const f32* S1 = Sources[Channel + 1];
+
+      ilv_f32x4 A = ILVLoadOrZero(S0 ? S0 + Frame : 0);
+      ilv_f32x4 B = ILVLoadOrZero(S1 ? S1 + Frame : 0);
+
+      // NOTE(robin): Low holds frames 0 and 1, High holds frames 2 and 3
+      ilv_f32x4 Low = ILVZipLow(A, B);
+      ilv_f32x4 High = ILVZipHigh(A, B);
+
+      ILVStoreLow2(Out + 0 * ChannelCount + Channel, Low);
+      ILVStoreHigh2(Out + 1 * ChannelCount + Channel, Low);
+      ILVStoreLow2(Out + 2 * ChannelCount + Channel, High);
+      ILVStoreHigh2(Out + 3 * ChannelCount + Channel, High);
+    }
+
+    for (; Channel < ChannelCount; Channel++)
+    {
+      const f32* S = Sources[Channel];
+      for (u32 i = 0; i < 4; i++)
+        Out[i * ChannelCount + Channel] = S ? S[Frame + i] : 0;
+    }
+  }
+
+  for (; Frame < FrameCount; Frame++)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    {
+      const f32* S = Sources[Channel];
+      Output[(size_t)Frame * ChannelCount + Channel] = S ? S[Frame] : 0;
+    }
+  }
+
+  if (NonTemporal)
+    ILVFence();
+}
+
+// NOTE(robin): Deinterleaves BlockFrames frames (a multiple of 4) starting at Frame
+INTERLEAVE_INLINE void DeinterleaveBlock(f32* const* Dests, const f32* restrict Input,
+    u32 ChannelCount, u32 Frame, u32 BlockFrames, u32 NonTemporal)
+{
+  u32 Channel = 0;
+  for (; Channel + 4 <= ChannelCount; Channel += 4)
+  {
+    f32* D0 = Dests[Channel + 0];
+    f32* D1 = Dests[Channel + 1];
+    f32* D2 = Dests[Channel + 2];
+    f32* D3 = Dests[Channel + 3];
+
+    if (!D0 && !D1 && !D2 && !D3)
+      continue;
+
+    for (u32 Tile = Frame; Tile < Frame + BlockFrames; Tile += 4)
+    {
+      const f32* In = Input + (size_t)Tile * ChannelCount + Channel;
+      ilv_f32x4 R0 = ILVLoad(In + 0 * ChannelCount);
+      ilv_f32x4 R1 = ILVLoad(In + 1 * ChannelCount);
+      ilv_f32x4 R2 = ILVLoad(In + 2 * ChannelCount);
+      ilv_f32x4 R3 = ILVLoad(In + 3 * ChannelCount);
+
+      // NOTE(robin): Rows were frames, now they're channels
+      ILVTranspose4(R0, R1, R2, R3);
+
+      if (NonTemporal)
+      {
+        if (D0) ILVStoreNT(D0 + Tile, R0);
+        if (D1) ILVStoreNT(D1 + Tile, R1);
+        if (D2) ILVStoreNT(D2 + Tile, R2);
+        if (D3) ILVStoreNT(D3 + Tile, R3);
+      }
+      else
+      {
+        if (D0) ILVStore(D0 + Tile, R0);
+        if (D1) ILVStore(D1 + Tile, R1);
+        if (D2) ILVStore(D2 + Tile, R2);
+        if (D3) ILVStore(D3 + Tile, R3);
+      }
+    }
+  }
+
+  for (; Channel + 2 <= ChannelCount; Channel += 2)
+  {
+    f32* D0 = Dests[Channel + 0];
+    f32* D1 = Dests[Channel + 1];
+
+    if (!D0 && !D1)
+      continue;
+
+    for (u32 Tile = Frame; Tile < Frame + BlockFrames; Tile += 4)
+    {
+      const f32* In = Input + (size_t)Tile * ChannelCount + Channel;
+      ilv_f32x4 A = ILVLoad2x2(In + 0 * ChannelCount, In + 1 * ChannelCount);
+      ilv_f32x4 B = ILVLoad2x2(In + 2 * ChannelCount, In + 3 * ChannelCount);
+
+      if (NonTemporal)
+      {
+        if (D0) ILVStoreNT(D0 + Tile, ILVEvens(A, B));
+        if (D1) ILVStoreNT(D1 + Tile, ILVOdds(A, B));
+      }
+      else
+      {
+        if (D0) ILVStore(D0 + Tile, ILVEvens(A, B));
+        if (D1) ILVStore(D1 + Tile, ILVOdds(A, B));
+      }
+    }
+  }
+
+  for (; Channel < ChannelCount; Channel++)
+  {
+    f32* D = Dests[Channel];
+    if (D)
+    {
+      for (u32 i = Frame; i < Frame + BlockFrames; i++)
+        D[i] = Input[(size_t)i * ChannelCount + Channel];
+    }
+  }
+}
+
+// NOTE(robin): Interleaved -> planar. Dests has one pointer per interleaved channel, a null
+// pointer means that channel is skipped.
+INTERLEAVE_INLINE void DeinterleaveTiles(f32* const* Dests, const f32* restrict Input,
+    u32 ChannelCount, u32 FrameCount, u32 NonTemporal)
+{
+  u32 Frame = 0;
+
+  // NOTE(robin): Streaming stores are only fast when whole cache lines are written at once,
+  // otherwise we run out of write combining buffers. So for the non-temporal path we do 16
+  // frames (64 bytes) of each channel before moving on to the next channel.
+  if (NonTemporal)
+  {
+    for (; Frame + 16 <= FrameCount; Frame += 16)
+      DeinterleaveBlock(Dests, Input, ChannelCount, Frame, 16, 1);
+    ILVFence();
+  }
+
+  for (; Frame + 4 <= FrameCount; Frame += 4)
+    DeinterleaveBlock(Dests, Input, ChannelCount, Frame, 4, 0);
+
+  for (; Frame < FrameCount; Frame++)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    {
+      if (Dests[Channel])
+        Dests[Channel][Frame] = Input[(size_t)Frame * ChannelCount + Channel];
+    }
+  }
+}
+
+// NOTE(robin): Copies of the tile loops with the channel count known at compile time. The
+// compiler unrolls the channel loop completely for these.
+#define INTERLEAVE_DEFINE_FIXED(Channels) \
+  void InterleaveF32_##Channels(f32* restrict Output, const f32* const* Sources, u32 FrameCount, u32 NonTemporal) \
+  { \
+    InterleaveTiles(Output, Sources, Channels, FrameCount, NonTemporal); \
+  } \
+  void DeinterleaveF32_##Channels(f32* const* Dests, const f32* restrict Input, u32 FrameCount, u32 NonTemporal) \
+  { \
+    DeinterleaveTiles(Dests, Input, Channels, FrameCount, NonTemporal); \
+  }
+
+INTERLEAVE_DEFINE_FIXED(2)
+INTERLEAVE_DEFINE_FIXED(4)
+INTERLEAVE_DEFINE_FIXED(6)
+INTERLEAVE_DEFINE_FIXED(8)
+
+void InterleaveF32Dispatch(f32* restrict Output, const f32* const* Sources,
+    u32 ChannelCount, u32 FrameCount, u32 NonTemporal)
+{
+  // NOTE(robin): Mixing streaming and normal stores to the same cache line is very slow, so we
+  // only stream if every tile store will be aligned
+  if (ChannelCount % 4 || ((size_t)Output & 15))
+    NonTemporal = 0;
+
+  switch (ChannelCount)
+  {
+    case 2: InterleaveF32_2(Output, Sources, FrameCount, NonTemporal); break;
+    case 4: InterleaveF32_4(Output, Sources, FrameCount, NonTemporal); break;
+    case 6: InterleaveF32_6(Output, Sources, FrameCount, NonTemporal); break;
+    case 8: InterleaveF32_8(Output, Sources, FrameCount, NonTemporal); break;
+    default: InterleaveTiles(Output, Sources, ChannelCount, FrameCount, NonTemporal); break;
+  }
+}
+
+void DeinterleaveF32Dispatch(f32* const* Dests, const f32* restrict Input,
+    u32 ChannelCount, u32 FrameCount, u32 NonTemporal)
+{
+  switch (ChannelCount)
+  {
+    case 2: DeinterleaveF32_2(Dests, Input, FrameCount, NonTemporal); break;
+    case 4: DeinterleaveF32_4(Dests, Input, FrameCount, NonTemporal); break;
+    case 6: DeinterleaveF32_6(Dests, Input, FrameCount, NonTemporal); break;
+    case 8: DeinterleaveF32_8(Dests, Input, FrameCount, NonTemporal); break;
+    default: DeinterleaveTiles(Dests, Input, ChannelCount, FrameCount, NonTemporal); break;
+  }
+}
+
+// NOTE(robin): Planar[i] becomes channel i of the interleaved Output. A null pointer in Planar
+// writes silence to that channel.
+void InterleaveF32(f32* restrict Output, const f32* const* Planar, u32 ChannelCount, u32 FrameCount)
+{
+  InterleaveF32Dispatch(Output, Planar, ChannelCount, FrameCount, 0);
+}
+
+void InterleaveF32NonTemporal(f32* restrict Output, const f32* const* Planar, u32 ChannelCount, u32 FrameCount)
+{
+  InterleaveF32Dispatch(Output, Planar, ChannelCount, FrameCount, 1);
+}
+
+// NOTE(robin): Channel i of the interleaved Input goes to Planar[i]. A null pointer in Planar
+// skips that channel.
+void DeinterleaveF32(f32* const* Planar, const f32* restrict Input, u32 ChannelCount, u32 FrameCount)
+{
+  DeinterleaveF32Dispatch(Planar, Input, ChannelCount, FrameCount, 0);
+}
+
+void DeinterleaveF32NonTemporal(f32* const* Planar, const f32* restrict Input, u32 ChannelCount, u32 FrameCount)
+{
+  DeinterleaveF32Dispatch(Planar, Input, ChannelCount, FrameCount, 1);
+}
+
+// NOTE(robin): Writes PlanarCount planar channels into an interleaved buffer with
+// OutputChannels channels. Planar[i] goes to interleaved channel ChannelMap[i]. Interleaved
+// channels that nothing maps to are filled with silence, so this also handles writing a
+// subset of the device's channels (e.g. our stereo mix to outputs 3 and 4 of an 8 channel
+// device is ChannelMap = {2, 3}). Returns 0 and writes silence if OutputChannels is more
+// than INTERLEAVE_MAX_CHANNELS.
+u32 InterleaveF32Mapped(f32* restrict Output, u32 OutputChannels,
+    const f32* const* Planar, const u32* ChannelMap, u32 PlanarCount, u32 FrameCount)
+{
+  const f32* Sources[INTERLEAVE_MAX_CHANNELS] = {0};
+  if (OutputChannels > INTERLEAVE_MAX_CHANNELS)
+  {
+    memset(Output, 0, (size_t)OutputChannels * FrameCount * sizeof(f32));
+    return 0;
+  }
+
+  for (u32 i = 0; i < PlanarCount; i++)
+  {
+    if (ChannelMap[i] < OutputChannels)
+      Sources[ChannelMap[i]] = Planar[i];
+  }
+
+  InterleaveF32Dispatch(Output, Sources, OutputChannels, FrameCount, 0);
+  return 1;
+}
+
+// NOTE(robin): Reads interleaved channel ChannelMap[i] of Input into Planar[i]. Interleaved
+// channels that nothing maps to are skipped. If several planar channels map to the same
+// interleaved channel then the later ones are copied from the first. Planar channels that
+// map past InputChannels get silence, like the unmapped channels of InterleaveF32Mapped.
+// Returns 0 and writes silence to every planar channel if InputChannels is more than
+// INTERLEAVE_MAX_CHANNELS.
+u32 DeinterleaveF32Mapped(f32* const* Planar, const u32* ChannelMap, u32 PlanarCount,
+    const f32* restrict Input, u32 InputChannels, u32 FrameCount)
+{
+  f32* Dests[INTERLEAVE_MAX_CHANNELS] = {0};
+  if (InputChannels > INTERLEAVE_MAX_CHANNELS)
+  {
+    for (u32 i = 0; i < PlanarCount; i++)
+      memset(Planar[i], 0, FrameCount * sizeof(f32));
+    return 0;
+  }
+
+  for (u32 i = 0; i < PlanarCount; i++)
+  {
+    if (ChannelMap[i] < InputChannels && !Dests[ChannelMap[i]])
+      Dests[ChannelMap[i]] = Planar[i];
+  }
+
+  DeinterleaveF32Dispatch(Dests, Input, InputChannels, FrameCount, 0);
+
+  for (u32 i = 0; i < PlanarCount; i++)
+  {
+    u32 Channel = ChannelMap[i];
+    if (Channel >= InputChannels)
+      memset(Planar[i], 0, FrameCount * sizeof(f32));
+    else if (Dests[Channel] != Planar[i])
+      memcpy(Planar[i], Dests[Channel], FrameCount * sizeof(f32));
+  }
+  return 1;
+}
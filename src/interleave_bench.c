@@ -0,0 +1,221 @@
+/*
+ * This file benchmarks interleave.c against the plain per sample loops that the examples
+ * use, at 2 to 128 channels. Every kernel is checked against the plain loop before it is
+ * timed.
+ *
+ * The "large" runs convert 16MB at once to show where the non-temporal stores start to
+ * pay off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "types.h"
+#include "bench.c"
+#include "interleave.c"
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 FrameCount;
+  f32* Interleaved;
+  f32* PlanarBlock;
+  f32* Planar[128];
+} bench_data;
+
+void ScalarInterleave(f32* Output, f32* const* Planar, u32 ChannelCount, u32 FrameCount)
+{
+  for (u32 Frame = 0; Frame < FrameCount; Frame++)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      Output[Frame * ChannelCount + Channel] = Planar[Channel][Frame];
+  }
+}
+
+void ScalarDeinterleave(f32* const* Planar, const f32* Input, u32 ChannelCount, u32 FrameCount)
+{
+  for (u32 Frame = 0; Frame < FrameCount; Frame++)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      Planar[Channel][Frame] = Input[Frame * ChannelCount + Channel];
+  }
+}
+
+void BenchScalarInterleave(void* Context)
+{
+  bench_data* Data = Context;
+  ScalarInterleave(Data->Interleaved, Data->Planar, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchScalarDeinterleave(void* Context)
+{
+  bench_data* Data = Context;
+  ScalarDeinterleave(Data->Planar, Data->Interleaved, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchInterleave(void* Context)
+{
+  bench_data* Data = Context;
+  InterleaveF32(Data->Interleaved, (const f32* const*)Data->Planar, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchDeinterleave(void* Context)
+{
+  bench_data* Data = Context;
+  DeinterleaveF32(Data->Planar, Data->Interleaved, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchInterleaveNT(void* Context)
+{
+  bench_data* Data = Context;
+  InterleaveF32NonTemporal(Data->Interleaved, (const f32* const*)Data->Planar, Data->ChannelCount, Data->FrameCount);
+}
+
+void BenchDeinterleaveNT(void* Context)
+{
+  bench_data* Data = Context;
+  DeinterleaveF32NonTemporal(Data->Planar, Data->Interleaved, Data->ChannelCount, Data->FrameCount);
+}
+
+void* AllocateAligned(size_t Size)
+{
+  // NOTE(robin): Over-allocate and round up, we never free these
+  u8* Memory = malloc(Size + 64);
+  return (void*)(((size_t)Memory + 63) & ~(size_t)63);
+}
+
+// NOTE(robin): All of the planar channels live in one block, each starting on a 64 byte boundary
+void SetLayout(bench_data* Data, u32 ChannelCount, u32 FrameCount)
+{
+  u32 Stride = (FrameCount + 15) & ~15u;
+  Data->ChannelCount = ChannelCount;
+  Data->FrameCount = FrameCount;
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    Data->Planar[Channel] = Data->PlanarBlock + (size_t)Channel * Stride;
+}
+
+void Verify(bench_data* Data)
+{
+  u32 ChannelCount = Data->ChannelCount;
+  u32 FrameCount = Data->FrameCount;
+
+  f32* Expected = malloc((size_t)ChannelCount * FrameCount * sizeof(f32));
+  f32* Planar[128];
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+  {
+    Planar[Channel] = malloc(FrameCount * sizeof(f32));
+    for (u32 Frame = 0; Frame < FrameCount; Frame++)
+      Data->Planar[Channel][Frame] = (f32)(Channel * 100000 + Frame);
+  }
+
+  ScalarInterleave(Expected, Data->Planar, ChannelCount, FrameCount);
+
+  InterleaveF32(Data->Interleaved, (const f32* const*)Data->Planar, ChannelCount, FrameCount);
+  assert(!memcmp(Expected, Data->Interleaved, (size_t)ChannelCount * FrameCount * sizeof(f32)));
+  InterleaveF32NonTemporal(Data->Interleaved, (const f32* const*)Data->Planar, ChannelCount, FrameCount);
+  assert(!memcmp(Expected, Data->Interleaved, (size_t)ChannelCount * FrameCount * sizeof(f32)));
+
+  DeinterleaveF32(Planar, Data->Interleaved, ChannelCount, FrameCount);
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    assert(!memcmp(Planar[Channel], Data->Planar[Channel], FrameCount * sizeof(f32)));
+
+  // NOTE(robin): Cleared first so what DeinterleaveF32 left there can't pass for it
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    memset(Planar[Channel], 0, FrameCount * sizeof(f32));
+  DeinterleaveF32NonTemporal(Planar, Data->Interleaved, ChannelCount, FrameCount);
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    assert(!memcmp(Planar[Channel], Data->Planar[Channel], FrameCount * sizeof(f32)));
+
+  // NOTE(robin): Reversed channel map over a subset of the channels, the rest are silent
+  u32 Map[128] = {0};
+  u32 Subset = ChannelCount > 2 ? ChannelCount - 1 : ChannelCount;
+  for (u32 i = 0; i < Subset; i++)
+    Map[i] = Subset - 1 - i;
+
+  InterleaveF32Mapped(Data->Interleaved, ChannelCount, (const f32* const*)Data->Planar, Map, Subset, FrameCount);
+  for (u32 Frame = 0; Frame < FrameCount; Frame++)
+  {
+    for (u32 i = 0; i < Subset; i++)
+      assert(Data->Interleaved[Frame * ChannelCount + Map[i]] == Data->Planar[i][Frame]);
+    for (u32 Channel = Subset; Channel < ChannelCount; Channel++)
+      assert(Data->Interleaved[Frame * ChannelCount + Channel] == 0);
+  }
+
+  // NOTE(robin): One more planar channel that maps past the input, it must come back silent
+  u32 Extra = Subset < ChannelCount;
+  Map[Subset] = ChannelCount;
+  for (u32 Frame = 0; Extra && Frame < FrameCount; Frame++)
+    Planar[Subset][Frame] = 1.0f;
+  u32 Mapped = DeinterleaveF32Mapped(Planar, Map, Subset + Extra, Data->Interleaved, ChannelCount, FrameCount);
+  assert(Mapped);
+  for (u32 i = 0; i < Subset; i++)
+    assert(!memcmp(Planar[i], Data->Planar[i], FrameCount * sizeof(f32)));
+  for (u32 Frame = 0; Extra && Frame < FrameCount; Frame++)
+    assert(Planar[Subset][Frame] == 0);
+
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    free(Planar[Channel]);
+  free(Expected);
+}
+
+void Run(bench_data* Data, const char* Label)
+{
+  f64 ScalarI = BenchMeasure(BenchScalarInterleave, Data);
+  f64 SIMDI = BenchMeasure(BenchInterleave, Data);
+  f64 NTI = BenchMeasure(BenchInterleaveNT, Data);
+  f64 ScalarD = BenchMeasure(BenchScalarDeinterleave, Data);
+  f64 SIMDD = BenchMeasure(BenchDeinterleave, Data);
+  f64 NTD = BenchMeasure(BenchDeinterleaveNT, Data);
+
+  f64 Samples = (f64)Data->ChannelCount * Data->FrameCount;
+  printf("%-10s %4u %7u | %8.3f %8.3f %8.3f | %8.3f %8.3f %8.3f\n", Label,
+      Data->ChannelCount, Data->FrameCount,
+      ScalarI / Samples, SIMDI / Samples, NTI / Samples,
+      ScalarD / Samples, SIMDD / Samples, NTD / Samples);
+}
+
+int main(int argc, char** argv)
+{
+  u32 ChannelCounts[] = {2, 4, 6, 8, 12, 16, 32, 64, 128};
+  u32 MaxSamples = 4 * 1024 * 1024;
+
+  static bench_data Data;
+  Data.Interleaved = AllocateAligned(MaxSamples * sizeof(f32));
+  Data.PlanarBlock = AllocateAligned((MaxSamples + 128 * 16) * sizeof(f32));
+
+  // NOTE(robin): Correctness first, including odd frame counts to exercise the remainders
+  u32 VerifyFrames[] = {1, 7, 64, 131};
+  for (u32 i = 0; i < sizeof(ChannelCounts) / sizeof(ChannelCounts[0]); i++)
+  {
+    for (u32 j = 0; j < sizeof(VerifyFrames) / sizeof(VerifyFrames[0]); j++)
+    {
+      SetLayout(&Data, ChannelCounts[i], VerifyFrames[j]);
+      Verify(&Data);
+    }
+  }
+  for (u32 ChannelCount = 1; ChannelCount <= 17; ChannelCount++)
+  {
+    SetLayout(&Data, ChannelCount, 37);
+    Verify(&Data);
+  }
+  printf("All interleave kernels match the scalar reference\n\n");
+
+  printf("ns/sample     ch  frames | interleave scalar     simd       nt | deinterleave scalar simd  nt\n");
+
+  for (u32 i = 0; i < sizeof(ChannelCounts) / sizeof(ChannelCounts[0]); i++)
+  {
+    SetLayout(&Data, ChannelCounts[i], 256);
+    Run(&Data, "period");
+  }
+
+  for (u32 i = 0; i < sizeof(ChannelCounts) / sizeof(ChannelCounts[0]); i++)
+  {
+    // NOTE(robin): 16MB of samples so that we're well out of cache
+    SetLayout(&Data, ChannelCounts[i], MaxSamples / ChannelCounts[i]);
+    Run(&Data, "large");
+  }
+
+  return 0;
+}
@@ -3,24 +3,67 @@
 #include <unistd.h>
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 #include <jack/jack.h>
 
+#include "types.h"
+#include "denormal.c"
+#include "meter.c"
+#include "trace.c"
+#include "autotune.c"
+#include "delaycomp.c"
+#include "limiter.c"
+#include "filterbank.c"
+
+// NOTE(robin): The oscillators go through two paths in parallel, as they are and through a
+// lookahead limiter, which are mixed back together ("parallel limiting"). The limiter delays
+// its path by its lookahead, delaycomp.c delays the dry path to match. A third path takes
+// the through ports straight across, delayed the same, so something fed through us lines up
+// with our output.
+#define PATH_DRY 0
+#define PATH_LIMITER 1
+#define PATH_THROUGH 2
+#define MAX_LOOKAHEAD 512
+#define MAX_FRAMES 8192 // NOTE(robin): Largest buffer size we handle
+
 typedef struct
 {
   jack_port_t* OutputPorts[2];
   jack_port_t* InputPorts[2];
+  jack_port_t* ThroughInputs[2];
+  jack_port_t* ThroughOutputs[2];
   jack_client_t* JackClient;
+  denormal_counter OutputDenormals;
+  meter OutputMeter;
+  int AutoTuning;
+  auto_tune AutoTune;
+
+  filter OutputEQ[2][2]; // NOTE(robin): [Channel][Stage]
+  delay_comp DelayComp;
+  limiter Limiter;
+  f32 Limited[2][MAX_FRAMES];
 } jack_callback_data;
 
 int AudioCallback(uint32_t FrameCount, void* Context)
 {
   jack_callback_data* JackData = Context;
+  jack_time_t CallbackStart = jack_get_time();
+
+  // NOTE(robin): JACK owns this thread, so we only flush subnormals to zero for the duration of
+  // our callback and put things back afterwards, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): How late in the cycle JACK got around to us, then the stages of the callback,
+  // see trace.c. Naming the thread is only a store, so we just do it every time.
+  TraceThreadName("jack process");
+  TraceCounter("frames since cycle start", jack_frames_since_cycle_start(JackData->JackClient));
+  TraceBegin("callback");
 
   float* Left = jack_port_get_buffer(JackData->OutputPorts[0], FrameCount);
   float* Right = jack_port_get_buffer(JackData->OutputPorts[1], FrameCount);
 
-  // NOTE(robin): Data for the first channel of input
-  float* Input1 = jack_port_get_buffer(JackData->InputPorts[0], FrameCount);
+  // NOTE(robin): Picks up new path latencies from the main thread, see delaycomp.c
+  DelayCompBegin(&JackData->DelayComp);
 
   float SampleRate = jack_get_sample_rate(JackData->JackClient);
 
@@ -31,6 +74,7 @@ int AudioCallback(uint32_t FrameCount, void* Context)
     330.0f/SampleRate,
   };
 
+  TraceBegin("oscillators");
   for (uint32_t i = 0; i < FrameCount; i++)
   {
     for (int i = 0; i < 2; i++)
@@ -45,28 +89,196 @@ int AudioCallback(uint32_t FrameCount, void* Context)
     Left[i] = Volume * sin(Phase[0] * 2 * M_PI);
     Right[i] = Volume * sin(Phase[1] * 2 * M_PI);
   }
+  TraceEnd("oscillators");
+
+  // NOTE(robin): Before the paths, so the limiter sees what we actually send out
+  TraceBegin("eq");
+  float* Outputs[] = {Left, Right};
+  for (int Channel = 0; Channel < 2; Channel++)
+  {
+    for (int Stage = 0; Stage < 2; Stage++)
+      FilterProcess(&JackData->OutputEQ[Channel][Stage], Outputs[Channel], FrameCount);
+  }
+  TraceEnd("eq");
+
+  TraceBegin("paths");
+  for (int Channel = 0; Channel < 2; Channel++)
+  {
+    for (uint32_t i = 0; i < FrameCount; i++)
+      JackData->Limited[Channel][i] = Outputs[Channel][i];
+  }
+
+  LimiterProcess(&JackData->Limiter, JackData->Limited[0], JackData->Limited[1], FrameCount,
+      DelayCompLatency(&JackData->DelayComp, PATH_LIMITER));
+
+  for (int Channel = 0; Channel < 2; Channel++)
+  {
+    DelayCompProcess(&JackData->DelayComp, PATH_DRY, Channel, Outputs[Channel], FrameCount);
+    DelayCompProcess(&JackData->DelayComp, PATH_LIMITER, Channel, JackData->Limited[Channel], FrameCount);
+
+    for (uint32_t i = 0; i < FrameCount; i++)
+      Outputs[Channel][i] = 0.5f * (Outputs[Channel][i] + JackData->Limited[Channel][i]);
+
+    // NOTE(robin): JACK doesn't let us write to an input's buffer, so copy it over first
+    float* ThroughInput = jack_port_get_buffer(JackData->ThroughInputs[Channel], FrameCount);
+    float* ThroughOutput = jack_port_get_buffer(JackData->ThroughOutputs[Channel], FrameCount);
+    memcpy(ThroughOutput, ThroughInput, FrameCount * sizeof(float));
+    DelayCompProcess(&JackData->DelayComp, PATH_THROUGH, Channel, ThroughOutput, FrameCount);
+  }
+  DelayCompEnd(&JackData->DelayComp, FrameCount);
+  TraceEnd("paths");
+
+  TraceBegin("denormal check");
+  DenormalSample(&JackData->OutputDenormals, Left, FrameCount);
+  DenormalSample(&JackData->OutputDenormals, Right, FrameCount);
+  TraceEnd("denormal check");
+
+  // NOTE(robin): Levels for the main thread to print, see meter.c
+  TraceBegin("meter");
+  MeterProcess(&JackData->OutputMeter, (const f32* const*)Outputs, FrameCount);
+  TraceEnd("meter");
 
+  TraceEnd("callback");
+
+  // NOTE(robin): jack_get_time is in microseconds
+  if (JackData->AutoTuning)
+    AutoTuneCallback(&JackData->AutoTune, (jack_get_time() - CallbackStart) * 1000, FrameCount);
+
+  FPLeaveAudioThread(FPState);
   return 0;
 }
 
+// NOTE(robin): JACK calls this from its notification thread, not the process thread
+int XRunCallback(void* Context)
+{
+  jack_callback_data* JackData = Context;
+  if (JackData->AutoTuning)
+    AutoTuneXRun(&JackData->AutoTune);
+  TraceTrigger("xrun");
+  return 0;
+}
+
+// NOTE(robin): JACK calls this from a non real-time thread when the latencies in the graph
+// change, once for each direction, and we tell it how our ports relate: what comes out of
+// a through output went in at the through input the total latency of our paths earlier, so
+// the capture latency of the output is that of the input plus ours, and the playback latency
+// of the input is that of the output plus ours. Without this, clients after us think the
+// signal is on time and can't line it up with anything else.
+//
+// Nothing of the main inputs reaches the main outputs, but what we play there still comes
+// out the total latency after we made it (the limiter's lookahead, and the dry path delayed
+// to match), so their capture latency is just ours. A client mixing us with a through
+// output or another source then knows to delay the other one.
+void LatencyCallback(jack_latency_callback_mode_t Mode, void* Context)
+{
+  jack_callback_data* JackData = Context;
+  jack_nframes_t Latency = DelayCompTotal(&JackData->DelayComp);
+
+  for (int i = 0; i < 2; i++)
+  {
+    jack_port_t* From = Mode == JackCaptureLatency ? JackData->ThroughInputs[i] : JackData->ThroughOutputs[i];
+    jack_port_t* To = Mode == JackCaptureLatency ? JackData->ThroughOutputs[i] : JackData->ThroughInputs[i];
+
+    jack_latency_range_t Range;
+    jack_port_get_latency_range(From, Mode, &Range);
+    Range.min += Latency;
+    Range.max += Latency;
+    jack_port_set_latency_range(To, Mode, &Range);
+
+    if (Mode == JackCaptureLatency)
+    {
+      jack_latency_range_t Ours = {Latency, Latency};
+      jack_port_set_latency_range(JackData->OutputPorts[i], Mode, &Ours);
+    }
+  }
+}
+
+void PrintPortLatencies(jack_callback_data* JackData)
+{
+  jack_port_t* Ports[] =
+  {
+    JackData->OutputPorts[0], JackData->OutputPorts[1],
+    JackData->ThroughInputs[0], JackData->ThroughInputs[1], JackData->ThroughOutputs[0], JackData->ThroughOutputs[1],
+  };
+
+  printf("Our latency: %u frames\n", DelayCompTotal(&JackData->DelayComp));
+  for (int i = 0; i < 6; i++)
+  {
+    jack_latency_range_t Capture, Playback;
+    jack_port_get_latency_range(Ports[i], JackCaptureLatency, &Capture);
+    jack_port_get_latency_range(Ports[i], JackPlaybackLatency, &Playback);
+    printf("  %-32s capture [%u, %u] playback [%u, %u]\n", jack_port_name(Ports[i]),
+        Capture.min, Capture.max, Playback.min, Playback.max);
+  }
+}
+
+// NOTE(robin): Usage: jack_example [autotune] [trace file]
+//
+// Every second the limiter's lookahead changes, which changes our latency, and we print the
+// latencies of our outputs and through ports, which you can also see with jack_lsp -l. The
+// through ports aren't connected to anything, connect another client through them to see
+// its latencies grow.
+//
+// With autotune we run for 30 seconds starting at the smallest buffer size JACK allows and
+// let autotune.c find the smallest one that runs without xruns, then print what it settled
+// on. Keep in mind the buffer size belongs to the JACK server, so this changes it for every
+// client connected to it.
+//
+// With a trace file, the trace is written out a second after the first xrun, or at the end
+// if there wasn't one. Open it in https://ui.perfetto.dev or chrome://tracing.
 int main(int argc, char** argv)
 {
+  static jack_callback_data JackData; // NOTE(robin): Static because the meter is fairly big
+  JackData.AutoTuning = argc > 1 && !strcmp(argv[1], "autotune");
+
+  const char* TracePath = argc > 1 + JackData.AutoTuning ? argv[1 + JackData.AutoTuning] : 0;
+  TraceInit();
+
   jack_status_t JackStatus;
-  jack_callback_data JackData;
+  DenormalCounterInit(&JackData.OutputDenormals, 16); // NOTE(robin): Check one buffer in 16
 
   JackData.JackClient = jack_client_open("SimpleNativeAudio", JackNullOption, &JackStatus, 0);
   assert(JackData.JackClient);
 
+  MeterInit(&JackData.OutputMeter, 2, jack_get_sample_rate(JackData.JackClient));
+
+  // NOTE(robin): A rumble filter and a little warmth on the output, see filterbank.c. With
+  // only two channels the bank's lanes would be mostly empty, so these are plain scalar
+  // filters. The settings stay put, so there's nothing to ramp.
+  float SampleRate = jack_get_sample_rate(JackData.JackClient);
+  for (u32 Channel = 0; Channel < 2; Channel++)
+  {
+    FilterInit(&JackData.OutputEQ[Channel][0], FilterKindBiquad, FilterHighpass, 30.0f / SampleRate, 0.707f, 0);
+    FilterInit(&JackData.OutputEQ[Channel][1], FilterKindSVF, FilterLowShelf, 250.0f / SampleRate, 0.707f, 3.0f);
+  }
+
   jack_set_process_callback(JackData.JackClient, AudioCallback, &JackData);
+  jack_set_xrun_callback(JackData.JackClient, XRunCallback, &JackData);
+  jack_set_latency_callback(JackData.JackClient, LatencyCallback, &JackData);
+
+  // NOTE(robin): Before the first callback, so it runs with the right delays from the start
+  u32 Lookaheads[] = {64, 256, 128};
+  DelayCompInit(&JackData.DelayComp, 3, 2, MAX_LOOKAHEAD);
+  DelayCompSetLatency(&JackData.DelayComp, PATH_LIMITER, Lookaheads[0]);
+  DelayCompUpdate(&JackData.DelayComp);
+  LimiterInit(&JackData.Limiter, 0.2f, jack_get_sample_rate(JackData.JackClient));
 
   uint32_t BufferSize = jack_get_buffer_size(JackData.JackClient);
   printf("Default buffer size is: %d\n", BufferSize);
 
   BufferSize = 128; // NOTE(robin): Override the default buffer size here
+  if (JackData.AutoTuning)
+  {
+    // NOTE(robin): 16 frames is as small as JACK goes
+    AutoTuneInit(&JackData.AutoTune, jack_get_sample_rate(JackData.JackClient), 16, 4096);
+    BufferSize = JackData.AutoTune.Period;
+  }
   jack_set_buffer_size(JackData.JackClient, BufferSize);
 
   BufferSize = jack_get_buffer_size(JackData.JackClient);
   printf("Actual buffer size was set to: %d\n", BufferSize);
+  if (JackData.AutoTuning)
+    AutoTuneApplied(&JackData.AutoTune, BufferSize);
 
   JackData.OutputPorts[0] = jack_port_register(JackData.JackClient, "Output1",
       JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
@@ -78,6 +290,15 @@ int main(int argc, char** argv)
   JackData.InputPorts[1] = jack_port_register(JackData.JackClient, "Input2",
       JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
 
+  JackData.ThroughInputs[0] = jack_port_register(JackData.JackClient, "ThroughIn1",
+      JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  JackData.ThroughInputs[1] = jack_port_register(JackData.JackClient, "ThroughIn2",
+      JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  JackData.ThroughOutputs[0] = jack_port_register(JackData.JackClient, "ThroughOut1",
+      JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  JackData.ThroughOutputs[1] = jack_port_register(JackData.JackClient, "ThroughOut2",
+      JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+
   // NOTE(robin): Tell the hardware to start calling our callback
   jack_activate(JackData.JackClient);
 
@@ -109,9 +330,52 @@ int main(int argc, char** argv)
 
   jack_free(JackPorts);
 
-  sleep(3);
+  int TraceWritten = 0;
+  for (int i = 0; i < (JackData.AutoTuning ? 30 : 3); i++)
+  {
+    sleep(1);
+
+    // NOTE(robin): JACK calls the process callback with the new size from the next cycle on.
+    // It can refuse a size, so we ask what we actually got.
+    if (JackData.AutoTuning)
+    {
+      uint32_t Period = AutoTuneUpdate(&JackData.AutoTune);
+      AutoTunePrintWindow(&JackData.AutoTune);
+      if (Period)
+      {
+        jack_set_buffer_size(JackData.JackClient, Period);
+        AutoTuneApplied(&JackData.AutoTune, jack_get_buffer_size(JackData.JackClient));
+      }
+    }
+    else
+    {
+      MeterPrint(MeterRead(&JackData.OutputMeter));
+      PrintPortLatencies(&JackData);
+
+      // NOTE(robin): The audio thread switches the limiter and the delays over together in
+      // its next callback, then JACK asks everyone for their latencies again
+      DelayCompSetLatency(&JackData.DelayComp, PATH_LIMITER, Lookaheads[(i + 1) % 3]);
+      if (DelayCompUpdate(&JackData.DelayComp))
+        jack_recompute_total_latencies(JackData.JackClient);
+    }
+
+    if (TracePath && !TraceWritten && TraceTriggered())
+    {
+      printf("Xrun, wrote %d trace events to %s\n", TraceWrite(TracePath), TracePath);
+      TraceWritten = 1;
+    }
+  }
 
   jack_client_close(JackData.JackClient);
+  DelayCompFree(&JackData.DelayComp);
+
+  if (TracePath && !TraceWritten)
+    printf("Wrote %d trace events to %s\n", TraceWrite(TracePath), TracePath);
+
+  DenormalPrintStats(&JackData.OutputDenormals, "output");
+
+  if (JackData.AutoTuning)
+    AutoTunePrint(&JackData.AutoTune);
 
   return 0;
 }
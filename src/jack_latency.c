@@ -0,0 +1,177 @@
+/*
+ * This file measures the round trip latency of a JACK setup with latency.c and compares it
+ * with the latency JACK reports for our ports.
+ *
+ * Usage: jack_latency [runs] [loopback | <playback port> <capture port>]
+ *
+ * By default we play on the first physical playback port and record the first physical
+ * capture port, so connect those two with a cable. "loopback" connects our output straight
+ * to our input instead, which needs no hardware (e.g. jackd -d dummy in CI). Our input then
+ * holds what we wrote in the previous cycle, so the expected result is exactly one buffer.
+ *
+ * NOTE(robin): "Reported" is the maximum JackPlaybackLatency of our output port plus the
+ * maximum JackCaptureLatency of our input port, i.e. what a client would use for delay
+ * compensation. A measurement that is consistently different from it means the backend's
+ * -I/-O (extra input/output latency) settings need adjusting.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <jack/jack.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "fft.c"
+#include "latency.c"
+
+#define LATENCY_ORDER 14      // NOTE(robin): 16383 samples, a third of a second at 48kHz
+#define LATENCY_MAX_DELAY 16384
+
+typedef struct
+{
+  jack_port_t* OutputPort;
+  jack_port_t* InputPort;
+  latency_probe Probe;
+} jack_latency_data;
+
+int AudioCallback(uint32_t FrameCount, void* Context)
+{
+  jack_latency_data* Data = Context;
+
+  // NOTE(robin): JACK owns this thread, so only for the duration of the callback, see
+  // denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  float* Output = jack_port_get_buffer(Data->OutputPort, FrameCount);
+  float* Input = jack_port_get_buffer(Data->InputPort, FrameCount);
+
+  LatencyProbeProcess(&Data->Probe, Output, Input, FrameCount);
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+f64 GetReportedLatency(jack_latency_data* Data)
+{
+  jack_latency_range_t Playback;
+  jack_latency_range_t Capture;
+  jack_port_get_latency_range(Data->OutputPort, JackPlaybackLatency, &Playback);
+  jack_port_get_latency_range(Data->InputPort, JackCaptureLatency, &Capture);
+  return (f64)Playback.max + (f64)Capture.max;
+}
+
+int main(int argc, char** argv)
+{
+  u32 Runs = argc > 1 ? atoi(argv[1]) : 10;
+  u32 Loopback = argc > 2 && !strcmp(argv[2], "loopback");
+
+  static jack_latency_data Data;
+  static latency_analyser Analyser;
+  latency_stats Stats = {0};
+
+  u32 Initialised = LatencyProbeInit(&Data.Probe, LATENCY_ORDER, 0.25f, LATENCY_MAX_DELAY);
+  Initialised &= LatencyAnalyserInit(&Analyser, &Data.Probe);
+  assert(Initialised);
+
+  jack_status_t JackStatus;
+  jack_client_t* Client = jack_client_open("LatencyProbe", JackNullOption, &JackStatus, 0);
+  if (!Client)
+  {
+    printf("Could not connect to the JACK server, is it running?\n");
+    return 1;
+  }
+
+  jack_set_process_callback(Client, AudioCallback, &Data);
+
+  Data.OutputPort = jack_port_register(Client, "Output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  Data.InputPort = jack_port_register(Client, "Input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+
+  jack_activate(Client);
+
+  // NOTE(robin): JackPortIsInput refers to an input to the backend, see jack_example.c
+  const char* PlaybackPort = 0;
+  const char* CapturePort = 0;
+  const char** PlaybackPorts = 0;
+  const char** CapturePorts = 0;
+  if (Loopback)
+  {
+    PlaybackPort = jack_port_name(Data.InputPort);
+    CapturePort = jack_port_name(Data.OutputPort);
+  }
+  else if (argc > 3)
+  {
+    PlaybackPort = argv[2];
+    CapturePort = argv[3];
+  }
+  else
+  {
+    PlaybackPorts = jack_get_ports(Client, NULL, NULL, JackPortIsPhysical|JackPortIsInput);
+    CapturePorts = jack_get_ports(Client, NULL, NULL, JackPortIsPhysical|JackPortIsOutput);
+    if (!PlaybackPorts || !CapturePorts)
+    {
+      printf("No physical ports, try \"jack_latency %u loopback\"\n", Runs);
+      return 1;
+    }
+    PlaybackPort = PlaybackPorts[0];
+    CapturePort = CapturePorts[0];
+  }
+
+  // NOTE(robin): In loopback mode both of these are the same connection
+  int Error = jack_connect(Client, jack_port_name(Data.OutputPort), PlaybackPort);
+  if (!Error && !Loopback)
+    Error = jack_connect(Client, CapturePort, jack_port_name(Data.InputPort));
+
+  if (Error)
+  {
+    printf("Could not connect %s -> %s\n", PlaybackPort, CapturePort);
+    return 1;
+  }
+
+  f64 SampleRate = jack_get_sample_rate(Client);
+  printf("Playing on %s, recording %s\n", PlaybackPort, CapturePort);
+  printf("Sample rate: %.0f\n", SampleRate);
+  printf("Buffer size: %u\n\n", jack_get_buffer_size(Client));
+
+  jack_recompute_total_latencies(Client);
+
+  // NOTE(robin): A run takes CaptureLength frames, give up if the callback doesn't finish it
+  // in a couple of seconds more than that
+  u32 TimeoutMS = (u32)(1000.0 * Data.Probe.CaptureLength / SampleRate) + 2000;
+
+  for (u32 Run = 0; Run < Runs; Run++)
+  {
+    // NOTE(robin): The audio thread doesn't touch Reported, we set it before arming
+    Data.Probe.Reported = GetReportedLatency(&Data);
+    LatencyProbeArm(&Data.Probe);
+
+    u32 WaitedMS = 0;
+    while (!LatencyProbeDone(&Data.Probe) && WaitedMS < TimeoutMS)
+    {
+      usleep(10000);
+      WaitedMS += 10;
+    }
+
+    if (!LatencyProbeDone(&Data.Probe))
+    {
+      printf("Timed out waiting for the process callback\n");
+      break;
+    }
+
+    latency_result Result = LatencyAnalyse(&Analyser, Data.Probe.Capture, Data.Probe.CaptureLength);
+    Result.Reported = Data.Probe.Reported;
+    LatencyPrintResult(Run, Result, SampleRate);
+    LatencyStatsAdd(&Stats, Result);
+  }
+
+  jack_client_close(Client);
+  if (PlaybackPorts)
+    jack_free(PlaybackPorts);
+  if (CapturePorts)
+    jack_free(CapturePorts);
+
+  LatencyPrintStats(&Stats, SampleRate);
+  return Stats.Count ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is a test MIDI client for jack_synth.c: it plays notes into the synth's MIDI input
+ * at random frame offsets, records the synth's output and checks that every note starts
+ * exactly the same number of frames after its MIDI event.
+ *
+ * Usage: jack_midi_test [notes]
+ *
+ * Start jack_synth first. No hardware is needed, a dummy server works:
+ *
+ *   jackd -d dummy -p 128 &
+ *   build/jack_synth 30 &
+ *   build/jack_midi_test
+ *
+ * NOTE(robin): We write a note on at frame offset k of period c and look for the first
+ * non-zero sample the synth sends back. The synth renders the note from offset k of the period
+ * in which it receives it, and since our MIDI output and its audio output feed each other
+ * (a loop), JACK delays one of the two connections by a period. So the note should come back
+ * exactly one period after we sent it, whatever k is. Between notes we wait for the output to
+ * be exactly zero (the synth frees voices once they have faded out), so the start of the next
+ * note is unambiguous.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "types.h"
+
+#define MIDI_TEST_MAX_NOTES 64
+#define MIDI_TEST_SYNTH "SimpleNativeAudioSynth"
+
+typedef enum
+{
+  MIDITestWaiting,   // NOTE(robin): For the synth to go quiet
+  MIDITestListening, // NOTE(robin): Note on sent, looking for it in the input
+  MIDITestHolding,   // NOTE(robin): Note found, note off after a while
+  MIDITestFinished,
+} midi_test_state;
+
+typedef struct
+{
+  jack_client_t* Client;
+  jack_port_t* MIDIPort;
+  jack_port_t* InputPort;
+
+  u32 State;
+  u32 NoteCount;
+  u32 NotesSent;
+  u32 SilentFrames;
+  u32 Countdown;
+  u32 Random;
+  jack_nframes_t Sent;
+  s64 Latencies[MIDI_TEST_MAX_NOTES];
+  u32 Offsets[MIDI_TEST_MAX_NOTES];
+} midi_test_data;
+
+int AudioCallback(uint32_t FrameCount, void* Context)
+{
+  midi_test_data* Data = Context;
+  void* MIDI = jack_port_get_buffer(Data->MIDIPort, FrameCount);
+  float* Input = jack_port_get_buffer(Data->InputPort, FrameCount);
+  jack_midi_clear_buffer(MIDI);
+
+  // NOTE(robin): The frame time of the first frame of this period
+  jack_nframes_t Now = jack_last_frame_time(Data->Client);
+  u32 State = __atomic_load_n(&Data->State, __ATOMIC_ACQUIRE);
+
+  switch (State)
+  {
+    case MIDITestWaiting:
+    {
+      u32 Silent = 1;
+      for (u32 i = 0; i < FrameCount; i++)
+        Silent &= Input[i] == 0.0f;
+      Data->SilentFrames = Silent ? Data->SilentFrames + FrameCount : 0;
+
+      // NOTE(robin): A few silent periods so that we know the previous note is gone
+      if (Data->SilentFrames >= 4 * FrameCount)
+      {
+        if (Data->NotesSent == Data->NoteCount)
+        {
+          State = MIDITestFinished;
+          break;
+        }
+
+        Data->Random = Data->Random * 1664525u + 1013904223u;
+        u32 Offset = (Data->Random >> 8) % FrameCount;
+        jack_midi_data_t NoteOn[] = {0x90, 60 + (Data->NotesSent % 12), 100};
+        jack_midi_event_write(MIDI, Offset, NoteOn, 3);
+
+        Data->Sent = Now + Offset;
+        Data->Offsets[Data->NotesSent] = Offset;
+        Data->Countdown = jack_get_sample_rate(Data->Client); // NOTE(robin): Give up after 1s
+        State = MIDITestListening;
+      }
+    } break;
+
+    case MIDITestListening:
+    {
+      u32 Found = FrameCount;
+      for (u32 i = 0; i < FrameCount && Found == FrameCount; i++)
+        if (Input[i] != 0.0f)
+          Found = i;
+
+      if (Found < FrameCount)
+        Data->Latencies[Data->NotesSent] = (s64)(jack_nframes_t)(Now + Found - Data->Sent);
+      else if (Data->Countdown > FrameCount)
+        Data->Countdown -= FrameCount;
+      else
+        Data->Latencies[Data->NotesSent] = -1;
+
+      if (Found < FrameCount || Data->Countdown <= FrameCount)
+      {
+        Data->NotesSent++;
+        Data->Countdown = jack_get_sample_rate(Data->Client) / 10;
+        State = MIDITestHolding;
+      }
+    } break;
+
+    case MIDITestHolding:
+    {
+      if (Data->Countdown > FrameCount)
+      {
+        Data->Countdown -= FrameCount;
+        break;
+      }
+
+      jack_midi_data_t NoteOff[] = {0x80, 60 + ((Data->NotesSent - 1) % 12), 0};
+      jack_midi_event_write(MIDI, 0, NoteOff, 3);
+      Data->SilentFrames = 0;
+      State = MIDITestWaiting;
+    } break;
+  }
+
+  __atomic_store_n(&Data->State, State, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  static midi_test_data Data;
+  Data.NoteCount = argc > 1 ? atoi(argv[1]) : 8;
+  if (Data.NoteCount > MIDI_TEST_MAX_NOTES)
+    Data.NoteCount = MIDI_TEST_MAX_NOTES;
+  Data.Random = 12345;
+
+  jack_status_t JackStatus;
+  Data.Client = jack_client_open("MIDITest", JackNullOption, &JackStatus, 0);
+  if (!Data.Client)
+  {
+    printf("Could not connect to the JACK server, is it running?\n");
+    return 1;
+  }
+
+  jack_set_process_callback(Data.Client, AudioCallback, &Data);
+  Data.MIDIPort = jack_port_register(Data.Client, "MIDIOut", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+  Data.InputPort = jack_port_register(Data.Client, "Input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  jack_activate(Data.Client);
+
+  if (jack_connect(Data.Client, jack_port_name(Data.MIDIPort), MIDI_TEST_SYNTH ":MIDIIn") ||
+      jack_connect(Data.Client, MIDI_TEST_SYNTH ":Output1", jack_port_name(Data.InputPort)))
+  {
+    printf("Could not connect to %s, start jack_synth first\n", MIDI_TEST_SYNTH);
+    jack_client_close(Data.Client);
+    return 1;
+  }
+
+  jack_nframes_t BufferSize = jack_get_buffer_size(Data.Client);
+  printf("Buffer size: %u, sending %u notes\n\n", BufferSize, Data.NoteCount);
+
+  // NOTE(robin): Each note takes about a second and a half (mostly waiting for the release)
+  u32 TimeoutMS = 3000 * Data.NoteCount + 2000;
+  for (u32 WaitedMS = 0; WaitedMS < TimeoutMS; WaitedMS += 10)
+  {
+    if (__atomic_load_n(&Data.State, __ATOMIC_ACQUIRE) == MIDITestFinished)
+      break;
+    usleep(10000);
+  }
+  jack_client_close(Data.Client);
+
+  u32 Passed = 0, Arrived = 0;
+  s64 Min = 0, Max = 0;
+  for (u32 i = 0; i < Data.NotesSent; i++)
+  {
+    s64 Latency = Data.Latencies[i];
+    if (Latency < 0)
+    {
+      printf("note %2u: sent at offset %4u, never arrived\n", i, Data.Offsets[i]);
+      continue;
+    }
+
+    printf("note %2u: sent at offset %4u, arrived %lld frames later\n", i, Data.Offsets[i], (long long)Latency);
+    Min = (Arrived == 0 || Latency < Min) ? Latency : Min;
+    Max = (Arrived == 0 || Latency > Max) ? Latency : Max;
+    Arrived++;
+    Passed += Latency == (s64)BufferSize;
+  }
+
+  if (Arrived)
+    printf("\nlatency %lld to %lld frames, jitter %lld frames\n", (long long)Min, (long long)Max, (long long)(Max - Min));
+  printf("%u of %u notes exactly one period late\n", Passed, Data.NoteCount);
+  return Passed == Data.NoteCount ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+/*
+ * This file streams two channels of audio between JACK servers over the network with
+ * netaudio.c. Linux only.
+ *
+ * Usage: jack_netaudio send ADDRESS [PORT=5004]
+ *        jack_netaudio receive [PORT=5004]
+ *
+ * The sender has two inputs (connected to the first two physical capture ports if there are
+ * any) and streams them as L24 RTP, 1ms per packet. The receiver plays the stream to two
+ * outputs (connected to the first two physical playback ports), following the sender's
+ * clock. Both ends have to run at the same nominal sample rate. Both print their counters
+ * every second until you press enter.
+ *
+ * To try it on one machine, run two JACK servers (jackd -n net -d dummy for the sender) and
+ * send to 127.0.0.1.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <poll.h>
+#include <jack/jack.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "netaudio.c"
+
+#define DEFAULT_PORT 5004 // NOTE(robin): The usual RTP port
+
+typedef struct
+{
+  u32 Sending;
+  jack_port_t* Ports[2];
+  net_sender Sender;
+  net_receiver Receiver;
+} jack_net_data;
+
+int AudioCallback(uint32_t FrameCount, void* Context)
+{
+  jack_net_data* Data = Context;
+
+  if (Data->Sending)
+  {
+    const f32* Channels[2];
+    for (u32 i = 0; i < 2; i++)
+      Channels[i] = jack_port_get_buffer(Data->Ports[i], FrameCount);
+    NetSenderSend(&Data->Sender, Channels, FrameCount);
+  }
+  else
+  {
+    f32* Channels[2];
+    for (u32 i = 0; i < 2; i++)
+      Channels[i] = jack_port_get_buffer(Data->Ports[i], FrameCount);
+
+    // NOTE(robin): NetReceiverRead takes at most NET_MAX_READ frames at a time
+    for (u32 Done = 0; Done < FrameCount;)
+    {
+      u32 Count = FrameCount - Done < NET_MAX_READ ? FrameCount - Done : NET_MAX_READ;
+      f32* Chunk[2] = {Channels[0] + Done, Channels[1] + Done};
+      NetReceiverRead(&Data->Receiver, Chunk, Count);
+      Done += Count;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  u32 Sending = argc > 2 && !strcmp(argv[1], "send");
+  u32 Receiving = argc > 1 && !strcmp(argv[1], "receive");
+  if (!Sending && !Receiving)
+  {
+    printf("Usage: %s send ADDRESS [PORT]\n       %s receive [PORT]\n", argv[0], argv[0]);
+    return 1;
+  }
+  int PortArgument = Sending ? 3 : 2;
+  u16 Port = argc > PortArgument ? (u16)atoi(argv[PortArgument]) : DEFAULT_PORT;
+
+  jack_status_t JackStatus;
+  static jack_net_data Data;
+  jack_client_t* Client = jack_client_open(Sending ? "NetAudioSend" : "NetAudioReceive", JackNullOption, &JackStatus, 0);
+  if (!Client)
+  {
+    printf("Could not connect to the JACK server, is it running?\n");
+    return 1;
+  }
+
+  u32 SampleRate = jack_get_sample_rate(Client);
+  u32 FramesPerPacket = SampleRate / 1000;
+  Data.Sending = Sending;
+  u32 Initialised = Sending ?
+    NetSenderInit(&Data.Sender, argv[2], Port, 2, FramesPerPacket, NetFormatL24) :
+    NetReceiverInit(&Data.Receiver, Port, 2, FramesPerPacket, NetFormatL24, SampleRate);
+  if (!Initialised)
+  {
+    printf("Could not open the socket\n");
+    jack_client_close(Client);
+    return 1;
+  }
+
+  jack_set_process_callback(Client, AudioCallback, &Data);
+
+  u32 Flags = Sending ? JackPortIsInput : JackPortIsOutput;
+  Data.Ports[0] = jack_port_register(Client, Sending ? "Input1" : "Output1", JACK_DEFAULT_AUDIO_TYPE, Flags, 0);
+  Data.Ports[1] = jack_port_register(Client, Sending ? "Input2" : "Output2", JACK_DEFAULT_AUDIO_TYPE, Flags, 0);
+  assert(Data.Ports[0] && Data.Ports[1]);
+
+  jack_activate(Client);
+
+  // NOTE(robin): JackPortIsInput refers to an input to the backend, see jack_example.c
+  const char** Ports = jack_get_ports(Client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical|(Sending ? JackPortIsOutput : JackPortIsInput));
+  for (u32 i = 0; Ports && Ports[i] && i < 2; i++)
+  {
+    if (Sending)
+      jack_connect(Client, Ports[i], jack_port_name(Data.Ports[i]));
+    else
+      jack_connect(Client, jack_port_name(Data.Ports[i]), Ports[i]);
+  }
+  if (Ports)
+    jack_free(Ports);
+
+  printf("Sample rate: %u\n", SampleRate);
+  printf("Buffer size: %u\n", jack_get_buffer_size(Client));
+  printf("%s port %u, %u frames per packet\n", Sending ? "Sending to" : "Receiving on", Port, FramesPerPacket);
+  printf("Press enter to quit\n");
+
+  struct pollfd Input = {STDIN_FILENO, POLLIN, 0};
+  while (poll(&Input, 1, 1000) == 0)
+  {
+    if (Sending)
+      printf("sent %u, dropped %u\n", Data.Sender.Sent, Data.Sender.Dropped);
+    else
+      NetReceiverPrintStats(&Data.Receiver);
+  }
+
+  jack_client_close(Client);
+  if (Sending)
+    NetSenderFree(&Data.Sender);
+  else
+    NetReceiverFree(&Data.Receiver);
+  return 0;
+}
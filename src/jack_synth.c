@@ -0,0 +1,377 @@
+/*
+ * This file is a JACK MIDI synthesiser: a MIDI input port drives the voice engine in synth.c,
+ * and the result goes to two audio outputs.
+ *
+ * Usage: jack_synth [seconds] [journal file]
+ *        jack_synth replay <journal file> [times=1]
+ *        jack_synth show <journal file> [callback=0] [count=20]
+ *
+ * Without seconds (or with 0) it runs until you press enter. We connect the first physical
+ * MIDI input and the first two physical playback ports if there are any. jack_midi_test
+ * plays notes into it and checks the timing, which works with a dummy server too
+ * (jackd -d dummy). What comes in on the audio input is mixed into the output.
+ *
+ * With a journal file every callback is recorded into it (see journal.c): the MIDI events,
+ * the audio input, the frame count, and when it ran and for how long. replay runs the same
+ * processing on the journal offline, as fast as it can, checks that every callback gives
+ * exactly the same output as it did live and prints the slowest ones, so a glitch that
+ * happened once can be run again as often as needed, e.g. under perf:
+ *
+ *   perf record -g build/jack_synth replay session.journal 20
+ *
+ * show prints the callbacks from the given one on, going straight there with the index.
+ *
+ * NOTE(robin): JACK gives us the MIDI events of the period together with their frame offsets
+ * in the period, so we render the audio up to each event, apply it, and carry on (see
+ * synth.c). Every note then starts exactly as far into our output period as its event was
+ * into the input period: the latency is exactly one period plus the output latency, with no
+ * jitter. The obvious alternative, applying all events at the start of the period, would
+ * quantise every note to the period boundary, which is up to a period of jitter.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "synth.c"
+#include "journal.c"
+
+#define SYNTH_MAX_EVENTS 256 // NOTE(robin): Per callback, JACK's MIDI buffers don't hold many more
+#define SYNTH_MAX_FRAMES 8192
+
+typedef struct
+{
+  jack_port_t* MIDIPort;
+  jack_port_t* InputPort;
+  jack_port_t* OutputPorts[2];
+  synth Synth;
+  u32 EventCount;
+  u32 LostEvents;
+
+  u32 Journaling;
+  journal Journal;
+} jack_synth_data;
+
+// NOTE(robin): Everything the callback does apart from talking to JACK, so that replaying a
+// journal runs exactly the same code. Events are sorted by frame.
+void SynthProcess(jack_synth_data* Data, f32* Left, f32* Right, const f32* Input,
+    u32 FrameCount, const journal_event* Events, u32 EventCount)
+{
+  u32 Done = 0;
+  for (u32 i = 0; i < EventCount; i++)
+  {
+    u32 Frame = Events[i].Frame < FrameCount ? Events[i].Frame : FrameCount;
+    if (Frame > Done)
+    {
+      SynthRender(&Data->Synth, Left + Done, Frame - Done);
+      Done = Frame;
+    }
+    SynthMIDI(&Data->Synth, Events[i].Data, Events[i].Size);
+  }
+  SynthRender(&Data->Synth, Left + Done, FrameCount - Done);
+
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    Left[i] += Input[i];
+    Right[i] = Left[i];
+  }
+}
+
+int AudioCallback(uint32_t FrameCount, void* Context)
+{
+  jack_synth_data* Data = Context;
+  fp_state FPState = FPEnterAudioThread();
+
+  float* Left = jack_port_get_buffer(Data->OutputPorts[0], FrameCount);
+  float* Right = jack_port_get_buffer(Data->OutputPorts[1], FrameCount);
+  float* Input = jack_port_get_buffer(Data->InputPort, FrameCount);
+  void* MIDI = jack_port_get_buffer(Data->MIDIPort, FrameCount);
+
+  if (Data->Journaling)
+    JournalBegin(&Data->Journal, FrameCount, (const f32* const*)&Input);
+
+  // NOTE(robin): JACK sorts the events by time
+  journal_event Events[SYNTH_MAX_EVENTS];
+  u32 EventCount = 0;
+  u32 MIDIEventCount = jack_midi_get_event_count(MIDI);
+  for (u32 i = 0; i < MIDIEventCount && EventCount < SYNTH_MAX_EVENTS; i++)
+  {
+    jack_midi_event_t Event;
+    if (jack_midi_event_get(&Event, MIDI, i))
+      continue;
+
+    Events[EventCount] = (journal_event){Event.time, (u32)Event.size, Event.buffer};
+    if (Data->Journaling)
+      JournalEvent(&Data->Journal, Event.time, Event.buffer, (u32)Event.size);
+    EventCount++;
+  }
+
+  SynthProcess(Data, Left, Right, Input, FrameCount, Events, EventCount);
+
+  Data->EventCount += MIDIEventCount;
+  Data->LostEvents += jack_midi_get_lost_event_count(MIDI) + (MIDIEventCount - EventCount);
+
+  if (Data->Journaling)
+    JournalEnd(&Data->Journal, JournalHash(JournalHash(JOURNAL_HASH_SEED, Left, FrameCount), Right, FrameCount));
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+typedef struct
+{
+  u64 Callback;
+  u32 Recorded; // NOTE(robin): Nanoseconds
+  u32 Replayed;
+} slow_callback;
+
+// NOTE(robin): Runs the journal through SynthProcess Times times. Every callback has to give
+// the output it gave live; when one doesn't, all the ones after it are likely to differ too
+// (the synth carries on from a different state), so we report the first.
+int Replay(const char* Path, u32 Times)
+{
+  journal_reader Reader;
+  if (!JournalReaderOpen(&Reader, Path))
+  {
+    printf("Could not read the journal %s\n", Path);
+    return 1;
+  }
+
+  u32 SampleRate = Reader.Header.SampleRate;
+  printf("%s: %u Hz, %u input channels, %u blocks\n", Path, SampleRate, Reader.Header.InputChannels,
+      Reader.BlockCount);
+  if (Reader.Header.InputChannels != 1 || Reader.Header.MaxFrameCount > SYNTH_MAX_FRAMES)
+  {
+    printf("This journal wasn't recorded by jack_synth\n");
+    JournalReaderClose(&Reader);
+    return 1;
+  }
+
+  static jack_synth_data Data;
+  static f32 Left[SYNTH_MAX_FRAMES], Right[SYNTH_MAX_FRAMES];
+  static journal_event Events[SYNTH_MAX_EVENTS];
+  slow_callback Slowest[8] = {0};
+
+  // NOTE(robin): Same floating point settings as the callback had, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  u64 Callbacks = 0, Mismatches = 0, Gaps = 0, FirstMismatch = 0;
+  for (u32 Time = 0; Time < Times; Time++)
+  {
+    SynthInit(&Data.Synth, (f32)SampleRate);
+    JournalSeek(&Reader, 0);
+
+    journal_callback Callback;
+    u64 Expected = 0;
+    while (JournalRead(&Reader, &Callback))
+    {
+      if (Callback.Callback != Expected && !Time)
+      {
+        printf("Callbacks %llu to %llu are missing (dropped while recording), the replay can't be exact after this\n",
+            (unsigned long long)Expected, (unsigned long long)Callback.Callback - 1);
+        Gaps++;
+      }
+      Expected = Callback.Callback + 1;
+
+      u32 EventCount = 0;
+      journal_event Event;
+      while (JournalNextEvent(&Callback, &Event) && EventCount < SYNTH_MAX_EVENTS)
+        Events[EventCount++] = Event;
+
+      // NOTE(robin): Its events ran past the record, replaying it without them would only
+      // report a mismatch that isn't one
+      if (Reader.Damaged)
+        break;
+
+      u64 Start = Now();
+      SynthProcess(&Data, Left, Right, Callback.Inputs[0], Callback.FrameCount, Events, EventCount);
+      u32 Replayed = (u32)(Now() - Start);
+
+      u32 Hash = JournalHash(JournalHash(JOURNAL_HASH_SEED, Left, Callback.FrameCount), Right, Callback.FrameCount);
+      if (Hash != Callback.OutputHash && !Time)
+      {
+        if (!Mismatches)
+          FirstMismatch = Callback.Callback;
+        Mismatches++;
+      }
+      Callbacks++;
+
+      // NOTE(robin): The slowest live callbacks are picked the first time through, after
+      // that we keep the fastest replay of each
+      u32 Slot = 0;
+      for (u32 i = 1; i < 8; i++)
+      {
+        if (Time ? Slowest[i].Callback == Callback.Callback : Slowest[i].Recorded < Slowest[Slot].Recorded)
+          Slot = i;
+      }
+
+      if (!Time && Callback.Duration > Slowest[Slot].Recorded)
+        Slowest[Slot] = (slow_callback){Callback.Callback, Callback.Duration, Replayed};
+      else if (Time && Slowest[Slot].Callback == Callback.Callback && Replayed < Slowest[Slot].Replayed)
+        Slowest[Slot].Replayed = Replayed;
+    }
+  }
+
+  FPLeaveAudioThread(FPState);
+
+  if (Reader.Damaged)
+    printf("The journal is damaged, we could only replay up to callback %llu\n", (unsigned long long)Callbacks / Times);
+  JournalReaderClose(&Reader);
+
+  printf("Replayed %llu callbacks, %llu gaps\n", (unsigned long long)Callbacks, (unsigned long long)Gaps);
+  if (Mismatches)
+    printf("%llu callbacks gave a different output than live, the first was %llu\n",
+        (unsigned long long)Mismatches, (unsigned long long)FirstMismatch);
+  else
+    printf("Every callback gave exactly the same output as live\n");
+
+  printf("\nSlowest callbacks live:\n%12s %12s %12s\n", "callback", "live", "replay");
+  for (u32 i = 0; i < 8; i++)
+  {
+    u32 Next = i;
+    for (u32 j = i + 1; j < 8; j++)
+      if (Slowest[j].Recorded > Slowest[Next].Recorded)
+        Next = j;
+    slow_callback Swap = Slowest[i];
+    Slowest[i] = Slowest[Next];
+    Slowest[Next] = Swap;
+
+    if (Slowest[i].Recorded)
+      printf("%12llu %10.1fus %10.1fus\n", (unsigned long long)Slowest[i].Callback,
+          Slowest[i].Recorded / 1000.0, Slowest[i].Replayed / 1000.0);
+  }
+
+  return Mismatches || Gaps || Reader.Damaged;
+}
+
+int Show(const char* Path, u64 First, u32 Count)
+{
+  journal_reader Reader;
+  if (!JournalReaderOpen(&Reader, Path))
+  {
+    printf("Could not read the journal %s\n", Path);
+    return 1;
+  }
+
+  if (!JournalSeek(&Reader, First))
+  {
+    printf("The journal ends before callback %llu\n", (unsigned long long)First);
+    JournalReaderClose(&Reader);
+    return 1;
+  }
+
+  printf("%10s %12s %10s %7s %7s  %s\n", "callback", "time", "took", "frames", "events", "first event");
+  journal_callback Callback;
+  for (u32 i = 0; i < Count && JournalRead(&Reader, &Callback); i++)
+  {
+    printf("%10llu %10.3fms %8.1fus %7u %7u", (unsigned long long)Callback.Callback, Callback.Time / 1e6,
+        Callback.Duration / 1000.0, Callback.FrameCount, Callback.EventCount);
+
+    journal_event Event;
+    if (JournalNextEvent(&Callback, &Event))
+    {
+      printf("  at %u:", Event.Frame);
+      for (u32 j = 0; j < Event.Size && j < 3; j++)
+        printf(" %02x", Event.Data[j]);
+    }
+    printf("\n");
+  }
+
+  JournalReaderClose(&Reader);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc > 2 && !strcmp(argv[1], "replay"))
+    return Replay(argv[2], argc > 3 ? atoi(argv[3]) : 1);
+  if (argc > 2 && !strcmp(argv[1], "show"))
+    return Show(argv[2], argc > 3 ? strtoull(argv[3], 0, 10) : 0, argc > 4 ? atoi(argv[4]) : 20);
+
+  u32 Seconds = argc > 1 ? atoi(argv[1]) : 0;
+  const char* JournalPath = argc > 2 ? argv[2] : 0;
+
+  jack_status_t JackStatus;
+  static jack_synth_data Data;
+  jack_client_t* Client = jack_client_open("SimpleNativeAudioSynth", JackNullOption, &JackStatus, 0);
+  if (!Client)
+  {
+    printf("Could not connect to the JACK server, is it running?\n");
+    return 1;
+  }
+
+  SynthInit(&Data.Synth, (f32)jack_get_sample_rate(Client));
+  jack_set_process_callback(Client, AudioCallback, &Data);
+
+  // NOTE(robin): Before activating, so the first callback is in it
+  if (JournalPath)
+  {
+    Data.Journaling = JournalOpen(&Data.Journal, JournalPath, jack_get_sample_rate(Client), 1, SYNTH_MAX_FRAMES);
+    if (!Data.Journaling)
+      printf("Could not create the journal %s\n", JournalPath);
+  }
+
+  Data.MIDIPort = jack_port_register(Client, "MIDIIn", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+  Data.InputPort = jack_port_register(Client, "Input1", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+  Data.OutputPorts[0] = jack_port_register(Client, "Output1", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  Data.OutputPorts[1] = jack_port_register(Client, "Output2", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  assert(Data.MIDIPort && Data.InputPort && Data.OutputPorts[0] && Data.OutputPorts[1]);
+
+  jack_activate(Client);
+
+  // NOTE(robin): JackPortIsInput refers to an input to the backend, see jack_example.c
+  const char** Ports = jack_get_ports(Client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical|JackPortIsInput);
+  for (u32 i = 0; Ports && Ports[i] && i < 2; i++)
+    jack_connect(Client, jack_port_name(Data.OutputPorts[i]), Ports[i]);
+  if (Ports)
+    jack_free(Ports);
+
+  Ports = jack_get_ports(Client, NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsPhysical|JackPortIsOutput);
+  if (Ports && Ports[0])
+  {
+    jack_connect(Client, Ports[0], jack_port_name(Data.MIDIPort));
+    printf("Listening to %s\n", Ports[0]);
+  }
+  if (Ports)
+    jack_free(Ports);
+
+  printf("Sample rate: %u\n", jack_get_sample_rate(Client));
+  printf("Buffer size: %u\n", jack_get_buffer_size(Client));
+  printf("MIDI input: %s\n", jack_port_name(Data.MIDIPort));
+
+  if (Seconds)
+  {
+    sleep(Seconds);
+  }
+  else
+  {
+    printf("Press enter to quit\n");
+    getchar();
+  }
+
+  jack_client_close(Client);
+  printf("MIDI events: %u, lost: %u, voices stolen: %u\n", Data.EventCount, Data.LostEvents, Data.Synth.Steals);
+
+  if (Data.Journaling)
+  {
+    JournalClose(&Data.Journal);
+    printf("Journal: %llu callbacks, %u dropped, %u events lost, %.1f MB (%.1f MB before compression)\n",
+        (unsigned long long)Data.Journal.Callback, Data.Journal.Dropped, Data.Journal.LostEvents,
+        Data.Journal.Written / 1e6, Data.Journal.RawWritten / 1e6);
+  }
+  return 0;
+}
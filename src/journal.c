@@ -0,0 +1,853 @@
+/*
+ * This file records everything that goes into the audio callback (the input buffers, the
+ * frame count, the control events, when it was called and how long it took) into a journal
+ * file, and reads it back so the same processing can be run again offline with exactly the
+ * same input, e.g. to find out why one callback in a thousand takes too long.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined. On Windows you need to have
+ * included Windows.h.
+ *
+ *   journal Journal;
+ *   JournalOpen(&Journal, "session.journal", SampleRate, InputChannels, MaxFrameCount);
+ *   ...
+ *   // In the callback
+ *   JournalBegin(&Journal, FrameCount, Inputs);
+ *   JournalEvent(&Journal, Frame, Data, Size); // NOTE(robin): For each control event
+ *   ... process ...
+ *   JournalEnd(&Journal, JournalHash(JOURNAL_HASH_SEED, Output, FrameCount));
+ *   ...
+ *   JournalClose(&Journal);
+ *
+ *   // Offline
+ *   journal_reader Reader;
+ *   JournalReaderOpen(&Reader, "session.journal");
+ *   journal_callback Callback;
+ *   while (JournalRead(&Reader, &Callback))
+ *   {
+ *     journal_event Event;
+ *     while (JournalNextEvent(&Callback, &Event))
+ *       ...
+ *   }
+ *
+ * NOTE(robin): The callback builds its record in a buffer of its own and copies it into a
+ * ring when it's done, so recording is a couple of memcpys and no system calls; when the
+ * ring is full the record is dropped and counted. A thread takes the records out of the ring
+ * every JOURNAL_INTERVAL_MS and writes them to the file in blocks:
+ *
+ *   file header
+ *   block header, block (records), block header, block, ...
+ *   index (the first callback and file offset of every block), footer
+ *
+ * - Seeking: JournalSeek finds the block from the index and skips to the record in it. A
+ *   journal that wasn't closed (the program crashed, which is when you want it most) has no
+ *   index, so the reader builds one by walking the block headers. Blocks are written at
+ *   least once a second, so at most about a second is lost.
+ * - Compression: each block is compressed on its own as 32 bit words, each XORed with the
+ *   one before it and stored as only its non-zero low bytes, with a 4 bit count per word.
+ *   The inputs are stored one channel after another so that the word before a sample is the
+ *   sample before it. It's lossless, so replaying stays bit exact, and cheap enough for the
+ *   writing thread. Silence, which is most of what an unused input is, takes an eighth of
+ *   the space, a clean tone about 15% less, and a block that doesn't get any smaller
+ *   (noise) is stored as it is. Put the file on a compressed filesystem, or run it through
+ *   a general purpose compressor, if that's not enough.
+ *
+ * JournalHash hashes the output of the callback so that the replay can check that it gets
+ * exactly the same result for every callback. For that the processing has to only depend
+ * on what's in the journal (not on the time, or the load as with governor.c) and run with
+ * the same floating point settings (see denormal.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define JOURNAL_VERSION 1
+#define JOURNAL_MAX_CHANNELS 8
+#define JOURNAL_MAX_EVENT_BYTES 16384 // NOTE(robin): Of events per callback
+#define JOURNAL_RING_SIZE (1 << 22)   // NOTE(robin): Bytes, a power of two
+#define JOURNAL_BLOCK_SIZE (1 << 18)  // NOTE(robin): Bytes of records per block, before compression
+#define JOURNAL_INTERVAL_MS 10
+#define JOURNAL_HASH_SEED 2166136261u
+
+#define JOURNAL_BLOCK_MAGIC 0x4B4C424Au // NOTE(robin): "JBLK"
+#define JOURNAL_INDEX_MAGIC 0x5844494Au // NOTE(robin): "JIDX"
+
+#define JOURNAL_COMPRESSED 1 // NOTE(robin): Block flag, otherwise the block is stored as it is
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define JournalLoad(Pointer) (*(volatile u32*)(Pointer))
+#define JournalStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#else
+#define JournalLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_ACQUIRE)
+#define JournalStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELEASE)
+#endif
+
+typedef struct
+{
+  char Magic[8]; // NOTE(robin): "JOURNAL"
+  u32 Version;
+  u32 SampleRate;
+  u32 InputChannels;
+  u32 MaxFrameCount;
+  u32 Reserved[2];
+} journal_file_header;
+
+typedef struct
+{
+  u32 Magic;
+  u32 RawSize;    // NOTE(robin): Bytes of records
+  u32 StoredSize; // NOTE(robin): Bytes that follow in the file
+  u32 CallbackCount;
+  u32 Flags;
+  u32 Reserved;
+  u64 FirstCallback;
+  u64 FirstTime;
+} journal_block_header;
+
+typedef struct
+{
+  u64 FirstCallback;
+  u64 Offset;
+} journal_index_entry;
+
+typedef struct
+{
+  u32 Magic;
+  u32 BlockCount;
+  u64 IndexOffset;
+} journal_footer;
+
+// NOTE(robin): A record is this, then the inputs (InputChannels * FrameCount floats), then
+// the events, each a journal_event_header and its data padded to 4 bytes
+typedef struct
+{
+  u32 Size; // NOTE(robin): Bytes of the whole record, a multiple of 4
+  u32 FrameCount;
+  u64 Callback; // NOTE(robin): Counts from 0, so a gap shows where records were dropped
+  u64 Time;     // NOTE(robin): Nanoseconds since JournalOpen, at the start of the callback
+  u32 Duration; // NOTE(robin): Nanoseconds from JournalBegin to JournalEnd
+  u32 EventCount;
+  u32 EventBytes;
+  u32 OutputHash;
+} journal_record;
+
+typedef struct
+{
+  u32 Frame;
+  u32 Size;
+} journal_event_header;
+
+typedef struct
+{
+  u32 Frame;
+  u32 Size;
+  const u8* Data;
+} journal_event;
+
+typedef struct
+{
+  // NOTE(robin): Only touched by the callback
+  u8* Record;
+  u32 InputChannels;
+  u32 MaxFrameCount;
+  u64 Callback;
+  u64 Start;
+  u32 Oversized; // NOTE(robin): This callback has more than MaxFrameCount frames
+
+  // NOTE(robin): The callback writes, the journal thread reads
+  u8* Ring;
+  u32 Write;
+  u32 Read;
+  u32 Dropped;     // NOTE(robin): Records
+  u32 LostEvents;  // NOTE(robin): Events that didn't fit in a record
+
+  // NOTE(robin): Only touched by the journal thread
+  FILE* File;
+  u8* Block;
+  u8* Packed;
+  u32 BlockSize;
+  u32 BlockCallbacks;
+  u64 LastFlush;
+  journal_index_entry* Index;
+  u32 BlockCount;
+  u32 IndexCapacity;
+  u32 IndexLost;   // NOTE(robin): Out of memory, the file gets no index (see JournalFlushBlock)
+  u64 Written;     // NOTE(robin): Bytes, compressed
+  u64 RawWritten;  // NOTE(robin): Bytes, before compression
+
+  u64 OpenTime;
+  u32 Quit;
+#ifdef _WIN32
+  HANDLE Thread;
+  LARGE_INTEGER Frequency;
+#else
+  pthread_t Thread;
+#endif
+} journal;
+
+typedef struct
+{
+  FILE* File;
+  journal_file_header Header;
+  journal_index_entry* Index;
+  u32 BlockCount;
+
+  u8* Block;
+  u8* Packed;
+  u32 BlockCapacity;
+  u32 PackedCapacity;
+  u32 BlockSize;
+  u32 Position;
+  u32 NextBlock;
+  u32 Damaged; // NOTE(robin): A block didn't decode, JournalRead stops before it
+} journal_reader;
+
+typedef struct
+{
+  u64 Callback;
+  u64 Time;
+  u32 Duration;
+  u32 FrameCount;
+  u32 OutputHash;
+  u32 EventCount;
+  const f32* Inputs[JOURNAL_MAX_CHANNELS];
+
+  journal_reader* Reader;
+  const u8* NextEvent;
+  u32 EventsLeft;
+  u32 EventBytesLeft;
+} journal_callback;
+
+static u64 JournalNow(journal* Journal)
+{
+#ifdef _WIN32
+  LARGE_INTEGER Counter;
+  QueryPerformanceCounter(&Counter);
+  u64 Seconds = Counter.QuadPart / Journal->Frequency.QuadPart;
+  u64 Remainder = Counter.QuadPart % Journal->Frequency.QuadPart;
+  return Seconds * 1000000000ull + Remainder * 1000000000ull / Journal->Frequency.QuadPart;
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+static inline u32 JournalPad(u32 Size)
+{
+  return (Size + 3) & ~3u;
+}
+
+// NOTE(robin): FNV-1a over the bits of the samples, so that -0 and 0, or two NaNs, count as
+// different, which they are as far as bit exact goes
+u32 JournalHash(u32 Hash, const f32* Samples, u32 Count)
+{
+  for (u32 i = 0; i < Count; i++)
+  {
+    u32 Bits;
+    memcpy(&Bits, &Samples[i], sizeof(Bits));
+    Hash = (Hash ^ Bits) * 16777619u;
+  }
+  return Hash;
+}
+
+// NOTE(robin): Worst case is 4 bytes a word and a tag byte for every two
+static u32 JournalPackedBound(u32 Bytes)
+{
+  return Bytes + Bytes / 8 + 1;
+}
+
+static u32 JournalPack(const u8* Raw, u32 Size, u8* Packed)
+{
+  u8* Out = Packed;
+  u32 Previous = 0;
+  u32 Count = Size / 4;
+  for (u32 i = 0; i < Count; i += 2)
+  {
+    u8* Tag = Out++;
+    *Tag = 0;
+    for (u32 j = 0; j < 2 && i + j < Count; j++)
+    {
+      u32 Word;
+      memcpy(&Word, Raw + 4 * (i + j), 4);
+      u32 Delta = Word ^ Previous;
+      Previous = Word;
+
+      u32 Bytes = 0;
+      while (Bytes < 4 && (Delta >> (8 * Bytes)))
+        Bytes++;
+
+      *Tag |= (u8)(Bytes << (4 * j));
+      for (u32 b = 0; b < Bytes; b++)
+        *Out++ = (u8)(Delta >> (8 * b));
+    }
+  }
+  return (u32)(Out - Packed);
+}
+
+// NOTE(robin): Returns 0 if the packed data doesn't decode to exactly Size bytes
+static u32 JournalUnpack(const u8* Packed, u32 PackedSize, u8* Raw, u32 Size)
+{
+  const u8* In = Packed;
+  const u8* End = Packed + PackedSize;
+  u32 Previous = 0;
+  u32 Count = Size / 4;
+  for (u32 i = 0; i < Count; i += 2)
+  {
+    if (In >= End)
+      return 0;
+    u8 Tag = *In++;
+    for (u32 j = 0; j < 2 && i + j < Count; j++)
+    {
+      u32 Bytes = (Tag >> (4 * j)) & 15;
+      if (Bytes > 4 || In + Bytes > End)
+        return 0;
+
+      u32 Delta = 0;
+      for (u32 b = 0; b < Bytes; b++)
+        Delta |= (u32)*In++ << (8 * b);
+
+      Previous ^= Delta;
+      memcpy(Raw + 4 * (i + j), &Previous, 4);
+    }
+  }
+  return In == End ? Size : 0;
+}
+
+static u32 JournalMaxRecordSize(journal* Journal)
+{
+  return sizeof(journal_record) + Journal->InputChannels * Journal->MaxFrameCount * sizeof(f32) +
+      JOURNAL_MAX_EVENT_BYTES;
+}
+
+// NOTE(robin): Call at the start of the callback. Inputs are the input buffers, one per
+// channel, FrameCount samples each. A callback with more than MaxFrameCount frames doesn't
+// fit in a record, so it's dropped (and counted) like one that doesn't fit in the ring,
+// rather than recorded cut short, which would replay as something that never happened.
+void JournalBegin(journal* Journal, u32 FrameCount, const f32* const* Inputs)
+{
+  Journal->Start = JournalNow(Journal);
+  Journal->Oversized = FrameCount > Journal->MaxFrameCount;
+  if (Journal->Oversized)
+  {
+    Journal->Callback++;
+    return;
+  }
+
+  journal_record* Record = (journal_record*)Journal->Record;
+  Record->FrameCount = FrameCount;
+  Record->Callback = Journal->Callback++;
+  Record->Time = Journal->Start - Journal->OpenTime;
+  Record->EventCount = 0;
+  Record->EventBytes = 0;
+
+  f32* Samples = (f32*)(Record + 1);
+  for (u32 i = 0; i < Journal->InputChannels; i++)
+    memcpy(Samples + i * FrameCount, Inputs[i], FrameCount * sizeof(f32));
+}
+
+// NOTE(robin): Call for each control event the callback gets (MIDI, parameter changes...),
+// in the order it applies them. Frame is the offset in the period.
+void JournalEvent(journal* Journal, u32 Frame, const void* Data, u32 Size)
+{
+  if (Journal->Oversized)
+    return;
+
+  journal_record* Record = (journal_record*)Journal->Record;
+  u32 Bytes = sizeof(journal_event_header) + JournalPad(Size);
+  if (Record->EventBytes + Bytes > JOURNAL_MAX_EVENT_BYTES)
+  {
+    JournalStore(&Journal->LostEvents, Journal->LostEvents + 1);
+    return;
+  }
+
+  u8* Event = Journal->Record + sizeof(journal_record) +
+      Journal->InputChannels * Record->FrameCount * sizeof(f32) + Record->EventBytes;
+  journal_event_header Header = {Frame, Size};
+  memcpy(Event, &Header, sizeof(Header));
+  memcpy(Event + sizeof(Header), Data, Size);
+  memset(Event + sizeof(Header) + Size, 0, JournalPad(Size) - Size);
+
+  Record->EventCount++;
+  Record->EventBytes += Bytes;
+}
+
+// NOTE(robin): Call at the end of the callback with the hash of its output (or 0)
+void JournalEnd(journal* Journal, u32 OutputHash)
+{
+  if (Journal->Oversized)
+  {
+    JournalStore(&Journal->Dropped, Journal->Dropped + 1);
+    return;
+  }
+
+  journal_record* Record = (journal_record*)Journal->Record;
+  Record->Duration = (u32)(JournalNow(Journal) - Journal->Start);
+  Record->OutputHash = OutputHash;
+  Record->Size = sizeof(journal_record) +
+      Journal->InputChannels * Record->FrameCount * sizeof(f32) + Record->EventBytes;
+
+  // NOTE(robin): Only we write Write, and Read only ever grows, so there's at least this
+  // much space
+  u32 Write = Journal->Write;
+  u32 Free = JOURNAL_RING_SIZE - (Write - JournalLoad(&Journal->Read));
+  if (Record->Size > Free)
+  {
+    JournalStore(&Journal->Dropped, Journal->Dropped + 1);
+    return;
+  }
+
+  u32 Offset = Write & (JOURNAL_RING_SIZE - 1);
+  u32 First = JOURNAL_RING_SIZE - Offset < Record->Size ? JOURNAL_RING_SIZE - Offset : Record->Size;
+  memcpy(Journal->Ring + Offset, Journal->Record, First);
+  memcpy(Journal->Ring, Journal->Record + First, Record->Size - First);
+  JournalStore(&Journal->Write, Write + Record->Size);
+}
+
+static void JournalFlushBlock(journal* Journal)
+{
+  if (!Journal->BlockSize)
+    return;
+
+  journal_record* First = (journal_record*)Journal->Block;
+  journal_block_header Header = {0};
+  Header.Magic = JOURNAL_BLOCK_MAGIC;
+  Header.RawSize = Journal->BlockSize;
+  Header.CallbackCount = Journal->BlockCallbacks;
+  Header.FirstCallback = First->Callback;
+  Header.FirstTime = First->Time;
+  Header.StoredSize = JournalPack(Journal->Block, Journal->BlockSize, Journal->Packed);
+  Header.Flags = JOURNAL_COMPRESSED;
+
+  const u8* Stored = Journal->Packed;
+  if (Header.StoredSize >= Header.RawSize)
+  {
+    Header.StoredSize = Header.RawSize;
+    Header.Flags = 0;
+    Stored = Journal->Block;
+  }
+
+  // NOTE(robin): Without the memory for the index we stop keeping it and close the file
+  // without one, like after a crash. The reader walks the blocks instead, so nothing is lost.
+  if (!Journal->IndexLost && Journal->BlockCount == Journal->IndexCapacity)
+  {
+    u32 Capacity = Journal->IndexCapacity ? 2 * Journal->IndexCapacity : 256;
+    journal_index_entry* Index = realloc(Journal->Index, Capacity * sizeof(journal_index_entry));
+    if (Index)
+    {
+      Journal->Index = Index;
+      Journal->IndexCapacity = Capacity;
+    }
+    else
+    {
+      free(Journal->Index);
+      Journal->Index = 0;
+      Journal->IndexLost = 1;
+    }
+  }
+  if (!Journal->IndexLost)
+  {
+    Journal->Index[Journal->BlockCount].FirstCallback = Header.FirstCallback;
+    Journal->Index[Journal->BlockCount].Offset = (u64)ftell(Journal->File);
+  }
+  Journal->BlockCount++;
+
+  fwrite(&Header, sizeof(Header), 1, Journal->File);
+  fwrite(Stored, 1, Header.StoredSize, Journal->File);
+  fflush(Journal->File);
+
+  Journal->Written += sizeof(Header) + Header.StoredSize;
+  Journal->RawWritten += Header.RawSize;
+  Journal->BlockSize = 0;
+  Journal->BlockCallbacks = 0;
+  Journal->LastFlush = JournalNow(Journal);
+}
+
+// NOTE(robin): Moves the records from the ring into the block, writing the block out when
+// it's full or hasn't been for a second
+static void JournalDrain(journal* Journal)
+{
+  u32 Read = Journal->Read;
+  u32 Write = JournalLoad(&Journal->Write);
+  while (Read != Write)
+  {
+    u32 Offset = Read & (JOURNAL_RING_SIZE - 1);
+    u32 Size;
+    memcpy(&Size, Journal->Ring + Offset, sizeof(Size));
+
+    if (Journal->BlockSize + Size > JOURNAL_BLOCK_SIZE)
+      JournalFlushBlock(Journal);
+
+    u32 First = JOURNAL_RING_SIZE - Offset < Size ? JOURNAL_RING_SIZE - Offset : Size;
+    memcpy(Journal->Block + Journal->BlockSize, Journal->Ring + Offset, First);
+    memcpy(Journal->Block + Journal->BlockSize + First, Journal->Ring, Size - First);
+    Journal->BlockSize += Size;
+    Journal->BlockCallbacks++;
+
+    Read += Size;
+    JournalStore(&Journal->Read, Read);
+  }
+
+  if (JournalNow(Journal) - Journal->LastFlush > 1000000000ull)
+    JournalFlushBlock(Journal);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI JournalThread(void* Context)
+#else
+static void* JournalThread(void* Context)
+#endif
+{
+  journal* Journal = Context;
+  while (!JournalLoad(&Journal->Quit))
+  {
+    JournalDrain(Journal);
+#ifdef _WIN32
+    Sleep(JOURNAL_INTERVAL_MS);
+#else
+    usleep(JOURNAL_INTERVAL_MS * 1000);
+#endif
+  }
+
+  JournalDrain(Journal);
+  JournalFlushBlock(Journal);
+  return 0;
+}
+
+// NOTE(robin): Undoes a JournalOpen that got part of the way, file included
+static s32 JournalFail(journal* Journal, const char* Path)
+{
+  fclose(Journal->File);
+  remove(Path);
+  free(Journal->Record);
+  free(Journal->Ring);
+  free(Journal->Block);
+  free(Journal->Packed);
+  *Journal = (journal){0};
+  return 0;
+}
+
+// NOTE(robin): Creates the file and starts the thread that writes it. MaxFrameCount is the
+// largest FrameCount JournalBegin will see, callbacks with more are dropped. Returns 0 if the
+// file can't be created, we're out of memory or the thread doesn't start.
+s32 JournalOpen(journal* Journal, const char* Path, u32 SampleRate, u32 InputChannels, u32 MaxFrameCount)
+{
+  *Journal = (journal){0};
+#ifdef _WIN32
+  QueryPerformanceFrequency(&Journal->Frequency);
+#endif
+
+  Journal->File = fopen(Path, "wb");
+  if (!Journal->File)
+    return 0;
+
+  Journal->InputChannels = InputChannels < JOURNAL_MAX_CHANNELS ? InputChannels : JOURNAL_MAX_CHANNELS;
+  Journal->MaxFrameCount = MaxFrameCount;
+
+  // NOTE(robin): The block can go over JOURNAL_BLOCK_SIZE by a record when a single record is
+  // bigger than that
+  u32 MaxRecord = JournalMaxRecordSize(Journal);
+  u32 BlockCapacity = JOURNAL_BLOCK_SIZE > MaxRecord ? JOURNAL_BLOCK_SIZE : MaxRecord;
+  Journal->Record = calloc(1, MaxRecord);
+  Journal->Ring = calloc(1, JOURNAL_RING_SIZE);
+  Journal->Block = malloc(BlockCapacity);
+  Journal->Packed = malloc(JournalPackedBound(BlockCapacity));
+  if (!Journal->Record || !Journal->Ring || !Journal->Block || !Journal->Packed)
+    return JournalFail(Journal, Path);
+
+  journal_file_header Header = {"JOURNAL", JOURNAL_VERSION, SampleRate, Journal->InputChannels,
+      MaxFrameCount, {0}};
+  fwrite(&Header, sizeof(Header), 1, Journal->File);
+
+  Journal->OpenTime = JournalNow(Journal);
+  Journal->LastFlush = Journal->OpenTime;
+
+#ifdef _WIN32
+  Journal->Thread = CreateThread(0, 0, JournalThread, Journal, 0, 0);
+  if (!Journal->Thread)
+    return JournalFail(Journal, Path);
+#else
+  if (pthread_create(&Journal->Thread, 0, JournalThread, Journal))
+    return JournalFail(Journal, Path);
+#endif
+  return 1;
+}
+
+// NOTE(robin): Call after the callback has stopped. Writes out what's left and the index.
+void JournalClose(journal* Journal)
+{
+  if (!Journal->File)
+    return;
+
+  JournalStore(&Journal->Quit, 1);
+#ifdef _WIN32
+  WaitForSingleObject(Journal->Thread, INFINITE);
+  CloseHandle(Journal->Thread);
+#else
+  pthread_join(Journal->Thread, 0);
+#endif
+
+  if (!Journal->IndexLost)
+  {
+    journal_footer Footer = {JOURNAL_INDEX_MAGIC, Journal->BlockCount, (u64)ftell(Journal->File)};
+    fwrite(Journal->Index, sizeof(journal_index_entry), Journal->BlockCount, Journal->File);
+    fwrite(&Footer, sizeof(Footer), 1, Journal->File);
+  }
+  fclose(Journal->File);
+  Journal->File = 0;
+
+  free(Journal->Record);
+  free(Journal->Ring);
+  free(Journal->Block);
+  free(Journal->Packed);
+  free(Journal->Index);
+}
+
+static void JournalReaderAddBlock(journal_reader* Reader, u32* Capacity, u64 FirstCallback, u64 Offset)
+{
+  if (Reader->BlockCount == *Capacity)
+  {
+    *Capacity = *Capacity ? 2 * *Capacity : 256;
+    Reader->Index = realloc(Reader->Index, *Capacity * sizeof(journal_index_entry));
+  }
+  Reader->Index[Reader->BlockCount].FirstCallback = FirstCallback;
+  Reader->Index[Reader->BlockCount].Offset = Offset;
+  Reader->BlockCount++;
+}
+
+// NOTE(robin): Returns 0 if the file isn't a journal we can read
+s32 JournalReaderOpen(journal_reader* Reader, const char* Path)
+{
+  *Reader = (journal_reader){0};
+  Reader->File = fopen(Path, "rb");
+  if (!Reader->File)
+    return 0;
+
+  if (fread(&Reader->Header, sizeof(Reader->Header), 1, Reader->File) != 1 ||
+      memcmp(Reader->Header.Magic, "JOURNAL", 8) || Reader->Header.Version != JOURNAL_VERSION ||
+      Reader->Header.InputChannels > JOURNAL_MAX_CHANNELS)
+  {
+    fclose(Reader->File);
+    return 0;
+  }
+
+  // NOTE(robin): The index is at the end if the journal was closed properly
+  journal_footer Footer = {0};
+  fseek(Reader->File, -(long)sizeof(Footer), SEEK_END);
+  u64 FooterOffset = (u64)ftell(Reader->File);
+  if (fread(&Footer, sizeof(Footer), 1, Reader->File) == 1 && Footer.Magic == JOURNAL_INDEX_MAGIC &&
+      Footer.IndexOffset + (u64)Footer.BlockCount * sizeof(journal_index_entry) == FooterOffset)
+  {
+    Reader->BlockCount = Footer.BlockCount;
+    Reader->Index = malloc((Footer.BlockCount ? Footer.BlockCount : 1) * sizeof(journal_index_entry));
+    fseek(Reader->File, (long)Footer.IndexOffset, SEEK_SET);
+    if (fread(Reader->Index, sizeof(journal_index_entry), Footer.BlockCount, Reader->File) == Footer.BlockCount)
+      return 1;
+    Reader->BlockCount = 0;
+  }
+
+  // NOTE(robin): Otherwise we walk the blocks, up to the first one that was cut off
+  u32 Capacity = 0;
+  u64 Offset = sizeof(journal_file_header);
+  for (;;)
+  {
+    journal_block_header Header;
+    fseek(Reader->File, (long)Offset, SEEK_SET);
+    if (fread(&Header, sizeof(Header), 1, Reader->File) != 1 || Header.Magic != JOURNAL_BLOCK_MAGIC)
+      break;
+
+    u64 End = Offset + sizeof(Header) + Header.StoredSize;
+    fseek(Reader->File, 0, SEEK_END);
+    if (End > (u64)ftell(Reader->File))
+      break;
+
+    JournalReaderAddBlock(Reader, &Capacity, Header.FirstCallback, Offset);
+    Offset = End;
+  }
+  return 1;
+}
+
+void JournalReaderClose(journal_reader* Reader)
+{
+  fclose(Reader->File);
+  free(Reader->Index);
+  free(Reader->Block);
+  free(Reader->Packed);
+}
+
+static s32 JournalLoadBlock(journal_reader* Reader, u32 Block)
+{
+  journal_block_header Header;
+  fseek(Reader->File, (long)Reader->Index[Block].Offset, SEEK_SET);
+  if (fread(&Header, sizeof(Header), 1, Reader->File) != 1 || Header.Magic != JOURNAL_BLOCK_MAGIC)
+  {
+    Reader->Damaged = 1;
+    return 0;
+  }
+
+  if (Header.RawSize > Reader->BlockCapacity)
+  {
+    Reader->BlockCapacity = Header.RawSize;
+    Reader->Block = realloc(Reader->Block, Reader->BlockCapacity);
+  }
+  if (Header.StoredSize > Reader->PackedCapacity)
+  {
+    Reader->PackedCapacity = Header.StoredSize;
+    Reader->Packed = realloc(Reader->Packed, Reader->PackedCapacity);
+  }
+
+  s32 Decoded;
+  if (Header.Flags & JOURNAL_COMPRESSED)
+    Decoded = fread(Reader->Packed, 1, Header.StoredSize, Reader->File) == Header.StoredSize &&
+        JournalUnpack(Reader->Packed, Header.StoredSize, Reader->Block, Header.RawSize) == Header.RawSize;
+  else
+    Decoded = Header.StoredSize == Header.RawSize &&
+        fread(Reader->Block, 1, Header.RawSize, Reader->File) == Header.RawSize;
+
+  if (!Decoded)
+  {
+    Reader->Damaged = 1;
+    return 0;
+  }
+
+  Reader->BlockSize = Header.RawSize;
+  Reader->Position = 0;
+  Reader->NextBlock = Block + 1;
+  return 1;
+}
+
+// NOTE(robin): Returns 1 and fills in Callback with the next callback in the journal, or 0 at
+// the end. The pointers in Callback are good until the next call.
+s32 JournalRead(journal_reader* Reader, journal_callback* Callback)
+{
+  while (Reader->Position >= Reader->BlockSize)
+  {
+    if (Reader->NextBlock >= Reader->BlockCount || !JournalLoadBlock(Reader, Reader->NextBlock))
+      return 0;
+  }
+
+  if (Reader->BlockSize - Reader->Position < sizeof(journal_record))
+  {
+    Reader->Damaged = 1;
+    return 0;
+  }
+
+  journal_record Record;
+  memcpy(&Record, Reader->Block + Reader->Position, sizeof(Record));
+
+  // NOTE(robin): In 64 bits, so a damaged FrameCount can't wrap around and pass. The replay
+  // sizes its buffers from MaxFrameCount, so a record with more frames is damaged too.
+  u64 InputBytes = (u64)Reader->Header.InputChannels * Record.FrameCount * sizeof(f32);
+  if (Record.FrameCount > Reader->Header.MaxFrameCount ||
+      Record.Size < sizeof(Record) + InputBytes + Record.EventBytes ||
+      Record.Size > Reader->BlockSize - Reader->Position)
+  {
+    Reader->Damaged = 1;
+    return 0;
+  }
+
+  const u8* Data = Reader->Block + Reader->Position;
+  Callback->Callback = Record.Callback;
+  Callback->Time = Record.Time;
+  Callback->Duration = Record.Duration;
+  Callback->FrameCount = Record.FrameCount;
+  Callback->OutputHash = Record.OutputHash;
+  Callback->EventCount = Record.EventCount;
+  for (u32 i = 0; i < Reader->Header.InputChannels; i++)
+    Callback->Inputs[i] = (const f32*)(Data + sizeof(Record)) + i * Record.FrameCount;
+  Callback->Reader = Reader;
+  Callback->NextEvent = Data + sizeof(Record) + InputBytes;
+  Callback->EventsLeft = Record.EventCount;
+  Callback->EventBytesLeft = Record.EventBytes;
+
+  Reader->Position += Record.Size;
+  return 1;
+}
+
+// NOTE(robin): Returns 1 and fills in Event with the next event of the callback, or 0 when
+// there are no more. An event that doesn't fit in the record's EventBytes marks the reader
+// damaged and ends the events, so the events read up to it are still good.
+s32 JournalNextEvent(journal_callback* Callback, journal_event* Event)
+{
+  if (!Callback->EventsLeft)
+    return 0;
+
+  journal_event_header Header;
+  if (Callback->EventBytesLeft < sizeof(Header))
+  {
+    Callback->Reader->Damaged = 1;
+    Callback->EventsLeft = 0;
+    return 0;
+  }
+  memcpy(&Header, Callback->NextEvent, sizeof(Header));
+
+  // NOTE(robin): In 64 bits, so a damaged Size can't pad around to 0
+  u64 Bytes = sizeof(Header) + (((u64)Header.Size + 3) & ~3ull);
+  if (Bytes > Callback->EventBytesLeft)
+  {
+    Callback->Reader->Damaged = 1;
+    Callback->EventsLeft = 0;
+    return 0;
+  }
+
+  Event->Frame = Header.Frame;
+  Event->Size = Header.Size;
+  Event->Data = Callback->NextEvent + sizeof(Header);
+
+  Callback->NextEvent += Bytes;
+  Callback->EventBytesLeft -= (u32)Bytes;
+  Callback->EventsLeft--;
+  return 1;
+}
+
+// NOTE(robin): Makes the next JournalRead return the callback numbered Callback (or the
+// first one after it, if it was dropped). Returns 0 if it's past the end.
+s32 JournalSeek(journal_reader* Reader, u64 Callback)
+{
+  u32 Low = 0, High = Reader->BlockCount;
+  while (High - Low > 1)
+  {
+    u32 Middle = (Low + High) / 2;
+    if (Reader->Index[Middle].FirstCallback <= Callback)
+      Low = Middle;
+    else
+      High = Middle;
+  }
+
+  if (!Reader->BlockCount || !JournalLoadBlock(Reader, Low))
+    return 0;
+
+  for (;;)
+  {
+    if (Reader->Position >= Reader->BlockSize)
+    {
+      if (Reader->NextBlock >= Reader->BlockCount || !JournalLoadBlock(Reader, Reader->NextBlock))
+        return 0;
+    }
+
+    journal_record Record;
+    if (Reader->BlockSize - Reader->Position < sizeof(Record))
+    {
+      Reader->Damaged = 1;
+      return 0;
+    }
+    memcpy(&Record, Reader->Block + Reader->Position, sizeof(Record));
+    if (Record.Callback >= Callback)
+      return 1;
+    if (!Record.Size || Record.Size > Reader->BlockSize - Reader->Position)
+    {
+      Reader->Damaged = 1;
+      return 0;
+    }
+    Reader->Position += Record.Size;
+  }
+}
@@ -0,0 +1,363 @@
+/*
+ * This file tests and benchmarks journal.c.
+ *
+ * - Round trip: a session of callbacks with silent, tonal and noisy inputs and random events
+ *   is recorded and read back. Every input sample, event and hash must come back bit for bit.
+ * - Seeking: JournalSeek to random callbacks must land exactly on them, both with the index
+ *   and on a copy of the journal cut off in the middle, as if the program had crashed.
+ * - Lost index: a journal that ran out of memory for its index is closed without one, and
+ *   must still read back and seek the same way.
+ * - Damage: a record with more frames than the header allows, or an event that runs past
+ *   the record's event bytes, must mark the reader damaged instead of being read.
+ * - Cost: the time JournalBegin, two events and JournalEnd take on the calling thread, and
+ *   how fast and how well the blocks compress.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "bench.c"
+#include "journal.c"
+
+#define BENCH_CALLBACKS 20000
+#define BENCH_FRAMES 128
+#define BENCH_CHANNELS 2
+
+static u32 Random = 12345;
+
+static u32 NextRandom(void)
+{
+  Random = Random * 1664525u + 1013904223u;
+  return Random >> 8;
+}
+
+// NOTE(robin): Silence, a tone and noise, a few hundred callbacks of each in turn
+static void MakeInput(u32 Callback, f32* Input, u32 Channel)
+{
+  u32 Kind = (Callback / 300) % 3;
+  for (u32 i = 0; i < BENCH_FRAMES; i++)
+  {
+    f32 Time = (f32)(Callback * BENCH_FRAMES + i);
+    Input[i] = Kind == 0 ? 0.0f :
+        Kind == 1 ? 0.5f * sinf(Time * 0.02f * (Channel + 1)) :
+        (f32)(NextRandom() & 0xFFFF) / 32768.0f - 1.0f;
+  }
+}
+
+static void MakeEvents(u32 Callback, u8 Events[4][8], u32* Sizes, u32* Frames, u32* Count)
+{
+  *Count = Callback % 5 == 0 ? 1 + Callback % 4 : 0;
+  for (u32 i = 0; i < *Count; i++)
+  {
+    Sizes[i] = 1 + (Callback + i) % 7;
+    Frames[i] = (Callback * 31 + i * 17) % BENCH_FRAMES;
+    for (u32 j = 0; j < Sizes[i]; j++)
+      Events[i][j] = (u8)(Callback + i * 8 + j);
+  }
+}
+
+// NOTE(robin): LoseIndex acts as if the index couldn't grow from the first block on. The
+// journal thread only looks at it once the callback has handed it a record.
+static void Record(const char* Path, u32 LoseIndex)
+{
+  journal Journal;
+  s32 Opened = JournalOpen(&Journal, Path, 48000, BENCH_CHANNELS, BENCH_FRAMES);
+  assert(Opened);
+  Journal.IndexLost = LoseIndex;
+  Random = 12345; // NOTE(robin): The same session every time, VerifyRoundTrip starts here too
+
+  f32 Inputs[BENCH_CHANNELS][BENCH_FRAMES];
+  const f32* InputPointers[BENCH_CHANNELS] = {Inputs[0], Inputs[1]};
+  for (u32 Callback = 0; Callback < BENCH_CALLBACKS; Callback++)
+  {
+    for (u32 i = 0; i < BENCH_CHANNELS; i++)
+      MakeInput(Callback, Inputs[i], i);
+
+    u8 Events[4][8];
+    u32 Sizes[4], Frames[4], Count;
+    MakeEvents(Callback, Events, Sizes, Frames, &Count);
+
+    JournalBegin(&Journal, BENCH_FRAMES, InputPointers);
+    for (u32 i = 0; i < Count; i++)
+      JournalEvent(&Journal, Frames[i], Events[i], Sizes[i]);
+    JournalEnd(&Journal, JournalHash(JOURNAL_HASH_SEED, Inputs[0], BENCH_FRAMES));
+
+    // NOTE(robin): A bit faster than real time, but slow enough for nothing to be dropped
+    if (Callback % 256 == 255)
+      usleep(1000);
+  }
+
+  JournalClose(&Journal);
+  printf("Recorded %u callbacks, %u dropped, %.2f MB, %.2f MB before compression\n",
+      BENCH_CALLBACKS, Journal.Dropped, Journal.Written / 1e6, Journal.RawWritten / 1e6);
+  assert(!Journal.Dropped && !Journal.LostEvents);
+}
+
+static void CheckCallback(journal_callback* Callback)
+{
+  // NOTE(robin): The inputs come from a generator with state, so we make them again in
+  // the same order, which VerifyRoundTrip does by reading every callback in turn
+  u32 Index = (u32)Callback->Callback;
+  assert(Callback->FrameCount == BENCH_FRAMES);
+  for (u32 i = 0; i < BENCH_CHANNELS; i++)
+  {
+    f32 Expected[BENCH_FRAMES];
+    MakeInput(Index, Expected, i);
+    assert(!memcmp(Expected, Callback->Inputs[i], sizeof(Expected)));
+  }
+  assert(Callback->OutputHash == JournalHash(JOURNAL_HASH_SEED, Callback->Inputs[0], BENCH_FRAMES));
+
+  u8 Events[4][8];
+  u32 Sizes[4], Frames[4], Count;
+  MakeEvents(Index, Events, Sizes, Frames, &Count);
+  assert(Callback->EventCount == Count);
+
+  journal_event Event;
+  for (u32 i = 0; i < Count; i++)
+  {
+    s32 Read = JournalNextEvent(Callback, &Event);
+    assert(Read && Event.Frame == Frames[i] && Event.Size == Sizes[i]);
+    assert(!memcmp(Event.Data, Events[i], Sizes[i]));
+  }
+  assert(!JournalNextEvent(Callback, &Event));
+}
+
+static void VerifyRoundTrip(const char* Path)
+{
+  journal_reader Reader;
+  s32 Opened = JournalReaderOpen(&Reader, Path);
+  assert(Opened);
+
+  Random = 12345;
+  journal_callback Callback;
+  u32 Count = 0;
+  while (JournalRead(&Reader, &Callback))
+  {
+    assert(Callback.Callback == Count);
+    CheckCallback(&Callback);
+    Count++;
+  }
+  assert(Count == BENCH_CALLBACKS && !Reader.Damaged);
+  printf("Round trip: %u callbacks in %u blocks, every sample and event the same\n", Count, Reader.BlockCount);
+  JournalReaderClose(&Reader);
+}
+
+// NOTE(robin): Only the order and the events are checked here, the noise inputs depend on
+// everything generated before them
+static void VerifySeeks(const char* Path, u32 Callbacks)
+{
+  journal_reader Reader;
+  s32 Opened = JournalReaderOpen(&Reader, Path);
+  assert(Opened);
+
+  u32 Seeks = 0;
+  for (u32 i = 0; i < 200; i++)
+  {
+    u32 Target = NextRandom() % (Callbacks + 50);
+    s32 Found = JournalSeek(&Reader, Target);
+    assert(Found == (Target < Callbacks));
+    if (!Found)
+      continue;
+
+    journal_callback Callback;
+    for (u32 j = 0; j < 3 && Target + j < Callbacks; j++)
+    {
+      s32 Read = JournalRead(&Reader, &Callback);
+      assert(Read && Callback.Callback == Target + j);
+
+      u8 Events[4][8];
+      u32 Sizes[4], Frames[4], Count;
+      MakeEvents(Target + j, Events, Sizes, Frames, &Count);
+      assert(Callback.EventCount == Count);
+    }
+    Seeks++;
+  }
+  JournalReaderClose(&Reader);
+  printf("Seeking: %u seeks in %s landed on the right callback\n", Seeks, Path);
+}
+
+static u32 VerifyCutOff(const char* Path, const char* CutPath)
+{
+  FILE* File = fopen(Path, "rb");
+  fseek(File, 0, SEEK_END);
+  long Size = ftell(File);
+  fseek(File, 0, SEEK_SET);
+  u8* Data = malloc(Size);
+  size_t Read = fread(Data, 1, Size, File);
+  assert(Read == (size_t)Size);
+  fclose(File);
+
+  // NOTE(robin): Half way through, i.e. in the middle of a block and without the index
+  File = fopen(CutPath, "wb");
+  fwrite(Data, 1, Size / 2, File);
+  fclose(File);
+  free(Data);
+
+  journal_reader Reader;
+  s32 Opened = JournalReaderOpen(&Reader, CutPath);
+  assert(Opened);
+  u32 Count = 0;
+  journal_callback Callback;
+  while (JournalRead(&Reader, &Callback))
+    assert(Callback.Callback == Count++);
+  JournalReaderClose(&Reader);
+
+  printf("Cut off: half the file gives the first %u callbacks\n", Count);
+  assert(Count > 0 && Count < BENCH_CALLBACKS);
+  return Count;
+}
+
+// NOTE(robin): A journal with a single record in an uncompressed block, with the record's
+// FrameCount and its one event's Size set to whatever we want to test
+static void WriteSingleRecord(const char* Path, u32 FrameCount, u32 EventSize)
+{
+  u8 Block[sizeof(journal_record) + BENCH_FRAMES * sizeof(f32) + sizeof(journal_event_header) + 8] = {0};
+  journal_record* Record = (journal_record*)Block;
+  Record->Size = sizeof(Block);
+  Record->FrameCount = FrameCount;
+  Record->EventCount = 1;
+  Record->EventBytes = sizeof(journal_event_header) + 8;
+
+  journal_event_header Event = {0, EventSize};
+  memcpy(Block + sizeof(journal_record) + BENCH_FRAMES * sizeof(f32), &Event, sizeof(Event));
+
+  journal_file_header Header = {"JOURNAL", JOURNAL_VERSION, 48000, 1, BENCH_FRAMES, {0}};
+  journal_block_header BlockHeader = {JOURNAL_BLOCK_MAGIC, sizeof(Block), sizeof(Block), 1, 0, 0, 0, 0};
+  FILE* File = fopen(Path, "wb");
+  fwrite(&Header, sizeof(Header), 1, File);
+  fwrite(&BlockHeader, sizeof(BlockHeader), 1, File);
+  fwrite(Block, sizeof(Block), 1, File);
+  fclose(File);
+}
+
+static void VerifyDamaged(const char* Path)
+{
+  journal_reader Reader;
+  journal_callback Callback;
+  journal_event Event;
+
+  // NOTE(robin): Undamaged, to show the ones below fail for the reason we think
+  WriteSingleRecord(Path, BENCH_FRAMES, 8);
+  s32 Opened = JournalReaderOpen(&Reader, Path);
+  s32 Read = Opened && JournalRead(&Reader, &Callback);
+  s32 First = Read && JournalNextEvent(&Callback, &Event);
+  s32 Second = Read && JournalNextEvent(&Callback, &Event);
+  assert(Read && First && !Second && Event.Size == 8 && !Reader.Damaged);
+  JournalReaderClose(&Reader);
+
+  // NOTE(robin): More frames than MaxFrameCount. The record is still the right size for
+  // them here, so only the check against the header catches it.
+  WriteSingleRecord(Path, BENCH_FRAMES + 1, 4);
+  Opened = JournalReaderOpen(&Reader, Path);
+  Read = Opened && JournalRead(&Reader, &Callback);
+  assert(Opened && !Read && Reader.Damaged);
+  JournalReaderClose(&Reader);
+
+  // NOTE(robin): An event past the end of the event bytes, and one whose size pads around
+  u32 EventSizes[] = {9, 0xFFFFFFFF};
+  for (u32 i = 0; i < 2; i++)
+  {
+    WriteSingleRecord(Path, BENCH_FRAMES, EventSizes[i]);
+    Opened = JournalReaderOpen(&Reader, Path);
+    Read = Opened && JournalRead(&Reader, &Callback);
+    First = Read && JournalNextEvent(&Callback, &Event);
+    assert(Read && !First && Reader.Damaged);
+    JournalReaderClose(&Reader);
+  }
+
+  remove(Path);
+  printf("Damage: records with too many frames and events past the record are caught\n");
+}
+
+typedef struct
+{
+  journal* Journal;
+  const f32* Inputs[BENCH_CHANNELS];
+} record_data;
+
+void BenchRecord(void* Context)
+{
+  record_data* Data = Context;
+  static const u8 NoteOn[3] = {0x90, 60, 100};
+  JournalBegin(Data->Journal, BENCH_FRAMES, Data->Inputs);
+  JournalEvent(Data->Journal, 10, NoteOn, 3);
+  JournalEvent(Data->Journal, 90, NoteOn, 3);
+  JournalEnd(Data->Journal, 0);
+}
+
+static void BenchCompression(void)
+{
+  u32 Size = JOURNAL_BLOCK_SIZE;
+  u8* Raw = malloc(Size);
+  u8* Packed = malloc(JournalPackedBound(Size));
+  u8* Unpacked = malloc(Size);
+
+  const char* Names[] = {"silence", "tone", "noise"};
+  printf("\n%-10s %10s %12s %12s\n", "block of", "ratio", "pack", "unpack");
+  for (u32 Kind = 0; Kind < 3; Kind++)
+  {
+    f32* Samples = (f32*)Raw;
+    for (u32 i = 0; i < Size / 4; i++)
+      Samples[i] = Kind == 0 ? 0.0f : Kind == 1 ? 0.5f * sinf(i * 0.02f) : (f32)(NextRandom() & 0xFFFF) / 32768.0f - 1.0f;
+
+    u64 Start = BenchGetTime();
+    u32 PackedSize = 0;
+    for (u32 i = 0; i < 20; i++)
+      PackedSize = JournalPack(Raw, Size, Packed);
+    u64 Middle = BenchGetTime();
+    u32 UnpackedSize = 0;
+    for (u32 i = 0; i < 20; i++)
+      UnpackedSize = JournalUnpack(Packed, PackedSize, Unpacked, Size);
+    u64 End = BenchGetTime();
+
+    assert(UnpackedSize == Size && !memcmp(Raw, Unpacked, Size));
+    printf("%-10s %9.2fx %8.0f MB/s %8.0f MB/s\n", Names[Kind], (f64)Size / PackedSize,
+        20.0 * Size / ((Middle - Start) / 1e9) / 1e6, 20.0 * Size / ((End - Middle) / 1e9) / 1e6);
+  }
+
+  free(Raw);
+  free(Packed);
+  free(Unpacked);
+}
+
+int main(int argc, char** argv)
+{
+  const char* Path = "journal_bench.journal";
+  const char* CutPath = "journal_bench_cut.journal";
+
+  Record(Path, 1);
+  VerifyRoundTrip(Path);
+  VerifySeeks(Path, BENCH_CALLBACKS);
+  printf("Lost index: the journal reads back and seeks without it\n");
+
+  Record(Path, 0);
+  VerifyRoundTrip(Path);
+  VerifySeeks(Path, BENCH_CALLBACKS);
+  u32 CutCallbacks = VerifyCutOff(Path, CutPath);
+  VerifySeeks(CutPath, CutCallbacks);
+  VerifyDamaged(CutPath);
+  remove(Path);
+  remove(CutPath);
+
+  BenchCompression();
+
+  // NOTE(robin): The ring fills up and records get dropped, which costs about the same as
+  // copying them in, so the numbers hold either way
+  static journal Journal;
+  JournalOpen(&Journal, Path, 48000, BENCH_CHANNELS, BENCH_FRAMES);
+  static f32 Inputs[BENCH_CHANNELS][BENCH_FRAMES];
+  record_data Data = {&Journal, {Inputs[0], Inputs[1]}};
+  f64 Time = BenchMeasure(BenchRecord, &Data);
+  JournalClose(&Journal);
+  remove(Path);
+  printf("\nRecording one callback (%u channels, %u frames, 2 events): %.1f ns\n",
+      BENCH_CHANNELS, BENCH_FRAMES, Time);
+
+  return 0;
+}
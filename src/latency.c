@@ -0,0 +1,324 @@
+/*
+ * This file measures round trip latency: play a known signal on an output, record an input
+ * that is looped back to it and find the delay between the two by cross-correlation.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined, and fft.c.
+ *
+ * NOTE(robin): The signal is a maximum length sequence (MLS), a pseudo random +/-1 sequence
+ * whose autocorrelation is one sharp peak, so cross-correlating what we recorded with what we
+ * played gives a peak at the delay even with noise, gain and some filtering in the loop.
+ * Interpolating a parabola through the peak and its neighbours gives a sub-sample estimate.
+ *
+ * There are two halves:
+ *
+ * - latency_probe runs on the audio thread. Once armed it plays the MLS followed by silence
+ *   and records the input of the same callbacks, so output and input share one frame
+ *   counter and the delay we find is the full round trip as the application sees it,
+ *   buffering included. It doesn't allocate or block.
+ * - LatencyAnalyse runs on another thread once the probe has finished recording and does
+ *   the cross-correlation with FFTs.
+ *
+ *   Main thread                              Audio thread
+ *   LatencyProbeArm --------------------->   LatencyProbeProcess every callback: plays and
+ *   wait for LatencyProbeDone <-----------   records, then marks the run done
+ *   LatencyAnalyse, LatencyStatsAdd
+ *
+ * The probe's state is handed over with the GCC/clang atomic builtins.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LATENCY_MIN_ORDER 10
+#define LATENCY_MAX_ORDER 16
+
+// NOTE(robin): A correlation peak less than this far above the RMS of the rest of the
+// correlation is probably not our signal (nothing connected, or the loop is too noisy)
+#define LATENCY_MIN_PEAK_DB 20.0
+
+typedef enum
+{
+  LatencyStateIdle,
+  LatencyStateArmed,
+  LatencyStateRunning,
+  LatencyStateDone,
+} latency_state;
+
+typedef struct
+{
+  f32* Signal;
+  u32 SignalLength;
+  f32* Capture;
+  u32 CaptureLength;
+  u32 Position;
+  u32 State;
+
+  // NOTE(robin): Whatever the caller wants to compare against, e.g. the latency the driver
+  // reports, set while the probe is running (see LatencyProbeProcess)
+  f64 Reported;
+} latency_probe;
+
+typedef struct
+{
+  f64 Delay;      // NOTE(robin): In frames, with a fractional part
+  f64 PeakDB;     // NOTE(robin): Correlation peak relative to the RMS of the correlation
+  f64 Reported;
+  u32 Valid;
+} latency_result;
+
+typedef struct
+{
+  fft FFT;
+  u32 SignalLength;
+  f32* SignalRe; // NOTE(robin): Spectrum of the MLS, computed once
+  f32* SignalIm;
+  f32* Re;
+  f32* Im;
+} latency_analyser;
+
+typedef struct
+{
+  u32 Count;
+  u32 Invalid;
+  f64 Min;
+  f64 Max;
+  f64 Sum;
+  f64 SumSquares;
+  f64 ReportedMin;
+  f64 ReportedMax;
+} latency_stats;
+
+// NOTE(robin): Fills Output with the 2^Order - 1 samples of an MLS at +/-Amplitude, from a
+// Galois LFSR. Order must be between LATENCY_MIN_ORDER and LATENCY_MAX_ORDER.
+u32 LatencyMLS(f32* Output, u32 Order, f32 Amplitude)
+{
+  static const u32 Masks[] = {0x240, 0x500, 0xE08, 0x1C80, 0x3802, 0x6000, 0xB400};
+  if (Order < LATENCY_MIN_ORDER || Order > LATENCY_MAX_ORDER)
+    return 0;
+
+  u32 Mask = Masks[Order - LATENCY_MIN_ORDER];
+  u32 Length = (1u << Order) - 1;
+  u32 State = 1;
+  for (u32 i = 0; i < Length; i++)
+  {
+    u32 Bit = State & 1;
+    State >>= 1;
+    if (Bit)
+      State ^= Mask;
+    Output[i] = Bit ? Amplitude : -Amplitude;
+  }
+
+  return Length;
+}
+
+// NOTE(robin): MaxDelay is the longest round trip we can measure, in frames. The probe
+// records the MLS length plus MaxDelay frames.
+u32 LatencyProbeInit(latency_probe* Probe, u32 Order, f32 Amplitude, u32 MaxDelay)
+{
+  *Probe = (latency_probe){0};
+  if (Order < LATENCY_MIN_ORDER || Order > LATENCY_MAX_ORDER)
+    return 0;
+
+  Probe->SignalLength = (1u << Order) - 1;
+  Probe->CaptureLength = Probe->SignalLength + MaxDelay;
+  Probe->Signal = malloc(Probe->SignalLength * sizeof(f32));
+  Probe->Capture = malloc(Probe->CaptureLength * sizeof(f32));
+  if (!Probe->Signal || !Probe->Capture)
+    return 0;
+
+  LatencyMLS(Probe->Signal, Order, Amplitude);
+  return 1;
+}
+
+// NOTE(robin): Call from the main thread, the next callback starts a run
+void LatencyProbeArm(latency_probe* Probe)
+{
+  __atomic_store_n(&Probe->State, LatencyStateArmed, __ATOMIC_RELEASE);
+}
+
+u32 LatencyProbeDone(latency_probe* Probe)
+{
+  return __atomic_load_n(&Probe->State, __ATOMIC_ACQUIRE) == LatencyStateDone;
+}
+
+// NOTE(robin): Call from the audio thread with the output and input of the same callback.
+// Output is always written (silence when we're not running) so this can own a channel.
+// Returns 1 if a run started in this callback, which is the moment to sample anything you
+// want to compare against into Probe->Reported.
+u32 LatencyProbeProcess(latency_probe* Probe, f32* Output, const f32* Input, u32 FrameCount)
+{
+  u32 Started = 0;
+  u32 State = __atomic_load_n(&Probe->State, __ATOMIC_ACQUIRE);
+  if (State == LatencyStateArmed)
+  {
+    Probe->Position = 0;
+    State = LatencyStateRunning;
+    Started = 1;
+  }
+
+  if (State != LatencyStateRunning)
+  {
+    memset(Output, 0, FrameCount * sizeof(f32));
+    return 0;
+  }
+
+  // NOTE(robin): Input is read before Output is written since they can be the same buffer,
+  // e.g. a JACK input port connected to only our own output
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    u32 Position = Probe->Position + i;
+    if (Position < Probe->CaptureLength)
+      Probe->Capture[Position] = Input[i];
+  }
+
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    u32 Position = Probe->Position + i;
+    Output[i] = Position < Probe->SignalLength ? Probe->Signal[Position] : 0.0f;
+  }
+
+  Probe->Position += FrameCount;
+  State = Probe->Position >= Probe->CaptureLength ? LatencyStateDone : LatencyStateRunning;
+  __atomic_store_n(&Probe->State, State, __ATOMIC_RELEASE);
+
+  return Started;
+}
+
+u32 LatencyAnalyserInit(latency_analyser* Analyser, latency_probe* Probe)
+{
+  *Analyser = (latency_analyser){0};
+
+  // NOTE(robin): Linear (not circular) correlation needs room for both signals
+  u32 Size = 2;
+  while (Size < Probe->CaptureLength + Probe->SignalLength)
+    Size *= 2;
+
+  if (!FFTInit(&Analyser->FFT, Size))
+    return 0;
+
+  Analyser->SignalLength = Probe->SignalLength;
+  Analyser->SignalRe = calloc(Size, sizeof(f32));
+  Analyser->SignalIm = calloc(Size, sizeof(f32));
+  Analyser->Re = malloc(Size * sizeof(f32));
+  Analyser->Im = malloc(Size * sizeof(f32));
+  if (!Analyser->SignalRe || !Analyser->SignalIm || !Analyser->Re || !Analyser->Im)
+    return 0;
+
+  memcpy(Analyser->SignalRe, Probe->Signal, Probe->SignalLength * sizeof(f32));
+  FFTForward(&Analyser->FFT, Analyser->SignalRe, Analyser->SignalIm);
+  return 1;
+}
+
+// NOTE(robin): Finds the delay of the MLS in Capture (CaptureLength samples)
+latency_result LatencyAnalyse(latency_analyser* Analyser, const f32* Capture, u32 CaptureLength)
+{
+  latency_result Result = {0};
+  u32 Size = Analyser->FFT.Size;
+  f32* Re = Analyser->Re;
+  f32* Im = Analyser->Im;
+
+  memset(Re, 0, Size * sizeof(f32));
+  memset(Im, 0, Size * sizeof(f32));
+  memcpy(Re, Capture, CaptureLength * sizeof(f32));
+  FFTForward(&Analyser->FFT, Re, Im);
+
+  // NOTE(robin): Cross-correlation is Capture times the conjugate of Signal
+  for (u32 i = 0; i < Size; i++)
+  {
+    f32 XRe = Re[i], XIm = Im[i];
+    f32 SRe = Analyser->SignalRe[i], SIm = Analyser->SignalIm[i];
+    Re[i] = XRe * SRe + XIm * SIm;
+    Im[i] = XIm * SRe - XRe * SIm;
+  }
+  FFTInverse(&Analyser->FFT, Re, Im);
+
+  // NOTE(robin): Re[Lag] is now the correlation at Lag, we only look at lags where the whole
+  // signal fits in the capture. We take the absolute value since the loop might invert.
+  u32 LagCount = CaptureLength - Analyser->SignalLength + 1;
+  u32 Peak = 0;
+  f64 SumSquares = 0;
+  for (u32 Lag = 0; Lag < LagCount; Lag++)
+  {
+    SumSquares += (f64)Re[Lag] * Re[Lag];
+    if (fabsf(Re[Lag]) > fabsf(Re[Peak]))
+      Peak = Lag;
+  }
+
+  f64 PeakValue = fabs(Re[Peak]);
+  f64 RMS = sqrt((SumSquares - PeakValue * PeakValue) / (LagCount - 1));
+  Result.PeakDB = 20.0 * log10(PeakValue / (RMS + 1e-30));
+  Result.Delay = Peak;
+
+  // NOTE(robin): Parabola through the peak and its neighbours
+  if (Peak > 0 && Peak + 1 < LagCount)
+  {
+    f64 Left = fabs(Re[Peak - 1]);
+    f64 Right = fabs(Re[Peak + 1]);
+    f64 Curvature = Left - 2.0 * PeakValue + Right;
+    if (Curvature < 0)
+      Result.Delay += 0.5 * (Left - Right) / Curvature;
+  }
+
+  Result.Valid = Result.PeakDB >= LATENCY_MIN_PEAK_DB;
+  return Result;
+}
+
+void LatencyStatsAdd(latency_stats* Stats, latency_result Result)
+{
+  if (!Result.Valid)
+  {
+    Stats->Invalid++;
+    return;
+  }
+
+  if (!Stats->Count || Result.Delay < Stats->Min)
+    Stats->Min = Result.Delay;
+  if (!Stats->Count || Result.Delay > Stats->Max)
+    Stats->Max = Result.Delay;
+  if (!Stats->Count || Result.Reported < Stats->ReportedMin)
+    Stats->ReportedMin = Result.Reported;
+  if (!Stats->Count || Result.Reported > Stats->ReportedMax)
+    Stats->ReportedMax = Result.Reported;
+
+  Stats->Count++;
+  Stats->Sum += Result.Delay;
+  Stats->SumSquares += Result.Delay * Result.Delay;
+}
+
+void LatencyPrintResult(u32 Run, latency_result Result, f64 SampleRate)
+{
+  if (!Result.Valid)
+  {
+    printf("run %3u: no signal found (peak %.1fdB), is the output looped back to the input?\n",
+        Run, Result.PeakDB);
+    return;
+  }
+
+  printf("run %3u: measured %9.2f frames (%7.3fms), reported %7.0f frames, difference %+8.2f, peak %.1fdB\n",
+      Run, Result.Delay, 1000.0 * Result.Delay / SampleRate, Result.Reported,
+      Result.Delay - Result.Reported, Result.PeakDB);
+}
+
+void LatencyPrintStats(latency_stats* Stats, f64 SampleRate)
+{
+  if (!Stats->Count)
+  {
+    printf("No valid measurements (%u failed)\n", Stats->Invalid);
+    return;
+  }
+
+  f64 Mean = Stats->Sum / Stats->Count;
+  f64 Variance = Stats->SumSquares / Stats->Count - Mean * Mean;
+  f64 Deviation = sqrt(Variance > 0 ? Variance : 0);
+
+  printf("\n%u valid runs, %u failed\n", Stats->Count, Stats->Invalid);
+  printf("measured: mean %.2f frames (%.3fms), min %.2f, max %.2f, std dev %.3f\n",
+      Mean, 1000.0 * Mean / SampleRate, Stats->Min, Stats->Max, Deviation);
+  printf("reported: min %.0f frames, max %.0f frames (%.3fms)\n",
+      Stats->ReportedMin, Stats->ReportedMax, 1000.0 * Stats->ReportedMax / SampleRate);
+  printf("measured - reported: %+.2f frames\n", Mean - Stats->ReportedMax);
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is a stereo lookahead limiter: it holds the signal back for Lookahead frames and
+ * turns the gain down before a peak over the ceiling reaches the output.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   limiter Limiter;
+ *   LimiterInit(&Limiter, Ceiling, SampleRate);
+ *
+ *   // In the callback, in place
+ *   LimiterProcess(&Limiter, Left, Right, FrameCount, Lookahead);
+ *
+ * NOTE(robin): The output is Lookahead frames late, so run it as a path of delaycomp.c and
+ * take the lookahead from DelayCompLatency. The lookahead can change from one call to the
+ * next (up to LIMITER_MAX_LOOKAHEAD), the limiter keeps enough history for that.
+ *
+ * The attack takes the gain to where it needs to be within the lookahead (to within 1%), the
+ * release brings it back up over about 50ms. Both channels get the same gain so the image
+ * stays put. The loudest peak in the window comes from a monotonic queue (see LimiterPush),
+ * so the cost doesn't grow with the lookahead.
+ */
+
+#include <math.h>
+
+#define LIMITER_SIZE 1024 // NOTE(robin): Of the history, a power of two
+#define LIMITER_MAX_LOOKAHEAD (LIMITER_SIZE - 1)
+
+typedef struct
+{
+  f32 History[2][LIMITER_SIZE];
+  f32 Peaks[LIMITER_SIZE]; // NOTE(robin): The louder channel of each frame in History
+  u32 Queue[LIMITER_SIZE]; // NOTE(robin): Positions, see LimiterPush
+  u32 Head;
+  u32 Tail;
+  u32 Position;
+  u32 Lookahead;
+  f32 Ceiling;
+  f32 Gain;
+  f32 Attack;
+  f32 Release;
+} limiter;
+
+void LimiterInit(limiter* Limiter, f32 Ceiling, f32 SampleRate)
+{
+  *Limiter = (limiter){0};
+  Limiter->Ceiling = Ceiling;
+  Limiter->Gain = 1.0f;
+  Limiter->Attack = 1.0f - expf(-5.0f);
+  Limiter->Release = 1.0f - expf(-1.0f / (0.05f * SampleRate));
+}
+
+// NOTE(robin): Adds the frame at Position (already in History) to the window of the last
+// Lookahead + 1 frames and returns the loudest peak in it. Queue holds the positions in the
+// window that are louder than everything after them, so their peaks go down from Head to
+// Tail and the loudest is at Head. Every position goes in and out once, so this is O(1) per
+// frame on average, whatever the lookahead.
+static f32 LimiterPush(limiter* Limiter, u32 Position)
+{
+  u32 Mask = LIMITER_SIZE - 1;
+  f32 Peak = fmaxf(fabsf(Limiter->History[0][Position & Mask]), fabsf(Limiter->History[1][Position & Mask]));
+  Limiter->Peaks[Position & Mask] = Peak;
+
+  while (Limiter->Tail != Limiter->Head && Limiter->Peaks[Limiter->Queue[(Limiter->Tail - 1) & Mask] & Mask] <= Peak)
+    Limiter->Tail--;
+  Limiter->Queue[Limiter->Tail++ & Mask] = Position;
+
+  while (Position - Limiter->Queue[Limiter->Head & Mask] > Limiter->Lookahead)
+    Limiter->Head++;
+  return Limiter->Peaks[Limiter->Queue[Limiter->Head & Mask] & Mask];
+}
+
+void LimiterProcess(limiter* Limiter, f32* Left, f32* Right, u32 FrameCount, u32 Lookahead)
+{
+  Lookahead = Lookahead < LIMITER_MAX_LOOKAHEAD ? Lookahead : LIMITER_MAX_LOOKAHEAD;
+  if (Lookahead != Limiter->Lookahead)
+  {
+    Limiter->Lookahead = Lookahead;
+    Limiter->Attack = 1.0f - expf(-5.0f / (f32)(Lookahead + 1));
+
+    // NOTE(robin): A longer window takes in frames the queue has already let go of, so we
+    // build it again from History
+    Limiter->Head = Limiter->Tail = 0;
+    for (u32 k = Lookahead; k > 0; k--)
+      LimiterPush(Limiter, Limiter->Position - k);
+  }
+
+  u32 Mask = LIMITER_SIZE - 1;
+  f32* Channels[2] = {Left, Right};
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    u32 Position = Limiter->Position++;
+    Limiter->History[0][Position & Mask] = Left[i];
+    Limiter->History[1][Position & Mask] = Right[i];
+
+    // NOTE(robin): The loudest of the samples we have seen but not output yet
+    f32 Peak = LimiterPush(Limiter, Position);
+
+    f32 Target = Peak > Limiter->Ceiling ? Limiter->Ceiling / Peak : 1.0f;
+    Limiter->Gain += (Target - Limiter->Gain) * (Target < Limiter->Gain ? Limiter->Attack : Limiter->Release);
+
+    for (u32 Channel = 0; Channel < 2; Channel++)
+      Channels[Channel][i] = Limiter->History[Channel][(Position - Lookahead) & Mask] * Limiter->Gain;
+  }
+}
@@ -0,0 +1,420 @@
+/*
+ * This file measures levels in the audio callback: sample peak, RMS, true peak and EBU R128
+ * momentary and short term loudness for up to METER_MAX_CHANNELS channels, and hands them
+ * to another thread (e.g. your UI) without locks.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   meter Meter; // NOTE(robin): Big-ish, make it static or global
+ *   MeterInit(&Meter, ChannelCount, SampleRate);
+ *
+ *   // In the callback, after rendering
+ *   MeterProcess(&Meter, Channels, FrameCount);
+ *
+ *   // On any other (single) thread, as often as you like
+ *   const meter_snapshot* Snapshot = MeterRead(&Meter);
+ *
+ * NOTE(robin): Everything is measured over intervals of 100ms, the update rate R128 asks for.
+ * At the end of each interval the callback writes a meter_snapshot and publishes it through
+ * a triple buffer: the writer always has a buffer of its own to fill, the reader always has
+ * one to look at, and the third is swapped between them with one atomic exchange. Neither
+ * side ever waits for the other. If the reader is slower than 10 snapshots a second it just
+ * sees the newest one, so peaks in the skipped intervals are lost: hold them on the reader
+ * side if you need to.
+ *
+ * - Peak and RMS loops keep METER_LANES independent maxima and sums so that the compiler
+ *   can vectorise them (a single running maximum is a dependency chain it won't reorder).
+ * - True peak follows ITU-R BS.1770-4 annex 2: 4x oversampling with a 48 tap polyphase
+ *   lowpass, computed METER_LANES outputs at a time so the loops vectorise. This is about
+ *   half of the cost.
+ * - Loudness is K-weighted (the BS.1770 shelf and highpass biquads) mean square, momentary
+ *   over the last 400ms and short term over the last 3s. This is the one recursive part,
+ *   so it runs sample by sample. The program loudness in the snapshot sums all channels
+ *   with the weights from MeterSetWeight (1 by default, 1.41 for surrounds in 5.1).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MeterExchange(Pointer, Value) (u32)_InterlockedExchange((volatile long*)(Pointer), (long)(Value))
+#define MeterLoad(Pointer) (*(volatile u32*)(Pointer))
+#else
+#define MeterExchange(Pointer, Value) __atomic_exchange_n((Pointer), (Value), __ATOMIC_ACQ_REL)
+#define MeterLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_ACQUIRE)
+#endif
+
+#define METER_MAX_CHANNELS 64
+#define METER_LANES 8
+#define METER_CHUNK 64
+#define METER_OVERSAMPLE 4
+#define METER_TRUE_PEAK_TAPS 12 // NOTE(robin): Per phase, 48 in total
+#define METER_MOMENTARY_INTERVALS 4
+#define METER_SHORT_TERM_INTERVALS 30
+#define METER_SILENCE -200.0f
+#define METER_FRESH 4 // NOTE(robin): Set in Middle when it holds a snapshot the reader hasn't seen
+
+typedef struct
+{
+  f32 Peak;      // NOTE(robin): Linear, over the last interval
+  f32 TruePeak;  // NOTE(robin): Linear, over the last interval
+  f32 RMS;       // NOTE(robin): Linear, over the last interval
+  f32 Momentary; // NOTE(robin): LUFS
+  f32 ShortTerm; // NOTE(robin): LUFS
+} meter_values;
+
+typedef struct
+{
+  u64 Sequence; // NOTE(robin): Number of intervals measured so far, 0 before the first one
+  u32 ChannelCount;
+  f32 Momentary; // NOTE(robin): Program loudness of all channels together, LUFS
+  f32 ShortTerm;
+  meter_values Channels[METER_MAX_CHANNELS];
+} meter_snapshot;
+
+typedef struct
+{
+  f32 B0, B1, B2, A1, A2;
+} meter_biquad;
+
+typedef struct
+{
+  f32 Peak;
+  f32 TruePeak;
+  f64 SumSquares;
+  f64 WeightedSumSquares;
+  f32 History[METER_TRUE_PEAK_TAPS - 1];
+  f32 Shelf[2];    // NOTE(robin): Transposed direct form II state
+  f32 HighPass[2];
+  f64 Intervals[METER_SHORT_TERM_INTERVALS]; // NOTE(robin): K-weighted mean squares
+} meter_channel;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 IntervalFrames;
+  u32 Position;
+  u32 Interval;
+  u64 Sequence;
+  f32 Weights[METER_MAX_CHANNELS];
+  meter_biquad Shelf;
+  meter_biquad HighPass;
+  f32 TruePeakTaps[METER_OVERSAMPLE][METER_TRUE_PEAK_TAPS];
+  meter_channel Channels[METER_MAX_CHANNELS];
+
+  // NOTE(robin): Triple buffer, WriteIndex belongs to the callback and ReadIndex to the reader
+  meter_snapshot Snapshots[3];
+  u32 WriteIndex;
+  u32 ReadIndex;
+  u32 Middle;
+} meter;
+
+static f64 MeterBesselI0(f64 X)
+{
+  f64 Sum = 1, Term = 1;
+  for (u32 k = 1; k < 32; k++)
+  {
+    Term *= (X / (2.0 * k)) * (X / (2.0 * k));
+    Sum += Term;
+  }
+  return Sum;
+}
+
+f32 MeterDecibels(f32 Linear)
+{
+  return Linear > 1e-10f ? 20.0f * log10f(Linear) : METER_SILENCE;
+}
+
+static f32 MeterLoudness(f64 MeanSquare)
+{
+  return MeanSquare > 1e-20 ? (f32)(-0.691 + 10.0 * log10(MeanSquare)) : METER_SILENCE;
+}
+
+// NOTE(robin): ChannelCount is clamped to METER_MAX_CHANNELS
+void MeterInit(meter* Meter, u32 ChannelCount, f64 SampleRate)
+{
+  memset(Meter, 0, sizeof(*Meter));
+  Meter->ChannelCount = ChannelCount < METER_MAX_CHANNELS ? ChannelCount : METER_MAX_CHANNELS;
+  Meter->IntervalFrames = (u32)(SampleRate / 10.0 + 0.5);
+  for (u32 i = 0; i < METER_MAX_CHANNELS; i++)
+    Meter->Weights[i] = 1.0f;
+
+  // NOTE(robin): The K-weighting filters from BS.1770, redesigned for any sample rate with the
+  // bilinear transform (the standard only lists coefficients for 48kHz)
+  const f64 Pi = 3.14159265358979323846;
+  f64 K = tan(Pi * 1681.974450955533 / SampleRate);
+  f64 Q = 0.7071752369554196;
+  f64 Vh = pow(10.0, 3.999843853973347 / 20.0);
+  f64 Vb = pow(Vh, 0.4996667741545416);
+  f64 A0 = 1.0 + K / Q + K * K;
+  Meter->Shelf.B0 = (f32)((Vh + Vb * K / Q + K * K) / A0);
+  Meter->Shelf.B1 = (f32)(2.0 * (K * K - Vh) / A0);
+  Meter->Shelf.B2 = (f32)((Vh - Vb * K / Q + K * K) / A0);
+  Meter->Shelf.A1 = (f32)(2.0 * (K * K - 1.0) / A0);
+  Meter->Shelf.A2 = (f32)((1.0 - K / Q + K * K) / A0);
+
+  K = tan(Pi * 38.13547087602444 / SampleRate);
+  Q = 0.5003270373238773;
+  A0 = 1.0 + K / Q + K * K;
+  Meter->HighPass.B0 = 1.0f;
+  Meter->HighPass.B1 = -2.0f;
+  Meter->HighPass.B2 = 1.0f;
+  Meter->HighPass.A1 = (f32)(2.0 * (K * K - 1.0) / A0);
+  Meter->HighPass.A2 = (f32)((1.0 - K / Q + K * K) / A0);
+
+  // NOTE(robin): Kaiser windowed sinc with its cutoff at the original Nyquist frequency. Tap
+  // i of phase p is tap 4i + p of the full filter, and each phase is normalised to unity
+  // gain so DC and slow signals read exactly their sample values.
+  u32 Taps = METER_OVERSAMPLE * METER_TRUE_PEAK_TAPS;
+  f64 Center = 0.5 * (Taps - 1);
+  f64 Beta = 6.0;
+  for (u32 p = 0; p < METER_OVERSAMPLE; p++)
+  {
+    f64 Sum = 0;
+    for (u32 i = 0; i < METER_TRUE_PEAK_TAPS; i++)
+    {
+      f64 X = (f64)(METER_OVERSAMPLE * i + p) - Center;
+      f64 Sinc = sin(Pi * X / METER_OVERSAMPLE) / (Pi * X / METER_OVERSAMPLE);
+      f64 Ratio = X / (Center + 1.0);
+      f64 Window = MeterBesselI0(Beta * sqrt(1.0 - Ratio * Ratio)) / MeterBesselI0(Beta);
+      Meter->TruePeakTaps[p][i] = (f32)(Sinc * Window);
+      Sum += Sinc * Window;
+    }
+    for (u32 i = 0; i < METER_TRUE_PEAK_TAPS; i++)
+      Meter->TruePeakTaps[p][i] = (f32)(Meter->TruePeakTaps[p][i] / Sum);
+  }
+
+  Meter->WriteIndex = 0;
+  Meter->Middle = 1;
+  Meter->ReadIndex = 2;
+  for (u32 i = 0; i < 3; i++)
+  {
+    meter_snapshot* Snapshot = &Meter->Snapshots[i];
+    Snapshot->ChannelCount = Meter->ChannelCount;
+    Snapshot->Momentary = METER_SILENCE;
+    Snapshot->ShortTerm = METER_SILENCE;
+    for (u32 Channel = 0; Channel < METER_MAX_CHANNELS; Channel++)
+    {
+      Snapshot->Channels[Channel].Momentary = METER_SILENCE;
+      Snapshot->Channels[Channel].ShortTerm = METER_SILENCE;
+    }
+  }
+}
+
+// NOTE(robin): Channel weight for the program loudness, call before MeterProcess starts
+void MeterSetWeight(meter* Meter, u32 Channel, f32 Weight)
+{
+  if (Channel < METER_MAX_CHANNELS)
+    Meter->Weights[Channel] = Weight;
+}
+
+static f32 MeterPeak(const f32* Samples, u32 Count, f32 Peak)
+{
+  f32 Lanes[METER_LANES] = {0};
+  u32 i = 0;
+  for (; i + METER_LANES <= Count; i += METER_LANES)
+  {
+    for (u32 j = 0; j < METER_LANES; j++)
+    {
+      f32 Magnitude = fabsf(Samples[i + j]);
+      Lanes[j] = Magnitude > Lanes[j] ? Magnitude : Lanes[j];
+    }
+  }
+  for (; i < Count; i++)
+  {
+    f32 Magnitude = fabsf(Samples[i]);
+    Peak = Magnitude > Peak ? Magnitude : Peak;
+  }
+
+  for (u32 j = 0; j < METER_LANES; j++)
+    Peak = Lanes[j] > Peak ? Lanes[j] : Peak;
+  return Peak;
+}
+
+static f32 MeterSumSquares(const f32* Samples, u32 Count)
+{
+  f32 Lanes[METER_LANES] = {0};
+  f32 Sum = 0;
+  u32 i = 0;
+  for (; i + METER_LANES <= Count; i += METER_LANES)
+  {
+    for (u32 j = 0; j < METER_LANES; j++)
+      Lanes[j] += Samples[i + j] * Samples[i + j];
+  }
+  for (; i < Count; i++)
+    Sum += Samples[i] * Samples[i];
+
+  for (u32 j = 0; j < METER_LANES; j++)
+    Sum += Lanes[j];
+  return Sum;
+}
+
+static void MeterChannel(meter* Meter, meter_channel* Channel, const f32* Input, u32 FrameCount)
+{
+  Channel->Peak = MeterPeak(Input, FrameCount, Channel->Peak);
+  Channel->SumSquares += MeterSumSquares(Input, FrameCount);
+
+  // NOTE(robin): The oversampled signal between input samples, a chunk at a time. Work holds
+  // the last few samples of the previous chunk followed by this one (and zeros after a short
+  // chunk, so that the loops below always have the same trip count).
+  const u32 HistoryLength = METER_TRUE_PEAK_TAPS - 1;
+  f32 Work[METER_TRUE_PEAK_TAPS - 1 + METER_CHUNK];
+  memcpy(Work, Channel->History, HistoryLength * sizeof(f32));
+  for (u32 Start = 0; Start < FrameCount; Start += METER_CHUNK)
+  {
+    u32 Count = FrameCount - Start < METER_CHUNK ? FrameCount - Start : METER_CHUNK;
+    memcpy(Work + HistoryLength, Input + Start, Count * sizeof(f32));
+    memset(Work + HistoryLength + Count, 0, (METER_CHUNK - Count) * sizeof(f32));
+
+    // NOTE(robin): METER_LANES outputs of one phase at a time, so the accumulators stay in
+    // registers instead of going through memory for every tap
+    f32 Lanes[METER_LANES] = {0};
+    for (u32 p = 0; p < METER_OVERSAMPLE; p++)
+    {
+      const f32* Taps = Meter->TruePeakTaps[p];
+      for (u32 n = 0; n < METER_CHUNK; n += METER_LANES)
+      {
+        f32 Acc[METER_LANES] = {0};
+        for (u32 k = 0; k < METER_TRUE_PEAK_TAPS; k++)
+        {
+          const f32* Source = Work + HistoryLength + n - k;
+          for (u32 j = 0; j < METER_LANES; j++)
+            Acc[j] += Taps[k] * Source[j];
+        }
+
+        for (u32 j = 0; j < METER_LANES; j++)
+        {
+          f32 Magnitude = n + j < Count ? fabsf(Acc[j]) : 0.0f;
+          Lanes[j] = Magnitude > Lanes[j] ? Magnitude : Lanes[j];
+        }
+      }
+    }
+    Channel->TruePeak = MeterPeak(Lanes, METER_LANES, Channel->TruePeak);
+
+    memmove(Work, Work + Count, HistoryLength * sizeof(f32));
+  }
+  memcpy(Channel->History, Work, HistoryLength * sizeof(f32));
+
+  // NOTE(robin): K-weighting, two biquads in series
+  meter_biquad S = Meter->Shelf;
+  meter_biquad H = Meter->HighPass;
+  f32 S1 = Channel->Shelf[0], S2 = Channel->Shelf[1];
+  f32 H1 = Channel->HighPass[0], H2 = Channel->HighPass[1];
+  f32 Sum = 0;
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f32 X = Input[i];
+    f32 Y = S.B0 * X + S1;
+    S1 = S.B1 * X - S.A1 * Y + S2;
+    S2 = S.B2 * X - S.A2 * Y;
+
+    f32 Z = H.B0 * Y + H1;
+    H1 = H.B1 * Y - H.A1 * Z + H2;
+    H2 = H.B2 * Y - H.A2 * Z;
+    Sum += Z * Z;
+  }
+  Channel->Shelf[0] = S1;
+  Channel->Shelf[1] = S2;
+  Channel->HighPass[0] = H1;
+  Channel->HighPass[1] = H2;
+  Channel->WeightedSumSquares += Sum;
+}
+
+static void MeterPublish(meter* Meter)
+{
+  meter_snapshot* Snapshot = &Meter->Snapshots[Meter->WriteIndex];
+  u32 Interval = Meter->Interval;
+  f64 Frames = (f64)Meter->IntervalFrames;
+  f64 ProgramMomentary = 0;
+  f64 ProgramShortTerm = 0;
+
+  for (u32 i = 0; i < Meter->ChannelCount; i++)
+  {
+    meter_channel* Channel = &Meter->Channels[i];
+    meter_values* Values = &Snapshot->Channels[i];
+    Channel->Intervals[Interval] = Channel->WeightedSumSquares / Frames;
+
+    // NOTE(robin): Until we've seen 3s the missing intervals count as silence
+    f64 Momentary = 0;
+    f64 ShortTerm = 0;
+    for (u32 j = 0; j < METER_SHORT_TERM_INTERVALS; j++)
+    {
+      u32 Age = (Interval + METER_SHORT_TERM_INTERVALS - j) % METER_SHORT_TERM_INTERVALS;
+      if (j < METER_MOMENTARY_INTERVALS)
+        Momentary += Channel->Intervals[Age];
+      ShortTerm += Channel->Intervals[Age];
+    }
+    Momentary /= METER_MOMENTARY_INTERVALS;
+    ShortTerm /= METER_SHORT_TERM_INTERVALS;
+    ProgramMomentary += Meter->Weights[i] * Momentary;
+    ProgramShortTerm += Meter->Weights[i] * ShortTerm;
+
+    Values->Peak = Channel->Peak;
+    Values->TruePeak = Channel->TruePeak > Channel->Peak ? Channel->TruePeak : Channel->Peak;
+    Values->RMS = (f32)sqrt(Channel->SumSquares / Frames);
+    Values->Momentary = MeterLoudness(Momentary);
+    Values->ShortTerm = MeterLoudness(ShortTerm);
+
+    Channel->Peak = 0;
+    Channel->TruePeak = 0;
+    Channel->SumSquares = 0;
+    Channel->WeightedSumSquares = 0;
+  }
+
+  Meter->Sequence++;
+  Snapshot->Sequence = Meter->Sequence;
+  Snapshot->ChannelCount = Meter->ChannelCount;
+  Snapshot->Momentary = MeterLoudness(ProgramMomentary);
+  Snapshot->ShortTerm = MeterLoudness(ProgramShortTerm);
+
+  Meter->Interval = (Interval + 1) % METER_SHORT_TERM_INTERVALS;
+  Meter->WriteIndex = MeterExchange(&Meter->Middle, Meter->WriteIndex | METER_FRESH) & 3;
+}
+
+// NOTE(robin): Call from the audio thread with one buffer per channel. Doesn't allocate, lock
+// or make system calls.
+void MeterProcess(meter* Meter, const f32* const* Channels, u32 FrameCount)
+{
+  u32 Done = 0;
+  while (Done < FrameCount)
+  {
+    u32 Count = Meter->IntervalFrames - Meter->Position;
+    if (Count > FrameCount - Done)
+      Count = FrameCount - Done;
+
+    for (u32 i = 0; i < Meter->ChannelCount; i++)
+      MeterChannel(Meter, &Meter->Channels[i], Channels[i] + Done, Count);
+
+    Done += Count;
+    Meter->Position += Count;
+    if (Meter->Position == Meter->IntervalFrames)
+    {
+      MeterPublish(Meter);
+      Meter->Position = 0;
+    }
+  }
+}
+
+// NOTE(robin): Returns the newest snapshot. It stays valid (and unchanged) until the next
+// MeterRead. Only one thread may read.
+const meter_snapshot* MeterRead(meter* Meter)
+{
+  if (MeterLoad(&Meter->Middle) & METER_FRESH)
+    Meter->ReadIndex = MeterExchange(&Meter->Middle, Meter->ReadIndex) & 3;
+  return &Meter->Snapshots[Meter->ReadIndex];
+}
+
+void MeterPrint(const meter_snapshot* Snapshot)
+{
+  printf("%6.1f LUFS momentary, %6.1f LUFS short term\n", Snapshot->Momentary, Snapshot->ShortTerm);
+  for (u32 i = 0; i < Snapshot->ChannelCount; i++)
+  {
+    const meter_values* Values = &Snapshot->Channels[i];
+    printf("  %2u: peak %6.1f dBFS, true peak %6.1f dBTP, RMS %6.1f dBFS\n", i,
+        MeterDecibels(Values->Peak), MeterDecibels(Values->TruePeak), MeterDecibels(Values->RMS));
+  }
+}
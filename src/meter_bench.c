@@ -0,0 +1,156 @@
+/*
+ * This file tests and benchmarks meter.c with synthetic signals, so it runs anywhere without
+ * an audio device.
+ *
+ * - Loudness: the EBU Tech 3341 reference, a 1kHz stereo sine at -23dBFS, must read -23 LUFS
+ *   momentary and short term (within 0.1 LU).
+ * - True peak: a sine at a quarter of the sample rate, 45 degrees out of phase with the
+ *   samples, has its sample peaks 3dB below its real peak. True peak must find it.
+ * - Triple buffer: a reader thread reads snapshots while the callback publishes them, and
+ *   must see sequence numbers that only go up and a snapshot that's never half written.
+ * - Cost: MeterProcess on 128 frame blocks for 2 to 64 channels, per channel per block and
+ *   as the share of real time one CPU core needs at 48kHz.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "bench.c"
+#include "meter.c"
+
+#define BENCH_RATE 48000
+#define BENCH_BLOCK 128
+
+typedef struct
+{
+  meter Meter;
+  f32* Channels[METER_MAX_CHANNELS];
+  u32 Running;
+  u32 Reads;
+} bench_data;
+
+void FillSine(f32* Output, u32 Count, f64 Frequency, f64 Phase, f64 Amplitude)
+{
+  for (u32 i = 0; i < Count; i++)
+    Output[i] = (f32)(Amplitude * sin(2 * 3.14159265358979 * Frequency * i / BENCH_RATE + Phase));
+}
+
+void VerifyLoudness(bench_data* Data)
+{
+  // NOTE(robin): 4 seconds, so the short term window is full
+  u32 Length = 4 * BENCH_RATE;
+  f32* Signal = malloc(Length * sizeof(f32));
+  FillSine(Signal, Length, 1000, 0, pow(10.0, -23.0 / 20.0));
+
+  MeterInit(&Data->Meter, 2, BENCH_RATE);
+  for (u32 Start = 0; Start < Length; Start += BENCH_BLOCK)
+  {
+    const f32* Channels[] = {Signal + Start, Signal + Start};
+    MeterProcess(&Data->Meter, Channels, BENCH_BLOCK);
+  }
+
+  const meter_snapshot* Snapshot = MeterRead(&Data->Meter);
+  printf("1kHz -23dBFS stereo: %.2f LUFS momentary, %.2f LUFS short term, peak %.2f dBFS, RMS %.2f dBFS\n",
+      Snapshot->Momentary, Snapshot->ShortTerm,
+      MeterDecibels(Snapshot->Channels[0].Peak), MeterDecibels(Snapshot->Channels[0].RMS));
+  assert(fabs(Snapshot->Momentary + 23.0) < 0.1);
+  assert(fabs(Snapshot->ShortTerm + 23.0) < 0.1);
+  assert(fabs(MeterDecibels(Snapshot->Channels[0].RMS) + 26.01) < 0.05);
+
+  FillSine(Signal, Length, BENCH_RATE / 4, 3.14159265358979 / 4, 0.5);
+  MeterInit(&Data->Meter, 1, BENCH_RATE);
+  for (u32 Start = 0; Start < BENCH_RATE; Start += BENCH_BLOCK)
+  {
+    const f32* Channels[] = {Signal + Start};
+    MeterProcess(&Data->Meter, Channels, BENCH_BLOCK);
+  }
+
+  Snapshot = MeterRead(&Data->Meter);
+  f32 Peak = MeterDecibels(Snapshot->Channels[0].Peak);
+  f32 TruePeak = MeterDecibels(Snapshot->Channels[0].TruePeak);
+  printf("fs/4 sine at -6.02dB, 45 degrees: peak %.2f dBFS, true peak %.2f dBTP\n", Peak, TruePeak);
+  assert(fabs(TruePeak + 6.02) < 0.5);
+
+  free(Signal);
+}
+
+void* ReaderThread(void* Context)
+{
+  bench_data* Data = Context;
+  u64 Last = 0;
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    const meter_snapshot* Snapshot = MeterRead(&Data->Meter);
+    assert(Snapshot->Sequence >= Last);
+    Last = Snapshot->Sequence;
+
+    // NOTE(robin): The writer puts the same value in every channel, see VerifyTripleBuffer
+    for (u32 i = 1; i < Snapshot->ChannelCount; i++)
+      assert(Snapshot->Channels[i].Peak == Snapshot->Channels[0].Peak);
+    Data->Reads++;
+  }
+  return 0;
+}
+
+void VerifyTripleBuffer(bench_data* Data)
+{
+  MeterInit(&Data->Meter, METER_MAX_CHANNELS, BENCH_RATE);
+  Data->Running = 1;
+  Data->Reads = 0;
+
+  pthread_t Thread;
+  pthread_create(&Thread, 0, ReaderThread, Data);
+
+  // NOTE(robin): A different level in every block, so a torn snapshot would have channels
+  // that disagree. Small intervals so that we publish a lot.
+  Data->Meter.IntervalFrames = 64;
+  for (u32 Block = 0; Block < 20000; Block++)
+  {
+    for (u32 i = 0; i < METER_MAX_CHANNELS; i++)
+      for (u32 j = 0; j < 64; j++)
+        Data->Channels[i][j] = (f32)(Block % 100) / 100.0f;
+    MeterProcess(&Data->Meter, (const f32* const*)Data->Channels, 64);
+  }
+
+  __atomic_store_n(&Data->Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Thread, 0);
+  printf("Triple buffer: %llu snapshots published, %u reads, none torn\n\n",
+      (unsigned long long)Data->Meter.Sequence, Data->Reads);
+}
+
+void BenchMeter(void* Context)
+{
+  bench_data* Data = Context;
+  MeterProcess(&Data->Meter, (const f32* const*)Data->Channels, BENCH_BLOCK);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  for (u32 i = 0; i < METER_MAX_CHANNELS; i++)
+    Data.Channels[i] = malloc(BENCH_BLOCK * sizeof(f32));
+
+  VerifyLoudness(&Data);
+  VerifyTripleBuffer(&Data);
+
+  for (u32 i = 0; i < METER_MAX_CHANNELS; i++)
+    FillSine(Data.Channels[i], BENCH_BLOCK, 100 * (i + 1), 0, 0.5);
+
+  u32 Channels[] = {2, 8, 32, 64};
+  f64 BlockNS = BENCH_BLOCK * 1e9 / BENCH_RATE;
+  printf("%d frame blocks at %dHz\n", BENCH_BLOCK, BENCH_RATE);
+  printf("%9s %16s %12s %12s\n", "channels", "ns/channel", "ns/sample", "realtime");
+  for (u32 i = 0; i < sizeof(Channels) / sizeof(Channels[0]); i++)
+  {
+    MeterInit(&Data.Meter, Channels[i], BENCH_RATE);
+    f64 Time = BenchMeasure(BenchMeter, &Data);
+    printf("%9u %16.1f %12.2f %11.2f%%\n", Channels[i], Time / Channels[i],
+        Time / (Channels[i] * BENCH_BLOCK), 100.0 * Time / BlockNS);
+  }
+
+  return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * This file tests netaudio.c over the loopback interface, so it runs anywhere without an
+ * audio device or a second machine. Linux only.
+ *
+ * Usage: net_bench [seconds per scenario]
+ *
+ * A sender thread plays a 1kHz sine through NetSenderSend, paced as if its sample clock were
+ * off by some ppm. Its packets go through a relay thread that drops and delays them (a
+ * uniformly random delay, which also reorders them), and on to a receiver that is read by a
+ * "playback" thread paced at the nominal rate, like a device callback.
+ *
+ * For every scenario we print the receiver's counters and check the output: a glitch is a
+ * sample that doesn't continue the sine (x[n+1] + x[n-1] = 2 cos(w) x[n]), which is what a
+ * concealed packet or a resync sounds like. Without loss there must be no glitch and nothing
+ * concealed once playback has started, with loss no more concealed packets than the relay
+ * dropped, and either way no resync, and the drift estimate has to find the clock offset we
+ * put in, within the estimate's own spread.
+ *
+ * NOTE(robin): Everything here shares the machine, so scheduling delays of the four threads
+ * show up as extra jitter, more so on a single core.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <poll.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "netaudio.c"
+
+#define BENCH_RATE 48000
+#define BENCH_CHANNELS 2
+#define BENCH_PACKET_FRAMES 48 // NOTE(robin): 1ms, the AES67 default
+#define BENCH_SEND_FRAMES 128  // NOTE(robin): Not a multiple of the packet size on purpose
+#define BENCH_PLAY_FRAMES 256
+#define BENCH_RELAY_PORT 47010
+#define BENCH_RECEIVE_PORT 47011
+#define BENCH_MAX_DELAYED 1024
+
+typedef struct
+{
+  const char* Name;
+  net_format Format;
+  f64 Drift;   // NOTE(robin): Of the sender's clock, in ppm
+  f64 Loss;    // NOTE(robin): Probability
+  f64 DelayMS; // NOTE(robin): Maximum extra delay, uniformly distributed
+} scenario;
+
+typedef struct
+{
+  u64 Due;
+  u32 Size;
+  u8 Data[NET_HEADER + NET_MAX_PAYLOAD];
+} delayed_packet;
+
+typedef struct
+{
+  scenario Scenario;
+  u32 Running;
+  net_sender Sender;
+  net_receiver Receiver;
+  u32 Random;
+  delayed_packet Delayed[BENCH_MAX_DELAYED];
+  u32 Dropped;
+} bench_data;
+
+static f64 Random01(u32* State)
+{
+  *State = *State * 1664525u + 1013904223u;
+  return (f64)(*State >> 8) / (f64)(1u << 24);
+}
+
+// NOTE(robin): The sender and the relay stand in for another machine, which wouldn't stop
+// when ours does. Above the receiver's network thread (and our playback thread), so that
+// after a stall they catch up first, as the other machine would have carried on. Without
+// the rtprio limits for it this fails and our own stalls show up as late packets.
+void RunAsRemote(void)
+{
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+}
+
+void SleepUntil(u64 Time)
+{
+  struct timespec Until = {Time / 1000000000ull, Time % 1000000000ull};
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+}
+
+void* SenderThread(void* Context)
+{
+  bench_data* Data = Context;
+  RunAsRemote();
+
+  // NOTE(robin): A fast sender clock means its periods are shorter in real time
+  f64 Period = 1e9 * BENCH_SEND_FRAMES / (BENCH_RATE * (1.0 + 1e-6 * Data->Scenario.Drift));
+  f64 Phase = 0;
+  f32 Left[BENCH_SEND_FRAMES], Right[BENCH_SEND_FRAMES];
+  const f32* Channels[] = {Left, Right};
+
+  u64 Start = NetNow();
+  for (u64 Cycle = 1; __atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE); Cycle++)
+  {
+    for (u32 i = 0; i < BENCH_SEND_FRAMES; i++)
+    {
+      Left[i] = (f32)(0.5 * sin(2.0 * M_PI * Phase));
+      Right[i] = -Left[i];
+      Phase += 1000.0 / BENCH_RATE;
+      Phase -= Phase >= 1.0 ? 1.0 : 0.0;
+    }
+    NetSenderSend(&Data->Sender, Channels, BENCH_SEND_FRAMES);
+    SleepUntil(Start + (u64)(Period * (f64)Cycle));
+  }
+  return 0;
+}
+
+// NOTE(robin): Our stand-in for a bad network
+void* RelayThread(void* Context)
+{
+  bench_data* Data = Context;
+  scenario* Scenario = &Data->Scenario;
+  RunAsRemote();
+
+  int Socket = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in Address = {0};
+  Address.sin_family = AF_INET;
+  Address.sin_port = htons(BENCH_RELAY_PORT);
+  Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int Bound = bind(Socket, (struct sockaddr*)&Address, sizeof(Address));
+  assert(Bound == 0);
+  Address.sin_port = htons(BENCH_RECEIVE_PORT);
+
+  // NOTE(robin): The delay counts from when the sender's clock says the packet was ready,
+  // taking the first packet as on time, rather than from when we got around to it. Otherwise
+  // a stall of ours (the sender and relay stop along with everything else) would add to the
+  // delay of everything sent around it, which no link does.
+  f64 FramesPerNanosecond = 1e-9 * BENCH_RATE * (1.0 + 1e-6 * Scenario->Drift);
+  u32 FirstTimestamp = 0;
+  u64 FirstTime = 0;
+
+  u32 DelayedCount = 0;
+  while (__atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE))
+  {
+    u64 Now = NetNow();
+    u64 Wait = 10000000;
+    for (u32 i = 0; i < DelayedCount; i++)
+    {
+      // NOTE(robin): One that fell due since we last sent isn't a reason to wait 10ms
+      u64 Left = Data->Delayed[i].Due > Now ? Data->Delayed[i].Due - Now : 0;
+      Wait = Left < Wait ? Left : Wait;
+    }
+
+    struct pollfd FD = {Socket, POLLIN, 0};
+    struct timespec Timeout = {0, (long)Wait};
+    if (ppoll(&FD, 1, &Timeout, 0) > 0)
+    {
+      delayed_packet Packet;
+      ssize_t Size;
+      while ((Size = recv(Socket, Packet.Data, sizeof(Packet.Data), MSG_DONTWAIT)) > 0)
+      {
+        if (Random01(&Data->Random) < Scenario->Loss || DelayedCount == BENCH_MAX_DELAYED)
+        {
+          Data->Dropped++;
+          continue;
+        }
+
+        u32 Timestamp = NetRead32(Packet.Data + 4);
+        if (!FirstTime)
+        {
+          FirstTimestamp = Timestamp;
+          FirstTime = NetNow();
+        }
+
+        u64 Ready = FirstTime + (u64)((f64)(Timestamp - FirstTimestamp) / FramesPerNanosecond);
+        Packet.Size = (u32)Size;
+        Packet.Due = Ready + (u64)(1e6 * Scenario->DelayMS * Random01(&Data->Random));
+        Data->Delayed[DelayedCount++] = Packet;
+      }
+    }
+
+    Now = NetNow();
+    for (u32 i = 0; i < DelayedCount;)
+    {
+      if (Data->Delayed[i].Due > Now)
+      {
+        i++;
+        continue;
+      }
+      sendto(Socket, Data->Delayed[i].Data, Data->Delayed[i].Size, 0, (struct sockaddr*)&Address, sizeof(Address));
+      Data->Delayed[i] = Data->Delayed[--DelayedCount];
+    }
+  }
+
+  close(Socket);
+  return 0;
+}
+
+u32 RunScenario(bench_data* Data, scenario Scenario, u32 Seconds)
+{
+  memset(Data, 0, sizeof(*Data));
+  Data->Scenario = Scenario;
+  Data->Random = 12345;
+  Data->Running = 1;
+
+  u32 Initialised = NetReceiverInit(&Data->Receiver, BENCH_RECEIVE_PORT, BENCH_CHANNELS, BENCH_PACKET_FRAMES, Scenario.Format, BENCH_RATE);
+  Initialised &= NetSenderInit(&Data->Sender, "127.0.0.1", BENCH_RELAY_PORT, BENCH_CHANNELS, BENCH_PACKET_FRAMES, Scenario.Format);
+  assert(Initialised);
+
+  pthread_t Relay, Sender;
+  pthread_create(&Relay, 0, RelayThread, Data);
+  pthread_create(&Sender, 0, SenderThread, Data);
+
+  // NOTE(robin): The playback side, paced by the receiver's (nominal) clock
+  static f32 Left[BENCH_PLAY_FRAMES], Right[BENCH_PLAY_FRAMES];
+  f32* Channels[] = {Left, Right};
+  u64 Period = 1000000000ull * BENCH_PLAY_FRAMES / BENCH_RATE;
+  u64 CycleCount = (u64)Seconds * BENCH_RATE / BENCH_PLAY_FRAMES;
+  u64 Start = NetNow();
+
+  f32 Twice = 2.0f * cosf(2.0f * (f32)M_PI * 1000.0f / BENCH_RATE);
+  f32 Previous[2] = {0, 0};
+  u32 Glitches = 0, Started = 0;
+  f64 DriftSum = 0, DriftSquares = 0;
+  u32 DriftCount = 0;
+  for (u64 Cycle = 1; Cycle <= CycleCount; Cycle++)
+  {
+    SleepUntil(Start + Period * Cycle);
+    NetReceiverRead(&Data->Receiver, Channels, BENCH_PLAY_FRAMES);
+
+    for (u32 i = 0; i < BENCH_PLAY_FRAMES; i++)
+    {
+      if (Started > 2 && fabsf(Left[i] + Previous[0] - Twice * Previous[1]) > 0.01f)
+        Glitches++;
+      Started += Started || Left[i] != 0.0f;
+      Previous[0] = Previous[1];
+      Previous[1] = Left[i];
+    }
+
+    // NOTE(robin): Average the drift estimate over the second half, by when it has (nearly)
+    // all of its NET_DRIFT_WINDOWS
+    if (Cycle > CycleCount / 2)
+    {
+      DriftSum += Data->Receiver.Drift;
+      DriftSquares += Data->Receiver.Drift * Data->Receiver.Drift;
+      DriftCount++;
+    }
+  }
+
+  __atomic_store_n(&Data->Running, 0, __ATOMIC_RELEASE);
+  pthread_join(Sender, 0);
+  pthread_join(Relay, 0);
+  NetReceiverFree(&Data->Receiver);
+  NetSenderFree(&Data->Sender);
+
+  f64 Drift = 1e6 * DriftSum / DriftCount;
+  f64 Variance = DriftSquares / DriftCount - (DriftSum / DriftCount) * (DriftSum / DriftCount);
+  f64 Spread = 1e6 * sqrt(Variance > 0 ? Variance : 0);
+  printf("%s (%s, %.0fppm, %.0f%% loss, 0-%.0fms delay)\n", Scenario.Name,
+      Scenario.Format == NetFormatL24 ? "L24" : "float", Scenario.Drift, 100.0 * Scenario.Loss, Scenario.DelayMS);
+  printf("  sent %u, dropped by the relay %u, ", Data->Sender.Sent, Data->Dropped);
+  NetReceiverPrintStats(&Data->Receiver);
+  printf("  glitches %u, drift estimate %+.1fppm (second half average, spread %.1fppm)\n",
+      Glitches, Drift, Spread);
+
+  // NOTE(robin): Each window's average is off by a few frames (scheduling noise), which puts
+  // the estimate's own wander at 5-15ppm here, so we allow for that on top of a fixed 20ppm.
+  // Without loss nothing may be concealed or glitch, jitter or not; with loss we can't
+  // conceal more packets than the relay dropped (late ones count as concealed).
+  net_stats* Stats = &Data->Receiver.Stats;
+  u32 DriftFound = fabs(Drift - Scenario.Drift) < 20.0 + 3.0 * Spread;
+  u32 Passed = DriftFound && Stats->Resyncs == 0;
+  if (Scenario.Loss == 0)
+    Passed &= Glitches == 0 && Stats->Concealed == 0;
+  else
+    Passed &= Stats->Concealed <= Data->Dropped;
+
+  printf("  %s\n\n", Passed ? "passed" : "FAILED");
+  return Passed;
+}
+
+int main(int argc, char** argv)
+{
+  u32 Seconds = argc > 1 ? atoi(argv[1]) : 20;
+  static bench_data Data;
+
+  scenario Scenarios[] =
+  {
+    {"clean", NetFormatL24, 200, 0, 0},
+    {"loss", NetFormatL24, 200, 0.01, 0},
+    {"jitter", NetFormatL24, 200, 0, 5},
+    {"loss and jitter", NetFormatF32, -150, 0.02, 10},
+  };
+
+  u32 Passed = 1;
+  for (u32 i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++)
+    Passed &= RunScenario(&Data, Scenarios[i], Seconds);
+
+  printf("%s\n", Passed ? "Every scenario passed" : "FAILED");
+  return Passed ? 0 : 1;
+}
@@ -0,0 +1,763 @@
+/*
+ * This file streams audio over UDP as RTP: a sender that packetises the output of an audio
+ * callback, and a receiver that feeds a playback callback from an adaptive jitter buffer.
+ * Linux only (recvmmsg/sendmmsg), IPv4 unicast.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined and denormal.c, and #define
+ * _GNU_SOURCE before its first #include (for recvmmsg and sendmmsg).
+ *
+ *   // Sending side, in the callback
+ *   NetSenderSend(&Sender, Channels, FrameCount);
+ *
+ *   // Receiving side, in the callback (the network thread is started by NetReceiverInit)
+ *   NetReceiverRead(&Receiver, Channels, FrameCount);
+ *
+ * NOTE(robin): The packets are plain RTP (RFC 3550) with a fixed number of frames each,
+ * either L24 (RFC 3190, 24 bit big endian, what AES67 uses) or 32 bit big endian float,
+ * which isn't a registered format. Both ends have to agree on the format, the channel count
+ * and the frames per packet, as they would with an SDP file. Packets are kept below the
+ * Ethernet MTU (NET_MAX_PAYLOAD), since a lost IP fragment loses the whole packet.
+ *
+ * The sender runs in the callback: sendmmsg on a non-blocking socket doesn't wait for
+ * anything, it copies into the socket buffer or fails (counted as Dropped). All the packets
+ * of one callback go out with one system call.
+ *
+ * The receiver has a network thread that reads batches of packets with recvmmsg, checks
+ * them, and writes them into a ring of NET_SLOTS packet slots indexed by timestamp, so
+ * reordered packets land in the right place. The callback copies what it needs out of the
+ * slots, reading each slot like a seqlock (the slot's frame number is checked again after
+ * the copy), so neither side ever waits. A packet that hasn't arrived by the time it's
+ * played is replaced by silence, and is dropped if it turns up later.
+ *
+ * How far the playout point trails the newest packet (the fill) is the latency, and it has
+ * to cover the network jitter. The network thread estimates the interarrival jitter (RFC
+ * 3550 section 6.4.1, from kernel receive timestamps) and sets a target fill of a few
+ * times that, held for a while after peaks, plus a boost for every packet that came in
+ * too late. The callback plays slightly faster or slower (4 point Hermite interpolation)
+ * to follow the sender's sample clock, and to steer the fill towards the target.
+ *
+ * Following the sender's clock is the drift compensation: two devices at "48kHz" are
+ * typically 10 to 100ppm apart, which would otherwise overflow or drain any buffer within
+ * minutes. We estimate the drift from when the packets arrive rather than from the fill
+ * (see NetReceiverRead), because the fill also moves whenever the target does, and a
+ * controller that integrated the fill error would take every target change for drift. If
+ * the fill is way off (startup, a stall, the sender restarted its clock) we jump instead
+ * (a resync).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define NET_MAX_CHANNELS 8
+#define NET_MAX_PAYLOAD 1440
+#define NET_HEADER 12
+#define NET_MAX_BATCH 32
+#define NET_SLOTS 256 // NOTE(robin): Packets, a power of 2
+#define NET_SLOT_SAMPLES (NET_MAX_PAYLOAD / 3)
+#define NET_MAX_READ 2048 // NOTE(robin): Frames per NetReceiverRead
+#define NET_SCRATCH_FRAMES (NET_MAX_READ + NET_MAX_READ / 64 + 8)
+#define NET_MAX_RATIO 0.005 // NOTE(robin): Fastest/slowest we play, +-0.5%
+#define NET_DRIFT_WINDOWS 16 // NOTE(robin): Seconds of history for the drift estimate
+#define NET_WARMUP 100 // NOTE(robin): Packets we see before we start playing
+#define NET_PAYLOAD_L24 96
+#define NET_PAYLOAD_F32 97
+#define NET_EMPTY 0xFFFFFFFFFFFFFFFFull
+#define NET_WRITING 0xFFFFFFFFFFFFFFFEull
+
+typedef enum
+{
+  NetFormatL24,
+  NetFormatF32,
+} net_format;
+
+typedef struct
+{
+  int Socket;
+  struct sockaddr_in Destination;
+  u32 ChannelCount;
+  u32 FramesPerPacket;
+  u32 BytesPerSample;
+  u8 PayloadType;
+
+  u16 Sequence;
+  u32 Timestamp;
+  u32 SSRC;
+
+  u32 Pending; // NOTE(robin): Frames waiting in Frames for the rest of their packet
+  f32 Frames[NET_SLOT_SAMPLES];
+  u8 Packets[NET_MAX_BATCH][NET_HEADER + NET_MAX_PAYLOAD];
+  struct iovec Vectors[NET_MAX_BATCH];
+  struct mmsghdr Messages[NET_MAX_BATCH];
+
+  u32 Sent;
+  u32 Dropped;
+} net_sender;
+
+typedef struct
+{
+  u64 Frame; // NOTE(robin): Of the first frame in the packet, or NET_EMPTY/NET_WRITING
+  f32 Samples[NET_SLOT_SAMPLES];
+} net_slot;
+
+typedef struct
+{
+  u32 Received;
+  u32 Late;
+  u32 Duplicates;
+  u32 Invalid;
+  u32 Concealed;
+  u32 Resyncs;
+} net_stats;
+
+typedef struct
+{
+  int Socket;
+  pthread_t Thread;
+  u32 Quit;
+
+  u32 ChannelCount;
+  u32 FramesPerPacket;
+  u32 BytesPerSample;
+  u8 PayloadType;
+  f64 SampleRate;
+
+  // NOTE(robin): Written by the network thread. Frame numbers count from the first packet
+  // we received, and Highest is the end of the newest one, which arrived at HighestArrival
+  // (CLOCK_MONOTONIC nanoseconds, like NetNow).
+  u32 Started;
+  u32 SSRC;
+  u32 BaseTimestamp;
+  u64 Highest;
+  u64 HighestArrival;
+  u32 Target;
+  f64 Jitter;
+  f64 JitterHold;
+  f64 LateBoost;
+  f64 HoldDecay;
+  f64 LastTransit;
+
+  // NOTE(robin): Written by the callback
+  u32 Playing;
+  u64 Playout;
+  u64 Gathered; // NOTE(robin): End of the frames the last read copied out of the slots
+  f64 Position;
+  f64 Fill;
+  f64 Ratio;
+  f64 Drift;
+  u64 Counted;
+  u64 Nominal;
+  u64 LastRead;
+  u32 WindowFrames;
+  u32 WindowUsed;
+  u32 WindowCount;
+  f64 WindowSum;
+  f64 WindowX[NET_DRIFT_WINDOWS];
+  f64 WindowY[NET_DRIFT_WINDOWS];
+
+  net_stats Stats;
+
+  f32 Scratch[NET_SCRATCH_FRAMES * NET_MAX_CHANNELS];
+  net_slot Slots[NET_SLOTS];
+
+  u8 Packets[NET_MAX_BATCH][NET_HEADER + NET_MAX_PAYLOAD + 1];
+  u8 Control[NET_MAX_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+  struct iovec Vectors[NET_MAX_BATCH];
+  struct mmsghdr Messages[NET_MAX_BATCH];
+} net_receiver;
+
+static u64 NetNow(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+static void NetWrite16(u8* Bytes, u16 Value)
+{
+  Bytes[0] = (u8)(Value >> 8);
+  Bytes[1] = (u8)Value;
+}
+
+static void NetWrite32(u8* Bytes, u32 Value)
+{
+  Bytes[0] = (u8)(Value >> 24);
+  Bytes[1] = (u8)(Value >> 16);
+  Bytes[2] = (u8)(Value >> 8);
+  Bytes[3] = (u8)Value;
+}
+
+static u32 NetRead32(const u8* Bytes)
+{
+  return ((u32)Bytes[0] << 24) | ((u32)Bytes[1] << 16) | ((u32)Bytes[2] << 8) | (u32)Bytes[3];
+}
+
+u32 NetSenderInit(net_sender* Sender, const char* Address, u16 Port, u32 ChannelCount,
+    u32 FramesPerPacket, net_format Format)
+{
+  memset(Sender, 0, sizeof(*Sender));
+  Sender->ChannelCount = ChannelCount;
+  Sender->FramesPerPacket = FramesPerPacket;
+  Sender->BytesPerSample = Format == NetFormatL24 ? 3 : 4;
+  Sender->PayloadType = Format == NetFormatL24 ? NET_PAYLOAD_L24 : NET_PAYLOAD_F32;
+
+  if (!ChannelCount || ChannelCount > NET_MAX_CHANNELS || !FramesPerPacket ||
+      FramesPerPacket * ChannelCount * Sender->BytesPerSample > NET_MAX_PAYLOAD)
+    return 0;
+
+  Sender->Destination.sin_family = AF_INET;
+  Sender->Destination.sin_port = htons(Port);
+  if (inet_pton(AF_INET, Address, &Sender->Destination.sin_addr) != 1)
+    return 0;
+
+  Sender->Socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (Sender->Socket < 0)
+    return 0;
+
+  // NOTE(robin): DSCP EF (expedited forwarding), like AES67, for switches that honour it
+  int TOS = 0xB8;
+  setsockopt(Sender->Socket, IPPROTO_IP, IP_TOS, &TOS, sizeof(TOS));
+
+  // NOTE(robin): RFC 3550 wants these to start at random values
+  u64 Seed = NetNow() ^ ((u64)getpid() << 32);
+  Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+  Sender->SSRC = (u32)(Seed >> 32);
+  Seed = Seed * 6364136223846793005ull + 1442695040888963407ull;
+  Sender->Sequence = (u16)(Seed >> 48);
+  Sender->Timestamp = (u32)(Seed >> 16);
+
+  u32 PacketSize = NET_HEADER + FramesPerPacket * ChannelCount * Sender->BytesPerSample;
+  for (u32 i = 0; i < NET_MAX_BATCH; i++)
+  {
+    Sender->Vectors[i].iov_base = Sender->Packets[i];
+    Sender->Vectors[i].iov_len = PacketSize;
+    Sender->Messages[i].msg_hdr.msg_name = &Sender->Destination;
+    Sender->Messages[i].msg_hdr.msg_namelen = sizeof(Sender->Destination);
+    Sender->Messages[i].msg_hdr.msg_iov = &Sender->Vectors[i];
+    Sender->Messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  return 1;
+}
+
+void NetSenderFree(net_sender* Sender)
+{
+  close(Sender->Socket);
+}
+
+static void NetSenderFlush(net_sender* Sender, u32 PacketCount)
+{
+  if (!PacketCount)
+    return;
+
+  int Sent = sendmmsg(Sender->Socket, Sender->Messages, PacketCount, MSG_DONTWAIT);
+  Sent = Sent < 0 ? 0 : Sent;
+  Sender->Sent += Sent;
+  Sender->Dropped += PacketCount - Sent;
+}
+
+// NOTE(robin): Takes any number of planar frames, sends every packet that is complete and
+// keeps the rest for the next call
+void NetSenderSend(net_sender* Sender, const f32* const* Channels, u32 FrameCount)
+{
+  u32 ChannelCount = Sender->ChannelCount;
+  u32 FramesPerPacket = Sender->FramesPerPacket;
+  u32 PacketCount = 0;
+
+  for (u32 n = 0; n < FrameCount;)
+  {
+    u32 Count = FramesPerPacket - Sender->Pending;
+    Count = Count < FrameCount - n ? Count : FrameCount - n;
+    for (u32 i = 0; i < Count; i++)
+      for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+        Sender->Frames[(Sender->Pending + i) * ChannelCount + Channel] = Channels[Channel][n + i];
+    Sender->Pending += Count;
+    n += Count;
+
+    if (Sender->Pending < FramesPerPacket)
+      break;
+
+    u8* Packet = Sender->Packets[PacketCount++];
+    Packet[0] = 0x80; // NOTE(robin): Version 2, no padding, extension or CSRCs
+    Packet[1] = Sender->PayloadType;
+    NetWrite16(Packet + 2, Sender->Sequence++);
+    NetWrite32(Packet + 4, Sender->Timestamp);
+    NetWrite32(Packet + 8, Sender->SSRC);
+    Sender->Timestamp += FramesPerPacket;
+
+    u8* Payload = Packet + NET_HEADER;
+    u32 SampleCount = FramesPerPacket * ChannelCount;
+    if (Sender->BytesPerSample == 3)
+    {
+      for (u32 i = 0; i < SampleCount; i++)
+      {
+        f32 Sample = Sender->Frames[i] * 8388608.0f;
+        Sample = Sample > 8388607.0f ? 8388607.0f : Sample < -8388608.0f ? -8388608.0f : Sample;
+        s32 Value = (s32)lrintf(Sample);
+        Payload[3 * i + 0] = (u8)(Value >> 16);
+        Payload[3 * i + 1] = (u8)(Value >> 8);
+        Payload[3 * i + 2] = (u8)Value;
+      }
+    }
+    else
+    {
+      for (u32 i = 0; i < SampleCount; i++)
+      {
+        u32 Value;
+        memcpy(&Value, &Sender->Frames[i], sizeof(Value));
+        NetWrite32(Payload + 4 * i, Value);
+      }
+    }
+
+    Sender->Pending = 0;
+    if (PacketCount == NET_MAX_BATCH)
+    {
+      NetSenderFlush(Sender, PacketCount);
+      PacketCount = 0;
+    }
+  }
+
+  NetSenderFlush(Sender, PacketCount);
+}
+
+// NOTE(robin): The arrival time goes first, so a callback that sees the new Highest also
+// sees its arrival time (one that catches us in between gets a slightly newer arrival time
+// with the old Highest, which is a few nanoseconds of error in the drift estimate)
+static void NetSetHighest(net_receiver* Receiver, u64 Highest, u64 Arrival)
+{
+  __atomic_store_n(&Receiver->HighestArrival, Arrival, __ATOMIC_RELAXED);
+  __atomic_store_n(&Receiver->Highest, Highest, __ATOMIC_RELEASE);
+}
+
+static void NetReceivePacket(net_receiver* Receiver, const u8* Packet, u32 Size, u64 Arrival)
+{
+  u32 ChannelCount = Receiver->ChannelCount;
+  u32 FramesPerPacket = Receiver->FramesPerPacket;
+  u32 PayloadSize = FramesPerPacket * ChannelCount * Receiver->BytesPerSample;
+  net_stats* Stats = &Receiver->Stats;
+
+  if (Size != NET_HEADER + PayloadSize || Packet[0] != 0x80 || (Packet[1] & 0x7F) != Receiver->PayloadType)
+  {
+    Stats->Invalid++;
+    return;
+  }
+
+  u32 Timestamp = NetRead32(Packet + 4);
+  u32 SSRC = NetRead32(Packet + 8);
+  if (!Receiver->Started)
+  {
+    Receiver->SSRC = SSRC;
+    Receiver->BaseTimestamp = Timestamp;
+  }
+  else if (SSRC != Receiver->SSRC)
+  {
+    Stats->Invalid++;
+    return;
+  }
+
+  // NOTE(robin): Unwrap the 32 bit timestamp around the newest one we've seen
+  u32 Reference = Receiver->BaseTimestamp + (u32)Receiver->Highest;
+  s64 Frame = (s64)Receiver->Highest + (s32)(Timestamp - Reference);
+  if (Frame < 0 || Frame % FramesPerPacket)
+  {
+    Stats->Invalid++;
+    return;
+  }
+
+  // NOTE(robin): A packet is too late once the callback has read any of its frames (as
+  // silence), even if it hasn't played past all of them yet, so that it is counted as
+  // concealed rather than turning up half way through.
+  //
+  // Packets we can't store still move Highest, so that the callback sees that
+  // it has fallen behind (the sender stalled and carried on where it left off) or is too
+  // far ahead (the sender skipped), and resyncs
+  u64 End = (u64)Frame + FramesPerPacket;
+  u64 Playout = __atomic_load_n(&Receiver->Playout, __ATOMIC_ACQUIRE);
+  u32 Playing = __atomic_load_n(&Receiver->Playing, __ATOMIC_ACQUIRE);
+  u32 TooLate = Playing && (u64)Frame < __atomic_load_n(&Receiver->Gathered, __ATOMIC_ACQUIRE);
+  u32 TooEarly = Playing && (u64)Frame >= Playout + (NET_SLOTS / 2) * FramesPerPacket;
+  if (TooLate || TooEarly)
+  {
+    Stats->Late += TooLate;
+    Stats->Invalid += TooEarly;
+    Receiver->LateBoost += TooLate ? FramesPerPacket : 0;
+    if (End > Receiver->Highest)
+      NetSetHighest(Receiver, End, Arrival);
+    return;
+  }
+
+  net_slot* Slot = &Receiver->Slots[((u64)Frame / FramesPerPacket) % NET_SLOTS];
+  if (Slot->Frame == (u64)Frame)
+  {
+    Stats->Duplicates++;
+    return;
+  }
+
+  __atomic_store_n(&Slot->Frame, NET_WRITING, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  const u8* Payload = Packet + NET_HEADER;
+  u32 SampleCount = FramesPerPacket * ChannelCount;
+  if (Receiver->BytesPerSample == 3)
+  {
+    for (u32 i = 0; i < SampleCount; i++)
+    {
+      s32 Value = (s32)(((u32)Payload[3 * i] << 24) | ((u32)Payload[3 * i + 1] << 16) | ((u32)Payload[3 * i + 2] << 8)) >> 8;
+      Slot->Samples[i] = (f32)Value * (1.0f / 8388608.0f);
+    }
+  }
+  else
+  {
+    for (u32 i = 0; i < SampleCount; i++)
+    {
+      u32 Value = NetRead32(Payload + 4 * i);
+      memcpy(&Slot->Samples[i], &Value, sizeof(Value));
+    }
+  }
+  __atomic_store_n(&Slot->Frame, (u64)Frame, __ATOMIC_RELEASE);
+
+  if (End > Receiver->Highest || !Receiver->Started)
+    NetSetHighest(Receiver, End, Arrival);
+  Stats->Received++;
+
+  // NOTE(robin): RFC 3550 interarrival jitter, in frames. Transit is arrival minus send time
+  // plus an unknown constant, which cancels in the difference.
+  f64 Transit = 1e-9 * (f64)Arrival * Receiver->SampleRate - (f64)Frame;
+  if (Receiver->Started)
+  {
+    f64 Difference = fabs(Transit - Receiver->LastTransit);
+    Receiver->Jitter += (Difference - Receiver->Jitter) / 16.0;
+  }
+  Receiver->LastTransit = Transit;
+
+  // NOTE(robin): The jitter is a mean deviation, the peaks are a few times that
+  f64 Hold = Receiver->JitterHold * Receiver->HoldDecay;
+  Receiver->JitterHold = 4.0 * Receiver->Jitter > Hold ? 4.0 * Receiver->Jitter : Hold;
+  Receiver->LateBoost *= Receiver->HoldDecay;
+
+  f64 Target = 2.0 * FramesPerPacket + Receiver->JitterHold + Receiver->LateBoost;
+  f64 MaxTarget = (NET_SLOTS / 2 - 4) * FramesPerPacket;
+  Target = Target < MaxTarget ? Target : MaxTarget;
+  __atomic_store_n(&Receiver->Target, (u32)Target, __ATOMIC_RELEASE);
+
+  if (!Receiver->Started)
+    __atomic_store_n(&Receiver->Started, 1, __ATOMIC_RELEASE);
+}
+
+static void* NetReceiverThread(void* Context)
+{
+  net_receiver* Receiver = Context;
+
+  // NOTE(robin): Flush subnormals to zero on this thread, see denormal.c
+  fp_state FPState = FPEnterAudioThread();
+
+  // NOTE(robin): Below the audio thread, but above everything else
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2 - 1;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+
+  while (!__atomic_load_n(&Receiver->Quit, __ATOMIC_ACQUIRE))
+  {
+    for (u32 i = 0; i < NET_MAX_BATCH; i++)
+      Receiver->Messages[i].msg_hdr.msg_controllen = sizeof(Receiver->Control[i]);
+
+    // NOTE(robin): Blocks until at least one packet is there (or the receive timeout, so we
+    // notice Quit), then takes whatever else is queued
+    int Count = recvmmsg(Receiver->Socket, Receiver->Messages, NET_MAX_BATCH, MSG_WAITFORONE, 0);
+    if (Count <= 0)
+      continue;
+
+    // NOTE(robin): The kernel's receive timestamp (SO_TIMESTAMPNS) rather than when we got
+    // around to it, so the jitter estimate doesn't include our own scheduling. That one is
+    // CLOCK_REALTIME, which NTP slews and steps, so we only take how long ago it was from
+    // it and count back from CLOCK_MONOTONIC. A step between the packet and here only
+    // spoils that one packet's age, which we then leave out (a second is way more than any
+    // packet waits in the socket).
+    struct timespec Time;
+    clock_gettime(CLOCK_REALTIME, &Time);
+    u64 Now = NetNow();
+    u64 RealNow = (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+    for (int i = 0; i < Count; i++)
+    {
+      struct msghdr* Header = &Receiver->Messages[i].msg_hdr;
+      u64 Age = 0;
+      for (struct cmsghdr* Message = CMSG_FIRSTHDR(Header); Message; Message = CMSG_NXTHDR(Header, Message))
+      {
+        if (Message->cmsg_level == SOL_SOCKET && Message->cmsg_type == SCM_TIMESTAMPNS)
+        {
+          memcpy(&Time, CMSG_DATA(Message), sizeof(Time));
+          u64 Received = (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+          Age = RealNow - Received < 1000000000ull ? RealNow - Received : 0;
+        }
+      }
+
+      u64 Arrival = Now - Age;
+      NetReceivePacket(Receiver, Receiver->Packets[i], Receiver->Messages[i].msg_len, Arrival);
+    }
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+u32 NetReceiverInit(net_receiver* Receiver, u16 Port, u32 ChannelCount, u32 FramesPerPacket,
+    net_format Format, u32 SampleRate)
+{
+  memset(Receiver, 0, sizeof(*Receiver));
+  Receiver->ChannelCount = ChannelCount;
+  Receiver->FramesPerPacket = FramesPerPacket;
+  Receiver->BytesPerSample = Format == NetFormatL24 ? 3 : 4;
+  Receiver->PayloadType = Format == NetFormatL24 ? NET_PAYLOAD_L24 : NET_PAYLOAD_F32;
+  Receiver->SampleRate = (f64)SampleRate;
+  Receiver->Ratio = 1.0;
+
+  if (!ChannelCount || ChannelCount > NET_MAX_CHANNELS || !FramesPerPacket ||
+      FramesPerPacket * ChannelCount * Receiver->BytesPerSample > NET_MAX_PAYLOAD)
+    return 0;
+
+  // NOTE(robin): Jitter peaks are held for about 10 seconds. We start as if we had seen some,
+  // since the first few packets don't tell us much about the jitter yet.
+  Receiver->HoldDecay = exp(-(f64)FramesPerPacket / (10.0 * SampleRate));
+  Receiver->JitterHold = 2.0 * FramesPerPacket;
+  Receiver->Target = 4 * FramesPerPacket;
+  for (u32 i = 0; i < NET_SLOTS; i++)
+    Receiver->Slots[i].Frame = NET_EMPTY;
+
+  Receiver->Socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (Receiver->Socket < 0)
+    return 0;
+
+  struct sockaddr_in Address = {0};
+  Address.sin_family = AF_INET;
+  Address.sin_port = htons(Port);
+  Address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(Receiver->Socket, (struct sockaddr*)&Address, sizeof(Address)))
+  {
+    close(Receiver->Socket);
+    return 0;
+  }
+
+  // NOTE(robin): Room for a burst of a few hundred ms, and a timeout so we can notice Quit
+  int BufferSize = 1 << 20;
+  int On = 1;
+  struct timeval Timeout = {0, 100000};
+  setsockopt(Receiver->Socket, SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+  setsockopt(Receiver->Socket, SOL_SOCKET, SO_TIMESTAMPNS, &On, sizeof(On));
+  setsockopt(Receiver->Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+
+  for (u32 i = 0; i < NET_MAX_BATCH; i++)
+  {
+    Receiver->Vectors[i].iov_base = Receiver->Packets[i];
+    Receiver->Vectors[i].iov_len = sizeof(Receiver->Packets[i]);
+    Receiver->Messages[i].msg_hdr.msg_iov = &Receiver->Vectors[i];
+    Receiver->Messages[i].msg_hdr.msg_iovlen = 1;
+    Receiver->Messages[i].msg_hdr.msg_control = Receiver->Control[i];
+  }
+
+  if (pthread_create(&Receiver->Thread, 0, NetReceiverThread, Receiver))
+  {
+    close(Receiver->Socket);
+    return 0;
+  }
+  return 1;
+}
+
+void NetReceiverFree(net_receiver* Receiver)
+{
+  __atomic_store_n(&Receiver->Quit, 1, __ATOMIC_RELEASE);
+  pthread_join(Receiver->Thread, 0);
+  close(Receiver->Socket);
+}
+
+// NOTE(robin): Copies Count frames from Offset into the packet starting at Frame. Returns 0
+// if the packet isn't there (never arrived, or the slot was reused while we copied).
+static u32 NetCopyPacket(net_receiver* Receiver, u64 Frame, u32 Offset, u32 Count, f32* Output)
+{
+  net_slot* Slot = &Receiver->Slots[(Frame / Receiver->FramesPerPacket) % NET_SLOTS];
+  if (__atomic_load_n(&Slot->Frame, __ATOMIC_ACQUIRE) != Frame)
+    return 0;
+
+  u32 ChannelCount = Receiver->ChannelCount;
+  memcpy(Output, Slot->Samples + Offset * ChannelCount, Count * ChannelCount * sizeof(f32));
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&Slot->Frame, __ATOMIC_RELAXED) == Frame;
+}
+
+// NOTE(robin): Writes FrameCount (at most NET_MAX_READ) planar frames, silence until there
+// is enough buffered
+void NetReceiverRead(net_receiver* Receiver, f32** Channels, u32 FrameCount)
+{
+  u32 ChannelCount = Receiver->ChannelCount;
+  u32 FramesPerPacket = Receiver->FramesPerPacket;
+  FrameCount = FrameCount < NET_MAX_READ ? FrameCount : NET_MAX_READ;
+
+  u64 Highest = __atomic_load_n(&Receiver->Highest, __ATOMIC_ACQUIRE);
+  u64 HighestArrival = __atomic_load_n(&Receiver->HighestArrival, __ATOMIC_RELAXED);
+  f64 Target = (f64)__atomic_load_n(&Receiver->Target, __ATOMIC_ACQUIRE) + FrameCount + 2;
+  f64 Fill = (f64)Highest - Receiver->Position;
+
+  // NOTE(robin): Jump if we are far behind, or far ahead of what has arrived, or have run
+  // dry while packets are still coming in (we started too close to the newest one, or it
+  // came in early). Running dry while nothing comes in isn't enough: when the network or
+  // the whole machine stalls, the packets we missed are on their way, and we'd rather play
+  // on through the gap (it would be silence after a jump as well) and stay on the sender's
+  // timeline, which keeps the latency and the drift windows.
+  u64 Now = NetNow();
+  f64 Since = Now > HighestArrival ? 1e-9 * (f64)(Now - HighestArrival) : 0.0;
+  f64 Limit = (NET_SLOTS / 4) * FramesPerPacket;
+  u32 Dry = Fill < 0 && Since * Receiver->SampleRate < FrameCount;
+  if (!Receiver->Playing || Dry || Fill < -Limit || Fill > Target + Limit)
+  {
+    // NOTE(robin): The first time round, we wait for the jitter estimate to settle, since
+    // every packet that is late while the target catches up is a glitch
+    u32 Received = __atomic_load_n(&Receiver->Stats.Received, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&Receiver->Started, __ATOMIC_ACQUIRE) || (f64)Highest < Target + 2 || Received < NET_WARMUP)
+    {
+      for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+        memset(Channels[Channel], 0, FrameCount * sizeof(f32));
+      return;
+    }
+
+    Receiver->Stats.Resyncs += Receiver->Playing;
+    Receiver->Position = (f64)Highest - Target;
+    Receiver->Counted = (u64)Receiver->Position / FramesPerPacket;
+    Receiver->Fill = Fill = Target;
+    Receiver->Nominal = 0;
+    Receiver->LastRead = 0;
+    Receiver->WindowFrames = 0;
+    Receiver->WindowUsed = 0;
+    Receiver->WindowCount = 0;
+    Receiver->WindowSum = 0;
+    __atomic_store_n(&Receiver->Playout, (u64)Receiver->Position, __ATOMIC_RELEASE);
+    __atomic_store_n(&Receiver->Gathered, (u64)Receiver->Position - 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&Receiver->Playing, 1, __ATOMIC_RELEASE);
+  }
+
+  // NOTE(robin): Drift: where the sender is now, minus the frames we have played at the
+  // nominal rate, goes up by the clock difference. Where the sender is now is the newest
+  // frame plus the time since it arrived, rather than just the newest frame, which only
+  // moves a packet at a time: if our period is a multiple of the packet time, we'd sample
+  // that staircase at the same point of every step and never see it drift. The average
+  // over a second of that goes into a least squares line over the last NET_DRIFT_WINDOWS
+  // seconds, and its slope is the drift. Network delay only adds noise around the line, and
+  // target changes don't touch it, unlike the fill.
+  //
+  // Only callbacks that come about a period after the one before are used. A late one sees
+  // the sender a stall further on than our frame count says, and the ones that catch up
+  // after it see the opposite; a few of those a second were enough to throw a window's
+  // average off by several frames, which is tens of ppm on the slope.
+  f64 Offset = (f64)Highest + Since * Receiver->SampleRate - (f64)Receiver->Nominal;
+  f64 Interval = 1e-9 * (f64)(s64)(Now - Receiver->LastRead) * Receiver->SampleRate;
+  if (Receiver->LastRead && fabs(Interval - FrameCount) < 0.5 * FrameCount)
+  {
+    Receiver->WindowSum += Offset * FrameCount;
+    Receiver->WindowUsed += FrameCount;
+  }
+  Receiver->LastRead = Now;
+  Receiver->Nominal += FrameCount;
+  Receiver->WindowFrames += FrameCount;
+  if (Receiver->WindowFrames >= (u32)Receiver->SampleRate && Receiver->WindowUsed)
+  {
+    u32 Index = Receiver->WindowCount++ % NET_DRIFT_WINDOWS;
+    Receiver->WindowX[Index] = (f64)Receiver->Nominal;
+    Receiver->WindowY[Index] = Receiver->WindowSum / Receiver->WindowUsed;
+    Receiver->WindowSum = 0;
+    Receiver->WindowFrames = 0;
+    Receiver->WindowUsed = 0;
+
+    u32 Count = Receiver->WindowCount < NET_DRIFT_WINDOWS ? Receiver->WindowCount : NET_DRIFT_WINDOWS;
+    if (Count >= 4)
+    {
+      f64 MeanX = 0, MeanY = 0, Covariance = 0, Variance = 0;
+      for (u32 i = 0; i < Count; i++)
+      {
+        MeanX += Receiver->WindowX[i] / Count;
+        MeanY += Receiver->WindowY[i] / Count;
+      }
+      for (u32 i = 0; i < Count; i++)
+      {
+        Covariance += (Receiver->WindowX[i] - MeanX) * (Receiver->WindowY[i] - MeanY);
+        Variance += (Receiver->WindowX[i] - MeanX) * (Receiver->WindowX[i] - MeanX);
+      }
+      f64 Drift = Covariance / Variance;
+      Receiver->Drift = Drift > NET_MAX_RATIO ? NET_MAX_RATIO : Drift < -NET_MAX_RATIO ? -NET_MAX_RATIO : Drift;
+    }
+  }
+
+  // NOTE(robin): Play at the drift, plus a correction that brings the (smoothed) fill to
+  // the target in about 2 seconds
+  f64 Seconds = (f64)FrameCount / Receiver->SampleRate;
+  Receiver->Fill += (Fill - Receiver->Fill) * (Seconds / 0.5 < 1.0 ? Seconds / 0.5 : 1.0);
+  f64 Error = Receiver->Fill - Target;
+  f64 Ratio = 1.0 + Receiver->Drift + 0.5 * Error / Receiver->SampleRate;
+  Ratio = Ratio > 1.0 + NET_MAX_RATIO ? 1.0 + NET_MAX_RATIO : Ratio < 1.0 - NET_MAX_RATIO ? 1.0 - NET_MAX_RATIO : Ratio;
+  Receiver->Ratio = Ratio;
+
+  // NOTE(robin): Gather the frames we interpolate from, one before and two after
+  f64 Position = Receiver->Position;
+  u64 First = (u64)Position - 1;
+  u64 Last = (u64)(Position + (f64)(FrameCount - 1) * Ratio) + 2;
+  __atomic_store_n(&Receiver->Gathered, Last + 1, __ATOMIC_SEQ_CST);
+  for (u64 Frame = First; Frame <= Last;)
+  {
+    u64 Packet = Frame / FramesPerPacket * FramesPerPacket;
+    u32 Offset = (u32)(Frame - Packet);
+    u32 Count = FramesPerPacket - Offset;
+    Count = Count < Last + 1 - Frame ? Count : (u32)(Last + 1 - Frame);
+
+    f32* Output = Receiver->Scratch + (Frame - First) * ChannelCount;
+    if (!NetCopyPacket(Receiver, Packet, Offset, Count, Output))
+      memset(Output, 0, Count * ChannelCount * sizeof(f32));
+    Frame += Count;
+  }
+
+  for (u32 n = 0; n < FrameCount; n++)
+  {
+    f64 Point = Position + (f64)n * Ratio;
+    u64 Index = (u64)Point;
+    f32 T = (f32)(Point - (f64)Index);
+    const f32* Y = Receiver->Scratch + (Index - 1 - First) * ChannelCount;
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+    {
+      f32 Y0 = Y[Channel], Y1 = Y[ChannelCount + Channel];
+      f32 Y2 = Y[2 * ChannelCount + Channel], Y3 = Y[3 * ChannelCount + Channel];
+      f32 C1 = 0.5f * (Y2 - Y0);
+      f32 C2 = Y0 - 2.5f * Y1 + 2.0f * Y2 - 0.5f * Y3;
+      f32 C3 = 0.5f * (Y3 - Y0) + 1.5f * (Y1 - Y2);
+      Channels[Channel][n] = ((C3 * T + C2) * T + C1) * T + Y1;
+    }
+  }
+
+  Receiver->Position = Position + (f64)FrameCount * Ratio;
+  u64 Playout = (u64)Receiver->Position;
+  __atomic_store_n(&Receiver->Playout, Playout, __ATOMIC_RELEASE);
+
+  // NOTE(robin): Count the packets we have now played past that never made it
+  for (; (Receiver->Counted + 1) * FramesPerPacket <= Playout; Receiver->Counted++)
+  {
+    u64 Frame = Receiver->Counted * FramesPerPacket;
+    net_slot* Slot = &Receiver->Slots[Receiver->Counted % NET_SLOTS];
+    if (__atomic_load_n(&Slot->Frame, __ATOMIC_ACQUIRE) != Frame)
+      Receiver->Stats.Concealed++;
+  }
+}
+
+void NetReceiverPrintStats(net_receiver* Receiver)
+{
+  net_stats* Stats = &Receiver->Stats;
+  f64 Milliseconds = 1000.0 / Receiver->SampleRate;
+  printf("received %u, late %u, duplicates %u, invalid %u, concealed %u, resyncs %u\n",
+      Stats->Received, Stats->Late, Stats->Duplicates, Stats->Invalid, Stats->Concealed, Stats->Resyncs);
+  printf("jitter %.2fms, target %.2fms, fill %.2fms, clock ratio %+.1fppm\n",
+      Receiver->Jitter * Milliseconds, (f64)Receiver->Target * Milliseconds,
+      Receiver->Fill * Milliseconds, Receiver->Drift * 1e6);
+}
@@ -0,0 +1,46 @@
+/*
+ * The interface between a DSP plugin built as a shared object and hotreload.c, which loads
+ * it. A plugin exports one function, PluginGetAPI, that returns a pointer to a static
+ * plugin_api. See plugin_example.c.
+ *
+ * All buffers are planar: one pointer per channel, FrameCount samples each. Inputs and
+ * outputs never overlap.
+ *
+ * Only Process and SaveState run on the audio thread, so they must not allocate, lock, or
+ * make system calls. Init, LoadState and Teardown run on the thread that loads plugins,
+ * where anything goes: Init should allocate everything Process will need for up to
+ * MaxFrames frames.
+ *
+ * State migration: when a new build replaces a running one, the host asks the old instance
+ * for its state with SaveState (on the audio thread, between two Process calls) and hands
+ * it to LoadState of the new instance. The state is whatever bytes the plugin wants it to
+ * be, tagged with StateVersion so a new build can read (or ignore) the state of an old one
+ * with a different layout. Both are optional.
+ */
+
+#ifndef SIMPLE_NATIVE_AUDIO_PLUGIN_H
+#define SIMPLE_NATIVE_AUDIO_PLUGIN_H
+
+#include "types.h"
+
+#define PLUGIN_API_VERSION 1
+#define PLUGIN_ENTRY_POINT "PluginGetAPI"
+
+typedef struct
+{
+  u32 APIVersion; // NOTE(robin): PLUGIN_API_VERSION when the plugin was built
+  const char* Name;
+  u32 StateVersion;
+
+  void* (*Init)(f32 SampleRate, u32 ChannelCount, u32 MaxFrames);
+  void (*Process)(void* Instance, const f32* const* Inputs, f32** Outputs, u32 FrameCount);
+  void (*Teardown)(void* Instance);
+
+  // NOTE(robin): SaveState returns the number of bytes it wrote, at most Capacity
+  u32 (*SaveState)(void* Instance, void* State, u32 Capacity);
+  void (*LoadState)(void* Instance, const void* State, u32 Size, u32 StateVersion);
+} plugin_api;
+
+typedef const plugin_api* plugin_get_api(void);
+
+#endif
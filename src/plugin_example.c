@@ -0,0 +1,140 @@
+/*
+ * This file is an example DSP plugin for hotreload.c: a state variable lowpass filter
+ * followed by a tremolo. Build it as a shared object:
+ *
+ *   clang -O2 -shared -fPIC plugin_example.c -o plugin_a.so -lm
+ *   clang -O2 -shared -fPIC -DPLUGIN_VARIANT=1 plugin_example.c -o plugin_b.so -lm
+ *
+ * The two variants stand in for two builds of the same plugin while you work on it: they
+ * have a different cutoff and tremolo rate, and the same state layout, so the filter and
+ * the tremolo phase carry over when one replaces the other.
+ *
+ * NOTE(robin): Everything but PluginGetAPI is static, so the only symbol we export is the
+ * entry point and two loaded builds can't resolve each other's functions.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin.h"
+
+#ifndef PLUGIN_VARIANT
+#define PLUGIN_VARIANT 0
+#endif
+
+#if PLUGIN_VARIANT == 0
+#define EXAMPLE_NAME "Example A"
+#define EXAMPLE_CUTOFF 2000.0f
+#define EXAMPLE_RATE 4.0f
+#else
+#define EXAMPLE_NAME "Example B"
+#define EXAMPLE_CUTOFF 800.0f
+#define EXAMPLE_RATE 6.0f
+#endif
+
+#define EXAMPLE_MAX_CHANNELS 8
+#define EXAMPLE_STATE_VERSION 1
+
+// NOTE(robin): What carries over from one build to the next, keep the layout or bump
+// EXAMPLE_STATE_VERSION
+typedef struct
+{
+  f32 Phase;
+  f32 Low[EXAMPLE_MAX_CHANNELS];
+  f32 Band[EXAMPLE_MAX_CHANNELS];
+} example_state;
+
+typedef struct
+{
+  u32 ChannelCount;
+  f32 F;
+  f32 Q;
+  f32 PhaseDelta;
+  example_state State;
+} example_plugin;
+
+static void* ExampleInit(f32 SampleRate, u32 ChannelCount, u32 MaxFrames)
+{
+  if (ChannelCount > EXAMPLE_MAX_CHANNELS)
+    return 0;
+
+  example_plugin* Plugin = calloc(1, sizeof(example_plugin));
+  if (!Plugin)
+    return 0;
+  Plugin->ChannelCount = ChannelCount;
+  Plugin->F = 2.0f * sinf((f32)M_PI * EXAMPLE_CUTOFF / SampleRate);
+  Plugin->Q = 1.0f / 0.707f;
+  Plugin->PhaseDelta = EXAMPLE_RATE / SampleRate;
+  return Plugin;
+}
+
+static void ExampleProcess(void* Instance, const f32* const* Inputs, f32** Outputs, u32 FrameCount)
+{
+  example_plugin* Plugin = Instance;
+  example_state* State = &Plugin->State;
+
+  for (u32 Channel = 0; Channel < Plugin->ChannelCount; Channel++)
+  {
+    // NOTE(robin): Chamberlin state variable filter
+    f32 Low = State->Low[Channel], Band = State->Band[Channel];
+    for (u32 i = 0; i < FrameCount; i++)
+    {
+      Low += Plugin->F * Band;
+      f32 High = Inputs[Channel][i] - Low - Plugin->Q * Band;
+      Band += Plugin->F * High;
+      Outputs[Channel][i] = Low;
+    }
+    State->Low[Channel] = Low;
+    State->Band[Channel] = Band;
+  }
+
+  f32 Phase = State->Phase;
+  for (u32 i = 0; i < FrameCount; i++)
+  {
+    f32 Gain = 0.7f + 0.3f * sinf(2.0f * (f32)M_PI * Phase);
+    for (u32 Channel = 0; Channel < Plugin->ChannelCount; Channel++)
+      Outputs[Channel][i] *= Gain;
+    Phase += Plugin->PhaseDelta;
+    Phase -= Phase >= 1.0f ? 1.0f : 0.0f;
+  }
+  State->Phase = Phase;
+}
+
+static void ExampleTeardown(void* Instance)
+{
+  free(Instance);
+}
+
+static u32 ExampleSaveState(void* Instance, void* State, u32 Capacity)
+{
+  example_plugin* Plugin = Instance;
+  if (Capacity < sizeof(example_state))
+    return 0;
+  memcpy(State, &Plugin->State, sizeof(example_state));
+  return sizeof(example_state);
+}
+
+static void ExampleLoadState(void* Instance, const void* State, u32 Size, u32 StateVersion)
+{
+  example_plugin* Plugin = Instance;
+  if (StateVersion == EXAMPLE_STATE_VERSION && Size == sizeof(example_state))
+    memcpy(&Plugin->State, State, sizeof(example_state));
+}
+
+static const plugin_api ExampleAPI =
+{
+  PLUGIN_API_VERSION,
+  EXAMPLE_NAME,
+  EXAMPLE_STATE_VERSION,
+  ExampleInit,
+  ExampleProcess,
+  ExampleTeardown,
+  ExampleSaveState,
+  ExampleLoadState,
+};
+
+const plugin_api* PluginGetAPI(void)
+{
+  return &ExampleAPI;
+}
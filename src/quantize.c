@@ -0,0 +1,371 @@
+/*
+ * This file provides a float to integer output stage for 16/24/32 bit devices: saturating
+ * conversion, TPDF dither and optional noise shaping, all done a block at a time.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): The naive conversion, (s32)(SampleMaxValue * Sample), has two problems:
+ *
+ * - Samples outside of [-1, 1] overflow and wrap around, so a tiny overshoot turns into a
+ *   full scale click. We clamp instead.
+ * - Truncating low level signals produces distortion that is correlated with the signal.
+ *   Adding triangular (TPDF) dither of +-1 LSB before rounding turns that into a constant,
+ *   signal independent noise floor.
+ *
+ * Noise shaping goes one step further and filters the quantisation error so that more of the
+ * noise ends up at frequencies where we can't hear it. We use the usual error feedback
+ * structure:
+ *
+ *   v[n] = x[n] - sum(H[k] * e[n - 1 - k])
+ *   y[n] = round(v[n] + dither)
+ *   e[n] = y[n] - v[n]
+ *
+ * The quantiser writes integers in the range of the target bit depth into an s32 buffer.
+ * QuantizePack then writes those into the device buffer (16 bit, packed 24 bit, 24 in 32 etc.)
+ *
+ * Dither uses a counter based PRNG: the random number for frame n of a channel is a hash of
+ * the channel's position (plus n) mixed with a per channel seed. Unlike xorshift or an LCG
+ * there is no dependency from one random number to the next, so the unshaped path vectorises
+ * along time. The noise shaping filter is recursive so it can't be vectorised along time;
+ * QuantizeChannels processes the shaped case 8 channels at a time instead.
+ */
+
+#include <math.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define restrict __restrict
+#endif
+
+#define QUANTIZE_MAX_CHANNELS 128
+#define QUANTIZE_LANES 8
+#define QUANTIZE_MAX_TAPS 9
+
+typedef enum
+{
+  QuantizeShapeNone,
+  QuantizeShapeFirstOrder,  // NOTE(robin): NTF = 1 - z^-1, +6dB/octave
+  QuantizeShapeSecondOrder, // NOTE(robin): NTF = (1 - z^-1)^2, +12dB/octave
+  QuantizeShapeLipshitz,    // NOTE(robin): 9 tap psychoacoustic filter for 44.1/48kHz
+
+  QuantizeShapeCount,
+} quantize_shape;
+
+typedef struct
+{
+  u32 Bits; // NOTE(robin): Bit depth of the output, e.g. 16 or 24
+  u32 Dither;
+  quantize_shape Shape;
+  u32 TapCount;
+  f32 Taps[QUANTIZE_MAX_TAPS];
+  f32 Scale; // NOTE(robin): 1.0 in the input is this many LSBs
+  f32 Min;
+  f32 Max;
+
+  u32 Seed[QUANTIZE_MAX_CHANNELS];
+  u32 Position[QUANTIZE_MAX_CHANNELS]; // NOTE(robin): Frames quantised so far
+  f32 Error[QUANTIZE_MAX_CHANNELS][QUANTIZE_MAX_TAPS]; // NOTE(robin): Error[0] is the newest
+} quantizer;
+
+// NOTE(robin): Lipshitz, Vanderkooy and Wannamaker, "Minimally audible noise shaping" (1991)
+static const f32 QuantizeLipshitzTaps[9] =
+{
+  2.412f, -3.370f, 3.937f, -4.174f, 3.353f, -2.205f, 1.281f, -0.569f, 0.0847f,
+};
+
+void QuantizerInit(quantizer* Quantizer, u32 Bits, u32 Dither, quantize_shape Shape)
+{
+  *Quantizer = (quantizer){0};
+  Quantizer->Bits = Bits;
+  Quantizer->Dither = Dither;
+  Quantizer->Shape = Shape;
+
+  switch (Shape)
+  {
+    case QuantizeShapeFirstOrder:
+    {
+      Quantizer->TapCount = 1;
+      Quantizer->Taps[0] = 1.0f;
+    } break;
+
+    case QuantizeShapeSecondOrder:
+    {
+      Quantizer->TapCount = 2;
+      Quantizer->Taps[0] = 2.0f;
+      Quantizer->Taps[1] = -1.0f;
+    } break;
+
+    case QuantizeShapeLipshitz:
+    {
+      Quantizer->TapCount = 9;
+      for (u32 i = 0; i < 9; i++)
+        Quantizer->Taps[i] = QuantizeLipshitzTaps[i];
+    } break;
+
+    default:
+    {
+      Quantizer->Shape = QuantizeShapeNone;
+    } break;
+  }
+
+  // NOTE(robin): 1.0 maps to 2^(Bits - 1), matching DSPConvertS16ToF32 and friends. The top of
+  // the range is one LSB short of that. For 32 bits neither end is representable as a float,
+  // so we use the largest float that still fits.
+  Quantizer->Scale = (f32)(1u << (Bits - 1));
+  Quantizer->Min = -Quantizer->Scale;
+  Quantizer->Max = Bits >= 25 ? Quantizer->Scale - (f32)(1u << (Bits - 25)) : Quantizer->Scale - 1.0f;
+
+  for (u32 Channel = 0; Channel < QUANTIZE_MAX_CHANNELS; Channel++)
+    Quantizer->Seed[Channel] = Channel * 0x9E3779B9u + 0x7F4A7C15u;
+}
+
+// NOTE(robin): TPDF dither in LSBs, in (-1, 1). The hash is Chris Wellons' "lowbias32", each
+// 32 bit result gives us two 16 bit uniform random numbers and the sum of two uniform
+// distributions is triangular.
+static inline f32 QuantizeDither(u32 Seed, u32 Position)
+{
+  u32 X = Position ^ Seed;
+  X ^= X >> 16;
+  X *= 0x7FEB352Du;
+  X ^= X >> 15;
+  X *= 0x846CA68Bu;
+  X ^= X >> 16;
+
+  return ((f32)(s32)(X & 0xFFFF) + (f32)(s32)(X >> 16) - 65535.0f) * (1.0f / 65536.0f);
+}
+
+static inline s32 QuantizeRound(f32 Value, f32 Min, f32 Max)
+{
+  Value = Value > Max ? Max : Value;
+  Value = Value < Min ? Min : Value;
+  return (s32)(Value + copysignf(0.5f, Value));
+}
+
+// NOTE(robin): Unshaped path, optionally dithered. Every frame is independent so this vectorises.
+void QuantizeUnshaped(quantizer* Quantizer, u32 Channel,
+    s32* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  f32 Scale = Quantizer->Scale;
+  f32 Min = Quantizer->Min;
+  f32 Max = Quantizer->Max;
+  u32 Seed = Quantizer->Seed[Channel];
+  u32 Position = Quantizer->Position[Channel];
+
+  if (Quantizer->Dither)
+  {
+    for (u32 Frame = 0; Frame < FrameCount; Frame++)
+    {
+      f32 Value = Input[Frame] * Scale + QuantizeDither(Seed, Position + Frame);
+      Output[Frame] = QuantizeRound(Value, Min, Max);
+    }
+  }
+  else
+  {
+    for (u32 Frame = 0; Frame < FrameCount; Frame++)
+      Output[Frame] = QuantizeRound(Input[Frame] * Scale, Min, Max);
+  }
+
+  Quantizer->Position[Channel] = Position + FrameCount;
+}
+
+// NOTE(robin): Noise shaped path for a single channel
+void QuantizeShaped(quantizer* Quantizer, u32 Channel,
+    s32* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  f32 Scale = Quantizer->Scale;
+  f32 Min = Quantizer->Min;
+  f32 Max = Quantizer->Max;
+  f32 DitherAmount = Quantizer->Dither ? 1.0f : 0.0f;
+  u32 TapCount = Quantizer->TapCount;
+  f32* Taps = Quantizer->Taps;
+  f32* Error = Quantizer->Error[Channel];
+  u32 Seed = Quantizer->Seed[Channel];
+  u32 Position = Quantizer->Position[Channel];
+
+  for (u32 Frame = 0; Frame < FrameCount; Frame++)
+  {
+    f32 Feedback = 0;
+    for (u32 Tap = 0; Tap < TapCount; Tap++)
+      Feedback += Taps[Tap] * Error[Tap];
+
+    f32 Wanted = Input[Frame] * Scale - Feedback;
+    s32 Sample = QuantizeRound(Wanted + DitherAmount * QuantizeDither(Seed, Position + Frame), Min, Max);
+
+    for (u32 Tap = TapCount - 1; Tap > 0; Tap--)
+      Error[Tap] = Error[Tap - 1];
+
+    // NOTE(robin): Limit the error we feed back. When we're clipping the error is huge and
+    // feeding it back would make the filter go unstable.
+    f32 NewError = (f32)Sample - Wanted;
+    NewError = NewError > 2.0f ? 2.0f : NewError;
+    NewError = NewError < -2.0f ? -2.0f : NewError;
+    Error[0] = NewError;
+
+    Output[Frame] = Sample;
+  }
+
+  Quantizer->Position[Channel] = Position + FrameCount;
+}
+
+// NOTE(robin): Noise shaped path for QUANTIZE_LANES channels at once, each lane is a channel.
+// The per sample work is the same as QuantizeShaped but every operation is done for 8
+// independent channels so it vectorises across the lanes.
+void QuantizeShapedGroup(quantizer* Quantizer, u32 FirstChannel,
+    s32* const* Outputs, const f32* const* Inputs, u32 FrameCount)
+{
+  f32 Scale = Quantizer->Scale;
+  f32 Min = Quantizer->Min;
+  f32 Max = Quantizer->Max;
+  f32 DitherAmount = Quantizer->Dither ? 1.0f : 0.0f;
+  u32 TapCount = Quantizer->TapCount;
+
+  // NOTE(robin): Structure of arrays copies of the state so that each tap is one vector
+  f32 Error[QUANTIZE_MAX_TAPS][QUANTIZE_LANES];
+  u32 Seed[QUANTIZE_LANES];
+  u32 Position[QUANTIZE_LANES];
+  for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+  {
+    for (u32 Tap = 0; Tap < QUANTIZE_MAX_TAPS; Tap++)
+      Error[Tap][Lane] = Quantizer->Error[FirstChannel + Lane][Tap];
+    Seed[Lane] = Quantizer->Seed[FirstChannel + Lane];
+    Position[Lane] = Quantizer->Position[FirstChannel + Lane];
+  }
+
+  for (u32 Frame = 0; Frame < FrameCount; Frame++)
+  {
+    f32 Wanted[QUANTIZE_LANES];
+    for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+      Wanted[Lane] = Inputs[Lane][Frame] * Scale;
+
+    for (u32 Tap = 0; Tap < TapCount; Tap++)
+    {
+      f32 Coefficient = Quantizer->Taps[Tap];
+      for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+        Wanted[Lane] -= Coefficient * Error[Tap][Lane];
+    }
+
+    for (u32 Tap = TapCount - 1; Tap > 0; Tap--)
+    {
+      for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+        Error[Tap][Lane] = Error[Tap - 1][Lane];
+    }
+
+    for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+    {
+      s32 Sample = QuantizeRound(Wanted[Lane] + DitherAmount * QuantizeDither(Seed[Lane], Position[Lane] + Frame), Min, Max);
+
+      f32 NewError = (f32)Sample - Wanted[Lane];
+      NewError = NewError > 2.0f ? 2.0f : NewError;
+      NewError = NewError < -2.0f ? -2.0f : NewError;
+      Error[0][Lane] = NewError;
+
+      Outputs[Lane][Frame] = Sample;
+    }
+  }
+
+  for (u32 Lane = 0; Lane < QUANTIZE_LANES; Lane++)
+  {
+    for (u32 Tap = 0; Tap < QUANTIZE_MAX_TAPS; Tap++)
+      Quantizer->Error[FirstChannel + Lane][Tap] = Error[Tap][Lane];
+    Quantizer->Position[FirstChannel + Lane] = Position[Lane] + FrameCount;
+  }
+}
+
+// NOTE(robin): Quantises one channel. Output receives integers in the range of the quantiser's
+// bit depth. Channels from QUANTIZE_MAX_CHANNELS on have no dither position or error state,
+// they're only rounded and clipped.
+void QuantizeChannel(quantizer* Quantizer, u32 Channel,
+    s32* restrict Output, const f32* restrict Input, u32 FrameCount)
+{
+  if (Channel >= QUANTIZE_MAX_CHANNELS)
+  {
+    for (u32 Frame = 0; Frame < FrameCount; Frame++)
+      Output[Frame] = QuantizeRound(Input[Frame] * Quantizer->Scale, Quantizer->Min, Quantizer->Max);
+    return;
+  }
+
+  if (Quantizer->Shape == QuantizeShapeNone)
+    QuantizeUnshaped(Quantizer, Channel, Output, Input, FrameCount);
+  else
+    QuantizeShaped(Quantizer, Channel, Output, Input, FrameCount);
+}
+
+// NOTE(robin): Quantises ChannelCount planar channels. Prefer this over calling
+// QuantizeChannel in a loop when noise shaping is enabled.
+void QuantizeChannels(quantizer* Quantizer, s32* const* Outputs, const f32* const* Inputs,
+    u32 ChannelCount, u32 FrameCount)
+{
+  u32 Channel = 0;
+  if (Quantizer->Shape != QuantizeShapeNone)
+  {
+    u32 Grouped = ChannelCount < QUANTIZE_MAX_CHANNELS ? ChannelCount : QUANTIZE_MAX_CHANNELS;
+    for (; Channel + QUANTIZE_LANES <= Grouped; Channel += QUANTIZE_LANES)
+      QuantizeShapedGroup(Quantizer, Channel, Outputs + Channel, Inputs + Channel, FrameCount);
+  }
+
+  for (; Channel < ChannelCount; Channel++)
+    QuantizeChannel(Quantizer, Channel, Outputs[Channel], Inputs[Channel], FrameCount);
+}
+
+// NOTE(robin): Writes quantised samples into a device buffer.
+//
+// Stride is the distance between consecutive frames in samples (1 for planar buffers like
+// ASIO, the channel count for interleaved buffers like WASAPI). BytesPerSample is the size of
+// the container (2, 3 or 4). Shift moves the value up inside the container, e.g. 8 for 24 bit
+// samples that are left justified in a 32 bit container.
+void QuantizePack(void* Output, u32 Stride, const s32* restrict Samples, u32 FrameCount,
+    u32 BytesPerSample, u32 Shift, u32 IsBigEndian)
+{
+  switch (BytesPerSample)
+  {
+    case 2:
+    {
+      s16* Out = Output;
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        u16 Value = (u16)((u32)Samples[i] << Shift);
+        if (IsBigEndian)
+          Value = (u16)((Value >> 8) | (Value << 8));
+        Out[i * Stride] = (s16)Value;
+      }
+    } break;
+
+    case 3:
+    {
+      u8* Out = Output;
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        u32 Value = (u32)Samples[i] << Shift;
+        u8* Bytes = Out + 3 * i * Stride;
+        if (IsBigEndian)
+        {
+          Bytes[0] = (u8)(Value >> 16);
+          Bytes[1] = (u8)(Value >> 8);
+          Bytes[2] = (u8)Value;
+        }
+        else
+        {
+          Bytes[0] = (u8)Value;
+          Bytes[1] = (u8)(Value >> 8);
+          Bytes[2] = (u8)(Value >> 16);
+        }
+      }
+    } break;
+
+    case 4:
+    {
+      s32* Out = Output;
+      for (u32 i = 0; i < FrameCount; i++)
+      {
+        u32 Value = (u32)Samples[i] << Shift;
+        if (IsBigEndian)
+        {
+          Value = (Value >> 24) | ((Value >> 8) & 0xFF00) |
+                  ((Value << 8) & 0xFF0000) | (Value << 24);
+        }
+        Out[i * Stride] = (s32)Value;
+      }
+    } break;
+  }
+}
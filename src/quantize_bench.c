@@ -0,0 +1,167 @@
+/*
+ * This file benchmarks the float to integer output stages in quantize.c against the plain
+ * truncating conversion that the examples used to do, at 64 channels of 256 frames.
+ *
+ * The budget column is the share of one 256 frame period at 48kHz (5.3ms) that converting
+ * all 64 channels takes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+
+#include "types.h"
+#include "bench.c"
+#include "quantize.c"
+
+#define BENCH_CHANNELS 64
+#define BENCH_FRAMES 256
+
+typedef struct
+{
+  quantizer Quantizer;
+  f32* Inputs[BENCH_CHANNELS];
+  s32* Outputs[BENCH_CHANNELS];
+  s16* Device; // NOTE(robin): Interleaved 16 bit, like a WASAPI buffer
+} bench_data;
+
+// NOTE(robin): What the examples used to do, no clipping and truncation towards zero
+void BenchNaive(void* Context)
+{
+  bench_data* Data = Context;
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    f32* Input = Data->Inputs[Channel];
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+      Data->Device[Frame * BENCH_CHANNELS + Channel] = (s16)(s32)(Input[Frame] * 0x7FFF);
+  }
+}
+
+void BenchQuantize(void* Context)
+{
+  bench_data* Data = Context;
+  QuantizeChannels(&Data->Quantizer, Data->Outputs, (const f32* const*)Data->Inputs,
+      BENCH_CHANNELS, BENCH_FRAMES);
+
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+    QuantizePack(Data->Device + Channel, BENCH_CHANNELS, Data->Outputs[Channel], BENCH_FRAMES, 2, 0, 0);
+}
+
+// NOTE(robin): Out of range input must clip, not wrap around
+void VerifySaturation(bench_data* Data, u32 Bits, quantize_shape Shape)
+{
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+      Data->Inputs[Channel][Frame] = (Frame & 1) ? 4.0f : -4.0f;
+  }
+
+  QuantizerInit(&Data->Quantizer, Bits, 1, Shape);
+  QuantizeChannels(&Data->Quantizer, Data->Outputs, (const f32* const*)Data->Inputs,
+      BENCH_CHANNELS, BENCH_FRAMES);
+
+  s64 Max = (Bits == 32) ? 0x7FFFFF80 : (1ll << (Bits - 1)) - 1;
+  s64 Min = -(1ll << (Bits - 1));
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+    {
+      s32 Sample = Data->Outputs[Channel][Frame];
+      assert(Sample == ((Frame & 1) ? Max : Min));
+    }
+  }
+}
+
+// NOTE(robin): Quantises a quiet sine and returns the RMS error in LSBs
+f64 MeasureError(bench_data* Data, u32 Dither, quantize_shape Shape)
+{
+  QuantizerInit(&Data->Quantizer, 16, Dither, Shape);
+
+  f64 SquaredError = 0;
+  u32 Blocks = 64;
+  for (u32 Block = 0; Block < Blocks; Block++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+    {
+      f64 Time = (f64)(Block * BENCH_FRAMES + Frame) / 48000.0;
+      Data->Inputs[0][Frame] = (f32)(0.001 * sin(2 * 3.14159265358979 * 1000.0 * Time));
+    }
+
+    QuantizeChannel(&Data->Quantizer, 0, Data->Outputs[0], Data->Inputs[0], BENCH_FRAMES);
+
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+    {
+      f64 Error = Data->Outputs[0][Frame] - Data->Inputs[0][Frame] * 32768.0;
+      SquaredError += Error * Error;
+    }
+  }
+
+  return sqrt(SquaredError / (Blocks * BENCH_FRAMES));
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  Data.Device = malloc(BENCH_CHANNELS * BENCH_FRAMES * sizeof(s16));
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    Data.Inputs[Channel] = malloc(BENCH_FRAMES * sizeof(f32));
+    Data.Outputs[Channel] = malloc(BENCH_FRAMES * sizeof(s32));
+  }
+
+  for (u32 Shape = 0; Shape < QuantizeShapeCount; Shape++)
+  {
+    VerifySaturation(&Data, 16, Shape);
+    VerifySaturation(&Data, 24, Shape);
+    VerifySaturation(&Data, 32, Shape);
+  }
+  printf("Out of range samples clip at every bit depth\n\n");
+
+  // NOTE(robin): Dither and noise shaping increase the total error on purpose, the point is
+  // that it's no longer correlated with the signal. This is just a sanity check that the
+  // numbers are in the expected ballpark (~0.29 LSB for rounding, ~0.5 for TPDF).
+  printf("RMS error, 16 bit, -60dB sine: round %.3f, tpdf %.3f, first order %.3f, lipshitz %.3f LSB\n\n",
+      MeasureError(&Data, 0, QuantizeShapeNone),
+      MeasureError(&Data, 1, QuantizeShapeNone),
+      MeasureError(&Data, 1, QuantizeShapeFirstOrder),
+      MeasureError(&Data, 1, QuantizeShapeLipshitz));
+
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 Frame = 0; Frame < BENCH_FRAMES; Frame++)
+      Data.Inputs[Channel][Frame] = 0.5f * sinf((f32)(Frame * (Channel + 1)) * 0.01f);
+  }
+
+  struct
+  {
+    const char* Name;
+    u32 Dither;
+    quantize_shape Shape;
+  } Cases[] =
+  {
+    {"saturate", 0, QuantizeShapeNone},
+    {"tpdf", 1, QuantizeShapeNone},
+    {"tpdf + first order", 1, QuantizeShapeFirstOrder},
+    {"tpdf + second order", 1, QuantizeShapeSecondOrder},
+    {"tpdf + lipshitz", 1, QuantizeShapeLipshitz},
+  };
+
+  f64 PeriodNS = BENCH_FRAMES * 1e9 / 48000.0;
+  f64 Samples = BENCH_CHANNELS * BENCH_FRAMES;
+
+  printf("%d channels x %d frames, 16 bit interleaved output\n", BENCH_CHANNELS, BENCH_FRAMES);
+  printf("%-22s %10s %10s\n", "", "ns/sample", "budget");
+
+  f64 Naive = BenchMeasure(BenchNaive, &Data);
+  printf("%-22s %10.3f %9.3f%%\n", "naive (truncate)", Naive / Samples, 100.0 * Naive / PeriodNS);
+
+  for (u32 i = 0; i < sizeof(Cases) / sizeof(Cases[0]); i++)
+  {
+    QuantizerInit(&Data.Quantizer, 16, Cases[i].Dither, Cases[i].Shape);
+    f64 Time = BenchMeasure(BenchQuantize, &Data);
+    printf("%-22s %10.3f %9.3f%%\n", Cases[i].Name, Time / Samples, 100.0 * Time / PeriodNS);
+  }
+
+  return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * This file runs the expensive part of the audio (a synth, a big mix) on a worker thread a few
+ * periods ahead of the device, so that one slow block doesn't mean an xrun.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined, and denormal.c.
+ *
+ * NOTE(robin): Normally everything is computed in the callback, so the work for a period has
+ * to be done within that period, every single time. When the work is spiky (a voice steal that
+ * starts 50 voices, a preset change, a page fault), the average might use 20% of the period but
+ * one block in a thousand takes two periods, and that block is an xrun.
+ *
+ * Here a worker thread keeps a queue of up to TargetDepth rendered blocks and the callback only
+ * copies the oldest one out:
+ *
+ *   worker:   render -> [ block ][ block ][ block ][ block ] -> callback: copy out
+ *                       |<------- TargetDepth blocks ------>|
+ *
+ * A slow block now only has to be done before the queue runs dry, i.e. within TargetDepth
+ * periods, and the worker catches up afterwards because it renders faster than real time on
+ * average. The price is TargetDepth periods of extra latency for everything that goes
+ * through the queue, so:
+ *
+ * - Live input (monitoring, effects on a microphone) should stay in the callback, mixed in
+ *   after RenderAheadPull. Rendering it ahead would mean delaying it by the queue depth.
+ * - Control changes (notes, parameters) reach the worker right away, but are only heard after
+ *   the blocks already in the queue have been played.
+ *
+ * The depth can be changed at any time with RenderAheadSetDepth. A deeper queue fills up right
+ * away (the worker renders as fast as it can), a shallower one drains over the next periods
+ * since the worker stops rendering until the queue is below the new depth, so either way
+ * there's no discontinuity in the output.
+ *
+ * RenderAheadPull never blocks, allocates or takes locks: it posts a semaphore to wake the
+ * worker, which doesn't block. If the queue is empty it outputs silence and counts it, see
+ * render_ahead_stats. Everything is allocated in RenderAheadInit, for a fixed period size; if
+ * the period size changes (e.g. the JACK buffer size callback), free and init again.
+ *
+ * Usage:
+ *
+ *   render_ahead RenderAhead;
+ *   if (!RenderAheadInit(&RenderAhead, ChannelCount, FrameCount, MaxDepth, Render, Context))
+ *     ... out of range or out of memory ...
+ *   if (!RenderAheadStart(&RenderAhead, 4)) // NOTE(robin): Returns once 4 blocks are queued
+ *     ... no worker thread, render in the callback instead ...
+ *   ...
+ *   // In the callback
+ *   RenderAheadPull(&RenderAhead, Outputs);
+ *   ... add live input to Outputs ...
+ *   ...
+ *   RenderAheadFree(&RenderAhead);
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+
+// NOTE(robin): Trace markers for the worker and the queue, only recorded if trace.c was
+// included before this file
+#ifndef TRACE_ENABLED
+#define TraceThreadName(Name)
+#define TraceBegin(Name)
+#define TraceEnd(Name)
+#define TraceCounter(Name, Value)
+#endif
+
+#define RENDER_AHEAD_MAX_CHANNELS 32
+#define RENDER_AHEAD_MAX_DEPTH 64
+
+// NOTE(robin): Renders the next FrameCount frames of ChannelCount planar channels. Always
+// called from the worker thread.
+typedef void render_ahead_function(void* Context, f32* const* Outputs, u32 FrameCount);
+
+typedef struct
+{
+  u32 Depth;       // NOTE(robin): Blocks in the queue right now
+  u32 TargetDepth;
+  u32 MinDepth;    // NOTE(robin): Fewest blocks the callback found since the last read
+  u64 Pulls;
+  u64 MarginUsed;  // NOTE(robin): Pulls that found fewer than TargetDepth blocks
+  u64 Starved;     // NOTE(robin): Pulls that found no blocks at all and output silence
+  u64 WorstRender; // NOTE(robin): Nanoseconds, the slowest block since the last read
+} render_ahead_stats;
+
+typedef struct
+{
+  u32 ChannelCount;
+  u32 FrameCount;
+  u32 MaxDepth;
+  render_ahead_function* Render;
+  void* Context;
+
+  f32* Blocks; // NOTE(robin): [MaxDepth][ChannelCount][FrameCount]
+
+  // NOTE(robin): Blocks written and read since the start. Written is only written by the
+  // worker and Read only by the callback, so the queue needs no locks.
+  u32 Written;
+  u32 Read;
+  u32 TargetDepth;
+
+  pthread_t Thread;
+  sem_t Wake;
+  u32 Started;
+  u32 Quit;
+
+  // NOTE(robin): Written by the callback (WorstRender by the worker), read by anyone
+  u32 MinDepth;
+  u64 Pulls;
+  u64 MarginUsed;
+  u64 Starved;
+  u64 WorstRender;
+} render_ahead;
+
+static u64 RenderAheadNow(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+static f32* RenderAheadBlock(render_ahead* RenderAhead, u32 Index)
+{
+  u64 BlockSize = (u64)RenderAhead->ChannelCount * RenderAhead->FrameCount;
+  return RenderAhead->Blocks + (Index % RenderAhead->MaxDepth) * BlockSize;
+}
+
+static void* RenderAheadWorker(void* Context)
+{
+  render_ahead* RenderAhead = Context;
+
+  // NOTE(robin): Just below the audio thread, see alsa_scheduler_example.c. This fails
+  // without rtprio limits, in which case we run at normal priority.
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2 - 1;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param);
+
+  fp_state FPState = FPEnterAudioThread();
+  TraceThreadName("render ahead worker");
+
+  while (!__atomic_load_n(&RenderAhead->Quit, __ATOMIC_ACQUIRE))
+  {
+    u32 Written = RenderAhead->Written;
+    u32 Read = __atomic_load_n(&RenderAhead->Read, __ATOMIC_ACQUIRE);
+    u32 Target = __atomic_load_n(&RenderAhead->TargetDepth, __ATOMIC_RELAXED);
+
+    if (Written - Read >= Target)
+    {
+      // NOTE(robin): Full, the callback posts every time it takes a block
+      TraceBegin("wait for space");
+      sem_wait(&RenderAhead->Wake);
+      TraceEnd("wait for space");
+      continue;
+    }
+
+    f32* Block = RenderAheadBlock(RenderAhead, Written);
+    f32* Outputs[RENDER_AHEAD_MAX_CHANNELS];
+    for (u32 Channel = 0; Channel < RenderAhead->ChannelCount; Channel++)
+      Outputs[Channel] = Block + Channel * RenderAhead->FrameCount;
+
+    TraceBegin("render block");
+    u64 Start = RenderAheadNow();
+    RenderAhead->Render(RenderAhead->Context, Outputs, RenderAhead->FrameCount);
+    TraceEnd("render block");
+    u64 Elapsed = RenderAheadNow() - Start;
+    if (Elapsed > __atomic_load_n(&RenderAhead->WorstRender, __ATOMIC_RELAXED))
+      __atomic_store_n(&RenderAhead->WorstRender, Elapsed, __ATOMIC_RELAXED);
+
+    // NOTE(robin): Publishes the block
+    __atomic_store_n(&RenderAhead->Written, Written + 1, __ATOMIC_RELEASE);
+  }
+
+  FPLeaveAudioThread(FPState);
+  return 0;
+}
+
+// NOTE(robin): MaxDepth is the most blocks the queue can ever hold, i.e. the upper limit for
+// RenderAheadSetDepth. Returns 0 if the arguments are out of range or allocation fails.
+u32 RenderAheadInit(render_ahead* RenderAhead, u32 ChannelCount, u32 FrameCount, u32 MaxDepth,
+    render_ahead_function* Render, void* Context)
+{
+  *RenderAhead = (render_ahead){0};
+  if (!ChannelCount || ChannelCount > RENDER_AHEAD_MAX_CHANNELS || !FrameCount ||
+      !MaxDepth || MaxDepth > RENDER_AHEAD_MAX_DEPTH)
+    return 0;
+
+  // NOTE(robin): Here rather than in RenderAheadStart so RenderAheadSetDepth can post it
+  // before the worker runs. MaxDepth being set tells RenderAheadFree to destroy it.
+  sem_init(&RenderAhead->Wake, 0, 0);
+  RenderAhead->ChannelCount = ChannelCount;
+  RenderAhead->FrameCount = FrameCount;
+  RenderAhead->MaxDepth = MaxDepth;
+  RenderAhead->Render = Render;
+  RenderAhead->Context = Context;
+  RenderAhead->MinDepth = 0xFFFFFFFF;
+
+  RenderAhead->Blocks = calloc((u64)MaxDepth * ChannelCount * FrameCount, sizeof(f32));
+  return RenderAhead->Blocks != 0;
+}
+
+// NOTE(robin): Can be called from any thread at any time after RenderAheadInit, see the top
+// of the file. Only wakes the worker if the depth changed, so calling this every period with
+// the same depth doesn't pile up wakeups.
+void RenderAheadSetDepth(render_ahead* RenderAhead, u32 TargetDepth)
+{
+  TargetDepth = TargetDepth < 1 ? 1 : TargetDepth > RenderAhead->MaxDepth ? RenderAhead->MaxDepth : TargetDepth;
+  if (__atomic_exchange_n(&RenderAhead->TargetDepth, TargetDepth, __ATOMIC_RELAXED) != TargetDepth)
+    sem_post(&RenderAhead->Wake);
+}
+
+// NOTE(robin): Starts the worker and waits until the queue is full, so that the first pulls
+// don't find it empty. Call this before starting the device. Returns 0 if the worker thread
+// couldn't be created, RenderAheadFree still has to be called then.
+u32 RenderAheadStart(render_ahead* RenderAhead, u32 TargetDepth)
+{
+  RenderAheadSetDepth(RenderAhead, TargetDepth);
+  if (pthread_create(&RenderAhead->Thread, 0, RenderAheadWorker, RenderAhead))
+    return 0;
+  RenderAhead->Started = 1;
+
+  while (__atomic_load_n(&RenderAhead->Written, __ATOMIC_ACQUIRE) < RenderAhead->TargetDepth)
+    usleep(100);
+  return 1;
+}
+
+// NOTE(robin): Call this from the audio callback, with FrameCount frames in each of the
+// ChannelCount outputs. Returns 0 if the queue was empty, in which case Outputs are silent.
+u32 RenderAheadPull(render_ahead* RenderAhead, f32* const* Outputs)
+{
+  u32 Read = RenderAhead->Read;
+  u32 Written = __atomic_load_n(&RenderAhead->Written, __ATOMIC_ACQUIRE);
+  u32 Depth = Written - Read;
+  TraceCounter("render ahead depth", Depth);
+
+  __atomic_store_n(&RenderAhead->Pulls, RenderAhead->Pulls + 1, __ATOMIC_RELAXED);
+  if (Depth < __atomic_load_n(&RenderAhead->TargetDepth, __ATOMIC_RELAXED))
+    __atomic_store_n(&RenderAhead->MarginUsed, RenderAhead->MarginUsed + 1, __ATOMIC_RELAXED);
+  if (Depth < __atomic_load_n(&RenderAhead->MinDepth, __ATOMIC_RELAXED))
+    __atomic_store_n(&RenderAhead->MinDepth, Depth, __ATOMIC_RELAXED);
+
+  u32 FrameCount = RenderAhead->FrameCount;
+  if (!Depth)
+  {
+    __atomic_store_n(&RenderAhead->Starved, RenderAhead->Starved + 1, __ATOMIC_RELAXED);
+    for (u32 Channel = 0; Channel < RenderAhead->ChannelCount; Channel++)
+      memset(Outputs[Channel], 0, FrameCount * sizeof(f32));
+    return 0;
+  }
+
+  f32* Block = RenderAheadBlock(RenderAhead, Read);
+  for (u32 Channel = 0; Channel < RenderAhead->ChannelCount; Channel++)
+    memcpy(Outputs[Channel], Block + Channel * FrameCount, FrameCount * sizeof(f32));
+
+  // NOTE(robin): Hands the slot back to the worker
+  __atomic_store_n(&RenderAhead->Read, Read + 1, __ATOMIC_RELEASE);
+  sem_post(&RenderAhead->Wake);
+  return 1;
+}
+
+// NOTE(robin): Can be called from any thread. MinDepth and WorstRender start over after each
+// read, the counters keep counting.
+render_ahead_stats RenderAheadRead(render_ahead* RenderAhead)
+{
+  render_ahead_stats Stats = {0};
+  u32 Written = __atomic_load_n(&RenderAhead->Written, __ATOMIC_ACQUIRE);
+  u32 Read = __atomic_load_n(&RenderAhead->Read, __ATOMIC_ACQUIRE);
+  Stats.Depth = Written - Read;
+  Stats.TargetDepth = __atomic_load_n(&RenderAhead->TargetDepth, __ATOMIC_RELAXED);
+  Stats.MinDepth = __atomic_exchange_n(&RenderAhead->MinDepth, 0xFFFFFFFF, __ATOMIC_RELAXED);
+  Stats.Pulls = __atomic_load_n(&RenderAhead->Pulls, __ATOMIC_RELAXED);
+  Stats.MarginUsed = __atomic_load_n(&RenderAhead->MarginUsed, __ATOMIC_RELAXED);
+  Stats.Starved = __atomic_load_n(&RenderAhead->Starved, __ATOMIC_RELAXED);
+  Stats.WorstRender = __atomic_exchange_n(&RenderAhead->WorstRender, 0, __ATOMIC_RELAXED);
+
+  // NOTE(robin): No pulls since the last read
+  if (Stats.MinDepth == 0xFFFFFFFF)
+    Stats.MinDepth = Stats.Depth;
+  return Stats;
+}
+
+void RenderAheadFree(render_ahead* RenderAhead)
+{
+  if (RenderAhead->Started)
+  {
+    __atomic_store_n(&RenderAhead->Quit, 1, __ATOMIC_RELEASE);
+    sem_post(&RenderAhead->Wake);
+    pthread_join(RenderAhead->Thread, 0);
+  }
+  if (RenderAhead->MaxDepth)
+    sem_destroy(&RenderAhead->Wake);
+
+  free(RenderAhead->Blocks);
+  *RenderAhead = (render_ahead){0};
+}
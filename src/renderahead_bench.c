@@ -0,0 +1,206 @@
+/*
+ * This file tests renderahead.c without an audio device: a thread stands in for the audio
+ * callback and pulls a block every period on a timer.
+ *
+ * - Spikes: every 50th block takes one and a half periods to render. At a depth of 4 the
+ *   callback must never find the queue empty, and every block must come out once, in order.
+ *   At a depth of 1 the same spikes have to starve it, or the test isn't testing anything.
+ * - Depth change: with a full queue of 8, the depth goes down to 2. The worker mustn't
+ *   render anything until the callback has drained the queue to 2, and then keep it there.
+ *   Going back up to 6 has to fill it again. Again no block may be lost or repeated.
+ *
+ * NOTE(robin): Like net_bench, the callback thread asks for real-time priority, above the
+ * worker. Without rtprio limits it runs at normal priority, where a busy machine can starve
+ * the queue at any depth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "types.h"
+#include "denormal.c"
+#include "renderahead.c"
+
+#define BENCH_CHANNELS 2
+#define BENCH_FRAMES 256
+#define BENCH_PERIOD 5333333ull // NOTE(robin): Nanoseconds, 256 frames at 48kHz
+#define BENCH_PULLS 1000
+#define BENCH_SPIKE_EVERY 50
+
+typedef struct
+{
+  u32 Rendered;
+  u32 Spikes;
+} bench_synth;
+
+typedef struct
+{
+  render_ahead RenderAhead;
+  bench_synth Synth;
+  u32 Next;    // NOTE(robin): The block number we expect to pull next
+  u32 Starved;
+  u32 OutOfOrder;
+  u32 Stalls;
+} bench_data;
+
+static u64 Now(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+// NOTE(robin): Writes the number of the block into every sample, so the callback can tell
+// which block it got
+static void RenderNumbered(void* Context, f32* const* Outputs, u32 FrameCount)
+{
+  bench_synth* Synth = Context;
+  u64 Start = Now();
+  u32 Block = Synth->Rendered++;
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 i = 0; i < FrameCount; i++)
+      Outputs[Channel][i] = (f32)Block;
+  }
+
+  if (Block % BENCH_SPIKE_EVERY == BENCH_SPIKE_EVERY - 1)
+  {
+    __atomic_store_n(&Synth->Spikes, Synth->Spikes + 1, __ATOMIC_RELAXED);
+    while (Now() < Start + 3 * BENCH_PERIOD / 2)
+    {
+    }
+  }
+}
+
+// NOTE(robin): Returns 0 if the queue was empty
+static u32 Pull(bench_data* Data)
+{
+  static f32 Outputs[BENCH_CHANNELS][BENCH_FRAMES];
+  f32* Pointers[BENCH_CHANNELS] = {Outputs[0], Outputs[1]};
+  if (!RenderAheadPull(&Data->RenderAhead, Pointers))
+  {
+    Data->Starved++;
+    return 0;
+  }
+
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+  {
+    for (u32 i = 0; i < BENCH_FRAMES; i++)
+      Data->OutOfOrder += Outputs[Channel][i] != (f32)Data->Next;
+  }
+  Data->Next++;
+  return 1;
+}
+
+static void* CallbackThread(void* Context)
+{
+  bench_data* Data = Context;
+
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  u64 Next = Now();
+  for (u32 i = 0; i < BENCH_PULLS; i++)
+  {
+    Next += BENCH_PERIOD;
+    struct timespec Until = {Next / 1000000000ull, Next % 1000000000ull};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+
+    // NOTE(robin): If we woke up more than a period late, the whole machine stalled (the
+    // worker too). A device would have had an xrun and carried on from now, rather than
+    // take the periods we missed all at once, which would drain the queue faster than real
+    // time and starve it for reasons that have nothing to do with the queue.
+    u64 Woke = Now();
+    if (Woke > Next + BENCH_PERIOD)
+    {
+      Data->Stalls++;
+      Next = Woke;
+    }
+    Pull(Data);
+  }
+  return 0;
+}
+
+static void Setup(bench_data* Data, u32 Depth)
+{
+  *Data = (bench_data){0};
+  u32 Ready = RenderAheadInit(&Data->RenderAhead, BENCH_CHANNELS, BENCH_FRAMES, 16, RenderNumbered, &Data->Synth);
+  assert(Ready);
+  u32 Started = RenderAheadStart(&Data->RenderAhead, Depth);
+  assert(Started);
+}
+
+static void VerifySpikes(bench_data* Data, u32 Depth)
+{
+  Setup(Data, Depth);
+  pthread_t Thread;
+  pthread_create(&Thread, 0, CallbackThread, Data);
+  pthread_join(Thread, 0);
+
+  render_ahead_stats Stats = RenderAheadRead(&Data->RenderAhead);
+  RenderAheadFree(&Data->RenderAhead);
+
+  printf("depth %u: %u pulls, %u spikes of 1.5 periods, margin used %llu, starved %u, out of order %u, stalls %u\n",
+      Depth, BENCH_PULLS, Data->Synth.Spikes, (unsigned long long)Stats.MarginUsed, Data->Starved, Data->OutOfOrder,
+      Data->Stalls);
+  assert(Data->Synth.Spikes >= BENCH_PULLS / BENCH_SPIKE_EVERY - 1);
+  assert(Data->OutOfOrder == 0);
+  assert(Data->Next + Data->Starved == BENCH_PULLS);
+  if (Depth > 1)
+    assert(Data->Starved == 0);
+  else
+    assert(Data->Starved > 0);
+}
+
+// NOTE(robin): Gives the worker time to do whatever it is going to do, then the depth
+static u32 Settle(bench_data* Data)
+{
+  struct timespec Wait = {0, 20 * 1000000};
+  nanosleep(&Wait, 0);
+  return RenderAheadRead(&Data->RenderAhead).Depth;
+}
+
+static void VerifyDepthChange(bench_data* Data)
+{
+  Setup(Data, 8);
+  u32 Depth = Settle(Data);
+  assert(Depth == 8);
+
+  // NOTE(robin): No spikes here, the first one would be block 49
+  RenderAheadSetDepth(&Data->RenderAhead, 2);
+  for (u32 i = 0; i < 10; i++)
+  {
+    u32 Pulled = Pull(Data);
+    u32 Expected = Depth - 1 > 2 ? Depth - 1 : 2;
+    Depth = Settle(Data);
+    assert(Pulled && Depth == Expected);
+  }
+
+  RenderAheadSetDepth(&Data->RenderAhead, 6);
+  Depth = Settle(Data);
+  assert(Depth == 6);
+  for (u32 i = 0; i < 10; i++)
+  {
+    u32 Pulled = Pull(Data);
+    Depth = Settle(Data);
+    assert(Pulled && Depth == 6);
+  }
+
+  printf("depth 8 -> 2 -> 6: drained one block per pull down to 2 and refilled to 6, %u blocks in order\n",
+      Data->Next);
+  assert(Data->OutOfOrder == 0 && Data->Starved == 0 && Data->Synth.Rendered == Data->Next + 6);
+  RenderAheadFree(&Data->RenderAhead);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  VerifySpikes(&Data, 4);
+  VerifySpikes(&Data, 1);
+  VerifyDepthChange(&Data);
+  return 0;
+}
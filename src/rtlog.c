@@ -0,0 +1,584 @@
+/*
+ * This file provides logging that is safe to call from the audio callback: RTLog takes a
+ * printf style format, but only copies the format pointer, the arguments and a timestamp into
+ * a fixed size record. A background thread does the formatting and the writing.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined. On Windows you need to have
+ * included Windows.h.
+ *
+ *   RTLogStart(stdout); // NOTE(robin): Once, before the audio starts
+ *   ...
+ *   // In the callback, or any other thread
+ *   RTLog("Failed to convert channel %u, error %d\n", Channel, Error);
+ *   ...
+ *   RTLogStop(); // NOTE(robin): Writes out whatever is left
+ *
+ * NOTE(robin): printf can take a lock (stdout is shared), allocate, and block in write() for
+ * as long as the terminal or the pipe behind it likes, which can be milliseconds. That's fine
+ * most of the time, and exactly what you can't afford in the callback, and of course the
+ * callback is where the interesting errors happen.
+ *
+ * - Each thread that logs gets a ring of records of its own, claimed the first time it calls
+ *   RTLog, so there's only ever one writer per ring and pushing is wait free: a bounded
+ *   number of steps, no locks, no retry loops, no system calls (clock_gettime is a vDSO call
+ *   on Linux). When a ring is full the record is dropped and counted.
+ * - The arguments are stored as 64 bit values. RTLog walks the format string to know what
+ *   type to read for each conversion, and the logging thread walks it again to format them
+ *   one at a time. At most RTLOG_MAX_ARGS arguments, and no '*' widths.
+ * - The logging thread wakes up every RTLOG_INTERVAL_MS, merges the rings in timestamp order
+ *   and writes the lines. A message (the same format pointer, i.e. the same call site) is
+ *   printed at most RTLOG_BURST times per second; the rest are counted and reported as one
+ *   line when the second is over, so an error in every callback doesn't flood the output.
+ *
+ * IMPORTANT(robin): Only the pointers are copied, so any format string and any %s argument
+ * has to outlive the record: string literals and other static strings (e.g. snd_strerror),
+ * never a buffer on the stack.
+ *
+ * A thread keeps its ring until the program exits, so with more than RTLOG_MAX_THREADS
+ * threads that log, the extra ones only count drops. Audio threads are long lived so this
+ * is rarely an issue.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define RTLOG_MAX_ARGS 8
+#define RTLOG_MAX_THREADS 16
+#define RTLOG_RING_SIZE 256 // NOTE(robin): Records per thread, a power of two
+#define RTLOG_INTERVAL_MS 10
+#define RTLOG_BURST 5
+#define RTLOG_SITES 256 // NOTE(robin): Call sites we rate limit, a power of two
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define RTLOG_THREAD_LOCAL __declspec(thread)
+#define RTLogLoad(Pointer) (*(volatile u32*)(Pointer))
+#define RTLogStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#define RTLogFetchAdd(Pointer, Value) (u32)_InterlockedExchangeAdd((volatile long*)(Pointer), (long)(Value))
+#else
+#define RTLOG_THREAD_LOCAL __thread
+#define RTLogLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_ACQUIRE)
+#define RTLogStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELEASE)
+#define RTLogFetchAdd(Pointer, Value) __atomic_fetch_add((Pointer), (Value), __ATOMIC_ACQ_REL)
+#endif
+
+typedef enum
+{
+  RTLogArgSigned,
+  RTLogArgUnsigned,
+  RTLogArgFloat,
+  RTLogArgPointer,
+} rtlog_arg_type;
+
+typedef enum
+{
+  RTLogLengthNone,
+  RTLogLengthChar,     // NOTE(robin): hh
+  RTLogLengthShort,    // NOTE(robin): h
+  RTLogLengthLong,     // NOTE(robin): l
+  RTLogLengthLongLong, // NOTE(robin): ll
+  RTLogLengthSize,     // NOTE(robin): z
+  RTLogLengthMax,      // NOTE(robin): j
+  RTLogLengthPtrdiff,  // NOTE(robin): t
+} rtlog_length;
+
+// NOTE(robin): One conversion in a format string, from the % to the conversion character
+typedef struct
+{
+  const char* Start;
+  u32 Size;
+  rtlog_arg_type Type;
+  rtlog_length Length;
+} rtlog_spec;
+
+typedef struct
+{
+  u64 Time;
+  const char* Format;
+  u32 ArgCount;
+  u64 Args[RTLOG_MAX_ARGS];
+} rtlog_record;
+
+typedef struct
+{
+  rtlog_record Records[RTLOG_RING_SIZE];
+  u32 Written; // NOTE(robin): Only written by the thread that owns the ring
+  u32 Read;    // NOTE(robin): Only written by the logging thread
+  u32 Dropped;
+} rtlog_ring;
+
+typedef struct
+{
+  const char* Format;
+  u64 WindowStart;
+  u32 Printed;    // NOTE(robin): In the current one second window
+  u32 Suppressed; // NOTE(robin): Since the last line that got through
+} rtlog_site;
+
+typedef struct
+{
+  rtlog_ring Rings[RTLOG_MAX_THREADS];
+  u32 RingCount;
+  u32 LostThreads; // NOTE(robin): Records from threads that didn't get a ring
+  u32 ReportedDrops;
+
+  rtlog_site Sites[RTLOG_SITES];
+  FILE* Output;
+  u64 StartTime;
+  u32 Running;
+  u32 Quit;
+
+#ifdef _WIN32
+  HANDLE Thread;
+  LARGE_INTEGER Frequency;
+#else
+  pthread_t Thread;
+#endif
+} rtlog;
+
+static rtlog RTLogState;
+static RTLOG_THREAD_LOCAL rtlog_ring* RTLogThreadRing;
+static RTLOG_THREAD_LOCAL u32 RTLogThreadHasNoRing;
+
+static u64 RTLogNow(void)
+{
+#ifdef _WIN32
+  // NOTE(robin): Here rather than in RTLogStart since we log before that too. Threads that
+  // race on it all write the same value.
+  if (!RTLogState.Frequency.QuadPart)
+    QueryPerformanceFrequency(&RTLogState.Frequency);
+  LARGE_INTEGER Counter;
+  QueryPerformanceCounter(&Counter);
+  u64 Seconds = Counter.QuadPart / RTLogState.Frequency.QuadPart;
+  u64 Remainder = Counter.QuadPart % RTLogState.Frequency.QuadPart;
+  return Seconds * 1000000000ull + Remainder * 1000000000ull / RTLogState.Frequency.QuadPart;
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+// NOTE(robin): Finds the next conversion that takes an argument in Format, returns the rest of
+// the format after it or 0 if there are no more. Both sides use this so they always agree on
+// the types.
+static const char* RTLogNextSpec(const char* Format, rtlog_spec* Spec)
+{
+  for (;;)
+  {
+    while (*Format && *Format != '%')
+      Format++;
+    if (!*Format)
+      return 0;
+
+    const char* Start = Format++;
+    if (*Format == '%')
+    {
+      Format++;
+      continue;
+    }
+
+    while (*Format && strchr("-+ #0123456789.", *Format))
+      Format++;
+
+    rtlog_length Length = RTLogLengthNone;
+    switch (*Format)
+    {
+      case 'h':
+      {
+        Format++;
+        Length = RTLogLengthShort;
+        if (*Format == 'h')
+        {
+          Format++;
+          Length = RTLogLengthChar;
+        }
+      } break;
+
+      case 'l':
+      {
+        Format++;
+        Length = RTLogLengthLong;
+        if (*Format == 'l')
+        {
+          Format++;
+          Length = RTLogLengthLongLong;
+        }
+      } break;
+
+      case 'z': Format++; Length = RTLogLengthSize; break;
+      case 'j': Format++; Length = RTLogLengthMax; break;
+      case 't': Format++; Length = RTLogLengthPtrdiff; break;
+      default: break;
+    }
+
+    char Conversion = *Format;
+    if (!Conversion)
+      return 0;
+    Format++;
+
+    if (strchr("di", Conversion))
+      Spec->Type = RTLogArgSigned;
+    else if (strchr("uoxXc", Conversion))
+      Spec->Type = RTLogArgUnsigned;
+    else if (strchr("fFeEgGaA", Conversion))
+      Spec->Type = RTLogArgFloat;
+    else if (strchr("sp", Conversion))
+      Spec->Type = RTLogArgPointer;
+    else
+      continue; // NOTE(robin): Not something we know how to pass along, printed as it is
+
+    Spec->Start = Start;
+    Spec->Size = (u32)(Format - Start);
+    Spec->Length = Length;
+    return Format;
+  }
+}
+
+// NOTE(robin): Wait free, see the top of the file. Safe to call before RTLogStart (the records
+// wait in the ring) and after RTLogStop (they are never printed).
+void RTLog(const char* Format, ...)
+{
+  rtlog_ring* Ring = RTLogThreadRing;
+  if (!Ring)
+  {
+    // NOTE(robin): Too many threads, this one isn't logged. We remember that, so every thread
+    // only counts once and RingCount can't wrap around to rings that have an owner.
+    u32 Index = RTLogThreadHasNoRing ? RTLOG_MAX_THREADS : RTLogFetchAdd(&RTLogState.RingCount, 1);
+    if (Index >= RTLOG_MAX_THREADS)
+    {
+      RTLogThreadHasNoRing = 1;
+      RTLogFetchAdd(&RTLogState.LostThreads, 1);
+      return;
+    }
+    Ring = &RTLogState.Rings[Index];
+    RTLogThreadRing = Ring;
+  }
+
+  u32 Written = Ring->Written;
+  if (Written - RTLogLoad(&Ring->Read) >= RTLOG_RING_SIZE)
+  {
+    RTLogStore(&Ring->Dropped, Ring->Dropped + 1);
+    return;
+  }
+
+  rtlog_record* Record = &Ring->Records[Written % RTLOG_RING_SIZE];
+  Record->Time = RTLogNow();
+  Record->Format = Format;
+  Record->ArgCount = 0;
+
+  va_list Args;
+  va_start(Args, Format);
+
+  rtlog_spec Spec;
+  const char* Rest = Format;
+  while (Record->ArgCount < RTLOG_MAX_ARGS && (Rest = RTLogNextSpec(Rest, &Spec)))
+  {
+    u64 Value = 0;
+    switch (Spec.Type)
+    {
+      case RTLogArgSigned:
+      {
+        switch (Spec.Length)
+        {
+          case RTLogLengthLong: Value = (u64)(s64)va_arg(Args, long); break;
+          case RTLogLengthLongLong: Value = (u64)va_arg(Args, long long); break;
+          case RTLogLengthSize: Value = (u64)va_arg(Args, size_t); break;
+          case RTLogLengthMax: Value = (u64)va_arg(Args, intmax_t); break;
+          case RTLogLengthPtrdiff: Value = (u64)va_arg(Args, ptrdiff_t); break;
+          default: Value = (u64)(s64)va_arg(Args, int); break;
+        }
+      } break;
+
+      case RTLogArgUnsigned:
+      {
+        switch (Spec.Length)
+        {
+          case RTLogLengthLong: Value = (u64)va_arg(Args, unsigned long); break;
+          case RTLogLengthLongLong: Value = (u64)va_arg(Args, unsigned long long); break;
+          case RTLogLengthSize: Value = (u64)va_arg(Args, size_t); break;
+          case RTLogLengthMax: Value = (u64)va_arg(Args, uintmax_t); break;
+          case RTLogLengthPtrdiff: Value = (u64)va_arg(Args, ptrdiff_t); break;
+          default: Value = (u64)va_arg(Args, unsigned int); break;
+        }
+      } break;
+
+      case RTLogArgFloat:
+      {
+        f64 Float = va_arg(Args, f64);
+        memcpy(&Value, &Float, sizeof(Value));
+      } break;
+
+      case RTLogArgPointer:
+      {
+        Value = (u64)(uintptr_t)va_arg(Args, void*);
+      } break;
+    }
+
+    Record->Args[Record->ArgCount++] = Value;
+  }
+
+  va_end(Args);
+
+  // NOTE(robin): Publishes the record
+  RTLogStore(&Ring->Written, Written + 1);
+}
+
+// NOTE(robin): Formats one conversion with its argument, passing it as the type the length
+// modifier says printf expects
+static int RTLogFormatSpec(char* Output, u32 Size, const rtlog_spec* Spec, u64 Value)
+{
+  char Format[32];
+  u32 FormatSize = Spec->Size < sizeof(Format) - 1 ? Spec->Size : (u32)sizeof(Format) - 1;
+  memcpy(Format, Spec->Start, FormatSize);
+  Format[FormatSize] = 0;
+
+  switch (Spec->Type)
+  {
+    case RTLogArgSigned:
+    case RTLogArgUnsigned:
+    {
+      switch (Spec->Length)
+      {
+        case RTLogLengthLong: return snprintf(Output, Size, Format, (long)Value);
+        case RTLogLengthLongLong: return snprintf(Output, Size, Format, (long long)Value);
+        case RTLogLengthSize: return snprintf(Output, Size, Format, (size_t)Value);
+        case RTLogLengthMax: return snprintf(Output, Size, Format, (intmax_t)Value);
+        case RTLogLengthPtrdiff: return snprintf(Output, Size, Format, (ptrdiff_t)Value);
+        default: return snprintf(Output, Size, Format, (int)Value);
+      }
+    } break;
+
+    case RTLogArgFloat:
+    {
+      f64 Float;
+      memcpy(&Float, &Value, sizeof(Float));
+      return snprintf(Output, Size, Format, Float);
+    } break;
+
+    case RTLogArgPointer:
+    {
+      void* Pointer = (void*)(uintptr_t)Value;
+      if (Format[FormatSize - 1] == 's' && !Pointer)
+        return snprintf(Output, Size, "(null)");
+      return snprintf(Output, Size, Format, Pointer);
+    } break;
+  }
+
+  return 0;
+}
+
+// NOTE(robin): Formats a record the way printf would have
+static void RTLogFormat(char* Output, u32 Size, rtlog_record* Record)
+{
+  u32 Used = 0;
+  const char* Format = Record->Format;
+  const char* Rest = Format;
+  rtlog_spec Spec;
+
+  for (u32 Arg = 0; Arg < Record->ArgCount && Used < Size - 1; Arg++)
+  {
+    Rest = RTLogNextSpec(Rest, &Spec);
+
+    // NOTE(robin): The text before the conversion, %% turns into %
+    for (const char* c = Format; c < Spec.Start && Used < Size - 1; c++)
+    {
+      Output[Used++] = *c;
+      if (c[0] == '%' && c[1] == '%')
+        c++;
+    }
+
+    int Written = RTLogFormatSpec(Output + Used, Size - Used, &Spec, Record->Args[Arg]);
+    Used += Written < 0 ? 0 : (u32)Written;
+    Used = Used < Size - 1 ? Used : Size - 1;
+    Format = Rest;
+  }
+
+  for (const char* c = Format; *c && Used < Size - 1; c++)
+  {
+    Output[Used++] = *c;
+    if (c[0] == '%' && c[1] == '%')
+      c++;
+  }
+  Output[Used] = 0;
+}
+
+static rtlog_site* RTLogFindSite(const char* Format)
+{
+  u32 Hash = (u32)(((uintptr_t)Format >> 3) * 0x9E3779B9u);
+  for (u32 Probe = 0; Probe < RTLOG_SITES; Probe++)
+  {
+    rtlog_site* Site = &RTLogState.Sites[(Hash + Probe) % RTLOG_SITES];
+    if (Site->Format == Format || !Site->Format)
+    {
+      Site->Format = Format;
+      return Site;
+    }
+  }
+
+  // NOTE(robin): More call sites than slots, just don't rate limit the rest
+  return 0;
+}
+
+static f64 RTLogSeconds(u64 Time)
+{
+  return (f64)(s64)(Time - RTLogState.StartTime) / 1e9;
+}
+
+static void RTLogReportSuppressed(rtlog_site* Site, u64 Time)
+{
+  if (!Site->Suppressed)
+    return;
+
+  // NOTE(robin): The format without its newline, which is enough to tell which message it was
+  int Length = (int)strlen(Site->Format);
+  while (Length && (Site->Format[Length - 1] == '\n' || Site->Format[Length - 1] == '\r'))
+    Length--;
+
+  fprintf(RTLogState.Output, "[%10.6f] (\"%.*s\" was repeated %u more times)\n",
+      RTLogSeconds(Time), Length, Site->Format, Site->Suppressed);
+  Site->Suppressed = 0;
+}
+
+static void RTLogWrite(rtlog_record* Record)
+{
+  rtlog_site* Site = RTLogFindSite(Record->Format);
+  if (Site)
+  {
+    if (Record->Time - Site->WindowStart >= 1000000000ull)
+    {
+      RTLogReportSuppressed(Site, Record->Time);
+      Site->WindowStart = Record->Time;
+      Site->Printed = 0;
+    }
+
+    if (Site->Printed >= RTLOG_BURST)
+    {
+      Site->Suppressed++;
+      return;
+    }
+    Site->Printed++;
+  }
+
+  char Line[1024];
+  RTLogFormat(Line, sizeof(Line), Record);
+  fprintf(RTLogState.Output, "[%10.6f] %s", RTLogSeconds(Record->Time), Line);
+}
+
+// NOTE(robin): Writes out everything in the rings, oldest first. Repeats that were held back
+// are reported once their one second window is over, or all of them when Final is set.
+static void RTLogDrain(u32 Final)
+{
+  u32 RingCount = RTLogLoad(&RTLogState.RingCount);
+  RingCount = RingCount < RTLOG_MAX_THREADS ? RingCount : RTLOG_MAX_THREADS;
+
+  // NOTE(robin): Only take what was there when we started, so a thread that logs all the time
+  // can't keep us in here forever
+  u32 Ends[RTLOG_MAX_THREADS];
+  for (u32 i = 0; i < RingCount; i++)
+    Ends[i] = RTLogLoad(&RTLogState.Rings[i].Written);
+
+  for (;;)
+  {
+    rtlog_ring* Oldest = 0;
+    for (u32 i = 0; i < RingCount; i++)
+    {
+      rtlog_ring* Ring = &RTLogState.Rings[i];
+      if (Ring->Read == Ends[i])
+        continue;
+
+      rtlog_record* Record = &Ring->Records[Ring->Read % RTLOG_RING_SIZE];
+      if (!Oldest || Record->Time < Oldest->Records[Oldest->Read % RTLOG_RING_SIZE].Time)
+        Oldest = Ring;
+    }
+
+    if (!Oldest)
+      break;
+
+    RTLogWrite(&Oldest->Records[Oldest->Read % RTLOG_RING_SIZE]);
+    RTLogStore(&Oldest->Read, Oldest->Read + 1);
+  }
+
+  u64 Now = RTLogNow();
+  for (u32 i = 0; i < RTLOG_SITES; i++)
+  {
+    rtlog_site* Site = &RTLogState.Sites[i];
+    if (Site->Suppressed && (Final || Now - Site->WindowStart >= 1000000000ull))
+      RTLogReportSuppressed(Site, Now);
+  }
+
+  u32 Dropped = RTLogLoad(&RTLogState.LostThreads);
+  for (u32 i = 0; i < RingCount; i++)
+    Dropped += RTLogLoad(&RTLogState.Rings[i].Dropped);
+
+  if (Dropped != RTLogState.ReportedDrops)
+  {
+    fprintf(RTLogState.Output, "[%10.6f] (%u messages dropped because the log was full)\n",
+        RTLogSeconds(Now), Dropped - RTLogState.ReportedDrops);
+    RTLogState.ReportedDrops = Dropped;
+  }
+
+  fflush(RTLogState.Output);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI RTLogThread(void* Context)
+#else
+static void* RTLogThread(void* Context)
+#endif
+{
+  while (!RTLogLoad(&RTLogState.Quit))
+  {
+    RTLogDrain(0);
+#ifdef _WIN32
+    Sleep(RTLOG_INTERVAL_MS);
+#else
+    usleep(RTLOG_INTERVAL_MS * 1000);
+#endif
+  }
+
+  RTLogDrain(1);
+  return 0;
+}
+
+// NOTE(robin): Starts the logging thread, which writes to Output (e.g. stdout or a file)
+void RTLogStart(FILE* Output)
+{
+  RTLogState.Output = Output;
+  RTLogState.StartTime = RTLogNow();
+  RTLogStore(&RTLogState.Quit, 0);
+
+#ifdef _WIN32
+  RTLogState.Thread = CreateThread(0, 0, RTLogThread, 0, 0, 0);
+#else
+  pthread_create(&RTLogState.Thread, 0, RTLogThread, 0);
+#endif
+  RTLogState.Running = 1;
+}
+
+// NOTE(robin): Stops the logging thread after it has written out everything logged so far
+void RTLogStop(void)
+{
+  if (!RTLogState.Running)
+    return;
+
+  RTLogStore(&RTLogState.Quit, 1);
+#ifdef _WIN32
+  WaitForSingleObject(RTLogState.Thread, INFINITE);
+  CloseHandle(RTLogState.Thread);
+#else
+  pthread_join(RTLogState.Thread, 0);
+#endif
+  RTLogState.Running = 0;
+}
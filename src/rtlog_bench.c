@@ -0,0 +1,182 @@
+/*
+ * This file tests and benchmarks rtlog.c.
+ *
+ * - Formatting: records go through RTLog and the logging thread's formatter, and must come
+ *   out exactly like snprintf would have printed them, for every length modifier.
+ * - Threads: several threads log as fast as they can, more than the rings hold. Every
+ *   message must be accounted for, either printed, reported as a repeat or counted as
+ *   dropped, and the lines must come out in timestamp order.
+ * - Cost: how long a single call takes on the calling thread, for RTLog and for fprintf to
+ *   /dev/null. The worst case is the number that matters in a callback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "types.h"
+#include "bench.c"
+#include "rtlog.c"
+
+#define BENCH_THREADS 4
+#define BENCH_MESSAGES 20000
+#define BENCH_CALLS 4096
+
+// NOTE(robin): Pushes one record on this thread's ring and formats it straight back out
+void FormatRecord(char* Output, u32 Size)
+{
+  rtlog_ring* Ring = RTLogThreadRing;
+  assert(Ring && Ring->Written == Ring->Read + 1);
+
+  RTLogFormat(Output, Size, &Ring->Records[Ring->Read % RTLOG_RING_SIZE]);
+  Ring->Read++;
+}
+
+#define VerifyFormat(Format, ...) \
+  do \
+  { \
+    char Expected[256], Got[256]; \
+    snprintf(Expected, sizeof(Expected), Format, __VA_ARGS__); \
+    RTLog(Format, __VA_ARGS__); \
+    FormatRecord(Got, sizeof(Got)); \
+    if (strcmp(Expected, Got)) \
+      printf("Format \"%s\": expected \"%s\", got \"%s\"\n", Format, Expected, Got); \
+    assert(!strcmp(Expected, Got)); \
+  } while (0)
+
+void VerifyFormatting(void)
+{
+  // NOTE(robin): Before RTLogStart, so the records stay in the ring for us to take
+  VerifyFormat("%d %i %u %x %X %o %c\n", -42, 7, 3000000000u, 0xBEEFu, 0xCAFEu, 8u, 'r');
+  VerifyFormat("%hhd %hd %hu\n", (signed char)-5, (short)-1234, (unsigned short)65535);
+  VerifyFormat("%ld %lu %lld %llu\n", -1234567L, 1234567UL, -123456789012LL, 18446744073709551615ULL);
+  VerifyFormat("%zu %jd %td\n", (size_t)123456789, (intmax_t)-99, (ptrdiff_t)-7);
+  VerifyFormat("%f %.3f %10.2e %g %G %a\n", 3.14159, -0.0005, 123456.0, 1e-10, 1e20, 1.0);
+  VerifyFormat("%s|%-8s|%8s|%.2s\n", "xrun", "left", "right", "truncated");
+  VerifyFormat("%p %d%% %5d%%\n", (void*)0x1234, 50, 100);
+  VerifyFormat("%+d % d %05d %-5d|%#x %#o\n", 1, 2, 3, 4, 255u, 8u);
+  VerifyFormat("%d %d %d %d %d %d %d %d\n", 1, 2, 3, 4, 5, 6, 7, 8);
+
+  printf("Formatting: every conversion matches snprintf\n");
+}
+
+void* LoggingThread(void* Context)
+{
+  u32 Thread = (u32)(uintptr_t)Context;
+  for (u32 i = 0; i < BENCH_MESSAGES; i++)
+  {
+    RTLog("thread %u message %u\n", Thread, i);
+
+    // NOTE(robin): Let the logging thread catch up now and then so that we get some of
+    // everything: printed, repeated and dropped
+    if (i % 1000 == 999)
+      usleep(15000);
+  }
+  return 0;
+}
+
+void VerifyThreads(void)
+{
+  FILE* Output = tmpfile();
+  RTLogStart(Output);
+
+  pthread_t Threads[BENCH_THREADS];
+  for (u32 i = 0; i < BENCH_THREADS; i++)
+    pthread_create(&Threads[i], 0, LoggingThread, (void*)(uintptr_t)i);
+  for (u32 i = 0; i < BENCH_THREADS; i++)
+    pthread_join(Threads[i], 0);
+
+  RTLogStop();
+
+  u64 Printed = 0, Repeated = 0, Dropped = 0, Lines = 0;
+  f64 LastTime = 0;
+  char Line[512];
+
+  rewind(Output);
+  while (fgets(Line, sizeof(Line), Output))
+  {
+    f64 Time;
+    u32 Thread, Message, Count;
+    int Offset = 0;
+    int Matched = sscanf(Line, "[%lf] %n", &Time, &Offset);
+    assert(Matched == 1);
+    assert(Time >= LastTime);
+    LastTime = Time;
+    Lines++;
+
+    if (sscanf(Line + Offset, "thread %u message %u", &Thread, &Message) == 2)
+      Printed++;
+    else if (sscanf(Line + Offset, "(\"thread %%u message %%u\" was repeated %u more times)", &Count) == 1)
+      Repeated += Count;
+    else if (sscanf(Line + Offset, "(%u messages dropped", &Count) == 1)
+      Dropped += Count;
+    else
+      assert(!"Unexpected line in the log");
+  }
+  fclose(Output);
+
+  u64 Total = BENCH_THREADS * BENCH_MESSAGES;
+  printf("Threads: %llu messages, %llu printed, %llu repeats, %llu dropped, %llu lines in order\n\n",
+      (unsigned long long)Total, (unsigned long long)Printed, (unsigned long long)Repeated,
+      (unsigned long long)Dropped, (unsigned long long)Lines);
+  assert(Printed + Repeated + Dropped == Total);
+}
+
+int CompareTimes(const void* A, const void* B)
+{
+  u64 a = *(const u64*)A, b = *(const u64*)B;
+  return a < b ? -1 : a > b;
+}
+
+void PrintCallCost(const char* Name, u64* Times)
+{
+  qsort(Times, BENCH_CALLS, sizeof(u64), CompareTimes);
+  printf("%-8s %10llu %10llu %10llu %10llu\n", Name,
+      (unsigned long long)Times[BENCH_CALLS / 2], (unsigned long long)Times[BENCH_CALLS * 99 / 100],
+      (unsigned long long)Times[BENCH_CALLS * 999 / 1000], (unsigned long long)Times[BENCH_CALLS - 1]);
+}
+
+int main(int argc, char** argv)
+{
+  VerifyFormatting();
+  VerifyThreads();
+
+  // NOTE(robin): Calls come in bursts of 16 a millisecond, which the logging thread keeps up
+  // with, so we time the normal path rather than the one that drops
+  static u64 Times[BENCH_CALLS];
+  FILE* Null = fopen("/dev/null", "w");
+  RTLogStart(Null);
+
+  for (u32 i = 0; i < BENCH_CALLS; i++)
+  {
+    u64 Start = BenchGetTime();
+    RTLog("Output: %s, woke up %.3f ms late\n", "Broken pipe", 1.234);
+    Times[i] = BenchGetTime() - Start;
+    if (i % 16 == 15)
+      usleep(1000);
+  }
+
+  RTLogStop();
+
+  printf("Time per call in ns, %d calls\n", BENCH_CALLS);
+  printf("%-8s %10s %10s %10s %10s\n", "", "median", "99%", "99.9%", "worst");
+  PrintCallCost("RTLog", Times);
+
+  for (u32 i = 0; i < BENCH_CALLS; i++)
+  {
+    u64 Start = BenchGetTime();
+    fprintf(Null, "Output: %s, woke up %.3f ms late\n", "Broken pipe", 1.234);
+    fflush(Null);
+    Times[i] = BenchGetTime() - Start;
+    if (i % 16 == 15)
+      usleep(1000);
+  }
+
+  PrintCallCost("fprintf", Times);
+  fclose(Null);
+
+  return 0;
+}
@@ -0,0 +1,445 @@
+/*
+ * This file provides a small event driven scheduler for servicing several audio streams
+ * (e.g. a WASAPI render client and capture client, or an ALSA playback and capture PCM)
+ * from a single high priority thread.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined. On Windows you need to have
+ * included Windows.h. On Linux, include <alsa/asoundlib.h> before this file if you want
+ * to use SchedulerAddALSAStream.
+ *
+ * NOTE(robin): The problem this solves is that the naive event loop
+ *
+ *   for (;;)
+ *   {
+ *     WaitForSingleObject(OutputEvent, INFINITE);
+ *     AudioOutputCallback(...);
+ *     WaitForSingleObject(InputEvent, INFINITE);
+ *     AudioInputCallback(...);
+ *   }
+ *
+ * serialises the streams, so if the input is late then the output is late too (and
+ * vice versa). Instead we wait on every stream at once (WaitForMultipleObjects on
+ * Windows, poll on the PCM descriptors on Linux) and then service all of the streams
+ * that are ready, earliest deadline first.
+ *
+ * Every stream has a nominal period. We keep a grid of deadlines for each stream
+ * (one per period), which follows the device's clock (see SchedulerUpdateLateness), and
+ * measure how late each wakeup was relative to that grid, so that you can see which
+ * stream is suffering when things go wrong.
+ *
+ * If trace.c is included before this file, the waits, the lateness of every wakeup (a
+ * counter named after the stream, in microseconds) and the callbacks are recorded, and
+ * missed periods and errors trigger the trace.
+ */
+
+#ifndef _WIN32
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifndef TRACE_ENABLED
+#define TraceBegin(Name)
+#define TraceEnd(Name)
+#define TraceCounter(Name, Value)
+#define TraceTrigger(Name)
+#endif
+
+#define SCHEDULER_MAX_STREAMS 8
+#define SCHEDULER_MAX_FDS 32
+#define SCHEDULER_SLEW 64 // NOTE(robin): The grid moves 1/64 of the lateness towards a wakeup
+
+// NOTE(robin): The callback is given the lateness of this wakeup in nanoseconds
+typedef void scheduler_callback(void* UserData, s64 Lateness);
+
+#ifndef _WIN32
+// NOTE(robin): On Linux a stream may own several poll descriptors and only the owner knows
+// how to interpret the returned events (ALSA for example mangles them). Return the POLLIN/
+// POLLOUT/POLLERR flags that actually apply to the stream.
+typedef u16 scheduler_demangle_events(void* DemangleData, struct pollfd* FDs, u32 FDCount);
+#endif
+
+typedef struct
+{
+  scheduler_callback* Callback;
+  void* UserData;
+  const char* Name;
+
+  u64 Period; // NOTE(robin): In nanoseconds
+  u64 NextDeadline;
+
+  // NOTE(robin): Lateness statistics, all in nanoseconds
+  u64 WakeCount;
+  u64 LateCount; // NOTE(robin): Wakeups that were later than LateThreshold
+  u64 MissedPeriods; // NOTE(robin): Whole periods that passed without a wakeup
+  u64 ErrorCount; // NOTE(robin): POLLERR on Linux, usually an xrun
+  s64 LateThreshold;
+  s64 LastLateness;
+  s64 MaxLateness;
+  s64 TotalLateness;
+  u64 MaxServiceTime; // NOTE(robin): How long the callback took
+
+#ifdef _WIN32
+  HANDLE Event;
+#else
+  u32 FirstFD;
+  u32 FDCount;
+  scheduler_demangle_events* Demangle;
+  void* DemangleData;
+#endif
+} scheduler_stream;
+
+typedef struct
+{
+  scheduler_stream Streams[SCHEDULER_MAX_STREAMS];
+  u32 StreamCount;
+
+#ifdef _WIN32
+  // NOTE(robin): Stream events come first, the quit event is at Events[StreamCount]
+  HANDLE Events[SCHEDULER_MAX_STREAMS + 1];
+  HANDLE QuitEvent;
+  LARGE_INTEGER Frequency;
+#else
+  // NOTE(robin): FDs[0] is an eventfd that is used to wake the scheduler up to quit
+  struct pollfd FDs[SCHEDULER_MAX_FDS];
+  u32 FDCount;
+  int QuitFD;
+#endif
+
+  volatile s32 Quit;
+} scheduler;
+
+u64 SchedulerGetTime(scheduler* Scheduler)
+{
+#ifdef _WIN32
+  LARGE_INTEGER Counter;
+  QueryPerformanceCounter(&Counter);
+  u64 Seconds = Counter.QuadPart / Scheduler->Frequency.QuadPart;
+  u64 Remainder = Counter.QuadPart % Scheduler->Frequency.QuadPart;
+  return Seconds * 1000000000ull + Remainder * 1000000000ull / Scheduler->Frequency.QuadPart;
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+void SchedulerInit(scheduler* Scheduler)
+{
+  *Scheduler = (scheduler){0};
+
+#ifdef _WIN32
+  QueryPerformanceFrequency(&Scheduler->Frequency);
+  Scheduler->QuitEvent = CreateEvent(0, 1, 0, 0); // NOTE(robin): Manual reset
+#else
+  Scheduler->QuitFD = eventfd(0, EFD_NONBLOCK);
+  Scheduler->FDs[0].fd = Scheduler->QuitFD;
+  Scheduler->FDs[0].events = POLLIN;
+  Scheduler->FDCount = 1;
+#endif
+}
+
+// NOTE(robin): Fills out the parts of a stream that are common to every platform.
+// Returns 0 if there is no room for another stream.
+scheduler_stream* SchedulerPushStream(scheduler* Scheduler, const char* Name,
+    u64 Period, scheduler_callback* Callback, void* UserData)
+{
+  if (Scheduler->StreamCount >= SCHEDULER_MAX_STREAMS)
+    return 0;
+
+  scheduler_stream* Stream = &Scheduler->Streams[Scheduler->StreamCount++];
+  *Stream = (scheduler_stream){0};
+  Stream->Name = Name;
+  Stream->Period = Period;
+  Stream->Callback = Callback;
+  Stream->UserData = UserData;
+
+  // NOTE(robin): By default anything more than a quarter of a period late counts as late
+  Stream->LateThreshold = (s64)(Period / 4);
+
+  return Stream;
+}
+
+#ifdef _WIN32
+
+// NOTE(robin): Event should be an auto-reset event, i.e. the one you passed to
+// IAudioClient_SetEventHandle.
+scheduler_stream* SchedulerAddEventStream(scheduler* Scheduler, const char* Name, HANDLE Event,
+    u64 Period, scheduler_callback* Callback, void* UserData)
+{
+  scheduler_stream* Stream = SchedulerPushStream(Scheduler, Name, Period, Callback, UserData);
+  if (Stream)
+    Stream->Event = Event;
+  return Stream;
+}
+
+#else
+
+scheduler_stream* SchedulerAddFDStream(scheduler* Scheduler, const char* Name,
+    struct pollfd* FDs, u32 FDCount,
+    scheduler_demangle_events* Demangle, void* DemangleData,
+    u64 Period, scheduler_callback* Callback, void* UserData)
+{
+  if (Scheduler->FDCount + FDCount > SCHEDULER_MAX_FDS)
+    return 0;
+
+  scheduler_stream* Stream = SchedulerPushStream(Scheduler, Name, Period, Callback, UserData);
+  if (!Stream)
+    return 0;
+
+  Stream->FirstFD = Scheduler->FDCount;
+  Stream->FDCount = FDCount;
+  Stream->Demangle = Demangle;
+  Stream->DemangleData = DemangleData;
+
+  for (u32 i = 0; i < FDCount; i++)
+    Scheduler->FDs[Scheduler->FDCount++] = FDs[i];
+
+  return Stream;
+}
+
+#ifdef __ASOUNDLIB_H
+
+u16 SchedulerDemangleALSAEvents(void* DemangleData, struct pollfd* FDs, u32 FDCount)
+{
+  snd_pcm_t* PCM = DemangleData;
+  unsigned short Events = 0;
+  snd_pcm_poll_descriptors_revents(PCM, FDs, FDCount, &Events);
+  return Events;
+}
+
+// NOTE(robin): Uses the descriptors from snd_pcm_poll_descriptors so that the scheduler wakes
+// up whenever avail_min frames are ready, just like snd_pcm_wait would.
+scheduler_stream* SchedulerAddALSAStream(scheduler* Scheduler, const char* Name, snd_pcm_t* PCM,
+    u64 Period, scheduler_callback* Callback, void* UserData)
+{
+  struct pollfd FDs[SCHEDULER_MAX_FDS];
+  int FDCount = snd_pcm_poll_descriptors_count(PCM);
+  if (FDCount <= 0 || FDCount > SCHEDULER_MAX_FDS)
+    return 0;
+
+  FDCount = snd_pcm_poll_descriptors(PCM, FDs, FDCount);
+
+  return SchedulerAddFDStream(Scheduler, Name, FDs, FDCount,
+      SchedulerDemangleALSAEvents, PCM, Period, Callback, UserData);
+}
+
+#endif
+#endif
+
+// NOTE(robin): Update the deadline grid for a stream that just woke up and return how late
+// the wakeup was.
+//
+// The device's clock isn't ours, so a grid that just steps by the nominal period drifts
+// against the wakeups: by 100ppm that's a period every 10000 periods, and the stream would
+// look later and later until it reported missed periods that never happened (or the other
+// way round). So the grid follows the device: an early wakeup shows where the grid really
+// is and moves it straight there, and every later one moves it forward by a small share
+// of its lateness, which a device slower than the period says needs, but a few genuinely
+// late wakeups hardly move.
+s64 SchedulerUpdateLateness(scheduler_stream* Stream, u64 Now)
+{
+  // NOTE(robin): The first wakeup defines the phase of the deadline grid
+  if (!Stream->NextDeadline)
+    Stream->NextDeadline = Now;
+
+  s64 Lateness = (s64)(Now - Stream->NextDeadline);
+
+  if (Lateness >= (s64)Stream->Period && Stream->Period)
+  {
+    // NOTE(robin): We slept through at least one whole period. Count the missed periods and
+    // move the grid forward so that we don't report the same lateness forever.
+    u64 Missed = (u64)Lateness / Stream->Period;
+    Stream->MissedPeriods += Missed;
+    TraceTrigger("missed period");
+    Stream->NextDeadline += Missed * Stream->Period;
+    Lateness -= (s64)(Missed * Stream->Period);
+  }
+  else if (Lateness < 0)
+  {
+    // NOTE(robin): Earlier than expected. The device runs a little faster than the period,
+    // or it has been restarted or changed its period, so the grid moves to this wakeup.
+    Stream->NextDeadline = Now;
+    Lateness = 0;
+  }
+
+  Stream->NextDeadline += (u64)Lateness / SCHEDULER_SLEW;
+  Stream->NextDeadline += Stream->Period;
+
+  Stream->WakeCount++;
+  Stream->LastLateness = Lateness;
+  Stream->TotalLateness += Lateness;
+  if (Lateness > Stream->MaxLateness)
+    Stream->MaxLateness = Lateness;
+  if (Lateness > Stream->LateThreshold)
+    Stream->LateCount++;
+
+  return Lateness;
+}
+
+// NOTE(robin): Service every stream whose Ready flag is set, earliest deadline first.
+// Returns the number of streams serviced.
+u32 SchedulerServiceReady(scheduler* Scheduler, u8* Ready, u64 Now)
+{
+  u32 Serviced = 0;
+
+  for (;;)
+  {
+    scheduler_stream* Next = 0;
+    u32 NextIndex = 0;
+
+    for (u32 i = 0; i < Scheduler->StreamCount; i++)
+    {
+      scheduler_stream* Stream = &Scheduler->Streams[i];
+      if (Ready[i] && (!Next || Stream->NextDeadline < Next->NextDeadline))
+      {
+        Next = Stream;
+        NextIndex = i;
+      }
+    }
+
+    if (!Next)
+      break;
+
+    Ready[NextIndex] = 0;
+
+    s64 Lateness = SchedulerUpdateLateness(Next, Now);
+    TraceCounter(Next->Name ? Next->Name : "stream", Lateness / 1000);
+
+    u64 Start = SchedulerGetTime(Scheduler);
+    TraceBegin(Next->Name ? Next->Name : "stream");
+    Next->Callback(Next->UserData, Lateness);
+    TraceEnd(Next->Name ? Next->Name : "stream");
+    u64 End = SchedulerGetTime(Scheduler);
+
+    if (End - Start > Next->MaxServiceTime)
+      Next->MaxServiceTime = End - Start;
+
+    Serviced++;
+  }
+
+  return Serviced;
+}
+
+// NOTE(robin): Waits until at least one stream is ready (or Timeout milliseconds have passed,
+// -1 for no timeout) and services every stream that is ready. Returns the number of streams
+// serviced.
+u32 SchedulerRunOnce(scheduler* Scheduler, s32 Timeout)
+{
+  u8 Ready[SCHEDULER_MAX_STREAMS] = {0};
+  u32 StreamCount = Scheduler->StreamCount;
+
+#ifdef _WIN32
+  for (u32 i = 0; i < StreamCount; i++)
+    Scheduler->Events[i] = Scheduler->Streams[i].Event;
+  Scheduler->Events[StreamCount] = Scheduler->QuitEvent;
+
+  TraceBegin("wait");
+  DWORD Result = WaitForMultipleObjects(StreamCount + 1, Scheduler->Events, 0,
+      Timeout < 0 ? INFINITE : (DWORD)Timeout);
+  TraceEnd("wait");
+
+  u64 Now = SchedulerGetTime(Scheduler);
+
+  if (Result >= WAIT_OBJECT_0 + StreamCount)
+    return 0; // NOTE(robin): Timeout, quit or failure
+
+  // NOTE(robin): WaitForMultipleObjects only tells us about the lowest signalled index, so poll
+  // the others as well. The events are auto-reset so this consumes them, which is fine because
+  // we're about to service them anyway.
+  Ready[Result - WAIT_OBJECT_0] = 1;
+  for (u32 i = 0; i < StreamCount; i++)
+  {
+    if (!Ready[i] && WaitForSingleObject(Scheduler->Events[i], 0) == WAIT_OBJECT_0)
+      Ready[i] = 1;
+  }
+#else
+  for (u32 i = 0; i < Scheduler->FDCount; i++)
+    Scheduler->FDs[i].revents = 0;
+
+  TraceBegin("wait");
+  int Result = poll(Scheduler->FDs, Scheduler->FDCount, Timeout);
+  TraceEnd("wait");
+
+  u64 Now = SchedulerGetTime(Scheduler);
+
+  if (Result <= 0 || Scheduler->FDs[0].revents)
+    return 0; // NOTE(robin): Timeout, quit or failure
+
+  for (u32 i = 0; i < StreamCount; i++)
+  {
+    scheduler_stream* Stream = &Scheduler->Streams[i];
+    struct pollfd* FDs = &Scheduler->FDs[Stream->FirstFD];
+
+    u16 Events = 0;
+    if (Stream->Demangle)
+    {
+      Events = Stream->Demangle(Stream->DemangleData, FDs, Stream->FDCount);
+    }
+    else
+    {
+      for (u32 FDIndex = 0; FDIndex < Stream->FDCount; FDIndex++)
+        Events |= FDs[FDIndex].revents;
+    }
+
+    if (Events & POLLERR)
+    {
+      Stream->ErrorCount++;
+      TraceTrigger("stream error");
+    }
+
+    // NOTE(robin): We also service streams with errors so that the callback gets the chance
+    // to recover from an xrun.
+    if (Events & (POLLIN | POLLOUT | POLLERR))
+      Ready[i] = 1;
+  }
+#endif
+
+  return SchedulerServiceReady(Scheduler, Ready, Now);
+}
+
+void SchedulerRun(scheduler* Scheduler)
+{
+  while (!Scheduler->Quit)
+    SchedulerRunOnce(Scheduler, -1);
+}
+
+// NOTE(robin): Safe to call from any thread, SchedulerRun will return shortly after
+void SchedulerStop(scheduler* Scheduler)
+{
+  Scheduler->Quit = 1;
+
+#ifdef _WIN32
+  SetEvent(Scheduler->QuitEvent);
+#else
+  u64 One = 1;
+  write(Scheduler->QuitFD, &One, sizeof(One));
+#endif
+}
+
+void SchedulerDestroy(scheduler* Scheduler)
+{
+#ifdef _WIN32
+  CloseHandle(Scheduler->QuitEvent);
+#else
+  close(Scheduler->QuitFD);
+#endif
+}
+
+void SchedulerPrintStats(scheduler* Scheduler)
+{
+  for (u32 i = 0; i < Scheduler->StreamCount; i++)
+  {
+    scheduler_stream* Stream = &Scheduler->Streams[i];
+    f64 MeanLateness = Stream->WakeCount ? (f64)Stream->TotalLateness / Stream->WakeCount : 0;
+
+    printf("%s: %llu wakeups, %llu late, %llu missed periods, %llu errors\n",
+        Stream->Name ? Stream->Name : "stream",
+        Stream->WakeCount, Stream->LateCount, Stream->MissedPeriods, Stream->ErrorCount);
+    printf("  lateness mean %.1fus max %.1fus, max service time %.1fus\n",
+        MeanLateness / 1000.0, Stream->MaxLateness / 1000.0, Stream->MaxServiceTime / 1000.0);
+  }
+}
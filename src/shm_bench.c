@@ -0,0 +1,285 @@
+/*
+ * This file tests and benchmarks shm_transport.c with worker processes that apply a gain, so
+ * it runs anywhere without an audio device. Linux only.
+ *
+ * - Latency: the host submits a cycle every period (paced with clock_nanosleep like a device
+ *   would) and we measure how long a sleeping worker takes to see it (wake to process), and
+ *   the whole submit to collect round trip, which is what the transport costs the device
+ *   process per period on top of the DSP itself.
+ * - Deadline: a worker told to stall must cost its cycle (silence, returned on time), then
+ *   the next one (skipped without waiting, since it's still busy), and then recover.
+ * - Crash: after SIGKILLing a worker the host must keep going with silence for it, and a
+ *   replacement attached to the same slot must take over.
+ *
+ * NOTE(robin): The latencies depend almost entirely on the scheduler: run it with real-time
+ * priority (chrt -f 50 build/shm_bench) and with as many cores as workers to see what you'd
+ * get in a real setup. On a single core every wake is also a context switch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#include "types.h"
+#include "shm_transport.c"
+
+#define BENCH_RATE 48000
+#define BENCH_CHANNELS 2
+#define BENCH_CYCLES 2000
+#define BENCH_STALL 1 // NOTE(robin): Message type, the worker sleeps for the given microseconds
+
+typedef struct
+{
+  shm_host Host;
+  pid_t Workers[SHM_MAX_WORKERS];
+  f32 Inputs[BENCH_CHANNELS][SHM_MAX_FRAMES];
+  f32 Outputs[SHM_MAX_WORKERS][BENCH_CHANNELS][SHM_MAX_FRAMES];
+  u64 WakeLatencies[BENCH_CYCLES * SHM_MAX_WORKERS];
+  u64 RoundTrips[BENCH_CYCLES];
+} bench_data;
+
+void WorkerMain(int FD, u32 Index)
+{
+  shm_worker Worker;
+  if (!ShmWorkerAttach(&Worker, FD, Index))
+    _exit(1);
+
+  shm_cycle Cycle;
+  while (ShmWorkerWait(&Worker, &Cycle))
+  {
+    shm_message Message;
+    while (ShmRingRead(&Worker.Slot->ToWorker, &Message))
+    {
+      u32 Microseconds;
+      memcpy(&Microseconds, Message.Data, sizeof(Microseconds));
+      if (Message.Type == BENCH_STALL)
+        usleep(Microseconds);
+    }
+
+    for (u32 Channel = 0; Channel < Cycle.ChannelCount; Channel++)
+      for (u32 i = 0; i < Cycle.FrameCount; i++)
+        Cycle.Outputs[Channel][i] = 0.5f * Cycle.Inputs[Channel][i];
+    ShmWorkerDone(&Worker);
+  }
+
+  // NOTE(robin): _exit, so we don't flush the stdout buffer we inherited from the host
+  ShmWorkerDetach(&Worker);
+  _exit(0);
+}
+
+void StartWorker(bench_data* Data, u32 Index)
+{
+  pid_t PID = fork();
+  if (PID == 0)
+    WorkerMain(Data->Host.FD, Index);
+  Data->Workers[Index] = PID;
+}
+
+void StartWorkers(bench_data* Data, u32 WorkerCount)
+{
+  u32 Created = ShmHostCreate(&Data->Host, BENCH_CHANNELS, WorkerCount, BENCH_RATE);
+  assert(Created);
+  for (u32 i = 0; i < WorkerCount; i++)
+    StartWorker(Data, i);
+}
+
+void StopWorkers(bench_data* Data)
+{
+  u32 WorkerCount = Data->Host.WorkerCount;
+  ShmHostDestroy(&Data->Host);
+  for (u32 i = 0; i < WorkerCount; i++)
+    waitpid(Data->Workers[i], 0, 0);
+}
+
+void SleepUntil(u64 Time)
+{
+  struct timespec Until = {Time / 1000000000ull, Time % 1000000000ull};
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Until, 0);
+}
+
+// NOTE(robin): One period like a device callback would do it. Returns a bit per worker that
+// didn't deliver.
+u32 RunCycle(bench_data* Data, u32 FrameCount, u64 Deadline, shm_status* Statuses)
+{
+  const f32* Inputs[BENCH_CHANNELS];
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+    Inputs[Channel] = Data->Inputs[Channel];
+
+  u32 WorkerCount = Data->Host.WorkerCount;
+  for (u32 i = 0; i < WorkerCount; i++)
+    ShmSubmit(&Data->Host, i, Inputs, FrameCount, Deadline);
+
+  u32 Missed = 0;
+  for (u32 i = 0; i < WorkerCount; i++)
+  {
+    f32* Outputs[BENCH_CHANNELS];
+    for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+      Outputs[Channel] = Data->Outputs[i][Channel];
+
+    Statuses[i] = ShmCollect(&Data->Host, i, Outputs, FrameCount);
+    if (Statuses[i] != ShmStatusOK)
+    {
+      Missed |= 1u << i;
+      for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+        for (u32 n = 0; n < FrameCount; n++)
+          assert(Outputs[Channel][n] == 0.0f);
+    }
+    else
+    {
+      for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+        for (u32 n = 0; n < FrameCount; n++)
+          assert(Outputs[Channel][n] == 0.5f * Data->Inputs[Channel][n]);
+    }
+  }
+  return Missed;
+}
+
+int CompareU64(const void* A, const void* B)
+{
+  u64 X = *(const u64*)A, Y = *(const u64*)B;
+  return X < Y ? -1 : X > Y;
+}
+
+void PrintPercentiles(const char* Name, u64* Values, u32 Count)
+{
+  qsort(Values, Count, sizeof(u64), CompareU64);
+  printf("  %-16s median %7.1fus  99%% %7.1fus  max %7.1fus\n", Name,
+      (f64)Values[Count / 2] / 1000.0, (f64)Values[Count * 99 / 100] / 1000.0, (f64)Values[Count - 1] / 1000.0);
+}
+
+void BenchLatency(bench_data* Data, u32 WorkerCount, u32 FrameCount)
+{
+  StartWorkers(Data, WorkerCount);
+
+  // NOTE(robin): About 4 seconds each
+  u64 Period = (u64)FrameCount * 1000000000ull / BENCH_RATE;
+  u32 CycleCount = 4 * BENCH_RATE / FrameCount < BENCH_CYCLES ? 4 * BENCH_RATE / FrameCount : BENCH_CYCLES;
+  u64 Next = ShmNow() + 10 * Period;
+  u32 WakeCount = 0, Misses = 0;
+  for (u32 Cycle = 0; Cycle < CycleCount; Cycle++)
+  {
+    SleepUntil(Next);
+    u64 Start = ShmNow();
+
+    shm_status Statuses[SHM_MAX_WORKERS];
+    Misses += RunCycle(Data, FrameCount, Start + Period / 2, Statuses) != 0;
+    Data->RoundTrips[Cycle] = ShmNow() - Start;
+
+    for (u32 i = 0; i < WorkerCount; i++)
+    {
+      shm_slot* Slot = &Data->Host.Region->Slots[i];
+      if (Statuses[i] == ShmStatusOK)
+        Data->WakeLatencies[WakeCount++] = Slot->WakeTime - Data->Host.SubmitTimes[i];
+    }
+    Next += Period;
+  }
+
+  printf("%u worker%s, %u frames (%.2fms period), %u of %u cycles with a miss\n", WorkerCount,
+      WorkerCount > 1 ? "s" : "", FrameCount, (f64)Period / 1e6, Misses, CycleCount);
+  PrintPercentiles("wake to process", Data->WakeLatencies, WakeCount);
+  PrintPercentiles("round trip", Data->RoundTrips, CycleCount);
+
+  StopWorkers(Data);
+}
+
+void VerifyDeadline(bench_data* Data)
+{
+  StartWorkers(Data, 2);
+
+  u32 FrameCount = 256;
+  u64 Period = (u64)FrameCount * 1000000000ull / BENCH_RATE;
+  shm_status Statuses[SHM_MAX_WORKERS];
+  u32 Missed = 0;
+  for (u32 Cycle = 0; Cycle < 10; Cycle++)
+    Missed |= RunCycle(Data, FrameCount, ShmNow() + Period, Statuses);
+  assert(Missed == 0);
+
+  // NOTE(robin): Stall worker 1 for 1.5 periods on its next cycle
+  u32 Microseconds = (u32)(3 * Period / 2000);
+  ShmRingWrite(&Data->Host.Region->Slots[1].ToWorker, BENCH_STALL, &Microseconds, sizeof(Microseconds));
+
+  u64 Deadline = ShmNow() + Period / 2;
+  Missed = RunCycle(Data, FrameCount, Deadline, Statuses);
+  u64 Overrun = ShmNow() - Deadline;
+  printf("Stalled worker: %s, collect returned %.0fus after the deadline\n",
+      Statuses[1] == ShmStatusLate ? "late" : "on time", (f64)Overrun / 1000.0);
+  assert(Missed == 2 && Statuses[1] == ShmStatusLate && Statuses[0] == ShmStatusOK);
+
+  u64 Now = ShmNow();
+  Missed = RunCycle(Data, FrameCount, Now + Period / 2, Statuses);
+  printf("Next cycle: %s after %.0fus\n", Statuses[1] == ShmStatusSkipped ? "skipped" : "not skipped",
+      (f64)(ShmNow() - Now) / 1000.0);
+  assert(Missed == 2 && Statuses[1] == ShmStatusSkipped);
+
+  u32 Recovered = 0;
+  for (u32 Cycle = 0; Cycle < 10 && !Recovered; Cycle++)
+  {
+    usleep(Period / 1000);
+    Recovered = RunCycle(Data, FrameCount, ShmNow() + Period, Statuses) == 0;
+  }
+  printf("Recovered: %s\n", Recovered ? "yes" : "no");
+  assert(Recovered);
+
+  StopWorkers(Data);
+}
+
+void VerifyCrash(bench_data* Data)
+{
+  StartWorkers(Data, 2);
+
+  u32 FrameCount = 256;
+  u64 Period = (u64)FrameCount * 1000000000ull / BENCH_RATE;
+  shm_status Statuses[SHM_MAX_WORKERS];
+  u32 Missed = 0;
+  for (u32 Cycle = 0; Cycle < 10; Cycle++)
+    Missed |= RunCycle(Data, FrameCount, ShmNow() + Period, Statuses);
+  assert(Missed == 0);
+
+  kill(Data->Workers[0], SIGKILL);
+  waitpid(Data->Workers[0], 0, 0);
+
+  u64 Worst = 0;
+  for (u32 Cycle = 0; Cycle < 10; Cycle++)
+  {
+    u64 Start = ShmNow();
+    Missed = RunCycle(Data, FrameCount, Start + Period / 2, Statuses);
+    u64 Elapsed = ShmNow() - Start;
+    Worst = Elapsed > Worst ? Elapsed : Worst;
+    assert(Missed == 1);
+  }
+  printf("Killed worker: silence, worst cycle %.0fus (deadline %.0fus)\n", (f64)Worst / 1000.0,
+      (f64)(Period / 2) / 1000.0);
+
+  StartWorker(Data, 0);
+  u32 Recovered = 0;
+  for (u32 Cycle = 0; Cycle < 100 && !Recovered; Cycle++)
+  {
+    usleep(Period / 1000);
+    Recovered = RunCycle(Data, FrameCount, ShmNow() + Period, Statuses) == 0;
+  }
+  printf("Replacement worker took over: %s\n\n", Recovered ? "yes" : "no");
+  assert(Recovered);
+
+  StopWorkers(Data);
+}
+
+int main(int argc, char** argv)
+{
+  static bench_data Data;
+  for (u32 Channel = 0; Channel < BENCH_CHANNELS; Channel++)
+    for (u32 i = 0; i < SHM_MAX_FRAMES; i++)
+      Data.Inputs[Channel][i] = (f32)sin(0.01 * (f64)(i + Channel * 100));
+
+  VerifyDeadline(&Data);
+  VerifyCrash(&Data);
+
+  u32 WorkerCounts[] = {1, 2, 4};
+  u32 FrameCounts[] = {64, 256};
+  for (u32 i = 0; i < sizeof(FrameCounts) / sizeof(FrameCounts[0]); i++)
+    for (u32 j = 0; j < sizeof(WorkerCounts) / sizeof(WorkerCounts[0]); j++)
+      BenchLatency(&Data, WorkerCounts[j], FrameCounts[i]);
+
+  return 0;
+}
@@ -0,0 +1,443 @@
+/*
+ * This file moves audio between the process that owns the device (e.g. an ALSA loop) and
+ * worker processes through shared memory, so that a crash in the DSP code of a worker only
+ * costs you that worker's output instead of the whole audio engine. Linux only.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ *   // Device process, once
+ *   shm_host Host;
+ *   ShmHostCreate(&Host, ChannelCount, WorkerCount, SampleRate);
+ *   // Start the workers and give them Host.FD (inherit it, or send it over a unix socket)
+ *
+ *   // Device process, every period
+ *   u64 Deadline = ShmNow() + Budget;
+ *   for (every worker)
+ *     ShmSubmit(&Host, Worker, Inputs, FrameCount, Deadline);
+ *   for (every worker)
+ *     ShmCollect(&Host, Worker, Outputs[Worker], FrameCount); // Silence if it's late
+ *
+ *   // Worker process
+ *   shm_worker Worker;
+ *   ShmWorkerAttach(&Worker, FD, Index);
+ *   shm_cycle Cycle;
+ *   while (ShmWorkerWait(&Worker, &Cycle))
+ *   {
+ *     Process(Cycle.Inputs, Cycle.Outputs, Cycle.FrameCount);
+ *     ShmWorkerDone(&Worker);
+ *   }
+ *
+ * NOTE(robin): The shared region is a memfd, so it has no name in the file system and goes
+ * away when the last process closes it. Everything in it is fixed size and addressed by
+ * index rather than by pointer, since every process maps it at a different address. It's
+ * mapped with MAP_POPULATE and locked so the audio path never page faults.
+ *
+ * Every worker has a slot with planar input and output buffers, and two counters that are
+ * also futexes: Request (written by the host, the worker sleeps on it) and Done (written by
+ * the worker, the host sleeps on it). ShmSubmit copies the inputs, increments Request and
+ * wakes the worker. ShmCollect sleeps on Done until the worker catches up or the deadline
+ * passes (FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, so there's no drift
+ * from computing relative timeouts). The buffers don't need double buffering because there
+ * is never more than one request outstanding: if the worker is still busy with an old cycle
+ * (it missed a deadline, or it crashed) ShmSubmit doesn't touch its buffers and ShmCollect
+ * returns silence straight away, without waiting out the deadline again. A replacement
+ * worker that attaches to the slot of a crashed one just picks up the request in flight.
+ *
+ * Each slot also has two single producer single consumer message rings (ToWorker and
+ * ToHost) for parameter changes and notifications, see ShmRingWrite.
+ *
+ * The host never trusts anything the workers write beyond comparing counters: lengths and
+ * indices read from shared memory are masked or clamped before they are used. What the host
+ * writes there for the workers (the channel count, the request counter, the deadline) it
+ * keeps its own copy of in shm_host, and only ever reads Done and the outputs back, since a
+ * worker can scribble over the rest of its slot, or the header, at any time.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_MAGIC 0x314d4853 // NOTE(robin): "SHM1"
+#define SHM_MAX_WORKERS 4
+#define SHM_MAX_CHANNELS 8
+#define SHM_MAX_FRAMES 2048
+#define SHM_RING_SIZE 64 // NOTE(robin): Messages, a power of 2
+#define SHM_MESSAGE_SIZE 56
+
+// NOTE(robin): Counters written by different processes live on different cache lines
+#define SHM_ALIGNED __attribute__((aligned(64)))
+
+typedef struct
+{
+  u32 Type;
+  u32 Size;
+  u8 Data[SHM_MESSAGE_SIZE];
+} shm_message;
+
+typedef struct
+{
+  SHM_ALIGNED u32 Write; // NOTE(robin): Only the producer writes this
+  SHM_ALIGNED u32 Read;  // NOTE(robin): Only the consumer writes this
+  shm_message Messages[SHM_RING_SIZE];
+} shm_ring;
+
+typedef struct
+{
+  // NOTE(robin): Written by the host
+  SHM_ALIGNED u32 Request;
+  u32 FrameCount;
+  u64 Deadline;
+
+  // NOTE(robin): Written by the worker
+  SHM_ALIGNED u32 Done;
+  u32 PID;
+  u64 WakeTime; // NOTE(robin): When the worker saw the last request, for benchmarking
+
+  shm_ring ToWorker;
+  shm_ring ToHost;
+
+  SHM_ALIGNED f32 Inputs[SHM_MAX_CHANNELS][SHM_MAX_FRAMES];
+  f32 Outputs[SHM_MAX_CHANNELS][SHM_MAX_FRAMES];
+} shm_slot;
+
+typedef struct
+{
+  u32 Magic;
+  u32 Size;
+  u32 ChannelCount;
+  u32 WorkerCount;
+  u32 SampleRate;
+  u32 HostPID;
+  u32 Quit;
+  shm_slot Slots[SHM_MAX_WORKERS];
+} shm_region;
+
+typedef enum
+{
+  ShmStatusOK,
+  ShmStatusLate,    // NOTE(robin): Missed the deadline, the output is silence
+  ShmStatusSkipped, // NOTE(robin): Still busy with an older cycle (or dead), the output is silence
+} shm_status;
+
+typedef struct
+{
+  u32 Cycles;
+  u32 Completed;
+  u32 Late;
+  u32 Skipped;
+  u64 WorstRoundTrip; // NOTE(robin): Submit to collect, in nanoseconds
+} shm_stats;
+
+typedef struct
+{
+  shm_region* Region;
+  int FD;
+  u32 ChannelCount;
+  u32 WorkerCount;
+  u32 Requests[SHM_MAX_WORKERS];
+  u32 Submitted[SHM_MAX_WORKERS];
+  u64 Deadlines[SHM_MAX_WORKERS];
+  u64 SubmitTimes[SHM_MAX_WORKERS];
+  shm_stats Stats[SHM_MAX_WORKERS];
+} shm_host;
+
+typedef struct
+{
+  shm_region* Region;
+  shm_slot* Slot;
+  u32 Done;
+} shm_worker;
+
+typedef struct
+{
+  const f32* Inputs[SHM_MAX_CHANNELS];
+  f32* Outputs[SHM_MAX_CHANNELS];
+  u32 ChannelCount;
+  u32 FrameCount;
+  u64 Deadline;
+} shm_cycle;
+
+u64 ShmNow(void)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+}
+
+// NOTE(robin): Sleeps while *Address == Expected, until Deadline (CLOCK_MONOTONIC
+// nanoseconds, 0 for no deadline). Not FUTEX_PRIVATE_FLAG since the waker is another process.
+static void ShmFutexWait(u32* Address, u32 Expected, u64 Deadline)
+{
+  struct timespec Time;
+  Time.tv_sec = Deadline / 1000000000ull;
+  Time.tv_nsec = Deadline % 1000000000ull;
+  syscall(SYS_futex, Address, FUTEX_WAIT_BITSET, Expected, Deadline ? &Time : 0, 0, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void ShmFutexWake(u32* Address)
+{
+  syscall(SYS_futex, Address, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+static shm_region* ShmMap(int FD)
+{
+  void* Memory = mmap(0, sizeof(shm_region), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, FD, 0);
+  if (Memory == MAP_FAILED)
+    return 0;
+
+  // NOTE(robin): Fails without the memlock limit for it, which only costs us page faults
+  // if the region gets swapped out
+  mlock(Memory, sizeof(shm_region));
+  return Memory;
+}
+
+u32 ShmHostCreate(shm_host* Host, u32 ChannelCount, u32 WorkerCount, u32 SampleRate)
+{
+  memset(Host, 0, sizeof(*Host));
+  if (ChannelCount > SHM_MAX_CHANNELS || WorkerCount > SHM_MAX_WORKERS)
+    return 0;
+
+  // NOTE(robin): No MFD_CLOEXEC, so the workers can inherit it through exec
+  Host->FD = syscall(SYS_memfd_create, "SimpleNativeAudio", 0);
+  if (Host->FD < 0)
+    return 0;
+
+  if (ftruncate(Host->FD, sizeof(shm_region)) || !(Host->Region = ShmMap(Host->FD)))
+  {
+    close(Host->FD);
+    return 0;
+  }
+
+  Host->ChannelCount = ChannelCount;
+  Host->WorkerCount = WorkerCount;
+
+  shm_region* Region = Host->Region;
+  Region->Size = sizeof(shm_region);
+  Region->ChannelCount = ChannelCount;
+  Region->WorkerCount = WorkerCount;
+  Region->SampleRate = SampleRate;
+  Region->HostPID = getpid();
+  __atomic_store_n(&Region->Magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void ShmHostDestroy(shm_host* Host)
+{
+  shm_region* Region = Host->Region;
+  __atomic_store_n(&Region->Quit, 1, __ATOMIC_RELEASE);
+
+  // NOTE(robin): Change Request as well, so that a worker that is just about to sleep on it
+  // doesn't miss the wake
+  for (u32 i = 0; i < Host->WorkerCount; i++)
+  {
+    __atomic_store_n(&Region->Slots[i].Request, ++Host->Requests[i], __ATOMIC_RELEASE);
+    ShmFutexWake(&Region->Slots[i].Request);
+  }
+
+  munmap(Region, sizeof(shm_region));
+  close(Host->FD);
+  Host->Region = 0;
+}
+
+// NOTE(robin): Hands one cycle of planar input to a worker. Returns 0 if the worker is still
+// busy with an older cycle, in which case ShmCollect will return silence for this one.
+u32 ShmSubmit(shm_host* Host, u32 Worker, const f32* const* Inputs, u32 FrameCount, u64 Deadline)
+{
+  shm_slot* Slot = &Host->Region->Slots[Worker];
+  shm_stats* Stats = &Host->Stats[Worker];
+  Stats->Cycles++;
+
+  u32 Request = Host->Requests[Worker];
+  Host->Submitted[Worker] = 0;
+  if (__atomic_load_n(&Slot->Done, __ATOMIC_ACQUIRE) != Request || FrameCount > SHM_MAX_FRAMES)
+  {
+    Stats->Skipped++;
+    return 0;
+  }
+
+  for (u32 Channel = 0; Channel < Host->ChannelCount; Channel++)
+    memcpy(Slot->Inputs[Channel], Inputs[Channel], FrameCount * sizeof(f32));
+  Slot->FrameCount = FrameCount;
+  Slot->Deadline = Deadline;
+  Host->Deadlines[Worker] = Deadline;
+  Host->SubmitTimes[Worker] = ShmNow();
+
+  Host->Requests[Worker] = Request + 1;
+  __atomic_store_n(&Slot->Request, Request + 1, __ATOMIC_RELEASE);
+  ShmFutexWake(&Slot->Request);
+  Host->Submitted[Worker] = 1;
+  return 1;
+}
+
+// NOTE(robin): Waits until the worker has processed the cycle given to ShmSubmit or the
+// deadline has passed, and copies its planar output. Outputs get silence unless the
+// result is ShmStatusOK.
+shm_status ShmCollect(shm_host* Host, u32 Worker, f32** Outputs, u32 FrameCount)
+{
+  shm_slot* Slot = &Host->Region->Slots[Worker];
+  shm_stats* Stats = &Host->Stats[Worker];
+  u32 ChannelCount = Host->ChannelCount;
+  u64 Deadline = Host->Deadlines[Worker];
+
+  shm_status Status = ShmStatusSkipped;
+  if (Host->Submitted[Worker])
+  {
+    Status = ShmStatusOK;
+    u32 Request = Host->Requests[Worker];
+    for (;;)
+    {
+      u32 Done = __atomic_load_n(&Slot->Done, __ATOMIC_ACQUIRE);
+      if (Done == Request)
+        break;
+
+      if (ShmNow() >= Deadline)
+      {
+        Status = ShmStatusLate;
+        Stats->Late++;
+        break;
+      }
+      ShmFutexWait(&Slot->Done, Done, Deadline);
+    }
+    Host->Submitted[Worker] = 0;
+  }
+
+  if (Status == ShmStatusOK)
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      memcpy(Outputs[Channel], Slot->Outputs[Channel], FrameCount * sizeof(f32));
+
+    u64 RoundTrip = ShmNow() - Host->SubmitTimes[Worker];
+    Stats->WorstRoundTrip = RoundTrip > Stats->WorstRoundTrip ? RoundTrip : Stats->WorstRoundTrip;
+    Stats->Completed++;
+  }
+  else
+  {
+    for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+      memset(Outputs[Channel], 0, FrameCount * sizeof(f32));
+  }
+
+  return Status;
+}
+
+void ShmHostPrintStats(shm_host* Host)
+{
+  for (u32 i = 0; i < Host->WorkerCount; i++)
+  {
+    shm_stats* Stats = &Host->Stats[i];
+    printf("worker %u: %u cycles, %u completed, %u late, %u skipped, worst round trip %.1fus\n",
+        i, Stats->Cycles, Stats->Completed, Stats->Late, Stats->Skipped, (f64)Stats->WorstRoundTrip / 1000.0);
+  }
+}
+
+u32 ShmWorkerAttach(shm_worker* Worker, int FD, u32 Index)
+{
+  memset(Worker, 0, sizeof(*Worker));
+  shm_region* Region = ShmMap(FD);
+  if (!Region)
+    return 0;
+
+  if (__atomic_load_n(&Region->Magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+      Region->Size != sizeof(shm_region) || Index >= Region->WorkerCount)
+  {
+    munmap(Region, sizeof(shm_region));
+    return 0;
+  }
+
+  Worker->Region = Region;
+  Worker->Slot = &Region->Slots[Index];
+  Worker->Slot->PID = getpid();
+
+  // NOTE(robin): If we replace a worker that died, its last request (if any) is still
+  // pending and the next ShmWorkerWait returns it
+  Worker->Done = __atomic_load_n(&Worker->Slot->Done, __ATOMIC_ACQUIRE);
+  return 1;
+}
+
+void ShmWorkerDetach(shm_worker* Worker)
+{
+  munmap(Worker->Region, sizeof(shm_region));
+  Worker->Region = 0;
+}
+
+// NOTE(robin): Sleeps until the host submits a cycle. Returns 0 when the host shuts down or
+// goes away.
+u32 ShmWorkerWait(shm_worker* Worker, shm_cycle* Cycle)
+{
+  shm_region* Region = Worker->Region;
+  shm_slot* Slot = Worker->Slot;
+
+  for (;;)
+  {
+    u32 Request = __atomic_load_n(&Slot->Request, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&Region->Quit, __ATOMIC_ACQUIRE))
+      return 0;
+
+    if (Request != Worker->Done)
+    {
+      Slot->WakeTime = ShmNow();
+      Worker->Done = Request;
+      break;
+    }
+
+    // NOTE(robin): Wake up every second to check that the host is still there
+    ShmFutexWait(&Slot->Request, Request, ShmNow() + 1000000000ull);
+    if (kill(Region->HostPID, 0) && errno == ESRCH)
+      return 0;
+  }
+
+  u32 ChannelCount = Region->ChannelCount < SHM_MAX_CHANNELS ? Region->ChannelCount : SHM_MAX_CHANNELS;
+  Cycle->ChannelCount = ChannelCount;
+  Cycle->FrameCount = Slot->FrameCount < SHM_MAX_FRAMES ? Slot->FrameCount : SHM_MAX_FRAMES;
+  Cycle->Deadline = Slot->Deadline;
+  for (u32 Channel = 0; Channel < ChannelCount; Channel++)
+  {
+    Cycle->Inputs[Channel] = Slot->Inputs[Channel];
+    Cycle->Outputs[Channel] = Slot->Outputs[Channel];
+  }
+  return 1;
+}
+
+// NOTE(robin): Publishes the outputs of the cycle from the last ShmWorkerWait
+void ShmWorkerDone(shm_worker* Worker)
+{
+  __atomic_store_n(&Worker->Slot->Done, Worker->Done, __ATOMIC_RELEASE);
+  ShmFutexWake(&Worker->Slot->Done);
+}
+
+// NOTE(robin): Single producer single consumer, never blocks. Returns 0 if the ring is full.
+u32 ShmRingWrite(shm_ring* Ring, u32 Type, const void* Data, u32 Size)
+{
+  u32 Write = Ring->Write;
+  u32 Read = __atomic_load_n(&Ring->Read, __ATOMIC_ACQUIRE);
+  if (Write - Read >= SHM_RING_SIZE || Size > SHM_MESSAGE_SIZE)
+    return 0;
+
+  shm_message* Message = &Ring->Messages[Write & (SHM_RING_SIZE - 1)];
+  Message->Type = Type;
+  Message->Size = Size;
+  memcpy(Message->Data, Data, Size);
+  __atomic_store_n(&Ring->Write, Write + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// NOTE(robin): Returns 0 if there is nothing to read
+u32 ShmRingRead(shm_ring* Ring, shm_message* Message)
+{
+  u32 Read = Ring->Read;
+  if (__atomic_load_n(&Ring->Write, __ATOMIC_ACQUIRE) == Read)
+    return 0;
+
+  *Message = Ring->Messages[Read & (SHM_RING_SIZE - 1)];
+  Message->Size = Message->Size < SHM_MESSAGE_SIZE ? Message->Size : SHM_MESSAGE_SIZE;
+  __atomic_store_n(&Ring->Read, Read + 1, __ATOMIC_RELEASE);
+  return 1;
+}
@@ -0,0 +1,293 @@
+/*
+ * This file is a small polyphonic synthesiser voice engine meant to be driven by MIDI events
+ * inside an audio callback, see jack_synth.c.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined.
+ *
+ * NOTE(robin): To be sample accurate, render up to each event's frame offset, apply the event,
+ * and carry on from there:
+ *
+ *   u32 Done = 0;
+ *   for (every event in the period, in order)
+ *   {
+ *     SynthRender(&Synth, Output + Done, Event.Frame - Done);
+ *     SynthMIDI(&Synth, Event.Data, Event.Size);
+ *     Done = Event.Frame;
+ *   }
+ *   SynthRender(&Synth, Output + Done, FrameCount - Done);
+ *
+ * A note then starts exactly at its frame, so the latency from the MIDI event to the sound is
+ * the same fixed number of frames for every note (no jitter from where in the period the
+ * event happened to arrive).
+ *
+ * All voices live in the synth struct, nothing is allocated. The voice state is stored as
+ * arrays per field (structure of arrays) with the playing voices packed at the front, so that
+ * rendering runs SYNTH_LANES voices side by side through the same loop, which the compiler
+ * vectorises. When a voice has faded out the last playing voice is moved into its slot. When
+ * every voice is busy a new note steals the oldest voice, preferring ones that are already
+ * released.
+ *
+ * SynthLimitVoices lowers the polyphony while the synth runs, e.g. when the CPU can't keep up
+ * (see governor.c). The oldest notes over the limit are released with a short fade, and new
+ * notes steal the oldest playing note instead of taking a free voice.
+ *
+ * The voices are sines with an exponential attack/release envelope. It's meant to show the
+ * structure, put your own oscillator in SynthRender.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#define SYNTH_MAX_VOICES 32
+#define SYNTH_LANES 8
+#define SYNTH_SILENT 1e-4f // NOTE(robin): Released voices below this level are freed
+
+typedef struct
+{
+  f32 SampleRate;
+  f32 AttackCoefficient;
+  f32 ReleaseCoefficient;
+  f32 StealCoefficient;
+  f32 Gain;
+  u32 VoiceLimit;
+  u32 ActiveCount;
+  u32 Serial;
+  u32 Steals;
+
+  // NOTE(robin): Voice state, the first ActiveCount entries are playing. Everything after
+  // that is zero so that the last lane group renders silence.
+  f32 Phase[SYNTH_MAX_VOICES];
+  f32 PhaseDelta[SYNTH_MAX_VOICES];
+  f32 Level[SYNTH_MAX_VOICES];
+  f32 Target[SYNTH_MAX_VOICES];
+  f32 Coefficient[SYNTH_MAX_VOICES];
+  u32 Started[SYNTH_MAX_VOICES];
+  u8 Note[SYNTH_MAX_VOICES];
+  u8 Released[SYNTH_MAX_VOICES];
+} synth;
+
+// NOTE(robin): sin(2 * pi * Phase) for Phase in [0, 1), branch free, see DSPSinTurns in
+// dsp_kernels.c
+static inline f32 SynthSinTurns(f32 Phase)
+{
+  f32 X = Phase - 0.5f;
+  X = copysignf(0.25f - fabsf(fabsf(X) - 0.25f), X);
+
+  f32 Z = 6.28318530718f * X;
+  f32 Z2 = Z * Z;
+  f32 Result = Z * (1.0f + Z2 * (-1.0f / 6.0f + Z2 * (1.0f / 120.0f +
+        Z2 * (-1.0f / 5040.0f + Z2 * (1.0f / 362880.0f)))));
+  return -Result;
+}
+
+void SynthInit(synth* Synth, f32 SampleRate)
+{
+  memset(Synth, 0, sizeof(*Synth));
+  Synth->SampleRate = SampleRate;
+  Synth->Gain = 0.1f;
+
+  // NOTE(robin): One pole envelopes, ~63% of the way after 2ms (attack) and 150ms (release)
+  Synth->AttackCoefficient = 1.0f - expf(-1.0f / (0.002f * SampleRate));
+  Synth->ReleaseCoefficient = 1.0f - expf(-1.0f / (0.150f * SampleRate));
+
+  // NOTE(robin): Fast enough to free the voice soon, slow enough not to click
+  Synth->StealCoefficient = 1.0f - expf(-1.0f / (0.005f * SampleRate));
+  Synth->VoiceLimit = SYNTH_MAX_VOICES;
+}
+
+static void SynthRemoveVoice(synth* Synth, u32 Voice)
+{
+  u32 Last = --Synth->ActiveCount;
+  Synth->Phase[Voice] = Synth->Phase[Last];
+  Synth->PhaseDelta[Voice] = Synth->PhaseDelta[Last];
+  Synth->Level[Voice] = Synth->Level[Last];
+  Synth->Target[Voice] = Synth->Target[Last];
+  Synth->Coefficient[Voice] = Synth->Coefficient[Last];
+  Synth->Started[Voice] = Synth->Started[Last];
+  Synth->Note[Voice] = Synth->Note[Last];
+  Synth->Released[Voice] = Synth->Released[Last];
+
+  Synth->Phase[Last] = 0;
+  Synth->PhaseDelta[Last] = 0;
+  Synth->Level[Last] = 0;
+  Synth->Target[Last] = 0;
+  Synth->Coefficient[Last] = 0;
+}
+
+// NOTE(robin): The oldest voice that hasn't been released, or ActiveCount if there's none.
+// Also counts them.
+static u32 SynthOldestPlaying(synth* Synth, u32* Playing)
+{
+  u32 Oldest = Synth->ActiveCount;
+  *Playing = 0;
+  for (u32 i = 0; i < Synth->ActiveCount; i++)
+  {
+    if (Synth->Released[i])
+      continue;
+
+    (*Playing)++;
+    if (Oldest == Synth->ActiveCount || (s32)(Synth->Started[i] - Synth->Started[Oldest]) < 0)
+      Oldest = i;
+  }
+  return Oldest;
+}
+
+void SynthNoteOn(synth* Synth, u8 Note, u8 Velocity)
+{
+  u32 Playing;
+  u32 Oldest = SynthOldestPlaying(Synth, &Playing);
+
+  u32 Voice = Synth->ActiveCount;
+  if (Playing >= Synth->VoiceLimit)
+  {
+    // NOTE(robin): At the limit, so this note takes over the oldest one, gliding like below
+    Voice = Oldest;
+    Synth->Steals++;
+  }
+  else if (Voice == SYNTH_MAX_VOICES)
+  {
+    // NOTE(robin): Steal the oldest voice, released ones first. It keeps its level and
+    // phase so the envelope glides to the new note instead of clicking.
+    u32 Best = 0;
+    for (u32 i = 1; i < SYNTH_MAX_VOICES; i++)
+    {
+      u32 BetterRelease = Synth->Released[i] > Synth->Released[Best];
+      u32 SameRelease = Synth->Released[i] == Synth->Released[Best];
+      if (BetterRelease || (SameRelease && (s32)(Synth->Started[i] - Synth->Started[Best]) < 0))
+        Best = i;
+    }
+    Voice = Best;
+    Synth->Steals++;
+  }
+  else
+  {
+    Synth->ActiveCount++;
+    Synth->Phase[Voice] = 0;
+    Synth->Level[Voice] = 0;
+  }
+
+  f32 Frequency = 440.0f * powf(2.0f, ((f32)Note - 69.0f) / 12.0f);
+  Synth->PhaseDelta[Voice] = Frequency / Synth->SampleRate;
+  Synth->Target[Voice] = Synth->Gain * (f32)Velocity / 127.0f;
+  Synth->Coefficient[Voice] = Synth->AttackCoefficient;
+  Synth->Started[Voice] = Synth->Serial++;
+  Synth->Note[Voice] = Note;
+  Synth->Released[Voice] = 0;
+}
+
+void SynthNoteOff(synth* Synth, u8 Note)
+{
+  for (u32 i = 0; i < Synth->ActiveCount; i++)
+  {
+    if (Synth->Note[i] == Note && !Synth->Released[i])
+    {
+      Synth->Target[i] = 0;
+      Synth->Coefficient[i] = Synth->ReleaseCoefficient;
+      Synth->Released[i] = 1;
+    }
+  }
+}
+
+// NOTE(robin): At most Limit notes keep playing (at least 1), see the top of the file. Notes
+// that are already over the limit fade out over a few milliseconds.
+void SynthLimitVoices(synth* Synth, u32 Limit)
+{
+  Synth->VoiceLimit = Limit < 1 ? 1 : Limit > SYNTH_MAX_VOICES ? SYNTH_MAX_VOICES : Limit;
+
+  u32 Playing;
+  u32 Oldest = SynthOldestPlaying(Synth, &Playing);
+  while (Playing > Synth->VoiceLimit)
+  {
+    Synth->Target[Oldest] = 0;
+    Synth->Coefficient[Oldest] = Synth->StealCoefficient;
+    Synth->Released[Oldest] = 1;
+    Synth->Steals++;
+    Oldest = SynthOldestPlaying(Synth, &Playing);
+  }
+}
+
+void SynthAllNotesOff(synth* Synth)
+{
+  for (u32 i = 0; i < Synth->ActiveCount; i++)
+  {
+    Synth->Target[i] = 0;
+    Synth->Coefficient[i] = Synth->ReleaseCoefficient;
+    Synth->Released[i] = 1;
+  }
+}
+
+// NOTE(robin): Handles one raw MIDI message (any channel). Returns 1 if it was a message we
+// understand.
+u32 SynthMIDI(synth* Synth, const u8* Data, u32 Size)
+{
+  if (Size < 3)
+    return 0;
+
+  u8 Status = Data[0] & 0xF0;
+  if (Status == 0x90 && Data[2])
+  {
+    SynthNoteOn(Synth, Data[1] & 0x7F, Data[2] & 0x7F);
+    return 1;
+  }
+  if (Status == 0x80 || Status == 0x90)
+  {
+    SynthNoteOff(Synth, Data[1] & 0x7F);
+    return 1;
+  }
+  if (Status == 0xB0 && (Data[1] == 120 || Data[1] == 123)) // NOTE(robin): All sound/notes off
+  {
+    SynthAllNotesOff(Synth);
+    return 1;
+  }
+  return 0;
+}
+
+// NOTE(robin): Writes FrameCount samples of the mix of all voices to Output
+void SynthRender(synth* Synth, f32* Output, u32 FrameCount)
+{
+  memset(Output, 0, FrameCount * sizeof(f32));
+
+  for (u32 Group = 0; Group * SYNTH_LANES < Synth->ActiveCount; Group++)
+  {
+    // NOTE(robin): Locals so that the compiler knows they don't alias Output
+    u32 First = Group * SYNTH_LANES;
+    f32 Phase[SYNTH_LANES], PhaseDelta[SYNTH_LANES], Level[SYNTH_LANES];
+    f32 Target[SYNTH_LANES], Coefficient[SYNTH_LANES];
+    memcpy(Phase, Synth->Phase + First, sizeof(Phase));
+    memcpy(PhaseDelta, Synth->PhaseDelta + First, sizeof(PhaseDelta));
+    memcpy(Level, Synth->Level + First, sizeof(Level));
+    memcpy(Target, Synth->Target + First, sizeof(Target));
+    memcpy(Coefficient, Synth->Coefficient + First, sizeof(Coefficient));
+
+    for (u32 n = 0; n < FrameCount; n++)
+    {
+      // NOTE(robin): Advance first, so a note that starts at frame n is already audible at n
+      f32 Voices[SYNTH_LANES];
+      for (u32 j = 0; j < SYNTH_LANES; j++)
+      {
+        Phase[j] += PhaseDelta[j];
+        Phase[j] -= Phase[j] >= 1.0f ? 1.0f : 0.0f;
+        Level[j] += (Target[j] - Level[j]) * Coefficient[j];
+        Voices[j] = Level[j] * SynthSinTurns(Phase[j]);
+      }
+
+      f32 Sum = 0;
+      for (u32 j = 0; j < SYNTH_LANES; j++)
+        Sum += Voices[j];
+      Output[n] += Sum;
+    }
+
+    memcpy(Synth->Phase + First, Phase, sizeof(Phase));
+    memcpy(Synth->Level + First, Level, sizeof(Level));
+  }
+
+  // NOTE(robin): Free the voices that have faded out. Going backwards means the voice we move
+  // into a freed slot has already been checked.
+  for (u32 i = Synth->ActiveCount; i-- > 0;)
+  {
+    if (Synth->Released[i] && Synth->Level[i] < SYNTH_SILENT)
+      SynthRemoveVoice(Synth, i);
+  }
+}
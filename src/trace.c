@@ -0,0 +1,347 @@
+/*
+ * This file records what the audio threads were doing, so that when a callback is late you
+ * can see why: which stage took long, whether the thread woke up late, whether it waited on a
+ * worker. The events go into a per thread flight recorder and are written out as a Chrome
+ * trace, which you can open in https://ui.perfetto.dev or chrome://tracing.
+ *
+ * IMPORTANT(robin): Like asio.c, THIS FILE WILL NOT COMPILE ON ITS OWN!!!
+ * It is expected that you #include this source file into another source file that
+ * already has the fixed size types from types.h defined. On Windows you need to have
+ * included Windows.h. Include it before files that have trace markers in them (like
+ * renderahead.c), otherwise their markers compile to nothing.
+ *
+ *   TraceInit();
+ *   ...
+ *   // In the callback, or any other thread
+ *   TraceThreadName("audio"); // NOTE(robin): Optional, once per thread
+ *   TraceBegin("callback");
+ *   TraceBegin("synth");
+ *   ...
+ *   TraceEnd("synth");
+ *   TraceCounter("queue depth", Depth);
+ *   if (Late)
+ *     TraceTrigger("xrun");
+ *   TraceEnd("callback");
+ *   ...
+ *   // On another thread
+ *   if (TraceTriggered())
+ *     TraceWrite("trace.json");
+ *
+ * NOTE(robin): Recording an event is a thread local load, a timestamp and a few stores into
+ * this thread's ring, about as cheap as it gets (see trace_bench.c), so the markers can stay
+ * in all the time. The timestamps come straight from the CPU's counter (rdtsc on x86,
+ * cntvct_el0 on ARM64) and are converted to time when the trace is written, by comparing
+ * the counter with the clock at TraceInit and at TraceWrite.
+ *
+ * Each ring keeps the last TRACE_RING_SIZE events of its thread, older ones are overwritten.
+ * At a few dozen events per period that's a couple of seconds, plenty to see what led up to
+ * an xrun. TraceWrite can run while the threads keep recording: it copies the rings and then
+ * throws away anything that was overwritten while it was copying.
+ *
+ * IMPORTANT(robin): Like rtlog.c, only the name pointers are stored, so names have to be
+ * string literals or other strings that live as long as the program.
+ *
+ * Begin and end events have to be on the same thread and properly nested, like a call stack.
+ * C has no destructors, so there's no scope guard, just make sure every return between a
+ * TraceBegin and its TraceEnd has a TraceEnd too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+#define TRACE_ENABLED 1
+#define TRACE_MAX_THREADS 16
+#define TRACE_RING_SIZE 16384 // NOTE(robin): Events per thread, a power of two
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#define TraceLoad(Pointer) (*(volatile u32*)(Pointer))
+#define TraceStore(Pointer, Value) (*(volatile u32*)(Pointer) = (Value))
+#define TraceFetchAdd(Pointer, Value) (u32)_InterlockedExchangeAdd((volatile long*)(Pointer), (long)(Value))
+#define TraceFence() _ReadWriteBarrier()
+#else
+#define TRACE_THREAD_LOCAL __thread
+#define TraceLoad(Pointer) __atomic_load_n((Pointer), __ATOMIC_ACQUIRE)
+#define TraceStore(Pointer, Value) __atomic_store_n((Pointer), (Value), __ATOMIC_RELEASE)
+#define TraceFetchAdd(Pointer, Value) __atomic_fetch_add((Pointer), (Value), __ATOMIC_ACQ_REL)
+#define TraceFence() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
+typedef enum
+{
+  TraceEventBegin,
+  TraceEventEnd,
+  TraceEventInstant,
+  TraceEventCounter,
+} trace_event_type;
+
+typedef struct
+{
+  u64 Time; // NOTE(robin): CPU counter ticks, see TraceTicks
+  const char* Name;
+  s64 Value; // NOTE(robin): Only for counters
+  u32 Type;
+  u32 Padding;
+} trace_event;
+
+typedef struct
+{
+  trace_event Events[TRACE_RING_SIZE];
+  u32 Written; // NOTE(robin): Only written by the thread that owns the ring, never wraps back
+  const char* Name;
+} trace_ring;
+
+typedef struct
+{
+  trace_ring Rings[TRACE_MAX_THREADS];
+  u32 RingCount;
+  u32 Triggers;
+  u32 Written; // NOTE(robin): Triggers as of the last TraceWrite
+
+  u64 StartTicks;
+  u64 StartNanoseconds;
+} trace;
+
+static trace TraceState;
+static TRACE_THREAD_LOCAL trace_ring* TraceThreadRing;
+static TRACE_THREAD_LOCAL u32 TraceThreadHasNoRing;
+
+static u64 TraceNanoseconds(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER Counter, Frequency;
+  QueryPerformanceCounter(&Counter);
+  QueryPerformanceFrequency(&Frequency);
+  return (u64)((f64)Counter.QuadPart * 1e9 / (f64)Frequency.QuadPart);
+#else
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  return (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec;
+#endif
+}
+
+static inline u64 TraceTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  // NOTE(robin): Every x86 CPU from the last 15 years has an invariant TSC, one that ticks
+  // at a constant rate whatever the clock speed and power state
+  return __rdtsc();
+#elif defined(__aarch64__)
+  u64 Ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(Ticks));
+  return Ticks;
+#else
+  return TraceNanoseconds();
+#endif
+}
+
+// NOTE(robin): Call once before anything is recorded
+void TraceInit(void)
+{
+  TraceState.StartTicks = TraceTicks();
+  TraceState.StartNanoseconds = TraceNanoseconds();
+}
+
+static trace_ring* TraceGetRing(void)
+{
+  trace_ring* Ring = TraceThreadRing;
+  if (!Ring && !TraceThreadHasNoRing)
+  {
+    // NOTE(robin): Too many threads, this one isn't recorded. We remember that, so every
+    // thread only counts once and RingCount can't wrap around to rings that have an owner.
+    u32 Index = TraceFetchAdd(&TraceState.RingCount, 1);
+    if (Index >= TRACE_MAX_THREADS)
+    {
+      TraceThreadHasNoRing = 1;
+      return 0;
+    }
+    Ring = &TraceState.Rings[Index];
+    TraceThreadRing = Ring;
+  }
+  return Ring;
+}
+
+static inline void TraceRecord(u32 Type, const char* Name, s64 Value)
+{
+  trace_ring* Ring = TraceThreadRing;
+  if (!Ring && !(Ring = TraceGetRing()))
+    return;
+
+  u32 Index = Ring->Written;
+  trace_event* Event = &Ring->Events[Index % TRACE_RING_SIZE];
+  Event->Time = TraceTicks();
+  Event->Name = Name;
+  Event->Value = Value;
+  Event->Type = Type;
+  TraceStore(&Ring->Written, Index + 1);
+}
+
+static inline void TraceBegin(const char* Name)
+{
+  TraceRecord(TraceEventBegin, Name, 0);
+}
+
+static inline void TraceEnd(const char* Name)
+{
+  TraceRecord(TraceEventEnd, Name, 0);
+}
+
+static inline void TraceInstant(const char* Name)
+{
+  TraceRecord(TraceEventInstant, Name, 0);
+}
+
+static inline void TraceCounter(const char* Name, s64 Value)
+{
+  TraceRecord(TraceEventCounter, Name, Value);
+}
+
+// NOTE(robin): Names the calling thread in the trace
+void TraceThreadName(const char* Name)
+{
+  trace_ring* Ring = TraceGetRing();
+  if (Ring)
+    Ring->Name = Name;
+}
+
+// NOTE(robin): Marks something that went wrong (an xrun, a missed deadline) and asks for the
+// trace to be written out. Safe in the callback, the writing is up to another thread, see
+// TraceTriggered.
+void TraceTrigger(const char* Name)
+{
+  TraceInstant(Name);
+  TraceFetchAdd(&TraceState.Triggers, 1);
+}
+
+// NOTE(robin): True if TraceTrigger was called since the last TraceWrite
+u32 TraceTriggered(void)
+{
+  return TraceLoad(&TraceState.Triggers) != TraceState.Written;
+}
+
+// NOTE(robin): Copies the events of a ring that are still there after the copy, returns how
+// many. Events is in order, oldest first.
+static u32 TraceCopyRing(trace_ring* Ring, trace_event* Events)
+{
+  u32 End = TraceLoad(&Ring->Written);
+  u32 Start = End > TRACE_RING_SIZE ? End - TRACE_RING_SIZE : 0;
+  for (u32 i = Start; i < End; i++)
+    Events[i - Start] = Ring->Events[i % TRACE_RING_SIZE];
+
+  // NOTE(robin): The owner might have written over the oldest ones while we were copying.
+  // Event i is overwritten by event i + TRACE_RING_SIZE, which is in progress as soon as
+  // Written is at i + TRACE_RING_SIZE (Written goes up after the event is written).
+  TraceFence();
+  u32 Now = TraceLoad(&Ring->Written);
+  u32 Valid = Now >= TRACE_RING_SIZE ? Now - TRACE_RING_SIZE + 1 : 0;
+  if (Valid > Start)
+  {
+    u32 Lost = Valid - Start < End - Start ? Valid - Start : End - Start;
+    memmove(Events, Events + Lost, (End - Start - Lost) * sizeof(trace_event));
+    return End - Start - Lost;
+  }
+  return End - Start;
+}
+
+static void TraceWriteString(FILE* File, const char* String)
+{
+  fputc('"', File);
+  for (const char* c = String ? String : "(null)"; *c; c++)
+  {
+    if (*c == '"' || *c == '\\')
+      fputc('\\', File);
+    if ((u8)*c >= 0x20)
+      fputc(*c, File);
+  }
+  fputc('"', File);
+}
+
+// NOTE(robin): Writes everything that's in the rings to Path as a Chrome trace (JSON), returns
+// the number of events written, or -1 if the file couldn't be opened or we're out of memory.
+// Not for the audio thread: it allocates and does file IO. The times are in microseconds
+// since TraceInit.
+s32 TraceWrite(const char* Path)
+{
+  u32 Triggers = TraceLoad(&TraceState.Triggers);
+
+  // NOTE(robin): Work out how fast the counter ticks from how far it got since TraceInit
+  u64 Ticks = TraceTicks() - TraceState.StartTicks;
+  u64 Nanoseconds = TraceNanoseconds() - TraceState.StartNanoseconds;
+  f64 MicrosecondsPerTick = Ticks ? (f64)Nanoseconds / (f64)Ticks / 1000.0 : 0.0;
+
+  FILE* File = fopen(Path, "w");
+  if (!File)
+    return -1;
+
+  trace_event* Events = malloc(TRACE_RING_SIZE * sizeof(trace_event));
+  if (!Events)
+  {
+    fclose(File);
+    return -1;
+  }
+  u32 RingCount = TraceLoad(&TraceState.RingCount);
+  RingCount = RingCount < TRACE_MAX_THREADS ? RingCount : TRACE_MAX_THREADS;
+
+  s32 Total = 0;
+  fprintf(File, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(File, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"SimpleNativeAudio\"}}");
+
+  for (u32 RingIndex = 0; RingIndex < RingCount; RingIndex++)
+  {
+    trace_ring* Ring = &TraceState.Rings[RingIndex];
+    u32 Tid = RingIndex + 1;
+
+    char Name[32];
+    snprintf(Name, sizeof(Name), "thread %u", Tid);
+    fprintf(File, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", Tid);
+    TraceWriteString(File, Ring->Name ? Ring->Name : Name);
+    fprintf(File, "}}");
+
+    // NOTE(robin): The oldest events can be the ends of scopes whose beginnings were already
+    // overwritten, which the viewers don't like, so we skip ends until we've seen a begin
+    u32 Count = TraceCopyRing(Ring, Events);
+    u32 Depth = 0;
+    for (u32 i = 0; i < Count; i++)
+    {
+      trace_event* Event = &Events[i];
+      static const char* Phases[] = {"B", "E", "i", "C"};
+
+      if (Event->Type == TraceEventBegin)
+        Depth++;
+      else if (Event->Type == TraceEventEnd && !Depth)
+        continue;
+      else if (Event->Type == TraceEventEnd)
+        Depth--;
+
+      f64 Time = (f64)(s64)(Event->Time - TraceState.StartTicks) * MicrosecondsPerTick;
+      fprintf(File, ",\n{\"name\":");
+      TraceWriteString(File, Event->Name);
+      fprintf(File, ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", Phases[Event->Type], Time, Tid);
+
+      if (Event->Type == TraceEventInstant)
+        fprintf(File, ",\"s\":\"t\"");
+      else if (Event->Type == TraceEventCounter)
+        fprintf(File, ",\"args\":{\"value\":%lld}", (long long)Event->Value);
+      fprintf(File, "}");
+      Total++;
+    }
+  }
+
+  fprintf(File, "\n]}\n");
+  fclose(File);
+  free(Events);
+
+  TraceState.Written = Triggers;
+  return Total;
+}
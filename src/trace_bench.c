@@ -0,0 +1,283 @@
+/*
+ * This file tests and benchmarks trace.c.
+ *
+ * - Snapshots: threads record numbered counter events as fast as they can while the main
+ *   thread copies their rings over and over. Every copy must be a run of consecutive events
+ *   in time order, i.e. nothing torn or half overwritten gets through.
+ * - File: the trace is written out and read back to check that every event is in it.
+ * - Cost: the time per event on the calling thread, which is what the markers add to a
+ *   callback.
+ *
+ * `trace_bench example trace.json` instead writes an example trace of scheduler.c running
+ * an output and an input stream from timers, the way alsa_scheduler_example does on the null
+ * device, with one callback that takes two and a half periods. example_trace.json in the
+ * root of the repo was made with it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "bench.c"
+#include "trace.c"
+#ifdef __linux__
+#include <sys/timerfd.h>
+#include <math.h>
+#include "scheduler.c"
+#endif
+
+#define BENCH_THREADS 3
+#define BENCH_EVENTS 64
+
+typedef struct
+{
+  u32 Running;
+  u32 Thread;
+} writer_data;
+
+void* WriterThread(void* Context)
+{
+  writer_data* Data = Context;
+  static const char* Names[] = {"writer 0", "writer 1", "writer 2"};
+  TraceThreadName(Names[Data->Thread]);
+
+  for (s64 i = 0; __atomic_load_n(&Data->Running, __ATOMIC_ACQUIRE); i++)
+    TraceCounter("sequence", i);
+  return 0;
+}
+
+void VerifySnapshots(void)
+{
+  static writer_data Writers[BENCH_THREADS];
+  pthread_t Threads[BENCH_THREADS];
+  for (u32 i = 0; i < BENCH_THREADS; i++)
+  {
+    Writers[i].Running = 1;
+    Writers[i].Thread = i;
+    pthread_create(&Threads[i], 0, WriterThread, &Writers[i]);
+  }
+
+  // NOTE(robin): Wait for the writers to claim their rings
+  while (TraceLoad(&TraceState.RingCount) < BENCH_THREADS)
+  {
+  }
+
+  trace_event* Events = malloc(TRACE_RING_SIZE * sizeof(trace_event));
+  u64 Copied = 0, Dropped = 0;
+  for (u32 Copy = 0; Copy < 1000; Copy++)
+  {
+    trace_ring* Ring = &TraceState.Rings[Copy % BENCH_THREADS];
+    u32 Count = TraceCopyRing(Ring, Events);
+    for (u32 i = 1; i < Count; i++)
+    {
+      assert(Events[i].Value == Events[i - 1].Value + 1);
+      assert(Events[i].Time >= Events[i - 1].Time);
+    }
+    Copied += Count;
+    Dropped += TRACE_RING_SIZE - Count;
+  }
+
+  for (u32 i = 0; i < BENCH_THREADS; i++)
+  {
+    __atomic_store_n(&Writers[i].Running, 0, __ATOMIC_RELEASE);
+    pthread_join(Threads[i], 0);
+  }
+  free(Events);
+
+  printf("Snapshots: 1000 copies while writing, %llu events, %llu overwritten during the copy, none torn\n",
+      (unsigned long long)Copied, (unsigned long long)Dropped);
+}
+
+void VerifyFile(void)
+{
+  // NOTE(robin): The main thread hasn't recorded anything yet, so its ring only has these
+  const char* Path = "trace_bench.json";
+  TraceThreadName("main");
+  for (u32 i = 0; i < 100; i++)
+  {
+    TraceBegin("outer");
+    TraceBegin("inner");
+    TraceEnd("inner");
+    TraceInstant("instant \"quoted\"");
+    TraceEnd("outer");
+  }
+
+  s32 Written = TraceWrite(Path);
+  FILE* File = fopen(Path, "r");
+  assert(File);
+
+  char Line[512];
+  u32 Lines = 0, Begins = 0, Ends = 0, Instants = 0;
+  while (fgets(Line, sizeof(Line), File))
+  {
+    if (strstr(Line, "\"ts\":"))
+      Lines++;
+    if (strstr(Line, "\"name\":\"outer\",\"ph\":\"B\""))
+      Begins++;
+    if (strstr(Line, "\"name\":\"outer\",\"ph\":\"E\""))
+      Ends++;
+    if (strstr(Line, "\"name\":\"instant \\\"quoted\\\"\",\"ph\":\"i\""))
+      Instants++;
+  }
+  fclose(File);
+  remove(Path);
+
+  printf("File: %d events written, %u read back, %u/%u/%u of the main thread's scopes and instants\n\n",
+      Written, Lines, Begins, Ends, Instants);
+  assert(Written > 0 && (u32)Written == Lines);
+  assert(Begins == 100 && Ends == 100 && Instants == 100);
+}
+
+void BenchScopes(void* Data)
+{
+  for (u32 i = 0; i < BENCH_EVENTS / 2; i++)
+  {
+    TraceBegin("stage");
+    TraceEnd("stage");
+  }
+}
+
+void BenchCounters(void* Data)
+{
+  for (u32 i = 0; i < BENCH_EVENTS; i++)
+    TraceCounter("value", i);
+}
+
+#ifdef __linux__
+
+#define EXAMPLE_RATE 44100
+#define EXAMPLE_FRAMES 512
+#define EXAMPLE_SPIKE 60 // NOTE(robin): The output callback that takes too long
+
+typedef struct
+{
+  int TimerFD;
+  u32 Callbacks;
+  f32 Phase;
+  f32 Device[2 * EXAMPLE_FRAMES]; // NOTE(robin): Stands in for the PCM's buffer
+} example_stream;
+
+void ExampleSpin(u64 Nanoseconds)
+{
+  struct timespec Time;
+  clock_gettime(CLOCK_MONOTONIC, &Time);
+  u64 End = (u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec + Nanoseconds;
+  for (;;)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    if ((u64)Time.tv_sec * 1000000000ull + (u64)Time.tv_nsec >= End)
+      break;
+  }
+}
+
+void ExampleOutputCallback(void* UserData, s64 Lateness)
+{
+  example_stream* Stream = UserData;
+  u64 Expirations;
+  read(Stream->TimerFD, &Expirations, sizeof(Expirations));
+
+  TraceBegin("render");
+  f32 AudioBuffer[2 * EXAMPLE_FRAMES];
+  for (u32 i = 0; i < EXAMPLE_FRAMES; i++)
+  {
+    Stream->Phase += 220.0f / EXAMPLE_RATE;
+    Stream->Phase -= Stream->Phase >= 1.0f ? 1.0f : 0.0f;
+    AudioBuffer[2 * i] = AudioBuffer[2 * i + 1] = 0.2f * sinf(Stream->Phase * 2 * 3.14159265f);
+  }
+  if (++Stream->Callbacks == EXAMPLE_SPIKE)
+    ExampleSpin(5ull * EXAMPLE_FRAMES * 1000000000ull / (2 * EXAMPLE_RATE));
+  TraceEnd("render");
+
+  TraceBegin("write");
+  memcpy(Stream->Device, AudioBuffer, sizeof(AudioBuffer));
+  TraceEnd("write");
+}
+
+void ExampleInputCallback(void* UserData, s64 Lateness)
+{
+  example_stream* Stream = UserData;
+  u64 Expirations;
+  read(Stream->TimerFD, &Expirations, sizeof(Expirations));
+
+  TraceBegin("read");
+  f32 AudioBuffer[2 * EXAMPLE_FRAMES];
+  memcpy(AudioBuffer, Stream->Device, sizeof(AudioBuffer));
+  TraceEnd("read");
+  Stream->Callbacks++;
+}
+
+// NOTE(robin): A second of the scheduler on this thread, written out shortly after the
+// spike like alsa_scheduler_example would
+void WriteExample(const char* Path)
+{
+  TraceThreadName("audio");
+
+  struct sched_param Param = {0};
+  Param.sched_priority = sched_get_priority_max(SCHED_FIFO) / 2;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param))
+    printf("Could not get real-time priority, running at normal priority\n");
+
+  scheduler Scheduler;
+  SchedulerInit(&Scheduler);
+
+  static example_stream Streams[2];
+  u64 Period = (u64)EXAMPLE_FRAMES * 1000000000ull / EXAMPLE_RATE;
+  for (int i = 0; i < 2; i++)
+  {
+    u64 Offset = Period + i * Period / 3;
+    struct itimerspec Timer = {0};
+    Timer.it_interval.tv_sec = Period / 1000000000ull;
+    Timer.it_interval.tv_nsec = Period % 1000000000ull;
+    Timer.it_value.tv_sec = Offset / 1000000000ull;
+    Timer.it_value.tv_nsec = Offset % 1000000000ull;
+
+    Streams[i].TimerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    timerfd_settime(Streams[i].TimerFD, 0, &Timer, 0);
+  }
+
+  struct pollfd OutputFD = {Streams[0].TimerFD, POLLIN, 0};
+  struct pollfd InputFD = {Streams[1].TimerFD, POLLIN, 0};
+  SchedulerAddFDStream(&Scheduler, "output", &OutputFD, 1, 0, 0, Period, ExampleOutputCallback, &Streams[0]);
+  SchedulerAddFDStream(&Scheduler, "input", &InputFD, 1, 0, 0, Period, ExampleInputCallback, &Streams[1]);
+
+  while (Streams[0].Callbacks < EXAMPLE_SPIKE + 25)
+    SchedulerRunOnce(&Scheduler, 1000);
+
+  s32 Written = TraceWrite(Path);
+  printf("Wrote %d trace events to %s\n", Written, Path);
+  SchedulerPrintStats(&Scheduler);
+  assert(Written > 0 && Scheduler.Streams[0].MissedPeriods > 0);
+
+  SchedulerDestroy(&Scheduler);
+  close(Streams[0].TimerFD);
+  close(Streams[1].TimerFD);
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+  TraceInit();
+
+#ifdef __linux__
+  if (argc > 2 && !strcmp(argv[1], "example"))
+  {
+    WriteExample(argv[2]);
+    return 0;
+  }
+#endif
+
+  VerifySnapshots();
+  VerifyFile();
+
+  printf("Time per event, %d events per call\n", BENCH_EVENTS);
+  f64 Time = BenchMeasure(BenchScopes, 0);
+  printf("%-20s %8.2f ns\n", "begin/end", Time / BENCH_EVENTS);
+  Time = BenchMeasure(BenchCounters, 0);
+  printf("%-20s %8.2f ns\n", "counter", Time / BENCH_EVENTS);
+
+  return 0;
+}
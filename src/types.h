@@ -0,0 +1,23 @@
+/*
+ * Fixed size typedefs shared by the includable source files in this directory
+ * (asio.c, scheduler.c, ...). asio_example.c declares its own copy of these so that
+ * it stays self contained, you can do the same in your own code if you'd rather not
+ * include this file.
+ */
+
+#ifndef SIMPLE_NATIVE_AUDIO_TYPES_H
+#define SIMPLE_NATIVE_AUDIO_TYPES_H
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef signed char s8;
+typedef signed short s16;
+typedef signed int s32;
+typedef signed long long s64;
+typedef float f32;
+typedef double f64;
+typedef u16 wchar;
+
+#endif
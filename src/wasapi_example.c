@@ -7,6 +7,11 @@
 #include <stdio.h>
 #include <math.h>
 
+#include "types.h"
+#include "scheduler.c"
+#include "quantize.c"
+#include "rtlog.c"
+
 #pragma comment(lib, "ole32")
 #pragma comment(lib, "avrt")
 
@@ -18,6 +23,7 @@ typedef struct
   IAudioCaptureClient* AudioCaptureClient;
   WAVEFORMATEX* InputFormat;
   WAVEFORMATEX* OutputFormat;
+  int BufferSize;
 } wasapi_data;
 
 // NOTE(robin): We write data from the input device into this global buffer
@@ -34,6 +40,15 @@ void AudioInputCallback(int FrameCount, wasapi_data* Data)
   int BytesPerSample = Data->InputFormat->wBitsPerSample / 8;
   int ChannelCount = Data->InputFormat->nChannels;
 
+  if (BytesPerSample < 2 || BytesPerSample > 4)
+  {
+    // NOTE(robin): Not printf, see rtlog.c. The format won't change while the stream runs so
+    // this would be logged on every callback, rtlog only prints it a few times a second.
+    RTLog("Unsupported input sample format! %d bytes per sample\n", BytesPerSample);
+    IAudioCaptureClient_ReleaseBuffer(Data->AudioCaptureClient, FrameCount);
+    return;
+  }
+
   MicIndex = 0;
   int ChannelSelect = 0; // NOTE(robin): Which input to write into the global buffer
 
@@ -73,12 +88,6 @@ void AudioInputCallback(int FrameCount, wasapi_data* Data)
           short InputSample = InputBuffer[SampleIndex];
           Sample = InputSample / (float)0x7FFFFFFF;
         } break;
-
-        default:
-        {
-          printf("Unsupported sample format! %d bytes per sample\n", BytesPerSample);
-          ExitProcess(1);
-        }
       }
 
       if (i == ChannelSelect)
@@ -89,6 +98,12 @@ void AudioInputCallback(int FrameCount, wasapi_data* Data)
   IAudioCaptureClient_ReleaseBuffer(Data->AudioCaptureClient, FrameCount);
 }
 
+// NOTE(robin): Scratch buffers for the output callback, big enough for any period we'll be given
+#define OUTPUT_MAX_FRAMES 4096
+f32 OutputPlanar[2][OUTPUT_MAX_FRAMES];
+s32 OutputQuantized[2][OUTPUT_MAX_FRAMES];
+quantizer OutputQuantizer;
+
 void AudioOutputCallback(int FrameCount, wasapi_data* Data)
 {
   BYTE* AudioBuffer;
@@ -97,6 +112,16 @@ void AudioOutputCallback(int FrameCount, wasapi_data* Data)
   int SampleRate = Data->OutputFormat->nSamplesPerSec;
   int BytesPerSample = Data->OutputFormat->wBitsPerSample / 8;
 
+  if (BytesPerSample < 2 || BytesPerSample > 4)
+  {
+    RTLog("Unsupported output sample format! %d bytes per sample\n", BytesPerSample);
+    IAudioRenderClient_ReleaseBuffer(Data->AudioRenderClient, FrameCount, AUDCLNT_BUFFERFLAGS_SILENT);
+    return;
+  }
+
+  if (FrameCount > OUTPUT_MAX_FRAMES)
+    FrameCount = OUTPUT_MAX_FRAMES;
+
   static float Phase[] = {0, 0};
   float PhaseDelta[] =
   {
@@ -104,6 +129,9 @@ void AudioOutputCallback(int FrameCount, wasapi_data* Data)
     330.0f/SampleRate,
   };
 
+  float Volume = 0.1f;
+
+  // NOTE(robin): Render a block of float samples per channel first...
   for (int FrameIndex = 0; FrameIndex < FrameCount; FrameIndex++)
   {
     for (int i = 0; i < 2; i++)
@@ -111,62 +139,65 @@ void AudioOutputCallback(int FrameCount, wasapi_data* Data)
       Phase[i] += PhaseDelta[i];
       if (Phase[i] >= 1)
         Phase[i] -= 1;
+
+      OutputPlanar[i][FrameIndex] = Volume * (f32)sin(2 * 3.1415926538 * Phase[i]);
+
+      // NOTE(robin): Uncomment to write some input to the output
+      // OutputPlanar[i][FrameIndex] = MicData[FrameIndex];
     }
+  }
 
-    float Samples[] =
-    {
-      sin(2 * 3.1415926538 * Phase[0]),
-      sin(2 * 3.1415926538 * Phase[1]),
-    };
+  // NOTE(robin): ...then convert the whole block to the hardware format. The quantiser clips,
+  // dithers and rounds rather than truncating, see quantize.c.
+  const f32* Inputs[] = {OutputPlanar[0], OutputPlanar[1]};
+  s32* Outputs[] = {OutputQuantized[0], OutputQuantized[1]};
+  QuantizeChannels(&OutputQuantizer, Outputs, Inputs, 2, FrameCount);
 
-    float Volume = 0.1f;
+  for (int i = 0; i < 2; i++)
+  {
+    // NOTE(robin): Each channel starts BytesPerSample into the interleaved buffer and then
+    // every second sample belongs to it
+    QuantizePack(AudioBuffer + i * BytesPerSample, 2, OutputQuantized[i], FrameCount, BytesPerSample, 0, 0);
+  }
 
-    for (int i = 0; i < 2; i++)
-    {
-      int SampleIndex = FrameIndex * 2 + i;
+  IAudioRenderClient_ReleaseBuffer(Data->AudioRenderClient, FrameCount, 0);
+}
 
-      // NOTE(robin): Uncomment to write some input to the output
-      // Samples[0] = MicData[FrameIndex];
+void SchedulerOutputCallback(void* UserData, s64 Lateness)
+{
+  wasapi_data* Data = UserData;
+  AudioOutputCallback(Data->BufferSize, Data);
+}
 
-      // NOTE(robin): Convert our 32 bit float samples to the hardware format
-      switch (BytesPerSample)
-      {
-        case 2: // NOTE(robin): 16 bit
-        {
-          short Sample = Volume * Samples[i] * 0x7FFF;
-          short* OutputBuffer = (short*)AudioBuffer;
-          OutputBuffer[SampleIndex] = Sample;
-        } break;
+void SchedulerInputCallback(void* UserData, s64 Lateness)
+{
+  wasapi_data* Data = UserData;
+  AudioInputCallback(Data->BufferSize, Data);
+}
 
-        case 3: // NOTE(robin): 24 bit
-        {
-          int Sample = Volume * Samples[i] * 0x7FFFFF;
-          char* SampleBytes = (char*)&Sample;
+typedef struct
+{
+  scheduler* Scheduler;
+  wasapi_data* Data;
+  HANDLE Ready;
+} audio_thread_data;
 
-          char* OutputBuffer = AudioBuffer + 3 * SampleIndex;
-          OutputBuffer[0] = SampleBytes[0];
-          OutputBuffer[1] = SampleBytes[1];
-          OutputBuffer[2] = SampleBytes[2];
-        } break;
+DWORD WINAPI AudioThread(void* Context)
+{
+  audio_thread_data* ThreadData = Context;
 
-        case 4: // NOTE(robin): 32 bit
-        {
-          int Sample = Volume * Samples[i] * 0x7FFFFFFF;
-          int* OutputBuffer = (int*)AudioBuffer;
-          OutputBuffer[SampleIndex] = Sample;
-        } break;
+  // NOTE(robin): Tell the OS scheduler that we're doing pro-audio stuff in this thread
+  // in a hope to have fewer buffer underflows. We do this before the devices are started
+  // so that the very first callbacks already run at the right priority.
+  DWORD TaskIndex = 0;
+  HANDLE Task = AvSetMmThreadCharacteristicsA("Pro Audio", &TaskIndex);
 
-        default:
-        {
-          printf("Unsupported sample format! %d bytes per sample\n", BytesPerSample);
-          ExitProcess(1);
-        }
-      }
-    }
+  SetEvent(ThreadData->Ready);
 
-  }
+  SchedulerRun(ThreadData->Scheduler);
 
-  IAudioRenderClient_ReleaseBuffer(Data->AudioRenderClient, FrameCount, 0);
+  AvRevertMmThreadCharacteristics(Task);
+  return 0;
 }
 
 int main(int argc, char** argv)
@@ -310,23 +341,46 @@ int main(int argc, char** argv)
   WASAPIData.AudioCaptureClient = AudioCaptureClient;
   WASAPIData.OutputFormat = OutputSampleFormat;
   WASAPIData.InputFormat = InputSampleFormat;
+  WASAPIData.BufferSize = BufferSize;
+
+  // NOTE(robin): TPDF dither with first order noise shaping. At 24 bits and up the dither is
+  // far below anything audible, but it costs next to nothing so we leave it on.
+  QuantizerInit(&OutputQuantizer, OutputSampleFormat->wBitsPerSample, 1, QuantizeShapeFirstOrder);
+
+  // NOTE(robin): Both streams are serviced by one scheduler so that a late input doesn't
+  // delay the output (and vice versa), see scheduler.c
+  u64 Period = (u64)BufferSize * 1000000000ull / OutputSampleFormat->nSamplesPerSec;
+
+  scheduler Scheduler;
+  SchedulerInit(&Scheduler);
+  SchedulerAddEventStream(&Scheduler, "output", AudioOutputCallbackEvent, Period,
+      SchedulerOutputCallback, &WASAPIData);
+  SchedulerAddEventStream(&Scheduler, "input", AudioInputCallbackEvent, Period,
+      SchedulerInputCallback, &WASAPIData);
+
+  audio_thread_data ThreadData = {0};
+  ThreadData.Scheduler = &Scheduler;
+  ThreadData.Data = &WASAPIData;
+  ThreadData.Ready = CreateEvent(0, 0, 0, 0);
+
+  HANDLE Thread = CreateThread(0, 0, AudioThread, &ThreadData, 0, 0);
+
+  // NOTE(robin): Only start the devices once the audio thread has its priority set up
+  WaitForSingleObject(ThreadData.Ready, INFINITE);
+
+  RTLogStart(stdout);
 
   IAudioClient_Start(OutputClient);
   IAudioClient_Start(InputClient);
 
-  // NOTE(robin): Tell the OS scheduler that we're doing pro-audio stuff in this thread
-  // in a hope to have fewer buffer underflows.
-  DWORD TaskIndex = 0;
-  AvSetMmThreadCharacteristicsA("Pro Audio", &TaskIndex);
+  Sleep(3000);
 
-  // NOTE(robin): You would have this in another high priority thread
-  for (;;)
-  {
-    WaitForSingleObject(AudioOutputCallbackEvent, INFINITE);
-    AudioOutputCallback(BufferSize, &WASAPIData);
-    WaitForSingleObject(AudioInputCallbackEvent, INFINITE);
-    AudioInputCallback(BufferSize, &WASAPIData);
-  }
+  SchedulerStop(&Scheduler);
+  WaitForSingleObject(Thread, INFINITE);
+  RTLogStop();
+
+  SchedulerPrintStats(&Scheduler);
+  SchedulerDestroy(&Scheduler);
 
   IAudioClient_Stop(OutputClient);
   IAudioClient_Stop(InputClient);